@@ -0,0 +1,132 @@
+#include "../llab.h"
+#include <time.h>
+
+/* Benchmark of fully_connected_back_prop: the fused loop of the first versions of the library (before)
+ * against the column blocked single pass kernels (after), for each instruction set up to the one
+ * chosen at startup (LLAB_ISA can lower it). It runs on the thread pool, set its size with the first argument.
+ * The flops are 4*input_size*output_size for each call (2 for the input error, 2 for the weight error)
+ *
+ * make benchmarks && ./benchmarks/fully_connected_back_prop_benchmark [n_threads]
+ * */
+
+/* the fully_connected_back_prop of the first versions of the library*/
+ISA_INLINE void fused_back_prop_kernel(float* input, float* output_error, float* weight,float* input_error, float* weight_error,float* bias_error, int input_size, int output_size){
+    int i,j;
+    for(j = 0; j < output_size; j++){
+        for(i = 0; i < input_size; i++){
+            weight_error[j*input_size+i] += output_error[j]*input[i];
+            input_error[i] += output_error[j]*weight[j*input_size+i];
+        }
+        bias_error[j] += output_error[j];
+    }
+}
+
+ISA_DISPATCH(static, fused_back_prop, (float* input, float* output_error, float* weight,float* input_error, float* weight_error,float* bias_error, int input_size, int output_size),
+             (input,output_error,weight,input_error,weight_error,bias_error,input_size,output_size))
+
+static double now(void){
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC,&t);
+    return t.tv_sec+t.tv_nsec*1e-9;
+}
+
+/* This function stores in before and after the best times of a call of the fused loop and of fully_connected_back_prop.
+ * The 2 versions are timed in turns, so the changes of the clock of the machine hit both*/
+static void time_back_prop(double* before, double* after, float* x, float* e, float* w, float* ie1, float* dw1, float* ie2, float* dw2, float* db, int input_size, int output_size){
+    int i,r,calls = 1+(int)(2e8/(4.0*input_size*output_size));
+    double t;
+    *before = *after = 1e30;
+    for(r = 0; r < 10; r++){
+        t = now();
+        for(i = 0; i < calls; i++){
+            fused_back_prop(x,e,w,ie1,dw1,db,input_size,output_size);
+        }
+        t = (now()-t)/calls;
+        if(t < *before)
+            *before = t;
+        t = now();
+        for(i = 0; i < calls; i++){
+            fully_connected_back_prop(x,e,w,ie2,dw2,db,input_size,output_size);
+        }
+        t = (now()-t)/calls;
+        if(t < *after)
+            *after = t;
+    }
+}
+
+/* This function allocates size floats set to 0, aligned as the parameters arena of a model*/
+static float* arena_floats(int size){
+    float* p;
+    if(posix_memalign((void**)&p,ARENA_ALIGNMENT*sizeof(float),sizeof(float)*size)){
+        fprintf(stderr,"Error: not enough memory\n");
+        exit(1);
+    }
+    memset(p,0,sizeof(float)*size);
+    return p;
+}
+
+int main(int argc, char** argv){
+    int sizes[][2] = {{256,256},{512,512},{1024,256},{2048,2048}};
+    int s,i,isa,max_isa = get_isa();
+    float max_diff;
+    if(argc > 1)
+        set_thread_pool_size(atoi(argv[1]));
+    srand(1);
+    printf("threads: %d\n",get_thread_pool_size());
+    printf("%-6s %-11s %14s %14s %8s %10s\n","isa","layer","before GFLOP/s","after GFLOP/s","speedup","max diff");
+    for(s = 0; s < (int)(sizeof(sizes)/sizeof(sizes[0])); s++){
+        int input_size = sizes[s][0], output_size = sizes[s][1];
+        float* x = (float*)malloc(sizeof(float)*input_size);
+        float* e = (float*)malloc(sizeof(float)*output_size);
+        /* the weights and their errors are aligned as in the arena of a model*/
+        float* w = arena_floats(input_size*output_size);
+        float* ie1 = (float*)calloc(input_size,sizeof(float));
+        float* ie2 = (float*)calloc(input_size,sizeof(float));
+        float* dw1 = arena_floats(input_size*output_size);
+        float* dw2 = arena_floats(input_size*output_size);
+        float* db = (float*)calloc(output_size,sizeof(float));
+        for(i = 0; i < input_size; i++){
+            x[i] = (float)rand()/RAND_MAX-0.5;
+        }
+        for(i = 0; i < output_size; i++){
+            e[i] = (float)rand()/RAND_MAX-0.5;
+        }
+        for(i = 0; i < input_size*output_size; i++){
+            w[i] = (float)rand()/RAND_MAX-0.5;
+        }
+        for(isa = ISA_SSE2; isa <= max_isa; isa++){
+            set_isa(isa);
+            /* the 2 versions must give the same errors, up to the rounding*/
+            memset(ie1,0,sizeof(float)*input_size);
+            memset(ie2,0,sizeof(float)*input_size);
+            memset(dw1,0,sizeof(float)*input_size*output_size);
+            memset(dw2,0,sizeof(float)*input_size*output_size);
+            fused_back_prop(x,e,w,ie1,dw1,db,input_size,output_size);
+            fully_connected_back_prop(x,e,w,ie2,dw2,db,input_size,output_size);
+            max_diff = 0;
+            for(i = 0; i < input_size; i++){
+                if(fabsf(ie1[i]-ie2[i]) > max_diff)
+                    max_diff = fabsf(ie1[i]-ie2[i]);
+            }
+            for(i = 0; i < input_size*output_size; i++){
+                if(fabsf(dw1[i]-dw2[i]) > max_diff)
+                    max_diff = fabsf(dw1[i]-dw2[i]);
+            }
+            double before,after;
+            time_back_prop(&before,&after,x,e,w,ie1,dw1,ie2,dw2,db,input_size,output_size);
+            double flops = 4.0*input_size*output_size;
+            char layer[32];
+            sprintf(layer,"%dx%d",output_size,input_size);
+            printf("%-6s %-11s %14.2f %14.2f %7.2fx %10.2g\n",isa_name(isa),layer,flops/before*1e-9,flops/after*1e-9,before/after,max_diff);
+        }
+        free(x);
+        free(e);
+        free(w);
+        free(ie1);
+        free(ie2);
+        free(dw1);
+        free(dw2);
+        free(db);
+    }
+    return 0;
+}
@@ -0,0 +1,86 @@
+#include "../llab.h"
+#include <time.h>
+
+/* Benchmark of the hogwild trainer against the synchronous trainer on a wide sparse model:
+ * a 2048-256-10 fully-connected network (relu, softmax) on 512 inputs with 20 ones each, nesterov.
+ * For each number of threads it prints the training throughput and the cross entropy loss
+ * on the training set after the last epoch. The synchronous trainer uses the learning rate lr on
+ * the mini batch, the hogwild trainer makes a step per sample with lr/batch_size
+ *
+ * make benchmarks && ./benchmarks/hogwild_benchmark [max_threads] [epochs] [batch_size]
+ * */
+
+#define SAMPLES 512
+#define INPUT 2048
+#define HIDDEN 256
+#define OUTPUT 10
+#define ONES 20
+
+/* with a softmax last layer the model computes the cross entropy error itself from the target, the one hot label*/
+static void error_function(model* m, int sample, float* output_error, void* data){
+    int j,label = ((int*)data)[sample];
+    for(j = 0; j < OUTPUT; j++){
+        output_error[j] = j == label;
+    }
+}
+
+static double now(void){
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC,&t);
+    return t.tv_sec+t.tv_nsec*1e-9;
+}
+
+/* This function trains a new model with a synchronous (hogwild = 0) or hogwild (hogwild = 1) trainer and prints the results*/
+static void run(int hogwild, int n_threads, int epochs, int batch_size, float** inputs, int* labels){
+    int i,e;
+    float b1 = BETA1_ADAM, b2 = BETA2_ADAM, lr = 0.1;
+    double t,loss = 0;
+    srand(1);
+    fcl** fcls = (fcl**)malloc(sizeof(fcl*)*2);
+    fcls[0] = fully_connected(INPUT,HIDDEN,0,NO_DROPOUT,RELU,0);
+    fcls[1] = fully_connected(HIDDEN,OUTPUT,1,NO_DROPOUT,SOFTMAX,0);
+    model* m = network(2,0,0,2,NULL,NULL,fcls);
+    trainer* tr = hogwild ? model_hogwild_trainer(m,n_threads,1,1,INPUT,OUTPUT,error_function,NULL) : model_trainer(m,n_threads,1,1,INPUT,OUTPUT,error_function,NULL);
+    t = now();
+    for(e = 0; e < epochs; e++){
+        for(i = 0; i+batch_size <= SAMPLES; i+=batch_size){
+            tr->data = &labels[i];
+            trainer_train_mini_batch(tr,&inputs[i],batch_size,hogwild ? lr/batch_size : lr,0.9,NESTEROV,&b1,&b2,NO_REGULARIZATION,0,0);
+        }
+    }
+    t = now()-t;
+    free_trainer(tr);
+    for(i = 0; i < SAMPLES; i++){
+        reset_model(m);
+        model_tensor_input_ff(m,1,1,INPUT,inputs[i]);
+        loss-=log(m->fcls[1]->post_activation[labels[i]]+1e-7);
+    }
+    printf("%-8s %7d %13.0f %10.4f\n",hogwild ? "hogwild" : "sync",n_threads,epochs*(SAMPLES/batch_size)*batch_size/t,loss/SAMPLES);
+    free_model(m);
+}
+
+int main(int argc, char** argv){
+    int max_threads = argc > 1 ? atoi(argv[1]) : 4;
+    int epochs = argc > 2 ? atoi(argv[2]) : 5;
+    int batch_size = argc > 3 ? atoi(argv[3]) : 32;
+    int i,j,n;
+    float* inputs[SAMPLES];
+    int labels[SAMPLES];
+    for(i = 0; i < SAMPLES; i++){
+        inputs[i] = (float*)calloc(INPUT,sizeof(float));
+        for(j = 0; j < ONES; j++){
+            inputs[i][(i*37+j*101)%INPUT] = 1;
+        }
+        labels[i] = (i*7)%OUTPUT;
+    }
+    printf("cores: %d, epochs: %d, batch size: %d\n",get_thread_pool_size(),epochs,batch_size);
+    printf("%-8s %7s %13s %10s\n","trainer","threads","samples/s","loss");
+    for(n = 1; n <= max_threads; n*=2){
+        run(0,n,epochs,batch_size,inputs,labels);
+        run(1,n,epochs,batch_size,inputs,labels);
+    }
+    for(i = 0; i < SAMPLES; i++){
+        free(inputs[i]);
+    }
+    return 0;
+}
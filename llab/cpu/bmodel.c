@@ -1,22 +1,130 @@
 #include "llab.h"
+#include <sys/mman.h>
 
-/* This function builds a bmodel* structure which can be used to train the network
+/* This function places kernels, weights, biases, gamma, beta and their D, D1, D2 of all the layers of the bmodel
+ * in the ARENA_SLABS slabs of m->arena: first all the kernels and weights, then all the biases and then
+ * gamma and beta of the batch normalization layers.
+ * Each layer view starts on a 64 bytes boundary (the gaps are 0 and stay 0 during the training)
+ * 
+ * Input:
+ *             @ bmodel* m:= the bmodel
+ *             @ float* parameters:= the parameters slab of an inference only bmodel given by the caller, NULL to allocate the arena
+ * 
+ * */
+static void bmodel_arena(bmodel* m, float* parameters){
+    int i,j,w = 0,b,g;
+    cl* c;
+    for(i = 0; i < m->n_rl; i++){
+        for(j = 0; j < m->rls[i]->n_cl; j++){
+            c = m->rls[i]->cls[j];
+            w+=arena_aligned(c->n_kernels*c->channels*c->kernel_rows*c->kernel_cols);
+        }
+    }
+    for(i = 0; i < m->n_cl; i++){
+        c = m->cls[i];
+        w+=arena_aligned(c->n_kernels*c->channels*c->kernel_rows*c->kernel_cols);
+    }
+    for(i = 0; i < m->n_fcl; i++){
+        w+=arena_aligned(m->fcls[i]->output*m->fcls[i]->input);
+    }
+    b = w;
+    for(i = 0; i < m->n_rl; i++){
+        for(j = 0; j < m->rls[i]->n_cl; j++){
+            b+=arena_aligned(m->rls[i]->cls[j]->n_kernels);
+        }
+    }
+    for(i = 0; i < m->n_cl; i++){
+        b+=arena_aligned(m->cls[i]->n_kernels);
+    }
+    for(i = 0; i < m->n_fcl; i++){
+        b+=arena_aligned(m->fcls[i]->output);
+    }
+    g = b;
+    for(i = 0; i < m->n_bn; i++){
+        g+=2*arena_aligned(m->bns[i]->vector_dim);
+    }
+    
+    m->arena_weights = w;
+    m->arena_bn = b;
+    m->arena_size = g;
+    m->arena_shared = parameters != NULL;
+    if(parameters != NULL){
+        m->arena = (float**)calloc(ARENA_SLABS,sizeof(float*));
+        m->arena[0] = parameters;
+    }
+    else
+        m->arena = m->inference_only_flag ? inference_parameters_arena(m->arena_size) : parameters_arena(m->arena_size);
+    
+    w = 0;
+    b = m->arena_weights;
+    g = m->arena_bn;
+    for(i = 0; i < m->n_rl; i++){
+        for(j = 0; j < m->rls[i]->n_cl; j++){
+            c = m->rls[i]->cls[j];
+            move_cl_to_arena(c,m->arena,w,b);
+            w+=arena_aligned(c->n_kernels*c->channels*c->kernel_rows*c->kernel_cols);
+            b+=arena_aligned(c->n_kernels);
+        }
+    }
+    for(i = 0; i < m->n_cl; i++){
+        c = m->cls[i];
+        move_cl_to_arena(c,m->arena,w,b);
+        w+=arena_aligned(c->n_kernels*c->channels*c->kernel_rows*c->kernel_cols);
+        b+=arena_aligned(c->n_kernels);
+    }
+    for(i = 0; i < m->n_fcl; i++){
+        move_fcl_to_arena(m->fcls[i],m->arena,w,b);
+        w+=arena_aligned(m->fcls[i]->output*m->fcls[i]->input);
+        b+=arena_aligned(m->fcls[i]->output);
+    }
+    for(i = 0; i < m->n_bn; i++){
+        move_bn_to_arena(m->bns[i],m->arena,g,g+arena_aligned(m->bns[i]->vector_dim));
+        g+=2*arena_aligned(m->bns[i]->vector_dim);
+    }
+}
+
+/* This function returns 1 if m and m2 have arenas with the same layout, 0 otherwise
+ * 
+ * Input:
+ *             @ bmodel* m:= the first bmodel
+ *             @ bmodel* m2:= the second bmodel
+ * 
+ * */
+static int same_bmodel_arena(bmodel* m, bmodel* m2){
+    return m->arena != NULL && m2->arena != NULL && m->arena_size == m2->arena_size && m->arena_weights == m2->arena_weights && m->arena_bn == m2->arena_bn;
+}
+
+/* the kernels of the convolutional layers have been changed, the winograd kernels must be computed again*/
+static void bmodel_kernels_changed(bmodel* m){
+    int i,j;
+    for(i = 0; i < m->n_rl; i++){
+        for(j = 0; j < m->rls[i]->n_cl; j++){
+            m->rls[i]->cls[j]->winograd_kernels_flag = 0;
+        }
+    }
+    for(i = 0; i < m->n_cl; i++){
+        m->cls[i]->winograd_kernels_flag = 0;
+    }
+}
+
+/* This function builds a bmodel* structure, see batch_network and inference_batch_network
  * 
  * Input:
  *             
- *             @ int layers:= number of total layers, this means that if you have 2 layers with the same layer id 
- *                            then layers = 2. For example if you have 2 fully-connected layers with same layer id = 0
- *                            then layers param must be set to 2. if you have 3 layers, 2 with same layer id and 1 with another
- *                            layer id, then layers = 3
+ *             @ int layers:= number of total layers
  *             @ int n_rl:= same as layers but only for residual layers
- *             @ int n_cl:= same as layer but only for convolutional layers. (the convolutional layers inside residual layer must not be count)
+ *             @ int n_cl:= same as layer but only for convolutional layers
  *             @ int n_fcl:= same as layer, but only for fully-connected layers
+ *             @ int n_bnl:= same as layer, but only for batch normalization layers
  *             @ rl** rls:= your residual layers
  *             @ cl** cls:= your convolutional layers
  *             @ fcl** fcls:= your fully-connected layers
+ *             @ bn** bnls:= your batch normalization layers
+ *             @ int inference_only_flag:= 1 if the bmodel computes only the feed forward
+ *             @ float* parameters:= the parameters slab given by the caller (only with inference_only_flag), NULL to allocate the arena
  * 
  * */
-bmodel* batch_network(int layers, int n_rl, int n_cl, int n_fcl, int n_bnl, rl** rls, cl** cls, fcl** fcls, bn** bnls){
+static bmodel* new_batch_network(int layers, int n_rl, int n_cl, int n_fcl, int n_bnl, rl** rls, cl** cls, fcl** fcls, bn** bnls, int inference_only_flag, float* parameters){
     if(!layers || (!n_rl && !n_cl && !n_fcl && !n_bnl) || (!n_rl && rls != NULL) || (!n_cl && cls!= NULL) || (!n_fcl && fcls != NULL) || (!n_bnl && bnls != NULL)){
         fprintf(stderr,"Error: layers must be > 0 and at least one between n_rl, n_cl, n_fcl, n_bnl must be > 0\n");
         exit(1); 
@@ -24,6 +132,40 @@ bmodel* batch_network(int layers, int n_rl, int n_cl, int n_fcl, int n_bnl, rl**
     
     int i,j,k, position, count, k1,k2,k3;
     
+    /* the layers built for inference only have no partial derivatives, they can't be trained*/
+    for(i = 0; i < n_rl; i++){
+        if(inference_only_flag)
+            set_residual_inference_only(rls[i]);
+        else if(rls[i]->cl_output->inference_only_flag){
+            fprintf(stderr,"Error: the residual layer %d has been built for inference only, use inference_batch_network\n",i);
+            exit(1);
+        }
+    }
+    for(i = 0; i < n_cl; i++){
+        if(inference_only_flag)
+            set_convolutional_inference_only(cls[i]);
+        else if(cls[i]->inference_only_flag){
+            fprintf(stderr,"Error: the convolutional layer %d has been built for inference only, use inference_batch_network\n",cls[i]->layer);
+            exit(1);
+        }
+    }
+    for(i = 0; i < n_fcl; i++){
+        if(inference_only_flag)
+            set_fully_connected_inference_only(fcls[i]);
+        else if(fcls[i]->inference_only_flag){
+            fprintf(stderr,"Error: the fully-connected layer %d has been built for inference only, use inference_batch_network\n",fcls[i]->layer);
+            exit(1);
+        }
+    }
+    for(i = 0; i < n_bnl; i++){
+        if(inference_only_flag)
+            set_batch_normalization_inference_only(bnls[i]);
+        else if(bnls[i]->inference_only_flag){
+            fprintf(stderr,"Error: the batch normalization layer %d has been built for inference only, use inference_batch_network\n",bnls[i]->layer);
+            exit(1);
+        }
+    }
+    
     
     /*checking if the residual layer has the right size from the input to the output*/
     for(i = 0; i < n_rl; i++){
@@ -185,10 +327,97 @@ bmodel* batch_network(int layers, int n_rl, int n_cl, int n_fcl, int n_bnl, rl**
     m->cls = cls;
     m->fcls = fcls;
     m->bns = bnls;
+    m->inference_only_flag = inference_only_flag;
+    m->mapping = NULL;
+    m->mapping_size = 0;
+    bmodel_arena(m,parameters);
         
     return m;
 }
 
+/* This function builds a bmodel* structure which can be used to train the network.
+ * The parameters of the layers (and their D, D1, D2) are moved in the contiguous slabs of the bmodel arena
+ * and they are freed with the bmodel
+ * 
+ * Input:
+ *             
+ *             @ int layers:= number of total layers, this means that if you have 2 layers with the same layer id 
+ *                            then layers = 2. For example if you have 2 fully-connected layers with same layer id = 0
+ *                            then layers param must be set to 2. if you have 3 layers, 2 with same layer id and 1 with another
+ *                            layer id, then layers = 3
+ *             @ int n_rl:= same as layers but only for residual layers
+ *             @ int n_cl:= same as layer but only for convolutional layers. (the convolutional layers inside residual layer must not be count)
+ *             @ int n_fcl:= same as layer, but only for fully-connected layers
+ *             @ rl** rls:= your residual layers
+ *             @ cl** cls:= your convolutional layers
+ *             @ fcl** fcls:= your fully-connected layers
+ * 
+ * */
+bmodel* batch_network(int layers, int n_rl, int n_cl, int n_fcl, int n_bnl, rl** rls, cl** cls, fcl** fcls, bn** bnls){
+    return new_batch_network(layers,n_rl,n_cl,n_fcl,n_bnl,rls,cls,fcls,bnls,0,NULL);
+}
+
+/* This function builds a bmodel* structure which can be used only for the feed forward (as batch_network).
+ * The partial derivatives, the arrays of the optimizers and the arrays used only by the back propagation
+ * of the layers are freed, the batch normalization layers use their final mean and variance
+ * and the arena of the bmodel holds only the parameters. The updates and the training mode are rejected
+ * 
+ * Input:
+ *             
+ *             @ int layers:= number of total layers (see batch_network)
+ *             @ int n_rl:= same as layers but only for residual layers
+ *             @ int n_cl:= same as layer but only for convolutional layers. (the convolutional layers inside residual layer must not be count)
+ *             @ int n_fcl:= same as layer, but only for fully-connected layers
+ *             @ int n_bnl:= same as layer, but only for batch normalization layers
+ *             @ rl** rls:= your residual layers
+ *             @ cl** cls:= your convolutional layers
+ *             @ fcl** fcls:= your fully-connected layers
+ *             @ bn** bnls:= your batch normalization layers
+ * 
+ * */
+bmodel* inference_batch_network(int layers, int n_rl, int n_cl, int n_fcl, int n_bnl, rl** rls, cl** cls, fcl** fcls, bn** bnls){
+    return new_batch_network(layers,n_rl,n_cl,n_fcl,n_bnl,rls,cls,fcls,bnls,1,NULL);
+}
+
+/* This function builds a bmodel* structure which can be used only for the feed forward (as inference_batch_network),
+ * but the parameters slab of its arena is given by the caller and it is not freed with the bmodel (see external_inference_network)
+ * 
+ * Input:
+ *             
+ *             @ int layers:= number of total layers (see batch_network)
+ *             @ int n_rl:= same as layers but only for residual layers
+ *             @ int n_cl:= same as layer but only for convolutional layers. (the convolutional layers inside residual layer must not be count)
+ *             @ int n_fcl:= same as layer, but only for fully-connected layers
+ *             @ int n_bnl:= same as layer, but only for batch normalization layers
+ *             @ rl** rls:= your residual layers
+ *             @ cl** cls:= your convolutional layers
+ *             @ fcl** fcls:= your fully-connected layers
+ *             @ bn** bnls:= your batch normalization layers
+ *             @ float* parameters:= the parameters slab, 64 bytes aligned
+ * 
+ * */
+bmodel* external_inference_batch_network(int layers, int n_rl, int n_cl, int n_fcl, int n_bnl, rl** rls, cl** cls, fcl** fcls, bn** bnls, float* parameters){
+    if(parameters == NULL || (size_t)parameters%(ARENA_ALIGNMENT*sizeof(float))){
+        fprintf(stderr,"Error: the parameters slab must be 64 bytes aligned\n");
+        exit(1);
+    }
+    return new_batch_network(layers,n_rl,n_cl,n_fcl,n_bnl,rls,cls,fcls,bnls,1,parameters);
+}
+
+/* This function exits if the bmodel has been built for inference only
+ * 
+ * Input:
+ *             @ bmodel* m:= the bmodel
+ *             @ char* function:= the name of the function that needs the partial derivatives
+ * 
+ * */
+static void bmodel_training_check(bmodel* m, char* function){
+    if(m->inference_only_flag){
+        fprintf(stderr,"Error: the bmodel has been built for inference only, %s can't be used\n",function);
+        exit(1);
+    }
+}
+
 /* This function frees the space allocated by a model structure
  * 
  * Input:
@@ -221,6 +450,12 @@ void free_bmodel(bmodel* m){
         free(m->sla[i]);
     }
     free(m->sla);
+    if(m->arena_shared)
+        free(m->arena);
+    else
+        free_parameters_arena(m->arena);
+    if(m->mapping != NULL)
+        munmap(m->mapping,m->mapping_size);
     free(m);
 }
 
@@ -266,7 +501,11 @@ bmodel* copy_bmodel(bmodel* m){
     for(i = 0; i < m->n_bn; i++){
         bns[i] = copy_bn(m->bns[i]);
     }
-    bmodel* copy = batch_network(m->layers, m->n_rl, m->n_cl, m->n_fcl,m->n_bn, rls, cls, fcls, bns);
+    bmodel* copy;
+    if(m->inference_only_flag)
+        copy = inference_batch_network(m->layers, m->n_rl, m->n_cl, m->n_fcl,m->n_bn, rls, cls, fcls, bns);
+    else
+        copy = batch_network(m->layers, m->n_rl, m->n_cl, m->n_fcl,m->n_bn, rls, cls, fcls, bns);
     return copy;
 }
 
@@ -286,6 +525,19 @@ void paste_bmodel(bmodel* m,bmodel* copy){
         return;
     int i;
     
+    if(same_bmodel_arena(m,copy)){
+        for(i = 0; i < ARENA_SLABS; i++){
+            if(copy->arena[i] != NULL && m->arena[i] != NULL)
+                memcpy(copy->arena[i],m->arena[i],sizeof(float)*m->arena_size);
+        }
+        for(i = 0; i < m->n_bn; i++){
+            copy_array(m->bns[i]->final_mean,copy->bns[i]->final_mean,m->bns[i]->vector_dim);
+            copy_array(m->bns[i]->final_var,copy->bns[i]->final_var,m->bns[i]->vector_dim);
+        }
+        bmodel_kernels_changed(copy);
+        return;
+    }
+    
     for(i = 0; i < m->n_fcl; i++){
         paste_fcl(m->fcls[i],copy->fcls[i]);
     }
@@ -315,6 +567,16 @@ void slow_paste_bmodel(bmodel* m, bmodel* copy, float tau){
         return;
     int i;
     
+    if(same_bmodel_arena(m,copy)){
+        float* p = m->arena[0];
+        float* p2 = copy->arena[0];
+        for(i = 0; i < m->arena_size; i++){
+            p2[i] = tau*p[i] + (1-tau)*p2[i];
+        }
+        bmodel_kernels_changed(copy);
+        return;
+    }
+    
     for(i = 0; i < m->n_fcl; i++){
         slow_paste_fcl(m->fcls[i],copy->fcls[i],tau);
     }
@@ -325,7 +587,7 @@ void slow_paste_bmodel(bmodel* m, bmodel* copy, float tau){
         slow_paste_rl(m->rls[i],copy->rls[i],tau);
     }
     
-    for(i = 0; i < m->n_rl; i++){
+    for(i = 0; i < m->n_bn; i++){
         slow_paste_bn(m->bns[i],copy->bns[i],tau);
     }
     return;
@@ -337,6 +599,23 @@ bmodel* reset_bmodel(bmodel* m){
     if(m == NULL)
         return NULL;
     int i;
+    if(m->arena != NULL){
+        if(m->arena[1] != NULL)
+            memset(m->arena[1],0,sizeof(float)*m->arena_size);
+        for(i = 0; i < m->n_fcl; i++){
+            reset_fcl_except_partial_derivatives(m->fcls[i]);
+        }
+        for(i = 0; i < m->n_cl; i++){
+            reset_cl_except_partial_derivatives(m->cls[i]);
+        }
+        for(i = 0; i < m->n_rl; i++){
+            reset_rl_except_partial_derivatives(m->rls[i]);
+        }
+        for(i = 0; i < m->n_bn; i++){
+            reset_bn_except_partial_derivatives(m->bns[i]);
+        }
+        return m;
+    }
     for(i = 0; i < m->n_fcl; i++){
         reset_fcl(m->fcls[i]);
     }
@@ -408,7 +687,8 @@ void save_bmodel(bmodel* m, int n){
     s = itoa(n,s);
     s = strcat(s,t);
     
-    fw = fopen(s,"a");
+    /* a new file, the layers are appended to it*/
+    fw = fopen(s,"w");
     
     if(fw == NULL){
         fprintf(stderr,"Error: error during the opening of the file %s\n",s);
@@ -475,14 +755,15 @@ void save_bmodel(bmodel* m, int n){
     free(s);
 }
 
-/* This function loads a network model from a .bin file with name file
+/* This function loads a bmodel from a .bin file with name file, see load_bmodel and load_inference_bmodel
  * 
  * Input:
  * 
- *             @ char* file:= the binary file from which the model will be loaded
+ *             @ char* file:= the binary file from which the bmodel will be loaded
+ *             @ int inference_only_flag:= 1 if the bmodel is built with inference_batch_network
  * 
  * */
-bmodel* load_bmodel(char* file){
+static bmodel* load_batch_network(char* file, int inference_only_flag){
     if(file == NULL)
         return NULL;
     int i;
@@ -574,12 +855,36 @@ bmodel* load_bmodel(char* file){
         exit(1);
     }
     
-    bmodel* m = batch_network(layers,n_rl,n_cl,n_fcl,n_bn,rls,cls,fcls,bns);
-    
-    return m;
+    if(inference_only_flag)
+        return inference_batch_network(layers,n_rl,n_cl,n_fcl,n_bn,rls,cls,fcls,bns);
+    return batch_network(layers,n_rl,n_cl,n_fcl,n_bn,rls,cls,fcls,bns);
     
 }
 
+/* This function loads a bmodel from a .bin file with name file
+ * 
+ * Input:
+ * 
+ *             @ char* file:= the binary file from which the bmodel will be loaded
+ * 
+ * */
+bmodel* load_bmodel(char* file){
+    return load_batch_network(file,0);
+}
+
+/* This function loads a bmodel from a .bin file with name file, the bmodel
+ * can be used only for the feed forward (see inference_batch_network). The file is the same
+ * saved by save_bmodel
+ * 
+ * Input:
+ * 
+ *             @ char* file:= the binary file from which the bmodel will be loaded
+ * 
+ * */
+bmodel* load_inference_bmodel(char* file){
+    return load_batch_network(file,1);
+}
+
 
 /* This function returs the total number of weights in the bmodel m
  * 
@@ -628,9 +933,34 @@ int count_bmodel_weights(bmodel* m){
 void update_bmodel(bmodel* m, float lr, float momentum, int mini_batch_size, int gradient_descent_flag, float* b1, float* b2, int regularization, int total_number_weights, float lambda){
     if(m == NULL)
         return;
+    bmodel_training_check(m,"update_bmodel");
     
     lambda*=mini_batch_size;
     
+    if(m->arena != NULL){
+        float* p = m->arena[0];
+        float* d = m->arena[1];
+        float* d1 = m->arena[2];
+        float* d2 = m->arena[3];
+        int w = m->arena_weights, g = m->arena_bn;
+        float weight_decay = regularization == L2_REGULARIZATION ? lambda/(float)total_number_weights : 0;
+        /* gamma and beta are updated with mini batch size 1, their derivatives are already averaged over the batch*/
+        if(gradient_descent_flag == NESTEROV){
+            nesterov_momentum_array(p,d,d1,w,lr,momentum,mini_batch_size,1,weight_decay,0);
+            nesterov_momentum_array(&p[w],&d[w],&d1[w],g-w,lr,momentum,mini_batch_size,1,0,0);
+            nesterov_momentum_array(&p[g],&d[g],&d1[g],m->arena_size-g,lr,momentum,1,1,0,0);
+        }
+        else if(gradient_descent_flag == ADAM){
+            adam_algorithm_array(p,d,d1,d2,w,lr,BETA1_ADAM,BETA2_ADAM,(*b1),(*b2),EPSILON_ADAM,mini_batch_size,1,weight_decay,0);
+            adam_algorithm_array(&p[w],&d[w],&d1[w],&d2[w],g-w,lr,BETA1_ADAM,BETA2_ADAM,(*b1),(*b2),EPSILON_ADAM,mini_batch_size,1,0,0);
+            adam_algorithm_array(&p[g],&d[g],&d1[g],&d2[g],m->arena_size-g,lr,BETA1_ADAM,BETA2_ADAM,(*b1),(*b2),EPSILON_ADAM,1,1,0,0);
+            (*b1)*=BETA1_ADAM;
+            (*b2)*=BETA2_ADAM;
+        }
+        bmodel_kernels_changed(m);
+        return;
+    }
+    
     if(regularization == L2_REGULARIZATION){
         add_l2_residual_layer_bmodel(m,total_number_weights,lambda);
         add_l2_convolutional_layer_bmodel(m,total_number_weights,lambda);
@@ -672,8 +1002,36 @@ void sum_model_partial_derivatives_bmodel(bmodel* m, bmodel* m2, bmodel* m3){
         fprintf(stderr,"Error: passed NULL pointer as values in sum_model_partial_derivatives\n");
         exit(1);
     }
+    bmodel_training_check(m,"sum_model_partial_derivatives_bmodel");
+    bmodel_training_check(m2,"sum_model_partial_derivatives_bmodel");
+    bmodel_training_check(m3,"sum_model_partial_derivatives_bmodel");
+    /* as the per layer sums, the partial derivatives of the batch normalization layers are not summed*/
+    if(same_bmodel_arena(m,m2) && same_bmodel_arena(m,m3)){
+        sum1D(m->arena[1],m2->arena[1],m3->arena[1],m->arena_bn);
+        return;
+    }
     sum_fully_connected_layers_partial_derivatives_bmodel(m,m2,m3);
     sum_convolutional_layers_partial_derivatives_bmodel(m,m2,m3);
     sum_residual_layers_partial_derivatives_bmodel(m,m2,m3);
 }
 
+/* This function sets the training or inference mode of all the convolutional layers of the bmodel
+ * (see set_convolutional_mode)
+ * 
+ * Input:
+ *             @ bmodel* m:= the bmodel
+ *             @ int mode_flag:= TRAINING_MODE or INFERENCE_MODE
+ * */
+void set_bmodel_mode(bmodel* m, int mode_flag){
+    int i,j;
+    if(mode_flag == TRAINING_MODE)
+        bmodel_training_check(m,"the training mode");
+    for(i = 0; i < m->n_rl; i++){
+        for(j = 0; j < m->rls[i]->n_cl; j++){
+            set_convolutional_mode(m->rls[i]->cls[j],mode_flag);
+        }
+    }
+    for(i = 0; i < m->n_cl; i++){
+        set_convolutional_mode(m->cls[i],mode_flag);
+    }
+}
@@ -0,0 +1,583 @@
+#include "llab.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+/* A checkpoint file holds a model with the state of its optimizer in a single file:
+ *
+ *     the header (checkpoint_header)
+ *     the table of contents: a checkpoint_entry for each convolutional and fully-connected layer
+ *                            with the position of its parameters in the slabs
+ *     the description of the layers (see model_description)
+ *     the parameters, D1 and D2 slabs of the arena of the model
+ *
+ * each section starts on a MAPPED_MODEL_ALIGNMENT boundary. The slabs are written straight from the arena with a
+ * single writev, in a temporary file that is synced and renamed (the directory is synced after the rename),
+ * so a checkpoint is replaced only by a complete one and the new name survives a crash.
+ * Only the model structure is supported: the batch normalization models (bmodel) have no checkpoint,
+ * their parameters and statistics can be saved with save_mapped_bmodel, without the state of the optimizer
+ * */
+
+static char checkpoint_zeros[MAPPED_MODEL_ALIGNMENT];
+
+/* This function rounds an offset up to a multiple of MAPPED_MODEL_ALIGNMENT*/
+static long long int checkpoint_aligned(long long int offset){
+    return (offset+MAPPED_MODEL_ALIGNMENT-1)/MAPPED_MODEL_ALIGNMENT*MAPPED_MODEL_ALIGNMENT;
+}
+
+/* This function adds the 32 bit words of data to the fletcher sums*/
+static void checkpoint_checksum(void* data, long long int size, unsigned long long int* sums){
+    long long int i;
+    unsigned int* w = (unsigned int*)data;
+    unsigned long long int a = sums[0], b = sums[1];
+    for(i = 0; i < size/(long long int)sizeof(unsigned int); i++){
+        a+=w[i];
+        b+=a;
+    }
+    sums[0] = a;
+    sums[1] = b;
+}
+
+/* This function fills the entry of the table of contents of a convolutional layer of m*/
+static void checkpoint_cl_entry(model* m, cl* c, int residual, int description_offset, checkpoint_entry* entry){
+    entry->type = CLS;
+    entry->layer = c->layer;
+    entry->residual = residual;
+    entry->description_offset = description_offset;
+    entry->weights_offset = c->kernels[0]-m->arena[0];
+    entry->weights_size = c->n_kernels*c->channels*c->kernel_rows*c->kernel_cols;
+    entry->biases_offset = c->biases-m->arena[0];
+    entry->biases_size = c->n_kernels;
+}
+
+/* This function fills the table of contents of a checkpoint of m
+ *
+ * Input:
+ *             @ model* m:= the model
+ *             @ checkpoint_entry* toc:= the table of contents, an entry for each convolutional and fully-connected layer
+ *
+ * */
+static void checkpoint_toc(model* m, checkpoint_entry* toc){
+    int i,j,k = 0,p = 5;
+    for(i = 0; i < m->n_rl; i++){
+        p+=MAPPED_RL_DESCRIPTION;
+        for(j = 0; j < m->rls[i]->n_cl; j++, k++){
+            checkpoint_cl_entry(m,m->rls[i]->cls[j],i,p,&toc[k]);
+            p+=MAPPED_CL_DESCRIPTION;
+        }
+    }
+    for(i = 0; i < m->n_cl; i++, k++){
+        checkpoint_cl_entry(m,m->cls[i],-1,p,&toc[k]);
+        p+=MAPPED_CL_DESCRIPTION;
+    }
+    for(i = 0; i < m->n_fcl; i++, k++){
+        toc[k].type = FCLS;
+        toc[k].layer = m->fcls[i]->layer;
+        toc[k].residual = -1;
+        toc[k].description_offset = p;
+        toc[k].weights_offset = m->fcls[i]->weights-m->arena[0];
+        toc[k].weights_size = m->fcls[i]->output*m->fcls[i]->input;
+        toc[k].biases_offset = m->fcls[i]->biases-m->arena[0];
+        toc[k].biases_size = m->fcls[i]->output;
+        p+=MAPPED_FCL_DESCRIPTION;
+    }
+}
+
+/* This function builds the header, the table of contents and the description of a checkpoint of m,
+ * the offsets of the header are set by write_checkpoint_file
+ *
+ * Input:
+ *             @ model* m:= the model
+ *             @ float b1:= the adam accumulator b1
+ *             @ float b2:= the adam accumulator b2
+ *             @ checkpoint_header* h:= the header
+ *             @ checkpoint_entry** toc:= where the table of contents is allocated
+ *             @ int** description:= where the description is allocated
+ *
+ * */
+static void checkpoint_model(model* m, float b1, float b2, checkpoint_header* h, checkpoint_entry** toc, int** description){
+    int i;
+    memset(h,0,sizeof(checkpoint_header));
+    h->n_entries = m->n_cl+m->n_fcl;
+    for(i = 0; i < m->n_rl; i++){
+        h->n_entries+=m->rls[i]->n_cl;
+    }
+    h->description_size = model_description_size(m->n_rl,m->n_cl,m->n_fcl,0,m->rls);
+    h->arena_size = m->arena_size;
+    h->arena_weights = m->arena_weights;
+    h->b1 = b1;
+    h->b2 = b2;
+    (*toc) = (checkpoint_entry*)malloc(sizeof(checkpoint_entry)*h->n_entries);
+    (*description) = (int*)malloc(sizeof(int)*h->description_size);
+    checkpoint_toc(m,*toc);
+    model_description(*description,m->layers,m->n_rl,m->n_cl,m->n_fcl,0,m->rls,m->cls,m->fcls,NULL);
+}
+
+/* This function adds a section to the vector of a writev, with the padding before it*/
+static void checkpoint_section(struct iovec* iov, int* n, void* data, long long int size, long long int offset, long long int* position){
+    iov[*n].iov_base = checkpoint_zeros;
+    iov[*n].iov_len = offset-(*position);
+    iov[(*n)+1].iov_base = data;
+    iov[(*n)+1].iov_len = size;
+    (*n)+=2;
+    (*position) = offset+size;
+}
+
+/* This function writes the vector on fd, also when writev writes only a part of it, it returns 0 or the errno of the error*/
+static int checkpoint_writev(int fd, struct iovec* iov, int n){
+    ssize_t written;
+    while(n > 0){
+        written = writev(fd,iov,n);
+        if(written < 0){
+            if(errno == EINTR)
+                continue;
+            return errno;
+        }
+        while(n > 0 && (size_t)written >= iov->iov_len){
+            written-=iov->iov_len;
+            iov++;
+            n--;
+        }
+        if(n > 0){
+            iov->iov_base = (char*)iov->iov_base+written;
+            iov->iov_len-=written;
+        }
+    }
+    return 0;
+}
+
+/* This function writes a checkpoint file: it sets the offsets and the checksum of the header,
+ * writes all the sections in file.tmp with a single writev, syncs it, renames it in file and syncs the directory
+ *
+ * Input:
+ *             @ char* file:= the name of the file
+ *             @ checkpoint_header* h:= the header built by checkpoint_model
+ *             @ checkpoint_entry* toc:= the table of contents
+ *             @ int* description:= the description of the layers
+ *             @ float** slabs:= ARENA_SLABS slabs of h->arena_size floats, the NULL slabs and the D slab are not saved
+ *
+ * returns 0 or the errno of the error (the error is printed on stderr, file is replaced only if the rename succeeded)
+ * */
+static int write_checkpoint_file(char* file, checkpoint_header* h, checkpoint_entry* toc, int* description, float** slabs){
+    int i,n = 0,fd,error;
+    long long int position;
+    struct iovec iov[2*(ARENA_SLABS+3)];
+    char* temp = (char*)malloc(sizeof(char)*(strlen(file)+5));
+    sprintf(temp,"%s.tmp",file);
+
+    memcpy(h->magic,"LLABCKPT",8);
+    h->version = CHECKPOINT_VERSION;
+    h->flags = 0;
+    h->slabs = 0;
+    h->toc_offset = checkpoint_aligned(sizeof(checkpoint_header));
+    h->description_offset = checkpoint_aligned(h->toc_offset+sizeof(checkpoint_entry)*(long long int)h->n_entries);
+    position = h->description_offset+sizeof(int)*(long long int)h->description_size;
+    for(i = 0; i < ARENA_SLABS; i++){
+        h->slabs_offset[i] = 0;
+        if(i != 1 && slabs[i] != NULL){
+            h->slabs|= 1<<i;
+            h->slabs_offset[i] = checkpoint_aligned(position);
+            position = h->slabs_offset[i]+sizeof(float)*(long long int)h->arena_size;
+        }
+    }
+    h->file_size = position;
+    h->checksum[0] = 0;
+    h->checksum[1] = 0;
+    unsigned long long int sums[2] = {0,0};
+    checkpoint_checksum(h,sizeof(checkpoint_header),sums);
+    checkpoint_checksum(toc,sizeof(checkpoint_entry)*(long long int)h->n_entries,sums);
+    checkpoint_checksum(description,sizeof(int)*(long long int)h->description_size,sums);
+    for(i = 0; i < ARENA_SLABS; i++){
+        if(h->slabs & (1<<i))
+            checkpoint_checksum(slabs[i],sizeof(float)*(long long int)h->arena_size,sums);
+    }
+    h->checksum[0] = sums[0];
+    h->checksum[1] = sums[1];
+
+    position = 0;
+    checkpoint_section(iov,&n,h,sizeof(checkpoint_header),0,&position);
+    checkpoint_section(iov,&n,toc,sizeof(checkpoint_entry)*(long long int)h->n_entries,h->toc_offset,&position);
+    checkpoint_section(iov,&n,description,sizeof(int)*(long long int)h->description_size,h->description_offset,&position);
+    for(i = 0; i < ARENA_SLABS; i++){
+        if(h->slabs & (1<<i))
+            checkpoint_section(iov,&n,slabs[i],sizeof(float)*(long long int)h->arena_size,h->slabs_offset[i],&position);
+    }
+
+    fd = open(temp,O_WRONLY | O_CREAT | O_TRUNC,0644);
+    if(fd < 0){
+        error = errno;
+        fprintf(stderr,"Error: error during the opening of the file %s\n",temp);
+        free(temp);
+        return error;
+    }
+    error = checkpoint_writev(fd,iov,n);
+    if(error)
+        fprintf(stderr,"Error: an error occurred writing the file %s\n",temp);
+    else if(fsync(fd)){
+        error = errno;
+        fprintf(stderr,"Error: an error occurred syncing the file %s\n",temp);
+    }
+    if(close(fd) && !error){
+        error = errno;
+        fprintf(stderr,"Error: an error occurred closing the file %s\n",temp);
+    }
+    if(!error && rename(temp,file)){
+        error = errno;
+        fprintf(stderr,"Error: an error occurred renaming the file %s in %s\n",temp,file);
+    }
+    if(error){
+        unlink(temp);
+        free(temp);
+        return error;
+    }
+    free(temp);
+    error = sync_directory(file);
+    if(error)
+        fprintf(stderr,"Error: an error occurred syncing the directory of the file %s\n",file);
+    return error;
+}
+
+/* This function saves a model and the state of its optimizer in a checkpoint file that can be loaded
+ * with load_checkpoint: the parameters, the D1 and D2 arrays of nesterov and adam and the adam accumulators.
+ * The whole file is written with a single writev straight from the arena of the model, in file.tmp
+ * that is synced and renamed (then the directory is synced), so an existing checkpoint is replaced only by a complete one.
+ * The batch normalization models (bmodel) are not supported
+ *
+ * Input:
+ *
+ *             @ model* m:= the model, built with network or inference_network (only the parameters are saved)
+ *             @ char* file:= the name of the file
+ *             @ float b1:= the adam accumulator b1 passed to update_model (BETA1_ADAM at the beginning)
+ *             @ float b2:= the adam accumulator b2 passed to update_model (BETA2_ADAM at the beginning)
+ *
+ * */
+void save_checkpoint(model* m, char* file, float b1, float b2){
+    if(m == NULL || file == NULL)
+        return;
+    if(m->arena == NULL){
+        fprintf(stderr,"Error: save_checkpoint needs a model built with network() or inference_network()\n");
+        exit(1);
+    }
+    checkpoint_header h;
+    checkpoint_entry* toc;
+    int* description;
+    checkpoint_model(m,b1,b2,&h,&toc,&description);
+    if(write_checkpoint_file(file,&h,toc,description,m->arena))
+        exit(1);
+    free(toc);
+    free(description);
+}
+
+/* This function reads size bytes of the file at offset and adds them to the checksum*/
+static void checkpoint_read(FILE* fr, void* data, long long int size, long long int offset, unsigned long long int* sums, char* file){
+    if(size > 0 && (fseeko(fr,offset,SEEK_SET) || fread(data,size,1,fr) != 1)){
+        fprintf(stderr,"Error: an error occurred loading the checkpoint %s\n",file);
+        exit(1);
+    }
+    checkpoint_checksum(data,size,sums);
+}
+
+/* This function loads a model saved by save_checkpoint, with the D1 and D2 arrays of its optimizer.
+ * The checksum of the file is checked, the slabs are read straight in the arena of the model
+ *
+ * Input:
+ *
+ *             @ char* file:= the name of the file
+ *             @ float* b1:= where the adam accumulator b1 is stored, it can be NULL
+ *             @ float* b2:= where the adam accumulator b2 is stored, it can be NULL
+ *
+ * */
+model* load_checkpoint(char* file, float* b1, float* b2){
+    if(file == NULL)
+        return NULL;
+    int i,counts[5];
+    long long int size,end;
+    checkpoint_header h;
+    unsigned long long int sums[2] = {0,0}, checksum[2];
+    FILE* fr = fopen(file,"r");
+    if(fr == NULL){
+        fprintf(stderr,"Error: error during the opening of the file %s\n",file);
+        exit(1);
+    }
+    if(fseeko(fr,0,SEEK_END) || (size = ftello(fr)) < (long long int)sizeof(checkpoint_header) || fseeko(fr,0,SEEK_SET) || fread(&h,sizeof(checkpoint_header),1,fr) != 1 || memcmp(h.magic,"LLABCKPT",8)){
+        fprintf(stderr,"Error: the file %s is not a checkpoint\n",file);
+        exit(1);
+    }
+    if(h.version != CHECKPOINT_VERSION){
+        fprintf(stderr,"Error: the file %s has the version %d of the checkpoints, this library reads the version %d\n",file,h.version,CHECKPOINT_VERSION);
+        exit(1);
+    }
+    end = h.description_offset+(long long int)sizeof(int)*h.description_size;
+    for(i = 0; i < ARENA_SLABS; i++){
+        if((h.slabs & (1<<i)) && (h.slabs_offset[i] < end || h.slabs_offset[i]%MAPPED_MODEL_ALIGNMENT || h.slabs_offset[i]+(long long int)sizeof(float)*h.arena_size > h.file_size))
+            break;
+    }
+    if(i < ARENA_SLABS || !(h.slabs & 1) || (h.slabs & 2) || h.slabs >= (1<<ARENA_SLABS) || h.n_entries < 0 || h.description_size < 5 || h.arena_weights < 0 || h.arena_size < h.arena_weights ||
+       h.toc_offset < (long long int)sizeof(checkpoint_header) || h.toc_offset%MAPPED_MODEL_ALIGNMENT || h.description_offset%MAPPED_MODEL_ALIGNMENT ||
+       h.description_offset < h.toc_offset+(long long int)sizeof(checkpoint_entry)*h.n_entries || end > h.file_size || h.file_size != size){
+        fprintf(stderr,"Error: the checkpoint %s is corrupted\n",file);
+        exit(1);
+    }
+    checksum[0] = h.checksum[0];
+    checksum[1] = h.checksum[1];
+    h.checksum[0] = 0;
+    h.checksum[1] = 0;
+    checkpoint_checksum(&h,sizeof(checkpoint_header),sums);
+    checkpoint_entry* toc = (checkpoint_entry*)malloc(sizeof(checkpoint_entry)*(h.n_entries+1));
+    int* description = (int*)malloc(sizeof(int)*h.description_size);
+    checkpoint_read(fr,toc,sizeof(checkpoint_entry)*(long long int)h.n_entries,h.toc_offset,sums,file);
+    checkpoint_read(fr,description,sizeof(int)*(long long int)h.description_size,h.description_offset,sums,file);
+
+    rl** rls;
+    cl** cls;
+    fcl** fcls;
+    bn** bns;
+    model_description_layers(description,h.description_size,counts,&rls,&cls,&fcls,&bns);
+    if(counts[4]){
+        fprintf(stderr,"Error: the checkpoint %s is corrupted\n",file);
+        exit(1);
+    }
+    model* m = network(counts[0],counts[1],counts[2],counts[3],rls,cls,fcls);
+    checkpoint_header h2;
+    checkpoint_entry* toc2;
+    int* description2;
+    checkpoint_model(m,0,0,&h2,&toc2,&description2);
+    if(m->arena_size != h.arena_size || m->arena_weights != h.arena_weights || h2.n_entries != h.n_entries || memcmp(toc,toc2,sizeof(checkpoint_entry)*h.n_entries)){
+        fprintf(stderr,"Error: the parameters of the checkpoint %s don't match its layers\n",file);
+        exit(1);
+    }
+    for(i = 0; i < ARENA_SLABS; i++){
+        if(h.slabs & (1<<i))
+            checkpoint_read(fr,m->arena[i],sizeof(float)*(long long int)h.arena_size,h.slabs_offset[i],sums,file);
+    }
+    if(sums[0] != checksum[0] || sums[1] != checksum[1]){
+        fprintf(stderr,"Error: the checksum of the checkpoint %s is wrong\n",file);
+        exit(1);
+    }
+    if(fclose(fr)){
+        fprintf(stderr,"Error: an error occurred closing the file %s\n",file);
+        exit(1);
+    }
+    if(b1 != NULL)
+        (*b1) = h.b1;
+    if(b2 != NULL)
+        (*b2) = h.b2;
+    free(toc);
+    free(toc2);
+    free(description);
+    free(description2);
+    return m;
+}
+
+/* the thread of a checkpoint writer: it writes the snapshots in the order they are taken until the writer is freed.
+ * A snapshot is written only after save_checkpoint_async has published it, an error is recorded and passed to the callback*/
+static void* checkpoint_writer_thread(void* arg){
+    checkpoint_writer* w = (checkpoint_writer*)arg;
+    checkpoint_snapshot* s;
+    int error;
+    while(1){
+        pthread_mutex_lock(&w->mutex);
+        while(!(w->n_in_flight && w->snapshots[w->first].published) && !(w->exit_flag && !w->n_in_flight))
+            pthread_cond_wait(&w->cond,&w->mutex);
+        if(!w->n_in_flight){
+            pthread_mutex_unlock(&w->mutex);
+            break;
+        }
+        s = &w->snapshots[w->first];
+        pthread_mutex_unlock(&w->mutex);
+
+        error = write_checkpoint_file(s->file,&s->h,s->toc,s->description,s->slabs);
+        if(w->callback != NULL)
+            (*w->callback)(s->file,s->checkpoint,error,w->data);
+        free(s->file);
+        free(s->toc);
+        free(s->description);
+
+        pthread_mutex_lock(&w->mutex);
+        s->published = 0;
+        w->first = (w->first+1)%w->max_in_flight;
+        w->n_in_flight--;
+        w->completed++;
+        if(error){
+            w->failed++;
+            w->error = error;
+        }
+        pthread_cond_broadcast(&w->cond);
+        pthread_mutex_unlock(&w->mutex);
+    }
+    return NULL;
+}
+
+/* This function builds a checkpoint writer: save_checkpoint_async takes a copy of the model in memory
+ * and a background thread writes it as save_checkpoint does (single writev, fsync and rename),
+ * so the training stops only for the copy
+ *
+ * Input:
+ *
+ *             @ int max_in_flight:= the maximum number of snapshots taken and not written yet, save_checkpoint_async
+ *                                   waits when they are max_in_flight. Each snapshot keeps its memory for the next ones
+ *             @ void (*callback)(char* file, int checkpoint, int error, void* data):= called by the background thread after the checkpoint
+ *                                                                                     number checkpoint has been written in file (error = 0)
+ *                                                                                     or it could not be written (error is the errno,
+ *                                                                                     the previous file is kept), it can be NULL
+ *             @ void* data:= passed to callback
+ *
+ * */
+checkpoint_writer* async_checkpoint_writer(int max_in_flight, void (*callback)(char* file, int checkpoint, int error, void* data), void* data){
+    if(max_in_flight < 1){
+        fprintf(stderr,"Error: max_in_flight must be >= 1\n");
+        exit(1);
+    }
+    checkpoint_writer* w = (checkpoint_writer*)malloc(sizeof(checkpoint_writer));
+    w->max_in_flight = max_in_flight;
+    w->first = 0;
+    w->n_in_flight = 0;
+    w->submitted = 0;
+    w->completed = 0;
+    w->failed = 0;
+    w->error = 0;
+    w->exit_flag = 0;
+    w->snapshots = (checkpoint_snapshot*)calloc(max_in_flight,sizeof(checkpoint_snapshot));
+    w->callback = callback;
+    w->data = data;
+    pthread_mutex_init(&w->mutex,NULL);
+    pthread_cond_init(&w->cond,NULL);
+    if(pthread_create(&w->thread,NULL,checkpoint_writer_thread,w)){
+        fprintf(stderr,"Error: an error occurred creating the thread of the checkpoint writer\n");
+        exit(1);
+    }
+    return w;
+}
+
+/* This function takes a snapshot of a model and of the state of its optimizer (the parameters, the D1 and D2 arrays
+ * and the adam accumulators) and queues it to the writer, the file is the same written by save_checkpoint.
+ * The model can be trained again as soon as the function returns, it must not change during the call
+ * (with a trainer call it between the mini batches). If max_in_flight snapshots are waiting, it waits for the oldest one.
+ * More threads can call it on the same writer: each call reserves its snapshot and its number under the lock,
+ * copies the model and then publishes the snapshot
+ *
+ * Input:
+ *
+ *             @ checkpoint_writer* w:= the writer
+ *             @ model* m:= the model, built with network or inference_network (only the parameters are saved)
+ *             @ char* file:= the name of the file, it is copied
+ *             @ float b1:= the adam accumulator b1 passed to update_model
+ *             @ float b2:= the adam accumulator b2 passed to update_model
+ *
+ * returns the number of the checkpoint, the checkpoints are written in this order
+ * */
+int save_checkpoint_async(checkpoint_writer* w, model* m, char* file, float b1, float b2){
+    if(w == NULL || m == NULL || file == NULL)
+        return -1;
+    if(m->arena == NULL){
+        fprintf(stderr,"Error: save_checkpoint_async needs a model built with network() or inference_network()\n");
+        exit(1);
+    }
+    int i,k = 0;
+    long long int size = 0;
+    checkpoint_snapshot* s;
+    pthread_mutex_lock(&w->mutex);
+    while(w->n_in_flight == w->max_in_flight)
+        pthread_cond_wait(&w->cond,&w->mutex);
+    s = &w->snapshots[(w->first+w->n_in_flight)%w->max_in_flight];
+    s->checkpoint = w->submitted++;
+    w->n_in_flight++;
+    pthread_mutex_unlock(&w->mutex);
+
+    for(i = 0; i < ARENA_SLABS; i++){
+        if(i != 1 && m->arena[i] != NULL)
+            size+=m->arena_size;
+    }
+    if(s->buffer_size < size){
+        free(s->buffer);
+        if(posix_memalign((void**)&s->buffer,ARENA_ALIGNMENT*sizeof(float),sizeof(float)*size)){
+            fprintf(stderr,"Error: not enough memory for the checkpoint snapshot\n");
+            exit(1);
+        }
+        s->buffer_size = size;
+    }
+    for(i = 0; i < ARENA_SLABS; i++){
+        s->slabs[i] = NULL;
+        if(i != 1 && m->arena[i] != NULL){
+            s->slabs[i] = &s->buffer[(long long int)k*m->arena_size];
+            memcpy(s->slabs[i],m->arena[i],sizeof(float)*m->arena_size);
+            k++;
+        }
+    }
+    checkpoint_model(m,b1,b2,&s->h,&s->toc,&s->description);
+    s->file = (char*)malloc(sizeof(char)*(strlen(file)+1));
+    strcpy(s->file,file);
+
+    pthread_mutex_lock(&w->mutex);
+    s->published = 1;
+    i = s->checkpoint;
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->mutex);
+    return i;
+}
+
+/* This function returns the number of checkpoints of the writer that have been handled by its thread, the checkpoint i
+ * has been written or it failed if i < checkpoints_completed(w) (the callback tells which ones failed)
+ *
+ * Input:
+ *
+ *             @ checkpoint_writer* w:= the writer
+ *             @ int* failed:= where the number of the checkpoints that could not be written is stored, it can be NULL
+ *
+ * */
+int checkpoints_completed(checkpoint_writer* w, int* failed){
+    int completed;
+    pthread_mutex_lock(&w->mutex);
+    completed = w->completed;
+    if(failed != NULL)
+        (*failed) = w->failed;
+    pthread_mutex_unlock(&w->mutex);
+    return completed;
+}
+
+/* This function waits until all the checkpoints taken by the writer have been handled
+ *
+ * Input:
+ *
+ *             @ checkpoint_writer* w:= the writer
+ *
+ * returns 0 if all the checkpoints of the writer have been written, otherwise the errno of the last one that failed
+ * */
+int wait_checkpoints(checkpoint_writer* w){
+    int error;
+    pthread_mutex_lock(&w->mutex);
+    while(w->n_in_flight)
+        pthread_cond_wait(&w->cond,&w->mutex);
+    error = w->error;
+    pthread_mutex_unlock(&w->mutex);
+    return error;
+}
+
+/* This function writes the checkpoints still in flight, stops the thread and frees the writer
+ *
+ * Input:
+ *
+ *             @ checkpoint_writer* w:= the writer
+ *
+ * returns 0 if all the checkpoints of the writer have been written, otherwise the errno of the last one that failed
+ * */
+int free_checkpoint_writer(checkpoint_writer* w){
+    if(w == NULL)
+        return 0;
+    int i,error;
+    pthread_mutex_lock(&w->mutex);
+    w->exit_flag = 1;
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->mutex);
+    pthread_join(w->thread,NULL);
+    error = w->error;
+    for(i = 0; i < w->max_in_flight; i++){
+        free(w->snapshots[i].buffer);
+    }
+    free(w->snapshots);
+    pthread_mutex_destroy(&w->mutex);
+    pthread_cond_destroy(&w->cond);
+    free(w);
+    return error;
+}
@@ -11,18 +11,43 @@
  * */
  
 void clipping_gradient(model* m, float threshold) {
-     float sum = 0;
-     sum += sum_all_quadratic_derivative_weights_fcls(m->fcls, m->n_fcl);
-     sum += sum_all_quadratic_derivative_weights_cls(m->cls, m->n_cl);
-     sum += sum_all_quadratic_derivative_weights_rls(m->rls, m->n_rl);
+     float sum = sum_all_quadratic_derivative_weights_model(m);
      
      sum = sqrtf(sum);
      if(sum >= threshold){
+         if(m->arena != NULL){
+             mul_value(m->arena[1],(threshold)/(sum),m->arena[1],m->arena_weights);
+             return;
+         }
          clip_fcls(m->fcls, m->n_fcl, threshold, sum);
          clip_cls(m->cls, m->n_cl, threshold, sum);
          clip_rls(m->rls, m->n_rl, threshold, sum);
      }
 }
+
+/* This functions returns the derivative of the weights of the whole model in quadratic form
+ * returns Sum for all i (DL/Dw_i^2), with the arena the weights are read in a single pass.
+ * It is a pass over the partial derivatives before the update, sum_model_partial_derivatives_with_norm
+ * computes the same sum while it merges the partial derivatives of 2 models
+  * 
+  * Input:
+  * 
+  *             @ model* m:= the model
+  * 
+  * */
+float sum_all_quadratic_derivative_weights_model(model* m){
+    if(m->inference_only_flag){
+        fprintf(stderr,"Error: the model has been built for inference only, it has no partial derivatives\n");
+        exit(1);
+    }
+    if(m->arena != NULL)
+        return sum_squares(m->arena[1],m->arena_weights);
+    float sum = 0;
+    sum += sum_all_quadratic_derivative_weights_fcls(m->fcls, m->n_fcl);
+    sum += sum_all_quadratic_derivative_weights_cls(m->cls, m->n_cl);
+    sum += sum_all_quadratic_derivative_weights_rls(m->rls, m->n_rl);
+    return sum;
+}
  
 /* This functions clips the derivative weights according to the clipping_gradient formula
   * of residual layers
@@ -19,7 +19,7 @@
  *             @ int stride:= the stride used by the kernel on the feature maps of the inputs
  *             @ int padding:= the optional padding added to the output
  * */
-void convolutional_feed_forward(float* input, float* kernel, int input_i, int input_j, int kernel_i, int kernel_j, float bias, int channels, float* output, int stride, int padding){
+ISA_INLINE void convolutional_feed_forward_kernel(float* input, float* kernel, int input_i, int input_j, int kernel_i, int kernel_j, float bias, int channels, float* output, int stride, int padding){
     int oi,oj,i,j,c;
     int output_i = (input_i-kernel_i)/stride + 1 + 2*padding;
     int output_j = (input_j-kernel_j)/stride + 1 + 2*padding;
@@ -37,6 +37,8 @@ void convolutional_feed_forward(float* input, float* kernel, int input_i, int in
     }
 }
 
+ISA_DISPATCH(, convolutional_feed_forward, (float* input, float* kernel, int input_i, int input_j, int kernel_i, int kernel_j, float bias, int channels, float* output, int stride, int padding), (input,kernel,input_i,input_j,kernel_i,kernel_j,bias,channels,output,stride,padding))
+
 /* This function computes the errors using the backpropagation
  * 
  * Input:
@@ -62,7 +64,7 @@ void convolutional_feed_forward(float* input, float* kernel, int input_i, int in
  *             @ int stride:= the stride used by the kernel on the feature maps of the inputs
  *             @ int padding:= the optional padding added to the output
  * */
-void convolutional_back_prop(float* input, float* kernel, int input_i, int input_j, int kernel_i, int kernel_j, float bias, int channels, float* output_error,float* input_error, float* kernel_error, float* bias_error, int stride, int padding){
+ISA_INLINE void convolutional_back_prop_kernel(float* input, float* kernel, int input_i, int input_j, int kernel_i, int kernel_j, float bias, int channels, float* output_error,float* input_error, float* kernel_error, float* bias_error, int stride, int padding){
     int oi,oj,i,j,c;
     int output_i = (input_i-kernel_i)/stride + 1 + 2*padding;
     int output_j = (input_j-kernel_j)/stride + 1 + 2*padding;
@@ -81,6 +83,242 @@ void convolutional_back_prop(float* input, float* kernel, int input_i, int input
     }
 }
 
+ISA_DISPATCH(, convolutional_back_prop, (float* input, float* kernel, int input_i, int input_j, int kernel_i, int kernel_j, float bias, int channels, float* output_error,float* input_error, float* kernel_error, float* bias_error, int stride, int padding), (input,kernel,input_i,input_j,kernel_i,kernel_j,bias,channels,output_error,input_error,kernel_error,bias_error,stride,padding))
+
+/* This function lowers a tensor to a matrix (im2col): each column of the matrix contains the
+ * channels*kernel_i*kernel_j input values seen by the kernel on an output position.
+ * The row r = (c*kernel_i + i)*kernel_j + j of the matrix starts at col[r*ld], so the inputs of more instances
+ * can be lowered side by side in the same matrix
+ * 
+ * Input:
+ *             @ float* input:= a tensor of input of 3 dimensions: channels, rows and cols
+ *                              dimensions: channels*input_i*input_j
+ *             @ int channels:= the depth of the input
+ *             @ int input_i:= the number of rows of each feature map of the input
+ *             @ int input_j:= the number of columns of each feature map of the input
+ *             @ int kernel_i:= the number of rows of each channel of the kernel
+ *             @ int kernel_j:= the number of columns of each channel of the kernel
+ *             @ int stride:= the stride used by the kernel on the feature maps of the inputs
+ *             @ float* col:= the matrix that must be filled
+ *                            dimensions: (channels*kernel_i*kernel_j)*ld
+ *             @ int ld:= the distance between 2 rows of col, >= ((input_i-kernel_i)/stride + 1)*((input_j-kernel_j)/stride + 1)
+ * */
+ISA_INLINE void im2col_kernel(float* input, int channels, int input_i, int input_j, int kernel_i, int kernel_j, int stride, float* col, int ld){
+    int c,i,j,y,x;
+    int output_i = (input_i-kernel_i)/stride + 1;
+    int output_j = (input_j-kernel_j)/stride + 1;
+    float* src;
+    for(c = 0; c < channels; c++){
+        for(i = 0; i < kernel_i; i++){
+            for(j = 0; j < kernel_j; j++){
+                for(y = 0; y < output_i; y++){
+                    src = &input[c*input_i*input_j + (y*stride+i)*input_j + j];
+                    if(stride == 1){
+                        for(x = 0; x < output_j; x++){
+                            col[x] = src[x];
+                        }
+                    }
+                    else{
+                        for(x = 0; x < output_j; x++){
+                            col[x] = src[x*stride];
+                        }
+                    }
+                    col+=output_j;
+                }
+                col+=ld-output_i*output_j;
+            }
+        }
+    }
+}
+
+ISA_DISPATCH(, im2col, (float* input, int channels, int input_i, int input_j, int kernel_i, int kernel_j, int stride, float* col, int ld), (input,channels,input_i,input_j,kernel_i,kernel_j,stride,col,ld))
+
+/* This function is the inverse of im2col: it sums each element of the matrix
+ * to the input position from which it has been taken
+ * 
+ * Input:
+ *             @ float* col:= the matrix
+ *                            dimensions: (channels*kernel_i*kernel_j)*ld
+ *             @ int channels:= the depth of the input
+ *             @ int input_i:= the number of rows of each feature map of the input
+ *             @ int input_j:= the number of columns of each feature map of the input
+ *             @ int kernel_i:= the number of rows of each channel of the kernel
+ *             @ int kernel_j:= the number of columns of each channel of the kernel
+ *             @ int stride:= the stride used by the kernel on the feature maps of the inputs
+ *             @ float* input_error:= the tensor where the matrix is summed
+ *                                    dimensions: channels*input_i*input_j
+ *             @ int ld:= the distance between 2 rows of col, >= ((input_i-kernel_i)/stride + 1)*((input_j-kernel_j)/stride + 1)
+ * */
+ISA_INLINE void col2im_kernel(float* col, int channels, int input_i, int input_j, int kernel_i, int kernel_j, int stride, float* input_error, int ld){
+    int c,i,j,y,x;
+    int output_i = (input_i-kernel_i)/stride + 1;
+    int output_j = (input_j-kernel_j)/stride + 1;
+    float* dst;
+    for(c = 0; c < channels; c++){
+        for(i = 0; i < kernel_i; i++){
+            for(j = 0; j < kernel_j; j++){
+                for(y = 0; y < output_i; y++){
+                    dst = &input_error[c*input_i*input_j + (y*stride+i)*input_j + j];
+                    if(stride == 1){
+                        for(x = 0; x < output_j; x++){
+                            dst[x] += col[x];
+                        }
+                    }
+                    else{
+                        for(x = 0; x < output_j; x++){
+                            dst[x*stride] += col[x];
+                        }
+                    }
+                    col+=output_j;
+                }
+                col+=ld-output_i*output_j;
+            }
+        }
+    }
+}
+
+ISA_DISPATCH(, col2im, (float* col, int channels, int input_i, int input_j, int kernel_i, int kernel_j, int stride, float* input_error, int ld), (col,channels,input_i,input_j,kernel_i,kernel_j,stride,input_error,ld))
+
+/* This function computes the feed forward of all the feature maps of a convolutional layer at once
+ * for batch_size instances: the inputs are lowered with im2col side by side and the feature maps
+ * of all the instances are computed as a single sgemm between the kernels and the lowered inputs,
+ * then the biases are added
+ * 
+ * Input:
+ *             @ float* input:= batch_size tensors of input of 3 dimensions: channels, rows and cols stored one after the other
+ *                              dimensions: batch_size*channels*input_i*input_j
+ *             @ float* kernels:= the kernels of the layer stored one after the other
+ *                                dimensions: n_kernels*channels*kernel_i*kernel_j
+ *             @ int input_i := the number of rows of each feature map of the previous layer (input)
+ *             @ int input_j:= the number of columns of each feature map of the previous layer (input)
+ *             @ int kernel_i:= the number of rows of each channel of the kernel
+ *             @ int kernel_j:= the number of columns of each channel of the kernel
+ *             @ float* biases:= the biases of the feature maps
+ *                               dimensions: n_kernels
+ *             @ int channels:= the depth of the input and the kernel
+ *             @ int n_kernels:= the number of kernels
+ *             @ float* output:= the feature maps computed for the instances one after the other
+ *                               dimensions: batch_size*n_kernels*((input_i-kernel_i)/stride + 1 +2*padding)*((input_j-kernel_j)/stride + 1 +2*padding)
+ *             @ int stride:= the stride used by the kernel on the feature maps of the inputs
+ *             @ int padding:= the optional padding added to the output
+ *             @ float* col:= the buffer for the lowered inputs
+ *                            dimensions: (channels*kernel_i*kernel_j)*(batch_size*((input_i-kernel_i)/stride + 1)*((input_j-kernel_j)/stride + 1))
+ *             @ float* temp:= a buffer for the feature maps without padding (used only if padding > 0 or batch_size > 1)
+ *                             dimensions: n_kernels*(batch_size*((input_i-kernel_i)/stride + 1)*((input_j-kernel_j)/stride + 1))
+ *             @ int batch_size:= the number of instances
+ * */
+void convolutional_feed_forward_im2col(float* input, float* kernels, int input_i, int input_j, int kernel_i, int kernel_j, float* biases, int channels, int n_kernels, float* output, int stride, int padding, float* col, float* temp, int batch_size){
+    int b,k,y,x;
+    int output_i = (input_i-kernel_i)/stride + 1;
+    int output_j = (input_j-kernel_j)/stride + 1;
+    int n_pixels = output_i*output_j;
+    int n_columns = n_pixels*batch_size;
+    int kernel_size = channels*kernel_i*kernel_j;
+    int input_size = channels*input_i*input_j;
+    int output_size = n_kernels*(output_i+2*padding)*(output_j+2*padding);
+    float* dst;
+    float* src;
+    for(b = 0; b < batch_size; b++){
+        im2col(&input[b*input_size],channels,input_i,input_j,kernel_i,kernel_j,stride,&col[b*n_pixels],n_columns);
+    }
+    if(!padding && batch_size == 1){
+        sgemm(NO_TRANSPOSE,NO_TRANSPOSE,n_kernels,n_pixels,kernel_size,kernels,kernel_size,col,n_pixels,output,n_pixels,NULL);
+        for(k = 0; k < n_kernels; k++){
+            dst = &output[k*n_pixels];
+            for(x = 0; x < n_pixels; x++){
+                dst[x] += biases[k];
+            }
+        }
+        return;
+    }
+    
+    /* the feature maps of the instances are side by side in temp, they are moved to their output with the padding*/
+    memset(temp,0,sizeof(float)*n_kernels*n_columns);
+    sgemm(NO_TRANSPOSE,NO_TRANSPOSE,n_kernels,n_columns,kernel_size,kernels,kernel_size,col,n_columns,temp,n_columns,NULL);
+    for(b = 0; b < batch_size; b++){
+        for(k = 0; k < n_kernels; k++){
+            for(y = 0; y < output_i; y++){
+                dst = &output[b*output_size + k*(output_i+2*padding)*(output_j+2*padding) + (y+padding)*(output_j+2*padding) + padding];
+                src = &temp[k*n_columns + b*n_pixels + y*output_j];
+                for(x = 0; x < output_j; x++){
+                    dst[x] += src[x] + biases[k];
+                }
+            }
+        }
+    }
+}
+
+/* This function computes the errors using the backpropagation for all the feature maps of a convolutional layer
+ * at once for batch_size instances: the kernels error is the single sgemm between the output errors and the inputs
+ * lowered side by side, the input errors are the sgemm between the kernels and the output errors summed back with col2im
+ * 
+ * Input:
+ *             @ float* input:= batch_size tensors of input of 3 dimensions: channels, rows and cols stored one after the other
+ *                              dimensions: batch_size*channels*input_i*input_j
+ *             @ float* kernels:= the kernels of the layer stored one after the other
+ *                                dimensions: n_kernels*channels*kernel_i*kernel_j
+ *             @ int input_i := the number of rows of each feature map of the previous layer (input)
+ *             @ int input_j:= the number of columns of each feature map of the previous layer (input)
+ *             @ int kernel_i:= the number of rows of each channel of the kernel
+ *             @ int kernel_j:= the number of columns of each channel of the kernel
+ *             @ int channels:= the depth of the input and the kernel
+ *             @ int n_kernels:= the number of kernels
+ *             @ float* output_error:= the errors of the feature maps of the instances one after the other
+ *                                     dimensions: batch_size*n_kernels*((input_i-kernel_i)/stride + 1 +2*padding)*((input_j-kernel_j)/stride + 1 +2*padding)
+ *             @ float* input_error:= the errors of the inputs that must be filled, one after the other
+ *                                    dimensions: batch_size*channels*input_i*input_j
+ *             @ float* kernels_error:= the error of the kernels that must be filled, stored one after the other
+ *                                      dimensions: n_kernels*channels*kernel_i*kernel_j
+ *             @ float* biases_error:= the error of the biases that must be filled
+ *                                     dimensions: n_kernels
+ *             @ int stride:= the stride used by the kernel on the feature maps of the inputs
+ *             @ int padding:= the optional padding added to the output
+ *             @ float* col:= the buffer for the lowered inputs
+ *                            dimensions: (channels*kernel_i*kernel_j)*(batch_size*((input_i-kernel_i)/stride + 1)*((input_j-kernel_j)/stride + 1))
+ *             @ float* temp:= a buffer for the errors without padding (used only if padding > 0 or batch_size > 1)
+ *                             dimensions: n_kernels*(batch_size*((input_i-kernel_i)/stride + 1)*((input_j-kernel_j)/stride + 1))
+ *             @ int batch_size:= the number of instances
+ * */
+void convolutional_back_prop_im2col(float* input, float* kernels, int input_i, int input_j, int kernel_i, int kernel_j, int channels, int n_kernels, float* output_error, float* input_error, float* kernels_error, float* biases_error, int stride, int padding, float* col, float* temp, int batch_size){
+    int b,k,y,x;
+    int output_i = (input_i-kernel_i)/stride + 1;
+    int output_j = (input_j-kernel_j)/stride + 1;
+    int n_pixels = output_i*output_j;
+    int n_columns = n_pixels*batch_size;
+    int kernel_size = channels*kernel_i*kernel_j;
+    int input_size = channels*input_i*input_j;
+    int output_size = n_kernels*(output_i+2*padding)*(output_j+2*padding);
+    float* error = output_error;
+    
+    /* the errors of the instances are put side by side in temp without the padding*/
+    if(padding || batch_size > 1){
+        for(b = 0; b < batch_size; b++){
+            for(k = 0; k < n_kernels; k++){
+                for(y = 0; y < output_i; y++){
+                    copy_array(&output_error[b*output_size + k*(output_i+2*padding)*(output_j+2*padding) + (y+padding)*(output_j+2*padding) + padding],&temp[k*n_columns + b*n_pixels + y*output_j],output_j);
+                }
+            }
+        }
+        error = temp;
+    }
+    
+    for(k = 0; k < n_kernels; k++){
+        for(x = 0; x < n_columns; x++){
+            biases_error[k] += error[k*n_columns + x];
+        }
+    }
+    
+    for(b = 0; b < batch_size; b++){
+        im2col(&input[b*input_size],channels,input_i,input_j,kernel_i,kernel_j,stride,&col[b*n_pixels],n_columns);
+    }
+    sgemm(NO_TRANSPOSE,TRANSPOSE,n_kernels,kernel_size,n_columns,error,n_columns,col,n_columns,kernels_error,kernel_size,NULL);
+    memset(col,0,sizeof(float)*kernel_size*n_columns);
+    sgemm(TRANSPOSE,NO_TRANSPOSE,kernel_size,n_columns,n_kernels,kernels,kernel_size,error,n_columns,col,n_columns,NULL);
+    for(b = 0; b < batch_size; b++){
+        col2im(&col[b*n_pixels],channels,input_i,input_j,kernel_i,kernel_j,stride,&input_error[b*input_size],n_columns);
+    }
+}
+
 /* This function apply the 2D max-pooling to a covolutional layer
  * 
  * Input:
@@ -88,6 +326,9 @@ void convolutional_back_prop(float* input, float* kernel, int input_i, int input
  *                              dimensions: input_i*input_j
  *             @ float* output:= the output computed after applying the pooling to the input
  *                               dimensions: ((input_i-sub_pool_i)/stride + 1 + 2*padding)*((input_j-sub_pool_j)/stride + 1 + 2*padding)
+ *             @ unsigned short* indices:= for each output the position of the max inside its pooling window (k1*sub_pool_j+k2),
+ *                                         used by max_pooling_back_prop_indices. Can be NULL if there is no backpropagation
+ *                                         dimensions: ((input_i-sub_pool_i)/stride + 1 + 2*padding)*((input_j-sub_pool_j)/stride + 1 + 2*padding)
  *             @ int input_i:= the rows of the feature map input
  *             @ int input_j:= the number of columns of the feature map output
  *             @ int sub_pool_i:= the number of rows used for each pooling iteration
@@ -95,33 +336,39 @@ void convolutional_back_prop(float* input, float* kernel, int input_i, int input
  *             @ int stride:= the stride used to pool
  *             @ int padding:= the optional padding added to the output
  * */
-void max_pooling_feed_forward(float* input, float* output, int input_i, int input_j, int sub_pool_i, int sub_pool_j, int stride, int padding){
-    int i,j,k1,k2;
+void max_pooling_feed_forward_indices(float* input, float* output, unsigned short* indices, int input_i, int input_j, int sub_pool_i, int sub_pool_j, int stride, int padding){
+    int i,j,k1,k2,index;
     int output_i = (input_i-sub_pool_i)/stride + 1 + 2*padding;
     int output_j = (input_j-sub_pool_j)/stride + 1 + 2*padding;
-    float max = -9999;
+    float max,value;
+    float* window;
     
     for(i = 0; i < output_i - 2*padding; i++){
         for(j = 0; j < output_j - 2*padding; j++){
+            window = &input[input_j*i*stride + j*stride];
+            max = window[0];
+            index = 0;
             for(k1 = 0; k1 < sub_pool_i; k1++){
-                for(k2 = 0; k2 < sub_pool_j; k2++){                   
-                    if(input[input_j*(i*stride+k1) + j*stride + k2] > max)
-                        max = input[input_j*(i*stride+k1) + j*stride + k2];
+                for(k2 = 0; k2 < sub_pool_j; k2++){
+                    /* written without branches, the max of random data is unpredictable*/
+                    value = window[input_j*k1 + k2];
+                    index = value > max ? k1*sub_pool_j + k2 : index;
+                    max = value > max ? value : max;
                 }
             }
             output[(padding+i)*output_j+padding+j] = max;
-            max = -99999;        
+            if(indices != NULL)
+                indices[(padding+i)*output_j+padding+j] = index;
         }
     }
-    
-     
 }
 
-/* This function computed the error for a max-pool layer
+/* This function computed the error for a max-pool layer: the error of each output
+ * goes to the max of its pooling window, recorded by max_pooling_feed_forward_indices
  * 
  * Input:
- *             @ float* input:= a feature map to which the pooling is applied
- *                              dimensions: input_i*input_j
+ *             @ unsigned short* indices:= the positions of the max computed by max_pooling_feed_forward_indices
+ *                                         dimensions: ((input_i-sub_pool_i)/stride + 1 + 2*padding)*((input_j-sub_pool_j)/stride + 1 + 2*padding)
  *             @ float* output_error:= the output_error used to compute the input error
  *                               dimensions: ((input_i-sub_pool_i)/stride + 1 + 2*padding)*((input_j-sub_pool_j)/stride + 1 + 2*padding)
  *             @ int input_i:= the rows of the feature map input
@@ -133,44 +380,67 @@ void max_pooling_feed_forward(float* input, float* output, int input_i, int inpu
  *             @ float input_error := the error computed using the output_error
  *                                    dimensions: input_i*input_j
  * */
-void max_pooling_back_prop(float* input, float* output_error, int input_i, int input_j, int sub_pool_i, int sub_pool_j, int stride, int padding, float* input_error){
-    int i,j,k1,k2, index1, index2;
+void max_pooling_back_prop_indices(unsigned short* indices, float* output_error, int input_i, int input_j, int sub_pool_i, int sub_pool_j, int stride, int padding, float* input_error){
+    int i,j,index;
     int output_i = (input_i-sub_pool_i)/stride + 1 + 2*padding;
     int output_j = (input_j-sub_pool_j)/stride + 1 + 2*padding;
-    float max = -9999;
     
+    memset(input_error,0,sizeof(float)*input_i*input_j);
     for(i = 0; i < output_i - 2*padding; i++){
         for(j = 0; j < output_j - 2*padding; j++){
-            for(k1 = 0; k1 < sub_pool_i; k1++){
-                for(k2 = 0; k2 < sub_pool_j; k2++){
-                    
-                    if(input[input_j*(i*stride+k1) + j*stride + k2] > max){
-                        max = input[input_j*(i*stride+k1) + j*stride + k2];
-                        index1 = k1;
-                        index2 = k2;
-                        
-                    }
-                
-                }
-            }
-            
-            for(k1 = 0; k1 < sub_pool_i; k1++){
-                for(k2 = 0; k2 < sub_pool_j; k2++){
-                    
-                    if(index1 == k1 && index2 == k2)
-                        input_error[input_j*(i*stride+k1) + j*stride + k2] = output_error[(padding+i)*output_j+padding+j];
-                    
-                    else
-                        input_error[input_j*(i*stride+k1) + j*stride + k2] = 0;
-                        
-                
-                }
-            }
-            max = -99999;        
+            index = indices[(padding+i)*output_j+padding+j];
+            input_error[input_j*(i*stride + index/sub_pool_j) + j*stride + index%sub_pool_j] += output_error[(padding+i)*output_j+padding+j];
         }
     } 
 }
 
+/* This function apply the 2D max-pooling to a covolutional layer without recording the positions of the max,
+ * it is max_pooling_feed_forward_indices with indices = NULL
+ * 
+ * Input:
+ *             @ float* input:= a feature map to which the pooling is applied
+ *                              dimensions: input_i*input_j
+ *             @ float* output:= the output computed after applying the pooling to the input
+ *                               dimensions: ((input_i-sub_pool_i)/stride + 1 + 2*padding)*((input_j-sub_pool_j)/stride + 1 + 2*padding)
+ *             @ int input_i:= the rows of the feature map input
+ *             @ int input_j:= the number of columns of the feature map output
+ *             @ int sub_pool_i:= the number of rows used for each pooling iteration
+ *             @ int sub_pool_j:= the number of columns used for each pooling iteration
+ *             @ int stride:= the stride used to pool
+ *             @ int padding:= the optional padding added to the output
+ * */
+void max_pooling_feed_forward(float* input, float* output, int input_i, int input_j, int sub_pool_i, int sub_pool_j, int stride, int padding){
+    max_pooling_feed_forward_indices(input,output,NULL,input_i,input_j,sub_pool_i,sub_pool_j,stride,padding);
+}
+
+/* This function computed the error for a max-pool layer from its input, the positions of the max
+ * are found again with max_pooling_feed_forward_indices, the model uses max_pooling_back_prop_indices
+ * with the positions recorded during the feed forward
+ * 
+ * Input:
+ *             @ float* input:= a feature map to which the pooling is applied
+ *                              dimensions: input_i*input_j
+ *             @ float* output_error:= the output_error used to compute the input error
+ *                               dimensions: ((input_i-sub_pool_i)/stride + 1 + 2*padding)*((input_j-sub_pool_j)/stride + 1 + 2*padding)
+ *             @ int input_i:= the rows of the feature map input
+ *             @ int input_j:= the number of columns of the feature map output
+ *             @ int sub_pool_i:= the number of rows used for each pooling iteration
+ *             @ int sub_pool_j:= the number of columns used for each pooling iteration
+ *             @ int stride:= the stride used to pool
+ *             @ int padding:= the optional padding added to the output
+ *             @ float input_error := the error computed using the output_error
+ *                                    dimensions: input_i*input_j
+ * */
+void max_pooling_back_prop(float* input, float* output_error, int input_i, int input_j, int sub_pool_i, int sub_pool_j, int stride, int padding, float* input_error){
+    int output_size = ((input_i-sub_pool_i)/stride + 1 + 2*padding)*((input_j-sub_pool_j)/stride + 1 + 2*padding);
+    float* output = (float*)malloc(sizeof(float)*output_size);
+    unsigned short* indices = (unsigned short*)malloc(sizeof(unsigned short)*output_size);
+    max_pooling_feed_forward_indices(input,output,indices,input_i,input_j,sub_pool_i,sub_pool_j,stride,padding);
+    max_pooling_back_prop_indices(indices,output_error,input_i,input_j,sub_pool_i,sub_pool_j,stride,padding,input_error);
+    free(output);
+    free(indices);
+}
+
 /* This function apply the 2D avarage-pooling to a covolutional layer
  * 
  * Input:
@@ -234,3 +504,478 @@ void avarage_pooling_back_prop(float* input_error, float* output_error, int inpu
         }
     }
 }
+
+/* Winograd F(2x2,3x3): each 2x2 tile of the output is computed from a 4x4 tile of the input as
+ * Y = A^T [(G g G^T) .* (B^T d B)] A, where g is a 3x3 channel of the kernel and d the 4x4 input tile.
+ * The element-wise products of all the channels and kernels are computed as 16 sgemm, one for each
+ * of the 16 positions of the transformed tiles. The functions below are the 1D transforms (and their
+ * transposes used by the backpropagation), the 2D transforms apply them on the columns and then on the rows*/
+
+/* d (4) -> B^T d (4)*/
+static void winograd_input_1d(float* d, int sd, float* v, int sv){
+    float d0 = d[0], d1 = d[sd], d2 = d[2*sd], d3 = d[3*sd];
+    v[0] = d0 - d2;
+    v[sv] = d1 + d2;
+    v[2*sv] = d2 - d1;
+    v[3*sv] = d1 - d3;
+}
+
+/* v (4) -> B v (4)*/
+static void winograd_input_1d_transposed(float* v, int sv, float* d, int sd){
+    float v0 = v[0], v1 = v[sv], v2 = v[2*sv], v3 = v[3*sv];
+    d[0] = v0;
+    d[sd] = v1 - v2 + v3;
+    d[2*sd] = v1 + v2 - v0;
+    d[3*sd] = -v3;
+}
+
+/* g (3) -> G g (4)*/
+static void winograd_kernel_1d(float* g, int sg, float* u, int su){
+    float g0 = g[0], g1 = g[sg], g2 = g[2*sg];
+    u[0] = g0;
+    u[su] = 0.5*(g0 + g1 + g2);
+    u[2*su] = 0.5*(g0 - g1 + g2);
+    u[3*su] = g2;
+}
+
+/* u (4) -> G^T u (3)*/
+static void winograd_kernel_1d_transposed(float* u, int su, float* g, int sg){
+    float u0 = u[0], u1 = u[su], u2 = u[2*su], u3 = u[3*su];
+    g[0] = u0 + 0.5*(u1 + u2);
+    g[sg] = 0.5*(u1 - u2);
+    g[2*sg] = 0.5*(u1 + u2) + u3;
+}
+
+/* m (4) -> A^T m (2)*/
+static void winograd_output_1d(float* m, int sm, float* y, int sy){
+    float m0 = m[0], m1 = m[sm], m2 = m[2*sm], m3 = m[3*sm];
+    y[0] = m0 + m1 + m2;
+    y[sy] = m1 - m2 - m3;
+}
+
+/* y (2) -> A y (4)*/
+static void winograd_output_1d_transposed(float* y, int sy, float* m, int sm){
+    float y0 = y[0], y1 = y[sy];
+    m[0] = y0;
+    m[sm] = y0 + y1;
+    m[2*sm] = y0 - y1;
+    m[3*sm] = -y1;
+}
+
+/* This function computes the winograd transform G g G^T of each 3x3 channel of the kernels
+ * 
+ * Input:
+ *             @ float* kernels:= the kernels of the layer stored one after the other
+ *                                dimensions: n_kernels*channels*3*3
+ *             @ int channels:= the channels of the kernels
+ *             @ int n_kernels:= the number of kernels
+ *             @ float* winograd_kernels:= the transformed kernels, for each of the 16 positions a n_kernels*channels matrix
+ *                                         dimensions: 16*n_kernels*channels
+ * */
+void winograd_kernels_transform(float* kernels, int channels, int n_kernels, float* winograd_kernels){
+    int k,c,i;
+    float t[12],u[16];
+    for(k = 0; k < n_kernels; k++){
+        for(c = 0; c < channels; c++){
+            float* g = &kernels[(k*channels+c)*9];
+            for(i = 0; i < 3; i++){
+                winograd_kernel_1d(&g[i],3,&t[i],3);
+            }
+            for(i = 0; i < 4; i++){
+                winograd_kernel_1d(&t[i*3],1,&u[i*4],1);
+            }
+            for(i = 0; i < WINOGRAD_TILE; i++){
+                winograd_kernels[(i*n_kernels+k)*channels+c] = u[i];
+            }
+        }
+    }
+}
+
+/* This function computes the winograd transform B^T d B of each 4x4 tile of the input,
+ * the tiles overlap by 2 and the values out of the input are 0.
+ * The rows of winograd_input are ld apart, so the tiles of more instances can be side by side*/
+ISA_INLINE void winograd_input_transform_kernel(float* input, int channels, int input_i, int input_j, float* winograd_input, int ld){
+    int c,ti,tj,i,j,y,x;
+    int tiles_i = (input_i-1)/2, tiles_j = (input_j-1)/2;
+    float d[16],t[16],v[16];
+    for(c = 0; c < channels; c++){
+        for(ti = 0; ti < tiles_i; ti++){
+            for(tj = 0; tj < tiles_j; tj++){
+                for(i = 0; i < 4; i++){
+                    y = 2*ti+i;
+                    for(j = 0; j < 4; j++){
+                        x = 2*tj+j;
+                        d[i*4+j] = (y < input_i && x < input_j) ? input[(c*input_i+y)*input_j+x] : 0;
+                    }
+                }
+                for(i = 0; i < 4; i++){
+                    winograd_input_1d(&d[i],4,&t[i],4);
+                }
+                for(i = 0; i < 4; i++){
+                    winograd_input_1d(&t[i*4],1,&v[i*4],1);
+                }
+                for(i = 0; i < WINOGRAD_TILE; i++){
+                    winograd_input[(i*channels+c)*ld + ti*tiles_j+tj] = v[i];
+                }
+            }
+        }
+    }
+}
+
+ISA_DISPATCH(static, winograd_input_transform, (float* input, int channels, int input_i, int input_j, float* winograd_input, int ld), (input,channels,input_i,input_j,winograd_input,ld))
+
+/* This function computes the inverse winograd transform A^T m A of each tile of the sgemm outputs (rows ld apart)
+ * and sums the 2x2 outputs plus the biases to the feature maps (with their padding)*/
+ISA_INLINE void winograd_output_transform_kernel(float* winograd_output, float* biases, int input_i, int input_j, int n_kernels, int padding, float* output, int ld){
+    int k,ti,tj,i,j,y,x;
+    int output_i = input_i-2, output_j = input_j-2;
+    int tiles_i = (input_i-1)/2, tiles_j = (input_j-1)/2;
+    int padded_j = output_j+2*padding;
+    float m[16],t[8],out[4];
+    for(k = 0; k < n_kernels; k++){
+        float* dst = &output[k*(output_i+2*padding)*padded_j];
+        for(ti = 0; ti < tiles_i; ti++){
+            for(tj = 0; tj < tiles_j; tj++){
+                for(i = 0; i < WINOGRAD_TILE; i++){
+                    m[i] = winograd_output[(i*n_kernels+k)*ld + ti*tiles_j+tj];
+                }
+                for(i = 0; i < 4; i++){
+                    winograd_output_1d(&m[i],4,&t[i],4);
+                }
+                for(i = 0; i < 2; i++){
+                    winograd_output_1d(&t[i*4],1,&out[i*2],1);
+                }
+                for(i = 0; i < 2; i++){
+                    y = 2*ti+i;
+                    for(j = 0; j < 2; j++){
+                        x = 2*tj+j;
+                        if(y < output_i && x < output_j)
+                            dst[(y+padding)*padded_j + x+padding] += out[i*2+j] + biases[k];
+                    }
+                }
+            }
+        }
+    }
+}
+
+ISA_DISPATCH(static, winograd_output_transform, (float* winograd_output, float* biases, int input_i, int input_j, int n_kernels, int padding, float* output, int ld), (winograd_output,biases,input_i,input_j,n_kernels,padding,output,ld))
+
+/* This function computes the transposed output transform A e A^T of the 2x2 tiles of the error of the feature maps
+ * (the biases errors are summed too), the transformed errors are the inputs of the sgemm of the backpropagation (rows ld apart)*/
+ISA_INLINE void winograd_output_error_transform_kernel(float* output_error, int input_i, int input_j, int n_kernels, int padding, float* biases_error, float* winograd_output, int ld){
+    int k,ti,tj,i,j,y,x;
+    int output_i = input_i-2, output_j = input_j-2;
+    int tiles_i = (input_i-1)/2, tiles_j = (input_j-1)/2;
+    int padded_j = output_j+2*padding;
+    float e[4],t[16],m[16];
+    for(k = 0; k < n_kernels; k++){
+        float* src = &output_error[k*(output_i+2*padding)*padded_j];
+        for(y = 0; y < output_i; y++){
+            for(x = 0; x < output_j; x++){
+                biases_error[k] += src[(y+padding)*padded_j + x+padding];
+            }
+        }
+        for(ti = 0; ti < tiles_i; ti++){
+            for(tj = 0; tj < tiles_j; tj++){
+                for(i = 0; i < 2; i++){
+                    y = 2*ti+i;
+                    for(j = 0; j < 2; j++){
+                        x = 2*tj+j;
+                        e[i*2+j] = (y < output_i && x < output_j) ? src[(y+padding)*padded_j + x+padding] : 0;
+                    }
+                }
+                for(i = 0; i < 2; i++){
+                    winograd_output_1d_transposed(&e[i],2,&t[i],4);
+                }
+                for(i = 0; i < 4; i++){
+                    winograd_output_1d_transposed(&t[i*4],1,&m[i*4],1);
+                }
+                for(i = 0; i < WINOGRAD_TILE; i++){
+                    winograd_output[(i*n_kernels+k)*ld + ti*tiles_j+tj] = m[i];
+                }
+            }
+        }
+    }
+}
+
+ISA_DISPATCH(static, winograd_output_error_transform, (float* output_error, int input_i, int input_j, int n_kernels, int padding, float* biases_error, float* winograd_output, int ld), (output_error,input_i,input_j,n_kernels,padding,biases_error,winograd_output,ld))
+
+/* This function computes the transposed input transform B v B^T of the errors of the transformed tiles (rows ld apart)
+ * and sums them to the error of the input (the tiles overlap by 2, the values out of the input are dropped)*/
+ISA_INLINE void winograd_input_error_transform_kernel(float* winograd_input, int channels, int input_i, int input_j, float* input_error, int ld){
+    int c,ti,tj,i,j,y,x;
+    int tiles_i = (input_i-1)/2, tiles_j = (input_j-1)/2;
+    float t[16],m[16];
+    for(c = 0; c < channels; c++){
+        for(ti = 0; ti < tiles_i; ti++){
+            for(tj = 0; tj < tiles_j; tj++){
+                for(i = 0; i < WINOGRAD_TILE; i++){
+                    m[i] = winograd_input[(i*channels+c)*ld + ti*tiles_j+tj];
+                }
+                for(i = 0; i < 4; i++){
+                    winograd_input_1d_transposed(&m[i],4,&t[i],4);
+                }
+                for(i = 0; i < 4; i++){
+                    winograd_input_1d_transposed(&t[i*4],1,&m[i*4],1);
+                }
+                for(i = 0; i < 4; i++){
+                    y = 2*ti+i;
+                    for(j = 0; j < 4; j++){
+                        x = 2*tj+j;
+                        if(y < input_i && x < input_j)
+                            input_error[(c*input_i+y)*input_j+x] += m[i*4+j];
+                    }
+                }
+            }
+        }
+    }
+}
+
+ISA_DISPATCH(static, winograd_input_error_transform, (float* winograd_input, int channels, int input_i, int input_j, float* input_error, int ld), (winograd_input,channels,input_i,input_j,input_error,ld))
+
+/* This function computes the feed forward of all the kernels of a 3x3 stride 1 convolutional layer
+ * with the winograd F(2x2,3x3) algorithm for batch_size instances, the tiles of all the instances
+ * are side by side in the 16 sgemm
+ * 
+ * Input:
+ *             @ float* input:= batch_size tensors of input of 3 dimensions: channels, rows and cols stored one after the other
+ *                              dimensions: batch_size*channels*input_i*input_j
+ *             @ float* winograd_kernels:= the kernels transformed by winograd_kernels_transform
+ *                                         dimensions: 16*n_kernels*channels
+ *             @ int input_i := the number of rows of each feature map of the previous layer (input)
+ *             @ int input_j:= the number of columns of each feature map of the previous layer (input)
+ *             @ float* biases:= the biases of the feature maps
+ *                               dimensions: n_kernels
+ *             @ int channels:= the depth of the input and the kernel
+ *             @ int n_kernels:= the number of kernels
+ *             @ float* output:= the feature maps computed for the instances one after the other
+ *                               dimensions: batch_size*n_kernels*(input_i-2+2*padding)*(input_j-2+2*padding)
+ *             @ int padding:= the optional padding added to the output
+ *             @ float* winograd_input:= the buffer for the transformed inputs
+ *                                       dimensions: 16*channels*batch_size*((input_i-1)/2)*((input_j-1)/2)
+ *             @ float* winograd_output:= the buffer for the transformed outputs
+ *                                        dimensions: 16*n_kernels*batch_size*((input_i-1)/2)*((input_j-1)/2)
+ *             @ int batch_size:= the number of instances
+ * */
+void convolutional_feed_forward_winograd(float* input, float* winograd_kernels, int input_i, int input_j, float* biases, int channels, int n_kernels, float* output, int padding, float* winograd_input, float* winograd_output, int batch_size){
+    int i,b;
+    int tiles_i = (input_i-1)/2, tiles_j = (input_j-1)/2;
+    int n_tiles = tiles_i*tiles_j;
+    int n_columns = n_tiles*batch_size;
+    int input_size = channels*input_i*input_j;
+    int output_size = n_kernels*(input_i-2+2*padding)*(input_j-2+2*padding);
+    
+    for(b = 0; b < batch_size; b++){
+        winograd_input_transform(&input[b*input_size],channels,input_i,input_j,&winograd_input[b*n_tiles],n_columns);
+    }
+    memset(winograd_output,0,sizeof(float)*WINOGRAD_TILE*n_kernels*n_columns);
+    for(i = 0; i < WINOGRAD_TILE; i++){
+        sgemm(NO_TRANSPOSE,NO_TRANSPOSE,n_kernels,n_columns,channels,&winograd_kernels[i*n_kernels*channels],channels,&winograd_input[i*channels*n_columns],n_columns,&winograd_output[i*n_kernels*n_columns],n_columns,NULL);
+    }
+    for(b = 0; b < batch_size; b++){
+        winograd_output_transform(&winograd_output[b*n_tiles],biases,input_i,input_j,n_kernels,padding,&output[b*output_size],n_columns);
+    }
+}
+
+/* This function computes the errors using the backpropagation for all the kernels of a 3x3 stride 1
+ * convolutional layer with the winograd F(2x2,3x3) algorithm for batch_size instances: the error of the output tiles
+ * is transformed with the transposed output transform, then the errors of the transformed kernels and of the transformed
+ * inputs are computed with 2 sgemm for each position over the tiles of all the instances side by side
+ * and they are brought back with the transposed transforms
+ * 
+ * Input:
+ *             @ float* input:= batch_size tensors of input of 3 dimensions: channels, rows and cols stored one after the other
+ *                              dimensions: batch_size*channels*input_i*input_j
+ *             @ float* winograd_kernels:= the kernels transformed by winograd_kernels_transform
+ *                                         dimensions: 16*n_kernels*channels
+ *             @ int input_i := the number of rows of each feature map of the previous layer (input)
+ *             @ int input_j:= the number of columns of each feature map of the previous layer (input)
+ *             @ int channels:= the depth of the input and the kernel
+ *             @ int n_kernels:= the number of kernels
+ *             @ float* output_error:= the errors of the feature maps of the instances one after the other
+ *                                     dimensions: batch_size*n_kernels*(input_i-2+2*padding)*(input_j-2+2*padding)
+ *             @ float* input_error:= the errors of the inputs that must be filled, one after the other
+ *                                    dimensions: batch_size*channels*input_i*input_j
+ *             @ float* kernels_error:= the error of the kernels that must be filled, stored one after the other
+ *                                      dimensions: n_kernels*channels*3*3
+ *             @ float* biases_error:= the error of the biases that must be filled
+ *                                     dimensions: n_kernels
+ *             @ int padding:= the optional padding added to the output
+ *             @ float* winograd_input:= the buffer for the transformed inputs
+ *                                       dimensions: 16*channels*batch_size*((input_i-1)/2)*((input_j-1)/2)
+ *             @ float* winograd_output:= the buffer for the transformed outputs
+ *                                        dimensions: 16*n_kernels*batch_size*((input_i-1)/2)*((input_j-1)/2)
+ *             @ float* winograd_kernels_error:= the buffer for the error of the transformed kernels
+ *                                               dimensions: 16*n_kernels*channels
+ *             @ int batch_size:= the number of instances
+ * */
+void convolutional_back_prop_winograd(float* input, float* winograd_kernels, int input_i, int input_j, int channels, int n_kernels, float* output_error, float* input_error, float* kernels_error, float* biases_error, int padding, float* winograd_input, float* winograd_output, float* winograd_kernels_error, int batch_size){
+    int k,c,i,b;
+    int tiles_i = (input_i-1)/2, tiles_j = (input_j-1)/2;
+    int n_tiles = tiles_i*tiles_j;
+    int n_columns = n_tiles*batch_size;
+    int input_size = channels*input_i*input_j;
+    int output_size = n_kernels*(input_i-2+2*padding)*(input_j-2+2*padding);
+    float t[16],m[16],g[9];
+    
+    for(b = 0; b < batch_size; b++){
+        winograd_output_error_transform(&output_error[b*output_size],input_i,input_j,n_kernels,padding,biases_error,&winograd_output[b*n_tiles],n_columns);
+        winograd_input_transform(&input[b*input_size],channels,input_i,input_j,&winograd_input[b*n_tiles],n_columns);
+    }
+    memset(winograd_kernels_error,0,sizeof(float)*WINOGRAD_TILE*n_kernels*channels);
+    for(i = 0; i < WINOGRAD_TILE; i++){
+        sgemm(NO_TRANSPOSE,TRANSPOSE,n_kernels,channels,n_columns,&winograd_output[i*n_kernels*n_columns],n_columns,&winograd_input[i*channels*n_columns],n_columns,&winograd_kernels_error[i*n_kernels*channels],channels,NULL);
+    }
+    
+    /* the transformed inputs are no more needed, their buffer is used for the errors of the transformed inputs*/
+    memset(winograd_input,0,sizeof(float)*WINOGRAD_TILE*channels*n_columns);
+    for(i = 0; i < WINOGRAD_TILE; i++){
+        sgemm(TRANSPOSE,NO_TRANSPOSE,channels,n_columns,n_kernels,&winograd_kernels[i*n_kernels*channels],channels,&winograd_output[i*n_kernels*n_columns],n_columns,&winograd_input[i*channels*n_columns],n_columns,NULL);
+    }
+    
+    for(k = 0; k < n_kernels; k++){
+        for(c = 0; c < channels; c++){
+            for(i = 0; i < WINOGRAD_TILE; i++){
+                m[i] = winograd_kernels_error[(i*n_kernels+k)*channels+c];
+            }
+            for(i = 0; i < 4; i++){
+                winograd_kernel_1d_transposed(&m[i],4,&t[i],4);
+            }
+            for(i = 0; i < 3; i++){
+                winograd_kernel_1d_transposed(&t[i*4],1,&g[i*3],1);
+            }
+            for(i = 0; i < 9; i++){
+                kernels_error[(k*channels+c)*9+i] += g[i];
+            }
+        }
+    }
+    
+    for(b = 0; b < batch_size; b++){
+        winograd_input_error_transform(&winograd_input[b*n_tiles],channels,input_i,input_j,&input_error[b*input_size],n_columns);
+    }
+}
+
+/* the arguments of the direct convolution split by parallel_for, each thread computes different feature maps*/
+typedef struct convolutional_job {
+    cl* c;
+    float* input;
+    float* output;
+} convolutional_job;
+
+/* This function computes the feature maps start <= i < end of the direct convolution of a convolutional layer*/
+static void convolutional_layer_feed_forward_kernels(void* data, int start, int end){
+    convolutional_job* job = (convolutional_job*)data;
+    cl* c = job->c;
+    int i;
+    for(i = start; i < end; i++){
+        convolutional_feed_forward(job->input, c->kernels[i], c->input_rows, c->input_cols, c->kernel_rows, c->kernel_cols, c->biases[i], c->channels, &job->output[i*c->rows1*c->cols1], c->stride1_rows, c->padding1_rows);
+    }
+}
+
+/* This function checks that the im2col or winograd buffers of a convolutional layer can hold batch_size instances*/
+static void convolutional_layer_batch_check(cl* c, int batch_size){
+    if(c->algorithm_flag != DIRECT_CONVOLUTION && batch_size > c->batch_size){
+        fprintf(stderr,"Error: the buffers of the convolutional layer %d hold %d instances, %d instances have been passed (see set_convolutional_batch_size)\n",c->layer,c->batch_size,batch_size);
+        exit(1);
+    }
+}
+
+/* This function computes the feed forward of all the kernels of a convolutional layer
+ * with the algorithm chosen for the layer (c->algorithm_flag),
+ * the feature maps are added to c->pre_activation
+ * 
+ * Input:
+ *             @ cl* c:= the convolutional layer
+ *             @ float* input:= the input of the layer
+ *                              dimensions: c->channels*c->input_rows*c->input_cols
+ * */
+void convolutional_layer_feed_forward(cl* c, float* input){
+    convolutional_layer_feed_forward_batch(c,input,1);
+}
+
+/* This function computes the feed forward of all the kernels of a convolutional layer for batch_size instances
+ * with the algorithm chosen for the layer (c->algorithm_flag): im2col and winograd compute all the instances
+ * with the same sgemm, the direct convolution computes them one after the other.
+ * The feature maps of the instances are added to c->pre_activation one after the other
+ * 
+ * Input:
+ *             @ cl* c:= the convolutional layer, its buffers must hold batch_size instances (see set_convolutional_batch_size)
+ *             @ float* input:= the inputs of the instances one after the other
+ *                              dimensions: batch_size*c->channels*c->input_rows*c->input_cols
+ *             @ int batch_size:= the number of instances
+ * */
+void convolutional_layer_feed_forward_batch(cl* c, float* input, int batch_size){
+    int b;
+    convolutional_layer_batch_check(c,batch_size);
+    if(c->algorithm_flag == WINOGRAD_CONVOLUTION){
+        if(!c->winograd_kernels_flag){
+            winograd_kernels_transform(c->kernels[0], c->channels, c->n_kernels, c->winograd_kernels);
+            c->winograd_kernels_flag = 1;
+        }
+        convolutional_feed_forward_winograd(input, c->winograd_kernels, c->input_rows, c->input_cols, c->biases, c->channels, c->n_kernels, c->pre_activation, c->padding1_rows, c->col, c->col_temp, batch_size);
+        return;
+    }
+    
+    if(c->algorithm_flag == IM2COL_CONVOLUTION){
+        convolutional_feed_forward_im2col(input, c->kernels[0], c->input_rows, c->input_cols, c->kernel_rows, c->kernel_cols, c->biases, c->channels, c->n_kernels, c->pre_activation, c->stride1_rows, c->padding1_rows, c->col, c->col_temp, batch_size);
+        return;
+    }
+    
+    for(b = 0; b < batch_size; b++){
+        convolutional_job job = {c,&input[b*c->channels*c->input_rows*c->input_cols],&c->pre_activation[b*c->n_kernels*c->rows1*c->cols1]};
+        parallel_for(c->n_kernels,1+PARALLEL_GRAIN/(c->channels*c->kernel_rows*c->kernel_cols*c->rows1*c->cols1+1),convolutional_layer_feed_forward_kernels,&job);
+    }
+}
+
+/* This function computes the backpropagation of all the kernels of a convolutional layer
+ * with the algorithm chosen for the layer (c->algorithm_flag), the errors are added to
+ * c->error2, c->d_kernels and c->d_biases
+ * 
+ * Input:
+ *             @ cl* c:= the convolutional layer
+ *             @ float* input:= the input of the layer used during the feed forward
+ *                              dimensions: c->channels*c->input_rows*c->input_cols
+ *             @ float* output_error:= the error of the pre activation of the layer
+ *                                     dimensions: c->n_kernels*c->rows1*c->cols1
+ * */
+void convolutional_layer_back_prop(cl* c, float* input, float* output_error){
+    convolutional_layer_back_prop_batch(c,input,output_error,1);
+}
+
+/* This function computes the backpropagation of all the kernels of a convolutional layer for batch_size instances
+ * with the algorithm chosen for the layer (c->algorithm_flag): im2col and winograd compute the errors of the kernels
+ * of all the instances with the same sgemm, the direct convolution computes the instances one after the other.
+ * The errors of the inputs are added to c->error2 one after the other, the errors of the kernels and biases
+ * of all the instances are added to c->d_kernels and c->d_biases
+ * 
+ * Input:
+ *             @ cl* c:= the convolutional layer, its buffers must hold batch_size instances (see set_convolutional_batch_size)
+ *             @ float* input:= the inputs of the instances used during the feed forward, one after the other
+ *                              dimensions: batch_size*c->channels*c->input_rows*c->input_cols
+ *             @ float* output_error:= the errors of the pre activation of the instances one after the other
+ *                                     dimensions: batch_size*c->n_kernels*c->rows1*c->cols1
+ *             @ int batch_size:= the number of instances
+ * */
+void convolutional_layer_back_prop_batch(cl* c, float* input, float* output_error, int batch_size){
+    int i,b,input_size = c->channels*c->input_rows*c->input_cols, output_size = c->n_kernels*c->rows1*c->cols1;
+    convolutional_layer_batch_check(c,batch_size);
+    if(c->algorithm_flag == WINOGRAD_CONVOLUTION){
+        if(!c->winograd_kernels_flag){
+            winograd_kernels_transform(c->kernels[0], c->channels, c->n_kernels, c->winograd_kernels);
+            c->winograd_kernels_flag = 1;
+        }
+        convolutional_back_prop_winograd(input, c->winograd_kernels, c->input_rows, c->input_cols, c->channels, c->n_kernels, output_error, c->error2, c->d_kernels[0], c->d_biases, c->padding1_rows, c->col, c->col_temp, c->winograd_d_kernels, batch_size);
+        return;
+    }
+    
+    if(c->algorithm_flag == IM2COL_CONVOLUTION){
+        convolutional_back_prop_im2col(input, c->kernels[0], c->input_rows, c->input_cols, c->kernel_rows, c->kernel_cols, c->channels, c->n_kernels, output_error, c->error2, c->d_kernels[0], c->d_biases, c->stride1_rows, c->padding1_rows, c->col, c->col_temp, batch_size);
+        return;
+    }
+    
+    for(b = 0; b < batch_size; b++){
+        for(i = 0; i < c->n_kernels; i++){
+            convolutional_back_prop(&input[b*input_size], c->kernels[i], c->input_rows, c->input_cols, c->kernel_rows, c->kernel_cols, c->biases[i], c->channels, &output_error[b*output_size + i*c->rows1*c->cols1], &c->error2[b*input_size], c->d_kernels[i], &c->d_biases[i], c->stride1_rows, c->padding1_rows);
+        }
+    }
+}
@@ -1,5 +1,34 @@
 #include "llab.h"
 
+/* the arguments of the kernels split by parallel_for, each thread computes different rows (or blocks) of the output*/
+typedef struct fully_connected_job {
+    float* input;
+    float* output;// the output, or the output error for the back propagation
+    float* weight;// the weights, or the weight error for the outer product
+    float* bias;
+    float* input_error;
+    float* weight_error;
+    int input_size, output_size;
+} fully_connected_job;
+
+/* This function computes the rows start <= j < end of the output of fully_connected_feed_forward*/
+ISA_INLINE void fully_connected_feed_forward_rows_kernel(void* data, int start, int end){
+    fully_connected_job* job = (fully_connected_job*)data;
+    float* input = job->input;
+    float* output = job->output;
+    float* weight = job->weight;
+    float* bias = job->bias;
+    int i,j,input_size = job->input_size;
+    for(j = start; j < end; j++){
+        for(i = 0; i < input_size; i++){
+            output[j] += input[i]*weight[j*input_size+i];
+        }
+        output[j] += bias[j];
+    }
+}
+
+ISA_DISPATCH(static, fully_connected_feed_forward_rows, (void* data, int start, int end), (data,start,end))
+
 /* This function computes the output of the current layer using the previous layer output
  * and the weights that connect the two layers and the biases of the output layer
  * 
@@ -16,17 +45,84 @@
  *         @ int output_size:= the size of the float* output vector
  * */
 void fully_connected_feed_forward(float* input, float* output, float* weight,float* bias, int input_size, int output_size){
-    int i,j;
-    for(j = 0; j < output_size; j++){
-        for(i = 0; i < input_size; i++){
-            output[j] += input[i]*weight[j*input_size+i];
+    fully_connected_job job = {input,output,weight,bias,NULL,NULL,input_size,output_size};
+    parallel_for(output_size,1+PARALLEL_GRAIN/(input_size+1),fully_connected_feed_forward_rows,&job);
+}
+
+/* This function adds the input error and the weight error of 4 rows of the weights on the elements i0 <= i < i1:
+ * each element of the input and of the input error is loaded once for the 4 rows.
+ * The rows are restrict arguments, so the loop is vectorized without aliasing checks*/
+ISA_INLINE void fully_connected_back_prop_4_rows(float* restrict input, float* restrict input_error, float* restrict output_error,
+                                                 float* restrict w0, float* restrict w1, float* restrict w2, float* restrict w3,
+                                                 float* restrict dw0, float* restrict dw1, float* restrict dw2, float* restrict dw3, int i0, int i1){
+    int i;
+    float x,e0 = output_error[0],e1 = output_error[1],e2 = output_error[2],e3 = output_error[3];
+    for(i = i0; i < i1; i++){
+        x = input[i];
+        input_error[i] += e0*w0[i] + e1*w1[i] + e2*w2[i] + e3*w3[i];
+        dw0[i] += e0*x;
+        dw1[i] += e1*x;
+        dw2[i] += e2*x;
+        dw3[i] += e3*x;
+    }
+}
+
+/* This function adds the input error and the weight error of 1 row of the weights on the elements i0 <= i < i1,
+ * it is the loop of the first versions of the library*/
+ISA_INLINE void fully_connected_back_prop_row(float* restrict input, float* restrict input_error, float e, float* restrict w, float* restrict dw, int i0, int i1){
+    int i;
+    for(i = i0; i < i1; i++){
+        input_error[i] += e*w[i];
+        dw[i] += e*input[i];
+    }
+}
+
+/* This function computes the input error and the weight error of the columns 64*start <= i < 64*end
+ * of fully_connected_back_prop, in blocks of FULLY_CONNECTED_BLOCK columns (the input and the input error stay in L1).
+ * When the weights and their errors fit in L2 the rows are processed 4 at time, otherwise the back propagation is
+ * limited by the memory bandwidth and they are streamed 1 at time, as the first versions of the library did.
+ * The rows with a 0 error are skipped*/
+ISA_INLINE void fully_connected_back_prop_blocks_kernel(void* data, int start, int end){
+    fully_connected_job* job = (fully_connected_job*)data;
+    float* input = job->input;
+    float* output_error = job->output;
+    float* weight = job->weight;
+    float* input_error = job->input_error;
+    float* weight_error = job->weight_error;
+    int input_size = job->input_size, output_size = job->output_size;
+    int j,i0,i1,last = end*64 < input_size ? end*64 : input_size;
+    int rows = 2*(long long int)input_size*output_size > FULLY_CONNECTED_L2_SIZE ? 1 : 4;
+    float* w;
+    float* dw;
+    for(i0 = start*64; i0 < last; i0+=FULLY_CONNECTED_BLOCK){
+        i1 = last-i0 < FULLY_CONNECTED_BLOCK ? last : i0+FULLY_CONNECTED_BLOCK;
+        j = 0;
+        if(rows == 4){
+            for(; j+4 <= output_size; j+=4){
+                if(output_error[j] == 0 && output_error[j+1] == 0 && output_error[j+2] == 0 && output_error[j+3] == 0)
+                    continue;
+                w = &weight[j*input_size];
+                dw = &weight_error[j*input_size];
+                fully_connected_back_prop_4_rows(input,input_error,&output_error[j],w,w+input_size,w+2*input_size,w+3*input_size,
+                                                 dw,dw+input_size,dw+2*input_size,dw+3*input_size,i0,i1);
+            }
+        }
+        for(; j < output_size; j++){
+            if(output_error[j] == 0)
+                continue;
+            fully_connected_back_prop_row(input,input_error,output_error[j],&weight[j*input_size],&weight_error[j*input_size],i0,i1);
         }
-        output[j] += bias[j];
     }
 }
 
+ISA_DISPATCH(static, fully_connected_back_prop_blocks, (void* data, int start, int end), (data,start,end))
+
 /* This function computes the error of the previous layer and the error of the weights and biases
- * using the current output layer error and the weights that connect the two layers
+ * using the current output layer error and the weights that connect the two layers.
+ * The input error (weight^T*output_error) and the weight error (output_error x input) are computed
+ * in a single pass over the weights, split by columns: each thread owns the same columns of the input error
+ * and of the weight error. fully_connected_transposed_gemv and fully_connected_outer_product compute
+ * only one of the 2 errors
  * 
  * Input:
  *         @ float* input:= a vector of inputs of the previous layer
@@ -45,15 +141,169 @@ void fully_connected_feed_forward(float* input, float* output, float* weight,flo
  *         @ int output_size:= the size of the float* output_error vector
  * */
 void fully_connected_back_prop(float* input, float* output_error, float* weight,float* input_error, float* weight_error,float* bias_error, int input_size, int output_size){
-    int i,j;
+    int j;
+    fully_connected_job job = {input,output_error,weight,NULL,input_error,weight_error,input_size,output_size};
+    parallel_for((input_size+63)/64,1+PARALLEL_GRAIN/(128*output_size+1),fully_connected_back_prop_blocks,&job);
     for(j = 0; j < output_size; j++){
+        bias_error[j] += output_error[j];
+    }
+}
+
+/* This function computes the elements 64*start <= i < 64*end of the input error of fully_connected_transposed_gemv*/
+ISA_INLINE void fully_connected_transposed_gemv_blocks_kernel(void* data, int start, int end){
+    fully_connected_job* job = (fully_connected_job*)data;
+    float* restrict weight = job->weight;
+    float* restrict output_error = job->output;
+    float* restrict input_error = job->input_error;
+    int input_size = job->input_size, output_size = job->output_size;
+    int i,j,i0,i1,last = end*64 < input_size ? end*64 : input_size;
+    float e0,e1,e2,e3;
+    float* w0;
+    float* w1;
+    float* w2;
+    float* w3;
+    for(i0 = start*64; i0 < last; i0+=FULLY_CONNECTED_BLOCK){
+        i1 = last-i0 < FULLY_CONNECTED_BLOCK ? last : i0+FULLY_CONNECTED_BLOCK;
+        for(j = 0; j+4 <= output_size; j+=4){
+            e0 = output_error[j];
+            e1 = output_error[j+1];
+            e2 = output_error[j+2];
+            e3 = output_error[j+3];
+            if(e0 == 0 && e1 == 0 && e2 == 0 && e3 == 0)
+                continue;
+            w0 = &weight[j*input_size];
+            w1 = w0+input_size;
+            w2 = w1+input_size;
+            w3 = w2+input_size;
+            for(i = i0; i < i1; i++){
+                input_error[i] += e0*w0[i] + e1*w1[i] + e2*w2[i] + e3*w3[i];
+            }
+        }
+        for(; j < output_size; j++){
+            e0 = output_error[j];
+            if(e0 == 0)
+                continue;
+            w0 = &weight[j*input_size];
+            for(i = i0; i < i1; i++){
+                input_error[i] += e0*w0[i];
+            }
+        }
+    }
+}
+
+ISA_DISPATCH(static, fully_connected_transposed_gemv_blocks, (void* data, int start, int end), (data,start,end))
+
+/* This function computes input_error += weight^T*output_error.
+ * The input error is computed in blocks of FULLY_CONNECTED_BLOCK elements (that stay in L1)
+ * and each block is updated with 4 rows of the weights at time, the rows with a 0 error
+ * (for example the neurons switched off by the relu) are skipped
+ * 
+ * Input:
+ *         @ float* weight:= a vector of weight which connects the current layer with the prvious one
+ *                           dimensions: output_size*input_size
+ *         @ float* output_error:= a vector of the errors of the current layer
+ *                                 dimensions: output_size
+ *         @ float* input_error:= a vector of error of the previous layer that must be filled
+ *                                dimensions: input_size
+ *         @ int input_size:= the size of the float* input_error vector
+ *         @ int output_size:= the size of the float* output_error vector
+ * */
+void fully_connected_transposed_gemv(float* restrict weight, float* restrict output_error, float* restrict input_error, int input_size, int output_size){
+    fully_connected_job job = {NULL,output_error,weight,NULL,input_error,NULL,input_size,output_size};
+    parallel_for((input_size+63)/64,1+PARALLEL_GRAIN/(64*output_size+1),fully_connected_transposed_gemv_blocks,&job);
+}
+
+/* This function computes the rows start <= j < end of the weight error of fully_connected_outer_product*/
+ISA_INLINE void fully_connected_outer_product_rows_kernel(void* data, int start, int end){
+    fully_connected_job* job = (fully_connected_job*)data;
+    float* restrict output_error = job->output;
+    float* restrict input = job->input;
+    float* restrict weight_error = job->weight;
+    int input_size = job->input_size;
+    int i,j;
+    float e;
+    float* dw;
+    for(j = start; j < end; j++){
+        e = output_error[j];
+        if(e == 0)
+            continue;
+        dw = &weight_error[j*input_size];
         for(i = 0; i < input_size; i++){
-            weight_error[j*input_size+i] += output_error[j]*input[i];
-            input_error[i] += output_error[j]*weight[j*input_size+i];
+            dw[i] += e*input[i];
         }
-        bias_error[j] += output_error[j];
     }
 }
 
+ISA_DISPATCH(static, fully_connected_outer_product_rows, (void* data, int start, int end), (data,start,end))
 
+/* This function computes weight_error += output_error x input (the outer product of the 2 vectors).
+ * Each row of the weight error is streamed once, the rows with a 0 error are skipped
+ * 
+ * Input:
+ *         @ float* output_error:= a vector of the errors of the current layer
+ *                                 dimensions: output_size
+ *         @ float* input:= a vector of inputs of the previous layer
+ *                          dimensions: input_size
+ *         @ float* weight_error:= a vector of error of the of the weights of the two layers that must be filled
+ *                                 dimensions: output_size*input_size
+ *         @ int input_size:= the size of the float* input vector
+ *         @ int output_size:= the size of the float* output_error vector
+ * */
+void fully_connected_outer_product(float* restrict output_error, float* restrict input, float* restrict weight_error, int input_size, int output_size){
+    fully_connected_job job = {input,output_error,weight_error,NULL,NULL,NULL,input_size,output_size};
+    parallel_for(output_size,1+PARALLEL_GRAIN/(input_size+1),fully_connected_outer_product_rows,&job);
+}
+
+/* This function computes the output of the current layer for a whole mini-batch at once,
+ * the mini-batch is processed as a single blocked sgemm (output = input*weight^T + bias),
+ * in this way the weights are read from memory once per mini-batch and not once per instance
+ * 
+ * Input:
+ *         @ float* input:= the inputs of the previous layer, one instance after the other
+ *                          dimensions: batch_size*input_size
+ *         @ float* output:= the outputs of the current layer, one instance after the other, that must be filled
+ *                           dimensions: batch_size*output_size
+ *         @ float* weight:= a vector of weight which connects the current layer with the prvious one
+ *                           dimensions: output_size*input_size
+ *         @ float* bias:= a vector of bias of the current layer
+ *                         dimensions: output_size
+ *         @ int input_size:= the size of each input instance
+ *         @ int output_size:= the size of each output instance
+ *         @ int batch_size:= the number of instances
+ * */
+void fully_connected_feed_forward_batch(float* input, float* output, float* weight,float* bias, int input_size, int output_size, int batch_size){
+    sgemm(NO_TRANSPOSE,TRANSPOSE,batch_size,output_size,input_size,input,input_size,weight,input_size,output,output_size,bias);
+}
 
+/* This function computes the error of the previous layer and the error of the weights and biases
+ * for a whole mini-batch at once. The weight error is summed over the instances
+ * (weight_error += output_error^T*input) and the input error is computed for each instance
+ * (input_error += output_error*weight), both as a single blocked sgemm
+ * 
+ * Input:
+ *         @ float* input:= the inputs of the previous layer, one instance after the other
+ *                          dimensions: batch_size*input_size
+ *         @ float* output_error:= the errors of the current layer, one instance after the other
+ *                                 dimensions: batch_size*output_size
+ *         @ float* weight:= a vector of weight which connects the current layer with the prvious one
+ *                           dimensions: output_size*input_size
+ *         @ float* input_error:= the errors of the previous layer that must be filled, one instance after the other
+ *                                dimensions: batch_size*input_size
+ *         @ float* weight_error:= a vector of error of the of the weights of the two layers that must be filled
+ *                                 dimensions: output_size*input_size
+ *         @ float* bias_error:= a vector of error of the of the biases of the current layer that must be filled
+ *                               dimensions: output_size
+ *         @ int input_size:= the size of each input instance
+ *         @ int output_size:= the size of each output instance
+ *         @ int batch_size:= the number of instances
+ * */
+void fully_connected_back_prop_batch(float* input, float* output_error, float* weight,float* input_error, float* weight_error,float* bias_error, int input_size, int output_size, int batch_size){
+    int i,j;
+    sgemm(TRANSPOSE,NO_TRANSPOSE,output_size,input_size,batch_size,output_error,output_size,input,input_size,weight_error,input_size,NULL);
+    sgemm(NO_TRANSPOSE,NO_TRANSPOSE,batch_size,input_size,output_size,output_error,output_size,weight,input_size,input_error,input_size,NULL);
+    for(i = 0; i < batch_size; i++){
+        for(j = 0; j < output_size; j++){
+            bias_error[j] += output_error[i*output_size+j];
+        }
+    }
+}
@@ -37,3 +37,125 @@ void adam_algorithm(float* p,float* delta1, float* delta2, float dp, float lr, f
      (*delta2) = b2*(*delta2) + (1-b2)*(temp*temp);
      (*p) -= ((lr*(*delta1)/(1-bb1))/(sqrtf((*delta2)/(1-bb2))+epsilon));
 }
+
+/* the arguments of the optimizers split by parallel_for, each thread updates a different span of the parameters*/
+typedef struct gd_job {
+    float* p;
+    float* dp;
+    float* delta1;// delta for the nesterov momentum
+    float* delta2;
+    float lr, m, b1, b2, bb1, bb2, epsilon, gradient_scale, weight_decay;
+    int mini_batch_size, reset_flag;
+} gd_job;
+
+/* This function updates the parameters start <= i < end of nesterov_momentum_array*/
+ISA_INLINE void nesterov_momentum_range_kernel(void* data, int start, int end){
+    gd_job* job = (gd_job*)data;
+    float* restrict p = job->p;
+    float* restrict dp = job->dp;
+    float* restrict delta = job->delta1;
+    float lr = job->lr, m = job->m, gradient_scale = job->gradient_scale, weight_decay = job->weight_decay;
+    int mini_batch_size = job->mini_batch_size, reset_flag = job->reset_flag;
+    int i;
+    float temp,d;
+    if(reset_flag){
+        for(i = start; i < end; i++){
+            d = (float)((dp[i]*gradient_scale+weight_decay*p[i])/mini_batch_size);
+            temp = delta[i];
+            delta[i] = m*temp-lr*d;
+            p[i] += m*m*temp - (1+m)*lr*d;
+            dp[i] = 0;
+        }
+    }
+    else{
+        for(i = start; i < end; i++){
+            d = (float)((dp[i]*gradient_scale+weight_decay*p[i])/mini_batch_size);
+            temp = delta[i];
+            delta[i] = m*temp-lr*d;
+            p[i] += m*m*temp - (1+m)*lr*d;
+        }
+    }
+}
+
+ISA_DISPATCH(static, nesterov_momentum_range, (void* data, int start, int end), (data,start,end))
+
+/* This function updates size parameters with the nesterov momentum in a single pass,
+ * it gives the same result of nesterov_momentum called on each parameter.
+ * The partial derivatives can be scaled (for example by a clipping factor), the l2 weight decay
+ * can be added to them and they can be resetted in the same pass
+ * 
+ * Input:
+ *                @ float* p:= the parameters that must be updated, dimensions: size
+ *                @ float* dp:= the sums of the derivatives of p over the whole mini batch, dimensions: size
+ *                @ float* delta:= the delta parameters of momentum, dimensions: size
+ *                @ int size:= the number of parameters
+ *                @ float lr:= the learning rate
+ *                @ float m:= the momentum
+ *                @ int mini_batch_size:= the size of the mini batch for sgd
+ *                @ float gradient_scale:= dp is multiplied by gradient_scale before the update (1 to leave it as it is)
+ *                @ float weight_decay:= weight_decay*p is added to the scaled dp (0 for no l2 regularization)
+ *                @ int reset_flag:= if 1 dp is set to 0 after the update
+ * */
+void nesterov_momentum_array(float* restrict p, float* restrict dp, float* restrict delta, int size, float lr, float m, int mini_batch_size, float gradient_scale, float weight_decay, int reset_flag){
+    gd_job job = {p,dp,delta,NULL,lr,m,0,0,0,0,0,gradient_scale,weight_decay,mini_batch_size,reset_flag};
+    parallel_for(size,PARALLEL_GRAIN,nesterov_momentum_range,&job);
+}
+
+/* This function updates the parameters start <= i < end of adam_algorithm_array*/
+ISA_INLINE void adam_algorithm_range_kernel(void* data, int start, int end){
+    gd_job* job = (gd_job*)data;
+    float* restrict p = job->p;
+    float* restrict dp = job->dp;
+    float* restrict delta1 = job->delta1;
+    float* restrict delta2 = job->delta2;
+    float lr = job->lr, b1 = job->b1, b2 = job->b2, bb1 = job->bb1, bb2 = job->bb2, epsilon = job->epsilon, gradient_scale = job->gradient_scale, weight_decay = job->weight_decay;
+    int mini_batch_size = job->mini_batch_size, reset_flag = job->reset_flag;
+    int i;
+    float temp;
+    if(reset_flag){
+        for(i = start; i < end; i++){
+            temp = (float)((dp[i]*gradient_scale+weight_decay*p[i])/mini_batch_size);
+            delta1[i] = b1*delta1[i]+(1-b1)*temp;
+            delta2[i] = b2*delta2[i] + (1-b2)*(temp*temp);
+            p[i] -= ((lr*delta1[i]/(1-bb1))/(sqrtf(delta2[i]/(1-bb2))+epsilon));
+            dp[i] = 0;
+        }
+    }
+    else{
+        for(i = start; i < end; i++){
+            temp = (float)((dp[i]*gradient_scale+weight_decay*p[i])/mini_batch_size);
+            delta1[i] = b1*delta1[i]+(1-b1)*temp;
+            delta2[i] = b2*delta2[i] + (1-b2)*(temp*temp);
+            p[i] -= ((lr*delta1[i]/(1-bb1))/(sqrtf(delta2[i]/(1-bb2))+epsilon));
+        }
+    }
+}
+
+ISA_DISPATCH(static, adam_algorithm_range, (void* data, int start, int end), (data,start,end))
+
+/* This function updates size parameters with the adam optimization algorithm in a single pass,
+ * it gives the same result of adam_algorithm called on each parameter.
+ * The partial derivatives can be scaled (for example by a clipping factor), the l2 weight decay
+ * can be added to them and they can be resetted in the same pass
+ * 
+ * Input:
+ *                @ float* p:= the parameters that must be updated, dimensions: size
+ *                @ float* dp:= the sums of the derivatives of p over the whole mini batch, dimensions: size
+ *                @ float* delta1:= the parameters m of the adam algorithm, dimensions: size
+ *                @ float* delta2:= the parameters v of the adam algorithm, dimensions: size
+ *                @ int size:= the number of parameters
+ *                @ float lr:= the learning rate
+ *                @ float b1:= hyper parameter usually 0.9
+ *                @ float b2:= the hyper parameter usually 0.999
+ *                @ float bb1:= b1^t where t is the time that p has been updated
+ *                @ float bb2:= b2^t where t is the time that p has been updated
+ *                @ float epsilon:= hyper parameter 10^-8
+ *                @ int mini_batch_size:= the size of the mini batch
+ *                @ float gradient_scale:= dp is multiplied by gradient_scale before the update (1 to leave it as it is)
+ *                @ float weight_decay:= weight_decay*p is added to the scaled dp (0 for no l2 regularization)
+ *                @ int reset_flag:= if 1 dp is set to 0 after the update
+ * */
+void adam_algorithm_array(float* restrict p, float* restrict dp, float* restrict delta1, float* restrict delta2, int size, float lr, float b1, float b2, float bb1, float bb2, float epsilon, int mini_batch_size, float gradient_scale, float weight_decay, int reset_flag){
+    gd_job job = {p,dp,delta1,delta2,lr,0,b1,b2,bb1,bb2,epsilon,gradient_scale,weight_decay,mini_batch_size,reset_flag};
+    parallel_for(size,PARALLEL_GRAIN,adam_algorithm_range,&job);
+}
@@ -0,0 +1,390 @@
+#include "llab.h"
+
+/* Blocking parameters of the sgemm engine:
+ *
+ * GEMM_MR x GEMM_NR is the register tile computed by the micro-kernel (12 vector accumulators)
+ * GEMM_KC is the depth of the packed panels (the A strip and the B strip of a micro-kernel stay in L1)
+ * GEMM_MC x GEMM_KC is the packed block of A (stays in L2)
+ * GEMM_KC x GEMM_NC is the packed block of B (stays in L3)
+ * */
+#define GEMM_MR 6
+#define GEMM_NR 16
+#define GEMM_KC 256
+#define GEMM_MC 144
+#define GEMM_NC 1024
+
+/* the sgemm with at least GEMM_PARALLEL_FLOPS multiply-adds run on the thread pool in blocks of GEMM_MC x GEMM_NB elements of C*/
+#define GEMM_NB 256
+#define GEMM_PARALLEL_FLOPS 262144
+
+/* 8 floats vector, it is lowered by the compiler to the instruction set of each version of the kernels (see ISA_DISPATCH)*/
+typedef float v8sf __attribute__((vector_size(32)));
+/* 4 floats vector for the sse2 micro-kernel: without avx the v8sf operations are expanded element by element*/
+typedef float v4sf __attribute__((vector_size(16)));
+
+/* the packing buffers are allocated once per thread and never reallocated*/
+static __thread float* gemm_packed_a = NULL;
+static __thread float* gemm_packed_b = NULL;
+
+ISA_INLINE v8sf load_v8sf(float* p){
+    v8sf v;
+    memcpy(&v,p,sizeof(v8sf));
+    return v;
+}
+
+ISA_INLINE void store_v8sf(float* p, v8sf v){
+    memcpy(p,&v,sizeof(v8sf));
+}
+
+ISA_INLINE v4sf load_v4sf(float* p){
+    v4sf v;
+    memcpy(&v,p,sizeof(v4sf));
+    return v;
+}
+
+ISA_INLINE void store_v4sf(float* p, v4sf v){
+    memcpy(p,&v,sizeof(v4sf));
+}
+
+/* This function packs a mc*kc block of op(A) in strips of GEMM_MR rows,
+ * each strip is stored column by column, the rows out of the matrix are filled with 0
+ *
+ * Input:
+ *
+ *             @ int trans_a:= NO_TRANSPOSE or TRANSPOSE
+ *             @ float* a:= the matrix A
+ *             @ int lda:= the leading dimension of A
+ *             @ int i0:= the first row of op(A) of the block
+ *             @ int p0:= the first column of op(A) of the block
+ *             @ int mc:= the rows of the block
+ *             @ int kc:= the columns of the block
+ *             @ float* packed:= the output buffer
+ *                               dimensions: ceil(mc/GEMM_MR)*GEMM_MR*kc
+ * */
+ISA_INLINE void sgemm_pack_a(int trans_a, float* a, int lda, int i0, int p0, int mc, int kc, float* packed){
+    int ir,i,p,rows;
+    for(ir = 0; ir < mc; ir+=GEMM_MR){
+        rows = mc-ir < GEMM_MR ? mc-ir : GEMM_MR;
+        for(p = 0; p < kc; p++){
+            for(i = 0; i < rows; i++){
+                if(trans_a == TRANSPOSE)
+                    packed[p*GEMM_MR+i] = a[(p0+p)*lda+i0+ir+i];
+                else
+                    packed[p*GEMM_MR+i] = a[(i0+ir+i)*lda+p0+p];
+            }
+            for(; i < GEMM_MR; i++){
+                packed[p*GEMM_MR+i] = 0;
+            }
+        }
+        packed+=GEMM_MR*kc;
+    }
+}
+
+/* This function packs a kc*nc block of op(B) in strips of GEMM_NR columns,
+ * each strip is stored row by row, the columns out of the matrix are filled with 0
+ *
+ * Input:
+ *
+ *             @ int trans_b:= NO_TRANSPOSE or TRANSPOSE
+ *             @ float* b:= the matrix B
+ *             @ int ldb:= the leading dimension of B
+ *             @ int p0:= the first row of op(B) of the block
+ *             @ int j0:= the first column of op(B) of the block
+ *             @ int kc:= the rows of the block
+ *             @ int nc:= the columns of the block
+ *             @ float* packed:= the output buffer
+ *                               dimensions: ceil(nc/GEMM_NR)*GEMM_NR*kc
+ * */
+ISA_INLINE void sgemm_pack_b(int trans_b, float* b, int ldb, int p0, int j0, int kc, int nc, float* packed){
+    int jr,j,p,cols;
+    for(jr = 0; jr < nc; jr+=GEMM_NR){
+        cols = nc-jr < GEMM_NR ? nc-jr : GEMM_NR;
+        for(p = 0; p < kc; p++){
+            if(trans_b == TRANSPOSE){
+                for(j = 0; j < cols; j++){
+                    packed[p*GEMM_NR+j] = b[(j0+jr+j)*ldb+p0+p];
+                }
+            }
+            else{
+                for(j = 0; j < cols; j++){
+                    packed[p*GEMM_NR+j] = b[(p0+p)*ldb+j0+jr+j];
+                }
+            }
+            for(; j < GEMM_NR; j++){
+                packed[p*GEMM_NR+j] = 0;
+            }
+        }
+        packed+=GEMM_NR*kc;
+    }
+}
+
+/* This function is the micro-kernel of the engine: it computes a GEMM_MR*GEMM_NR tile of C
+ * keeping all the accumulators in registers, and adds it to C (plus the bias if bias != NULL)
+ *
+ * Input:
+ *
+ *             @ int kc:= the depth of the packed strips
+ *             @ float* a:= the packed strip of A, dimensions: kc*GEMM_MR
+ *             @ float* b:= the packed strip of B, dimensions: kc*GEMM_NR
+ *             @ float* c:= the first element of the tile of C
+ *             @ int ldc:= the leading dimension of C
+ *             @ int mr:= the valid rows of the tile (<= GEMM_MR)
+ *             @ int nr:= the valid columns of the tile (<= GEMM_NR)
+ *             @ float* bias:= the bias of the columns of the tile, or NULL
+ * */
+ISA_INLINE void sgemm_micro_kernel(int kc, float* a, float* b, float* c, int ldc, int mr, int nr, float* bias){
+    v8sf c00 = {0}, c01 = {0}, c10 = {0}, c11 = {0}, c20 = {0}, c21 = {0};
+    v8sf c30 = {0}, c31 = {0}, c40 = {0}, c41 = {0}, c50 = {0}, c51 = {0};
+    v8sf b0,b1,av;
+    float x;
+    int p,i,j;
+
+    for(p = 0; p < kc; p++){
+        b0 = load_v8sf(b);
+        b1 = load_v8sf(b+8);
+        x = a[0]; av = (v8sf){x,x,x,x,x,x,x,x}; c00 += av*b0; c01 += av*b1;
+        x = a[1]; av = (v8sf){x,x,x,x,x,x,x,x}; c10 += av*b0; c11 += av*b1;
+        x = a[2]; av = (v8sf){x,x,x,x,x,x,x,x}; c20 += av*b0; c21 += av*b1;
+        x = a[3]; av = (v8sf){x,x,x,x,x,x,x,x}; c30 += av*b0; c31 += av*b1;
+        x = a[4]; av = (v8sf){x,x,x,x,x,x,x,x}; c40 += av*b0; c41 += av*b1;
+        x = a[5]; av = (v8sf){x,x,x,x,x,x,x,x}; c50 += av*b0; c51 += av*b1;
+        a+=GEMM_MR;
+        b+=GEMM_NR;
+    }
+
+    if(bias != NULL){
+        if(nr == GEMM_NR){
+            b0 = load_v8sf(bias);
+            b1 = load_v8sf(bias+8);
+        }
+        else{
+            float bias_tile[GEMM_NR] = {0};
+            for(j = 0; j < nr; j++){
+                bias_tile[j] = bias[j];
+            }
+            b0 = load_v8sf(bias_tile);
+            b1 = load_v8sf(bias_tile+8);
+        }
+        c00 += b0; c01 += b1; c10 += b0; c11 += b1; c20 += b0; c21 += b1;
+        c30 += b0; c31 += b1; c40 += b0; c41 += b1; c50 += b0; c51 += b1;
+    }
+
+    if(mr == GEMM_MR && nr == GEMM_NR){
+        store_v8sf(c,load_v8sf(c)+c00); store_v8sf(c+8,load_v8sf(c+8)+c01); c+=ldc;
+        store_v8sf(c,load_v8sf(c)+c10); store_v8sf(c+8,load_v8sf(c+8)+c11); c+=ldc;
+        store_v8sf(c,load_v8sf(c)+c20); store_v8sf(c+8,load_v8sf(c+8)+c21); c+=ldc;
+        store_v8sf(c,load_v8sf(c)+c30); store_v8sf(c+8,load_v8sf(c+8)+c31); c+=ldc;
+        store_v8sf(c,load_v8sf(c)+c40); store_v8sf(c+8,load_v8sf(c+8)+c41); c+=ldc;
+        store_v8sf(c,load_v8sf(c)+c50); store_v8sf(c+8,load_v8sf(c+8)+c51);
+    }
+
+    else{
+        float tile[GEMM_MR*GEMM_NR];
+        store_v8sf(tile,c00); store_v8sf(tile+8,c01);
+        store_v8sf(tile+16,c10); store_v8sf(tile+24,c11);
+        store_v8sf(tile+32,c20); store_v8sf(tile+40,c21);
+        store_v8sf(tile+48,c30); store_v8sf(tile+56,c31);
+        store_v8sf(tile+64,c40); store_v8sf(tile+72,c41);
+        store_v8sf(tile+80,c50); store_v8sf(tile+88,c51);
+        for(i = 0; i < mr; i++){
+            for(j = 0; j < nr; j++){
+                c[i*ldc+j] += tile[i*GEMM_NR+j];
+            }
+        }
+    }
+}
+
+/* This function computes the same tile of sgemm_micro_kernel with sse2 vectors: the tile is computed
+ * in 2 halves of GEMM_MR x 8 floats, so the 12 accumulators of each half fit in the 16 sse registers.
+ * Each element is the same sum of sgemm_micro_kernel in the same order
+ * */
+ISA_INLINE void sgemm_micro_kernel_sse2(int kc, float* a, float* b, float* c, int ldc, int mr, int nr, float* bias){
+    float tile[GEMM_MR*GEMM_NR];
+    v4sf c00,c01,c10,c11,c20,c21,c30,c31,c40,c41,c50,c51;
+    v4sf b0,b1,av;
+    float x;
+    float* ap;
+    float* bp;
+    int h,p,i,j;
+
+    for(h = 0; h < GEMM_NR; h+=8){
+        c00 = c01 = c10 = c11 = c20 = c21 = (v4sf){0};
+        c30 = c31 = c40 = c41 = c50 = c51 = (v4sf){0};
+        ap = a;
+        bp = b+h;
+        for(p = 0; p < kc; p++){
+            b0 = load_v4sf(bp);
+            b1 = load_v4sf(bp+4);
+            x = ap[0]; av = (v4sf){x,x,x,x}; c00 += av*b0; c01 += av*b1;
+            x = ap[1]; av = (v4sf){x,x,x,x}; c10 += av*b0; c11 += av*b1;
+            x = ap[2]; av = (v4sf){x,x,x,x}; c20 += av*b0; c21 += av*b1;
+            x = ap[3]; av = (v4sf){x,x,x,x}; c30 += av*b0; c31 += av*b1;
+            x = ap[4]; av = (v4sf){x,x,x,x}; c40 += av*b0; c41 += av*b1;
+            x = ap[5]; av = (v4sf){x,x,x,x}; c50 += av*b0; c51 += av*b1;
+            ap+=GEMM_MR;
+            bp+=GEMM_NR;
+        }
+        store_v4sf(&tile[h],c00); store_v4sf(&tile[h+4],c01);
+        store_v4sf(&tile[GEMM_NR+h],c10); store_v4sf(&tile[GEMM_NR+h+4],c11);
+        store_v4sf(&tile[2*GEMM_NR+h],c20); store_v4sf(&tile[2*GEMM_NR+h+4],c21);
+        store_v4sf(&tile[3*GEMM_NR+h],c30); store_v4sf(&tile[3*GEMM_NR+h+4],c31);
+        store_v4sf(&tile[4*GEMM_NR+h],c40); store_v4sf(&tile[4*GEMM_NR+h+4],c41);
+        store_v4sf(&tile[5*GEMM_NR+h],c50); store_v4sf(&tile[5*GEMM_NR+h+4],c51);
+    }
+
+    for(i = 0; i < mr; i++){
+        for(j = 0; j < nr; j++){
+            if(bias != NULL)
+                tile[i*GEMM_NR+j] += bias[j];
+            c[i*ldc+j] += tile[i*GEMM_NR+j];
+        }
+    }
+}
+
+/* This function computes C += op(A)*op(B) (+ bias on the first kc block) on the calling thread,
+ * isa is a constant after the inlining in the version of each instruction set*/
+ISA_INLINE void sgemm_serial_kernel(int trans_a, int trans_b, int m, int n, int k, float* a, int lda, float* b, int ldb, float* c, int ldc, float* bias, int isa){
+    int ic,jc,pc,ir,jr,mc,nc,kc;
+
+    if(gemm_packed_a == NULL){
+        gemm_packed_a = (float*)malloc(sizeof(float)*GEMM_MC*GEMM_KC);
+        gemm_packed_b = (float*)malloc(sizeof(float)*GEMM_KC*GEMM_NC);
+        if(gemm_packed_a == NULL || gemm_packed_b == NULL){
+            fprintf(stderr,"Error: not enough memory for the sgemm packing buffers\n");
+            exit(1);
+        }
+    }
+
+    for(jc = 0; jc < n; jc+=GEMM_NC){
+        nc = n-jc < GEMM_NC ? n-jc : GEMM_NC;
+        for(pc = 0; pc < k; pc+=GEMM_KC){
+            kc = k-pc < GEMM_KC ? k-pc : GEMM_KC;
+            sgemm_pack_b(trans_b,b,ldb,pc,jc,kc,nc,gemm_packed_b);
+            for(ic = 0; ic < m; ic+=GEMM_MC){
+                mc = m-ic < GEMM_MC ? m-ic : GEMM_MC;
+                sgemm_pack_a(trans_a,a,lda,ic,pc,mc,kc,gemm_packed_a);
+                for(jr = 0; jr < nc; jr+=GEMM_NR){
+                    for(ir = 0; ir < mc; ir+=GEMM_MR){
+                        if(isa == ISA_SSE2)
+                            sgemm_micro_kernel_sse2(kc,&gemm_packed_a[ir*kc],&gemm_packed_b[jr*kc],&c[(ic+ir)*ldc+jc+jr],ldc,mc-ir < GEMM_MR ? mc-ir : GEMM_MR,nc-jr < GEMM_NR ? nc-jr : GEMM_NR,(bias != NULL && pc == 0) ? &bias[jc+jr] : NULL);
+                        else
+                            sgemm_micro_kernel(kc,&gemm_packed_a[ir*kc],&gemm_packed_b[jr*kc],&c[(ic+ir)*ldc+jc+jr],ldc,mc-ir < GEMM_MR ? mc-ir : GEMM_MR,nc-jr < GEMM_NR ? nc-jr : GEMM_NR,(bias != NULL && pc == 0) ? &bias[jc+jr] : NULL);
+                    }
+                }
+            }
+        }
+    }
+}
+
+/* the sgemm versions are written by hand (and not with ISA_DISPATCH) because the sse2 one uses its own micro-kernel*/
+ISA_TARGET_AVX512 static void sgemm_serial_avx512(int trans_a, int trans_b, int m, int n, int k, float* a, int lda, float* b, int ldb, float* c, int ldc, float* bias){
+    sgemm_serial_kernel(trans_a,trans_b,m,n,k,a,lda,b,ldb,c,ldc,bias,ISA_AVX512);
+}
+
+ISA_TARGET_AVX2 static void sgemm_serial_avx2(int trans_a, int trans_b, int m, int n, int k, float* a, int lda, float* b, int ldb, float* c, int ldc, float* bias){
+    sgemm_serial_kernel(trans_a,trans_b,m,n,k,a,lda,b,ldb,c,ldc,bias,ISA_AVX2);
+}
+
+ISA_TARGET_AVX static void sgemm_serial_avx(int trans_a, int trans_b, int m, int n, int k, float* a, int lda, float* b, int ldb, float* c, int ldc, float* bias){
+    sgemm_serial_kernel(trans_a,trans_b,m,n,k,a,lda,b,ldb,c,ldc,bias,ISA_AVX);
+}
+
+static void sgemm_serial(int trans_a, int trans_b, int m, int n, int k, float* a, int lda, float* b, int ldb, float* c, int ldc, float* bias){
+    switch(get_isa()){
+        case ISA_AVX512: sgemm_serial_avx512(trans_a,trans_b,m,n,k,a,lda,b,ldb,c,ldc,bias); break;
+        case ISA_AVX2: sgemm_serial_avx2(trans_a,trans_b,m,n,k,a,lda,b,ldb,c,ldc,bias); break;
+        case ISA_AVX: sgemm_serial_avx(trans_a,trans_b,m,n,k,a,lda,b,ldb,c,ldc,bias); break;
+        default: sgemm_serial_kernel(trans_a,trans_b,m,n,k,a,lda,b,ldb,c,ldc,bias,ISA_SSE2);
+    }
+}
+
+/* the sgemm of a parallel_for is split in blocks of GEMM_MC rows and GEMM_NB columns of C,
+ * each element of C is computed by a single task with the same order of the sums, so the result
+ * doesn't depend on the number of threads*/
+typedef struct sgemm_job {
+    int trans_a, trans_b, m, n, k;
+    float* a;
+    int lda;
+    float* b;
+    int ldb;
+    float* c;
+    int ldc;
+    float* bias;
+    int row_blocks, column_blocks;
+} sgemm_job;
+
+static void sgemm_tasks(void* data, int start, int end){
+    sgemm_job* job = (sgemm_job*)data;
+    int t,i0,j0,mb,nb;
+    for(t = start; t < end; t++){
+        i0 = (t/job->column_blocks)*GEMM_MC;
+        j0 = (t%job->column_blocks)*GEMM_NB;
+        mb = job->m-i0 < GEMM_MC ? job->m-i0 : GEMM_MC;
+        nb = job->n-j0 < GEMM_NB ? job->n-j0 : GEMM_NB;
+        sgemm_serial(job->trans_a,job->trans_b,mb,nb,job->k,
+                     job->trans_a == NO_TRANSPOSE ? &job->a[i0*job->lda] : &job->a[i0],job->lda,
+                     job->trans_b == NO_TRANSPOSE ? &job->b[j0] : &job->b[j0*job->ldb],job->ldb,
+                     &job->c[i0*job->ldc+j0],job->ldc,job->bias != NULL ? &job->bias[j0] : NULL);
+    }
+}
+
+/* This function computes C += op(A)*op(B) (+ bias) where op(X) is X or X^T.
+ * All the matrices are stored by rows. The computation is blocked for the caches:
+ * op(B) is packed in kc*nc blocks, op(A) in mc*kc blocks and each block product
+ * is computed with a register tiled micro-kernel. The bias (if any) is added only once,
+ * during the first kc block, so it doesn't cost an extra pass over C.
+ * The large products are split among the threads of the pool in blocks of C (see parallel_for)
+ *
+ * Input:
+ *
+ *             @ int trans_a:= NO_TRANSPOSE if op(A) = A, TRANSPOSE if op(A) = A^T
+ *             @ int trans_b:= NO_TRANSPOSE if op(B) = B, TRANSPOSE if op(B) = B^T
+ *             @ int m:= the rows of op(A) and C
+ *             @ int n:= the columns of op(B) and C
+ *             @ int k:= the columns of op(A) and the rows of op(B)
+ *             @ float* a:= the matrix A
+ *                          dimensions: m*k
+ *             @ int lda:= the leading dimension of A (the distance between 2 rows of A)
+ *             @ float* b:= the matrix B
+ *                          dimensions: k*n
+ *             @ int ldb:= the leading dimension of B
+ *             @ float* c:= the matrix C that must be filled
+ *                          dimensions: m*n
+ *             @ int ldc:= the leading dimension of C
+ *             @ float* bias:= a vector added to each row of C, or NULL
+ *                             dimensions: n
+ * */
+void sgemm(int trans_a, int trans_b, int m, int n, int k, float* a, int lda, float* b, int ldb, float* c, int ldc, float* bias){
+    if(m <= 0 || n <= 0)
+        return;
+
+    int i,j;
+
+    if(k <= 0){
+        if(bias != NULL){
+            for(i = 0; i < m; i++){
+                for(j = 0; j < n; j++){
+                    c[i*ldc+j] += bias[j];
+                }
+            }
+        }
+        return;
+    }
+
+    if((long)m*n*k < GEMM_PARALLEL_FLOPS || get_thread_pool_size() == 1){
+        sgemm_serial(trans_a,trans_b,m,n,k,a,lda,b,ldb,c,ldc,bias);
+        return;
+    }
+
+    sgemm_job job = {trans_a,trans_b,m,n,k,a,lda,b,ldb,c,ldc,bias,(m+GEMM_MC-1)/GEMM_MC,(n+GEMM_NB-1)/GEMM_NB};
+    parallel_for(job.row_blocks*job.column_blocks,1,sgemm_tasks,&job);
+}
+
+/* This function frees the packing buffers of sgemm of the calling thread, it must be called
+ * by the threads that use sgemm before they exit (the next sgemm allocates them again)*/
+void free_sgemm_buffers(void){
+    free(gemm_packed_a);
+    free(gemm_packed_b);
+    gemm_packed_a = NULL;
+    gemm_packed_b = NULL;
+}
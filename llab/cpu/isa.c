@@ -0,0 +1,79 @@
+#include "llab.h"
+
+/* The hot kernels of the library are compiled for each instruction set (see ISA_DISPATCH in llab.h),
+ * the library is built for the sse2 baseline of x86-64, so it runs on every node,
+ * and at startup it picks the best instruction set supported by the cpu (and by the os).
+ * The environment variable LLAB_ISA = sse2, avx, avx2 or avx512 forces an instruction set (for example for benchmarks)
+ * */
+
+static int isa_flag = -1;
+
+static const char* isa_names[] = {"sse2","avx","avx2","avx512"};
+
+/* This function returns the best instruction set supported by the cpu*/
+static int isa_detect(void){
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq") && __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vl"))
+        return ISA_AVX512;
+    if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        return ISA_AVX2;
+    if(__builtin_cpu_supports("avx"))
+        return ISA_AVX;
+    return ISA_SSE2;
+}
+
+/* the instruction set is chosen before main, so the kernels never see it change while they run*/
+__attribute__((constructor)) static void isa_init(void){
+    int i;
+    char* env = getenv("LLAB_ISA");
+    isa_flag = isa_detect();
+    if(env == NULL || !env[0])
+        return;
+    for(i = 0; i <= ISA_AVX512; i++){
+        if(!strcmp(env,isa_names[i]))
+            break;
+    }
+    if(i > ISA_AVX512){
+        fprintf(stderr,"Error: LLAB_ISA must be sse2, avx, avx2 or avx512\n");
+        exit(1);
+    }
+    set_isa(i);
+}
+
+/* This function returns the instruction set used by the kernels: ISA_SSE2, ISA_AVX, ISA_AVX2 (with fma) or ISA_AVX512*/
+int get_isa(void){
+    if(isa_flag < 0)
+        isa_init();
+    return isa_flag;
+}
+
+/* This function sets the instruction set used by the kernels, it must be supported by the cpu.
+ * The avx2 and avx512 kernels use fma, so their results can differ in the last bits from the sse2 and avx ones
+ *
+ * Input:
+ *
+ *             @ int isa:= ISA_SSE2, ISA_AVX, ISA_AVX2 or ISA_AVX512
+ * */
+void set_isa(int isa){
+    if(isa < ISA_SSE2 || isa > ISA_AVX512){
+        fprintf(stderr,"Error: the instruction set must be ISA_SSE2, ISA_AVX, ISA_AVX2 or ISA_AVX512\n");
+        exit(1);
+    }
+    if(isa > isa_detect()){
+        fprintf(stderr,"Error: the cpu doesn't support the %s instruction set\n",isa_names[isa]);
+        exit(1);
+    }
+    isa_flag = isa;
+}
+
+/* This function returns the name of an instruction set (sse2, avx, avx2 or avx512)
+ *
+ * Input:
+ *
+ *             @ int isa:= ISA_SSE2, ISA_AVX, ISA_AVX2 or ISA_AVX512
+ * */
+const char* isa_name(int isa){
+    if(isa < ISA_SSE2 || isa > ISA_AVX512)
+        return "unknown";
+    return isa_names[isa];
+}
@@ -1,5 +1,20 @@
 #include "llab.h"
 
+static __thread int layers_parameters_flag = 1;// = 0 if the constructors of the calling thread leave the parameters to the model arena
+
+/* This function sets if the constructors of the layers called by the calling thread allocate and initialize
+ * the parameters (flag = 1, the default) or leave them NULL (flag = 0). The layers built with flag = 0 get
+ * their parameters when they are moved in a model arena, so they are filled only when they are read from a file
+ * straight in the arena (see load_mapped_model), the layers can't be used or saved before
+ * 
+ * Input:
+ *             @ int flag:= 1 to allocate the parameters, 0 to leave them NULL
+ * 
+ * */
+void set_layers_parameters_allocation(int flag){
+    layers_parameters_flag = flag;
+}
+
 /* This function builds a fully-connected layer according to the fcl structure defined in layers.h
  * 
  * Input:
@@ -30,11 +45,13 @@ fcl* fully_connected(int input, int output, int layer, int dropout_flag, int act
     f->dropout_flag = dropout_flag;
     f->activation_flag = activation_flag;
     f->dropout_threshold = dropout_threshold;
-    f->weights = (float*)malloc(sizeof(float)*output*input);
+    f->arena_flag = 0;
+    f->inference_only_flag = 0;
+    f->weights = layers_parameters_flag ? (float*)malloc(sizeof(float)*output*input) : NULL;
     f->d_weights = (float*)calloc(output*input,sizeof(float));
     f->d1_weights = (float*)calloc(output*input,sizeof(float));
     f->d2_weights = (float*)calloc(output*input,sizeof(float));
-    f->biases = (float*)calloc(output,sizeof(float));
+    f->biases = layers_parameters_flag ? (float*)calloc(output,sizeof(float)) : NULL;
     f->d_biases = (float*)calloc(output,sizeof(float));
     f->d1_biases = (float*)calloc(output,sizeof(float));
     f->d2_biases = (float*)calloc(output,sizeof(float));
@@ -55,7 +72,7 @@ fcl* fully_connected(int input, int output, int layer, int dropout_flag, int act
         f->dropout_mask = NULL;
     
     for(i = 0; i < output; i++){
-        for(j = 0; j < input; j++){
+        for(j = 0; layers_parameters_flag && j < input; j++){
             f->weights[i*input+j] = random_general_gaussian(0, (float)input);
         }
         if(dropout_flag)
@@ -71,23 +88,64 @@ void free_fully_connected(fcl* f){
         return;
     }
     
-    free(f->weights);
+    if(!f->arena_flag){
+        free(f->weights);
+        free(f->d_weights);
+        free(f->d1_weights);
+        free(f->d2_weights);
+        free(f->biases);
+        free(f->d_biases);
+        free(f->d1_biases);
+        free(f->d2_biases);
+    }
+    free(f->pre_activation);
+    free(f->post_activation);
+    free(f->dropout_mask);
+    free(f->dropout_temp);
+    free(f->temp);
+    free(f->temp2);
+    free(f->temp3);
+    free(f->error2);
+    free(f);    
+}
+
+/* This function frees the partial derivatives, the arrays of the optimizers and the arrays
+ * used only by the back propagation of a fully-connected layer, the layer keeps weights, biases
+ * and the feed forward arrays and it can be used only for the feed forward.
+ * It must be called before the layer is moved in a model arena (see inference_network)
+ * 
+ * Input:
+ *             @ fcl* f:= the fully-connected layer
+ * 
+ * */
+void set_fully_connected_inference_only(fcl* f){
+    if(f == NULL || f->inference_only_flag)
+        return;
+    if(f->arena_flag){
+        fprintf(stderr,"Error: the fully-connected layer %d belongs already to a model\n",f->layer);
+        exit(1);
+    }
     free(f->d_weights);
     free(f->d1_weights);
     free(f->d2_weights);
-    free(f->biases);
     free(f->d_biases);
     free(f->d1_biases);
     free(f->d2_biases);
-    free(f->pre_activation);
-    free(f->post_activation);
-    free(f->dropout_mask);
-    free(f->dropout_temp);
     free(f->temp);
     free(f->temp2);
     free(f->temp3);
     free(f->error2);
-    free(f);    
+    f->d_weights = NULL;
+    f->d1_weights = NULL;
+    f->d2_weights = NULL;
+    f->d_biases = NULL;
+    f->d1_biases = NULL;
+    f->d2_biases = NULL;
+    f->temp = NULL;
+    f->temp2 = NULL;
+    f->temp3 = NULL;
+    f->error2 = NULL;
+    f->inference_only_flag = 1;
 }
 
 /* This function builds a convolutional layer according to the cl structure defined in layers.h
@@ -137,6 +195,11 @@ cl* convolutional(int channels, int input_rows, int input_cols, int kernel_rows,
         exit(1);
     }
     
+    if(pooling_flag == MAX_POOLING && pooling_rows*pooling_cols > MAX_POOLING_WINDOW){
+        fprintf(stderr,"Error: the max-pooling window can have at most %d elements\n",MAX_POOLING_WINDOW);
+        exit(1);
+    }
+    
     if(convolutional_flag == NO_CONVOLUTION && n_kernels != channels){
         fprintf(stderr,"Error: if you don't apply convolution, your n_kernels param should be equal to channels, 'cause n_kernels indicates the channel of the current_layer\n");
         exit(1);
@@ -170,7 +233,7 @@ cl* convolutional(int channels, int input_rows, int input_cols, int kernel_rows,
     c->d_kernels = (float**)malloc(sizeof(float*)*n_kernels);
     c->d1_kernels = (float**)malloc(sizeof(float*)*n_kernels);
     c->d2_kernels = (float**)malloc(sizeof(float*)*n_kernels);
-    c->biases = (float*)calloc(n_kernels,sizeof(float));
+    c->biases = layers_parameters_flag ? (float*)calloc(n_kernels,sizeof(float)) : NULL;
     c->d_biases = (float*)calloc(n_kernels,sizeof(float));
     c->d1_biases = (float*)calloc(n_kernels,sizeof(float));
     c->d2_biases = (float*)calloc(n_kernels,sizeof(float));
@@ -228,12 +291,33 @@ cl* convolutional(int channels, int input_rows, int input_cols, int kernel_rows,
 
     
     
+    /* the kernels are stored one after the other in a single block, so all the kernels of the layer
+     * can be used as a n_kernels*(channels*kernel_rows*kernel_cols) matrix*/
+    c->kernels[0] = layers_parameters_flag ? (float*)malloc(sizeof(float)*n_kernels*channels*kernel_rows*kernel_cols) : NULL;
+    c->d_kernels[0] = (float*)calloc(n_kernels*channels*kernel_rows*kernel_cols,sizeof(float));
+    c->d1_kernels[0] = (float*)calloc(n_kernels*channels*kernel_rows*kernel_cols,sizeof(float));
+    c->d2_kernels[0] = (float*)calloc(n_kernels*channels*kernel_rows*kernel_cols,sizeof(float));
+    c->algorithm_flag = DIRECT_CONVOLUTION;
+    c->batch_size = 1;
+    c->col = NULL;
+    c->col_temp = NULL;
+    c->winograd_kernels = NULL;
+    c->winograd_d_kernels = NULL;
+    c->winograd_kernels_flag = 0;
+    c->mode_flag = TRAINING_MODE;
+    c->arena_flag = 0;
+    c->inference_only_flag = 0;
+    if(pooling_flag == MAX_POOLING)
+        c->pooling_indices = (unsigned short*)calloc(n_kernels*c->rows2*c->cols2,sizeof(unsigned short));
+    else
+        c->pooling_indices = NULL;
+    
     for(i = 0; i < n_kernels; i++){
-        c->kernels[i] = (float*)malloc(sizeof(float)*channels*kernel_rows*kernel_cols);
-        c->d_kernels[i] = (float*)calloc(channels*kernel_rows*kernel_cols,sizeof(float));
-        c->d1_kernels[i] = (float*)calloc(channels*kernel_rows*kernel_cols,sizeof(float));
-        c->d2_kernels[i] = (float*)calloc(channels*kernel_rows*kernel_cols,sizeof(float));
-        for(j = 0; j < channels*kernel_rows*kernel_cols; j++){
+        c->kernels[i] = layers_parameters_flag ? c->kernels[0] + i*channels*kernel_rows*kernel_cols : NULL;
+        c->d_kernels[i] = c->d_kernels[0] + i*channels*kernel_rows*kernel_cols;
+        c->d1_kernels[i] = c->d1_kernels[0] + i*channels*kernel_rows*kernel_cols;
+        c->d2_kernels[i] = c->d2_kernels[0] + i*channels*kernel_rows*kernel_cols;
+        for(j = 0; layers_parameters_flag && j < channels*kernel_rows*kernel_cols; j++){
             c->kernels[i][j] = random_general_gaussian(0, (float)channels*input_rows*input_cols);
         }
     }
@@ -246,21 +330,20 @@ void free_convolutional(cl* c){
         return;
     }
     
-    int i;
-    for(i = 0; i < c->n_kernels; i++){
-        free(c->kernels[i]);
-        free(c->d_kernels[i]);
-        free(c->d1_kernels[i]);
-        free(c->d2_kernels[i]);
+    if(!c->arena_flag){
+        free(c->kernels[0]);
+        free(c->d_kernels[0]);
+        free(c->d1_kernels[0]);
+        free(c->d2_kernels[0]);
+        free(c->biases);
+        free(c->d_biases);
+        free(c->d1_biases);
+        free(c->d2_biases);
     }
     free(c->kernels);
     free(c->d_kernels);
     free(c->d1_kernels);
     free(c->d2_kernels);
-    free(c->biases);
-    free(c->d_biases);
-    free(c->d1_biases);
-    free(c->d2_biases);
     free(c->pre_activation);
     free(c->post_activation);
     free(c->post_normalization);
@@ -269,9 +352,164 @@ void free_convolutional(cl* c){
     free(c->temp2);
     free(c->temp3);
     free(c->error2);
+    free(c->col);
+    free(c->col_temp);
+    free(c->winograd_kernels);
+    free(c->winograd_d_kernels);
+    free(c->pooling_indices);
     free(c);
 }
 
+/* This function sets the algorithm used to compute the convolution of a convolutional layer
+ * and allocates (or frees) the buffers needed by the algorithm.
+ * WINOGRAD_CONVOLUTION can be used only with 3x3 kernels and stride 1
+ * 
+ * Input:
+ *             @ cl* c:= the convolutional layer
+ *             @ int algorithm_flag:= DIRECT_CONVOLUTION, IM2COL_CONVOLUTION or WINOGRAD_CONVOLUTION
+ * */
+void set_convolutional_algorithm(cl* c, int algorithm_flag){
+    if(algorithm_flag != DIRECT_CONVOLUTION && algorithm_flag != IM2COL_CONVOLUTION && algorithm_flag != WINOGRAD_CONVOLUTION){
+        fprintf(stderr,"Error: the algorithm flag must be DIRECT_CONVOLUTION, IM2COL_CONVOLUTION or WINOGRAD_CONVOLUTION\n");
+        exit(1);
+    }
+    
+    if(algorithm_flag != DIRECT_CONVOLUTION && c->convolutional_flag != CONVOLUTION){
+        fprintf(stderr,"Error: you can change the convolution algorithm only for layers that apply the convolution\n");
+        exit(1);
+    }
+    
+    if(algorithm_flag == WINOGRAD_CONVOLUTION && (c->kernel_rows != 3 || c->kernel_cols != 3 || c->stride1_rows != 1)){
+        fprintf(stderr,"Error: the winograd convolution can be used only with 3x3 kernels and stride 1\n");
+        exit(1);
+    }
+    
+    free(c->col);
+    free(c->col_temp);
+    free(c->winograd_kernels);
+    free(c->winograd_d_kernels);
+    c->col = NULL;
+    c->col_temp = NULL;
+    c->winograd_kernels = NULL;
+    c->winograd_d_kernels = NULL;
+    c->winograd_kernels_flag = 0;
+    c->algorithm_flag = algorithm_flag;
+    
+    if(algorithm_flag == IM2COL_CONVOLUTION){
+        int n_pixels = c->batch_size*((c->input_rows-c->kernel_rows)/c->stride1_rows + 1)*((c->input_cols-c->kernel_cols)/c->stride1_cols + 1);
+        c->col = (float*)malloc(sizeof(float)*c->channels*c->kernel_rows*c->kernel_cols*n_pixels);
+        c->col_temp = (float*)malloc(sizeof(float)*c->n_kernels*n_pixels);
+        if(c->col == NULL || c->col_temp == NULL){
+            fprintf(stderr,"Error: not enough memory for the im2col buffers\n");
+            exit(1);
+        }
+    }
+    
+    else if(algorithm_flag == WINOGRAD_CONVOLUTION){
+        int n_tiles = c->batch_size*((c->input_rows-1)/2)*((c->input_cols-1)/2);
+        c->col = (float*)malloc(sizeof(float)*WINOGRAD_TILE*c->channels*n_tiles);
+        c->col_temp = (float*)malloc(sizeof(float)*WINOGRAD_TILE*c->n_kernels*n_tiles);
+        c->winograd_kernels = (float*)malloc(sizeof(float)*WINOGRAD_TILE*c->n_kernels*c->channels);
+        if(!c->inference_only_flag)
+            c->winograd_d_kernels = (float*)malloc(sizeof(float)*WINOGRAD_TILE*c->n_kernels*c->channels);
+        if(c->col == NULL || c->col_temp == NULL || c->winograd_kernels == NULL || (c->winograd_d_kernels == NULL && !c->inference_only_flag)){
+            fprintf(stderr,"Error: not enough memory for the winograd buffers\n");
+            exit(1);
+        }
+    }
+}
+
+/* This function sets the number of instances that the im2col or winograd buffers of a convolutional layer can hold,
+ * so convolutional_layer_feed_forward_batch and convolutional_layer_back_prop_batch can compute them with the same sgemm.
+ * The buffers are allocated again for the algorithm of the layer
+ * 
+ * Input:
+ *             @ cl* c:= the convolutional layer
+ *             @ int batch_size:= the number of instances, >= 1
+ * */
+void set_convolutional_batch_size(cl* c, int batch_size){
+    if(batch_size < 1){
+        fprintf(stderr,"Error: the batch size of a convolutional layer must be >= 1\n");
+        exit(1);
+    }
+    c->batch_size = batch_size;
+    set_convolutional_algorithm(c,c->algorithm_flag);
+}
+
+/* This function sets the training or inference mode of a convolutional layer.
+ * In training mode the max-pooling records the position of each max for the backpropagation,
+ * in inference mode the buffer of the positions is freed and the backpropagation can't be computed
+ * 
+ * Input:
+ *             @ cl* c:= the convolutional layer
+ *             @ int mode_flag:= TRAINING_MODE or INFERENCE_MODE
+ * */
+void set_convolutional_mode(cl* c, int mode_flag){
+    if(mode_flag != TRAINING_MODE && mode_flag != INFERENCE_MODE){
+        fprintf(stderr,"Error: the mode flag must be TRAINING_MODE or INFERENCE_MODE\n");
+        exit(1);
+    }
+    
+    if(mode_flag == TRAINING_MODE && c->inference_only_flag){
+        fprintf(stderr,"Error: the convolutional layer %d has been built for inference only\n",c->layer);
+        exit(1);
+    }
+    
+    c->mode_flag = mode_flag;
+    if(mode_flag == INFERENCE_MODE){
+        free(c->pooling_indices);
+        c->pooling_indices = NULL;
+    }
+    else if(c->pooling_flag == MAX_POOLING && c->pooling_indices == NULL){
+        c->pooling_indices = (unsigned short*)calloc(c->n_kernels*c->rows2*c->cols2,sizeof(unsigned short));
+    }
+}
+
+/* This function frees the partial derivatives, the arrays of the optimizers and the arrays
+ * used only by the back propagation of a convolutional layer, the layer keeps kernels, biases
+ * and the feed forward arrays and it stays in INFERENCE_MODE.
+ * It must be called before the layer is moved in a model arena (see inference_network)
+ * 
+ * Input:
+ *             @ cl* c:= the convolutional layer
+ * 
+ * */
+void set_convolutional_inference_only(cl* c){
+    if(c == NULL || c->inference_only_flag)
+        return;
+    if(c->arena_flag){
+        fprintf(stderr,"Error: the convolutional layer %d belongs already to a model\n",c->layer);
+        exit(1);
+    }
+    int i;
+    set_convolutional_mode(c,INFERENCE_MODE);
+    free(c->d_kernels[0]);
+    free(c->d1_kernels[0]);
+    free(c->d2_kernels[0]);
+    for(i = 0; i < c->n_kernels; i++){
+        c->d_kernels[i] = NULL;
+        c->d1_kernels[i] = NULL;
+        c->d2_kernels[i] = NULL;
+    }
+    free(c->d_biases);
+    free(c->d1_biases);
+    free(c->d2_biases);
+    free(c->temp);
+    free(c->temp2);
+    free(c->temp3);
+    free(c->error2);
+    free(c->winograd_d_kernels);
+    c->d_biases = NULL;
+    c->d1_biases = NULL;
+    c->d2_biases = NULL;
+    c->temp = NULL;
+    c->temp2 = NULL;
+    c->temp3 = NULL;
+    c->error2 = NULL;
+    c->winograd_d_kernels = NULL;
+    c->inference_only_flag = 1;
+}
+
 /* This function builds a residual layer according to the rl structure defined in layers.h
  * 
  * Input:
@@ -313,6 +551,23 @@ void free_residual(rl* r){
     free(r);
 }
 
+/* This function calls set_convolutional_inference_only for the convolutional layers
+ * of a residual layer and for its output layer
+ * 
+ * Input:
+ *             @ rl* r:= the residual layer
+ * 
+ * */
+void set_residual_inference_only(rl* r){
+    if(r == NULL)
+        return;
+    int i;
+    for(i = 0; i < r->n_cl; i++){
+        set_convolutional_inference_only(r->cls[i]);
+    }
+    set_convolutional_inference_only(r->cl_output);
+}
+
 
 /* this functions build a batch normalization layer
  * 
@@ -332,6 +587,9 @@ bn* batch_normalization(int batch_size, int vector_input_dimension, int layer, i
     b->layer = layer;
     b->batch_size = batch_size; 
     b->vector_dim = vector_input_dimension;
+    b->activation_flag = activation_flag;
+    b->epsilon = EPSILON;
+    b->momentum = BATCH_NORMALIZATION_MOMENTUM;
     
     b->input_vectors = (float**)malloc(sizeof(float*)*batch_size); 
     b->temp_vectors = (float**)malloc(sizeof(float*)*batch_size); 
@@ -340,20 +598,23 @@ bn* batch_normalization(int batch_size, int vector_input_dimension, int layer, i
     b->outputs = (float**)malloc(sizeof(float*)*batch_size);
     b->post_activation = (float**)malloc(sizeof(float*)*batch_size);
     
-    b->gamma = (float*)calloc(vector_input_dimension,sizeof(float));
+    b->gamma = layers_parameters_flag ? (float*)calloc(vector_input_dimension,sizeof(float)) : NULL;
     b->d_gamma = (float*)calloc(vector_input_dimension,sizeof(float));
     b->d1_gamma = (float*)calloc(vector_input_dimension,sizeof(float));
     b->d2_gamma = (float*)calloc(vector_input_dimension,sizeof(float));
-    b->beta = (float*)calloc(vector_input_dimension,sizeof(float));
+    b->beta = layers_parameters_flag ? (float*)calloc(vector_input_dimension,sizeof(float)) : NULL;
     b->d_beta = (float*)calloc(vector_input_dimension,sizeof(float));
     b->d1_beta = (float*)calloc(vector_input_dimension,sizeof(float));
     b->d2_beta = (float*)calloc(vector_input_dimension,sizeof(float));
     b->mean = (float*)calloc(vector_input_dimension,sizeof(float));
     b->var = (float*)calloc(vector_input_dimension,sizeof(float));
-    b->temp2 = (float*)calloc(vector_input_dimension,sizeof(float));
+    b->inv_std = (float*)calloc(vector_input_dimension,sizeof(float));
+    b->temp2 = (float*)calloc(2*vector_input_dimension,sizeof(float));
     b->final_mean = (float*)calloc(vector_input_dimension,sizeof(float));
     b->final_var = (float*)calloc(vector_input_dimension,sizeof(float));
     b->mode_flag = BATCH_NORMALIZATION_TRAINING_MODE;
+    b->arena_flag = 0;
+    b->inference_only_flag = 0;
     
     for(i = 0; i < batch_size; i++){
         b->input_vectors[i] = (float*)calloc(vector_input_dimension,sizeof(float));
@@ -365,7 +626,9 @@ bn* batch_normalization(int batch_size, int vector_input_dimension, int layer, i
     }
     
     for(i = 0; i < vector_input_dimension; i++){
-        b->gamma[i] = 1;
+        if(layers_parameters_flag)
+            b->gamma[i] = 1;
+        b->final_var[i] = 1;
     }
     
     return b;
@@ -397,20 +660,64 @@ void free_batch_normalization(bn* b){
     free(b->outputs);
     free(b->post_activation);
     
-    free(b->gamma);
+    if(!b->arena_flag){
+        free(b->gamma);
+        free(b->d_gamma);
+        free(b->d1_gamma);
+        free(b->d2_gamma);
+        free(b->beta);
+        free(b->d_beta);
+        free(b->d1_beta);
+        free(b->d2_beta);
+    }
+    free(b->temp2);
+    free(b->final_mean);
+    free(b->final_var);
+    free(b->mean);
+    free(b->var);
+    free(b->inv_std);
+    free(b);
+}
+
+/* This function frees the partial derivatives, the arrays of the optimizers and the arrays
+ * used only by the back propagation of a batch normalized layer, the layer keeps gamma, beta,
+ * the final mean and variance and the feed forward arrays and it stays in BATCH_NORMALIZATION_FINAL_MODE.
+ * It must be called before the layer is moved in a bmodel arena (see inference_batch_network)
+ * 
+ * Input:
+ *             @ bn* b:= the batch normalized layer
+ * 
+ * */
+void set_batch_normalization_inference_only(bn* b){
+    if(b == NULL || b->inference_only_flag)
+        return;
+    if(b->arena_flag){
+        fprintf(stderr,"Error: the batch normalization layer %d belongs already to a model\n",b->layer);
+        exit(1);
+    }
+    int i;
+    for(i = 0; i < b->batch_size; i++){
+        free(b->error2[i]);
+        free(b->temp1[i]);
+        b->error2[i] = NULL;
+        b->temp1[i] = NULL;
+    }
     free(b->d_gamma);
     free(b->d1_gamma);
     free(b->d2_gamma);
-    free(b->beta);
     free(b->d_beta);
     free(b->d1_beta);
     free(b->d2_beta);
     free(b->temp2);
-    free(b->final_mean);
-    free(b->final_var);
-    free(b->mean);
-    free(b->var);
-    free(b);
+    b->d_gamma = NULL;
+    b->d1_gamma = NULL;
+    b->d2_gamma = NULL;
+    b->d_beta = NULL;
+    b->d1_beta = NULL;
+    b->d2_beta = NULL;
+    b->temp2 = NULL;
+    b->mode_flag = BATCH_NORMALIZATION_FINAL_MODE;
+    b->inference_only_flag = 1;
 }
 
 /* This function saves a batch normalized layer on a .bin file with name n.bin
@@ -551,7 +858,7 @@ bn* load_bn(FILE* fr){
     final_mean = (float*)malloc(sizeof(float)*vector_dim);
     final_var = (float*)malloc(sizeof(float)*vector_dim);
     
-    i = fread(&gamma,sizeof(float)*vector_dim,1,fr);
+    i = fread(gamma,sizeof(float)*vector_dim,1,fr);
     
     if(i != 1){
         fprintf(stderr,"Error: an error occurred loading a bn layer\n");
@@ -559,14 +866,14 @@ bn* load_bn(FILE* fr){
     }
     
     
-    i = fread(&beta,sizeof(float)*vector_dim,1,fr);
+    i = fread(beta,sizeof(float)*vector_dim,1,fr);
     
     if(i != 1){
         fprintf(stderr,"Error: an error occurred loading a bn layer\n");
         exit(1);
     }
     
-    i = fread(&final_mean,sizeof(float)*vector_dim,1,fr);
+    i = fread(final_mean,sizeof(float)*vector_dim,1,fr);
     
     if(i != 1){
         fprintf(stderr,"Error: an error occurred loading a bn layer\n");
@@ -574,7 +881,7 @@ bn* load_bn(FILE* fr){
     }
     
     
-    i = fread(&final_var,sizeof(float)*vector_dim,1,fr);
+    i = fread(final_var,sizeof(float)*vector_dim,1,fr);
     
     if(i != 1){
         fprintf(stderr,"Error: an error occurred loading a bn layer\n");
@@ -1045,6 +1352,7 @@ void copy_cl_params(cl* f, float** kernels, float* biases){
         }
         f->biases[i] = biases[i];
     }
+    f->winograd_kernels_flag = 0;
 }
 
 /* This function loads a convolutional layer from a .bin file from fr
@@ -1410,16 +1718,12 @@ bn* copy_bn(bn* b){
     if(b == NULL)
         return NULL;
     bn* copy = batch_normalization(b->batch_size,b->vector_dim, b->layer, b->activation_flag);
-    copy_array(b->gamma,copy->gamma,b->vector_dim);
-    copy_array(b->d_gamma,copy->d_gamma,b->vector_dim);
-    copy_array(b->d1_gamma,copy->d1_gamma,b->vector_dim);
-    copy_array(b->d2_gamma,copy->d2_gamma,b->vector_dim);
-    copy_array(b->beta,copy->beta,b->vector_dim);
-    copy_array(b->d_beta,copy->d_beta,b->vector_dim);
-    copy_array(b->d1_beta,copy->d1_beta,b->vector_dim);
-    copy_array(b->d2_beta,copy->d2_beta,b->vector_dim);
-    copy_array(b->final_mean,copy->final_mean,b->vector_dim);
-    copy_array(b->final_var,copy->final_var,b->vector_dim);
+    if(b->inference_only_flag)
+        set_batch_normalization_inference_only(copy);
+    paste_bn(b,copy);
+    copy->epsilon = b->epsilon;
+    copy->momentum = b->momentum;
+    copy->mode_flag = b->mode_flag;
     
     return copy;
 }
@@ -1440,14 +1744,9 @@ fcl* copy_fcl(fcl* f){
     if(f == NULL)
         return NULL;
     fcl* copy = fully_connected(f->input, f->output,f->layer, f->dropout_flag,f->activation_flag,f->dropout_threshold);
-    copy_array(f->weights,copy->weights,f->output*f->input);
-    copy_array(f->d_weights,copy->d_weights,f->output*f->input);
-    copy_array(f->d1_weights,copy->d1_weights,f->output*f->input);
-    copy_array(f->d2_weights,copy->d2_weights,f->output*f->input);
-    copy_array(f->biases,copy->biases,f->output);
-    copy_array(f->d_biases,copy->d_biases,f->output);
-    copy_array(f->d1_biases,copy->d1_biases,f->output);
-    copy_array(f->d2_biases,copy->d2_biases,f->output);
+    if(f->inference_only_flag)
+        set_fully_connected_inference_only(copy);
+    paste_fcl(f,copy);
     return copy;
 }
 
@@ -1468,18 +1767,12 @@ cl* copy_cl(cl* f){
         return NULL;
     cl* copy = convolutional(f->channels,f->input_rows,f->input_cols,f->kernel_rows,f->kernel_cols,f->n_kernels,f->stride1_rows,f->stride1_cols,f->padding1_rows,f->padding1_cols,f->stride2_rows,f->stride2_cols,f->padding2_rows,f->padding2_cols,f->pooling_rows,f->pooling_cols,f->normalization_flag,f->activation_flag,f->pooling_flag,f->layer, f->convolutional_flag);
     
-    int i;
-    for(i = 0; i < f->n_kernels; i++){
-        copy_array(f->kernels[i],copy->kernels[i],f->channels*f->kernel_rows*f->kernel_cols);
-        copy_array(f->d_kernels[i],copy->d_kernels[i],f->channels*f->kernel_rows*f->kernel_cols);
-        copy_array(f->d1_kernels[i],copy->d1_kernels[i],f->channels*f->kernel_rows*f->kernel_cols);
-        copy_array(f->d2_kernels[i],copy->d2_kernels[i],f->channels*f->kernel_rows*f->kernel_cols);
-    }
+    if(f->inference_only_flag)
+        set_convolutional_inference_only(copy);
+    paste_cl(f,copy);
     
-    copy_array(f->biases,copy->biases,f->n_kernels);
-    copy_array(f->d_biases,copy->d_biases,f->n_kernels);
-    copy_array(f->d1_biases,copy->d1_biases,f->n_kernels);
-    copy_array(f->d2_biases,copy->d2_biases,f->n_kernels);
+    set_convolutional_algorithm(copy,f->algorithm_flag);
+    set_convolutional_mode(copy,f->mode_flag);
     
     return copy;
 }
@@ -1508,6 +1801,8 @@ rl* copy_rl(rl* f){
     }
     
     rl* copy = residual(f->channels, f->input_rows, f->input_cols, f->n_cl, cls);
+    if(f->cl_output->inference_only_flag)
+        set_residual_inference_only(copy);
     return copy;
 }
 
@@ -1521,6 +1816,25 @@ rl* copy_rl(rl* f){
  * 
  * */
 bn* reset_bn(bn* b){
+    if(b == NULL)
+        return NULL;
+    reset_bn_except_partial_derivatives(b);
+    if(b->inference_only_flag)
+        return b;
+    memset(b->d_gamma,0,sizeof(float)*b->vector_dim);
+    memset(b->d_beta,0,sizeof(float)*b->vector_dim);
+    return b;
+}
+
+/* same as reset_bn but d_gamma and d_beta are not touched,
+ * used by the bmodels that reset all the partial derivatives at once in their arena
+ * 
+ * Input:
+ * 
+ *             @ bn* b:= a bn* f layer
+ * 
+ * */
+bn* reset_bn_except_partial_derivatives(bn* b){
     if(b == NULL)
         return NULL;
     int i,j;
@@ -1530,16 +1844,18 @@ bn* reset_bn(bn* b){
             b->temp_vectors[j][i] = 0;
             b->outputs[j][i] = 0;
             b->post_activation[j][i] = 0;
-            b->error2[j][i] = 0;
-            b->temp1[j][i] = 0;
+            if(!b->inference_only_flag){
+                b->error2[j][i] = 0;
+                b->temp1[j][i] = 0;
+            }
         }
         
-        b->d_gamma[i] = 0; 
-        b->d_beta[i] = 0; 
-        b->temp2[i] = 0; 
+        if(!b->inference_only_flag)
+            b->temp2[i] = 0; 
         b->mean[i] = 0; 
         b->var[i] = 0; 
     } 
+    return b;
 }
 
 
@@ -1556,26 +1872,44 @@ bn* reset_bn(bn* b){
  * 
  * */
 fcl* reset_fcl(fcl* f){
+    if(f == NULL)
+        return NULL;
+    reset_fcl_except_partial_derivatives(f);
+    if(f->inference_only_flag)
+        return f;
+    memset(f->d_weights,0,sizeof(float)*f->output*f->input);
+    memset(f->d_biases,0,sizeof(float)*f->output);
+    return f;
+}
+
+/* same as reset_fcl but d_weights and d_biases are not touched,
+ * used by the models that reset all the partial derivatives at once in their arena
+ * 
+ * Input:
+ * 
+ *             @ fcl* f:= a fcl* f layer
+ * 
+ * */
+fcl* reset_fcl_except_partial_derivatives(fcl* f){
     if(f == NULL)
         return NULL;
     int i;
-    for(i = 0; i < f->output*f->input; i++){
-        if(i < f->output){
-            f->pre_activation[i] = 0;
-            f->post_activation[i] = 0;
-            f->d_biases[i] = 0;
-            if(f->dropout_flag)
-                f->dropout_mask[i] = 1;
-            f->dropout_temp[i] = 0;
-            f->temp[i] = 0;
-            f->temp3[i] = 0;
-            
-        }
-        if(i < f->input){
-            f->temp2[i] = 0;
-            f->error2[i] = 0;
-        }
-        f->d_weights[i] = 0;
+    for(i = 0; i < f->output; i++){
+        f->pre_activation[i] = 0;
+        f->post_activation[i] = 0;
+        if(f->dropout_flag)
+            f->dropout_mask[i] = 1;
+        f->dropout_temp[i] = 0;
+    }
+    if(f->inference_only_flag)
+        return f;
+    for(i = 0; i < f->output; i++){
+        f->temp[i] = 0;
+        f->temp3[i] = 0;
+    }
+    for(i = 0; i < f->input; i++){
+        f->temp2[i] = 0;
+        f->error2[i] = 0;
     }
     return f;
 }
@@ -1593,31 +1927,48 @@ fcl* reset_fcl(fcl* f){
  * 
  * */
 cl* reset_cl(cl* f){
+    if(f == NULL)
+        return NULL;
+    reset_cl_except_partial_derivatives(f);
+    if(f->inference_only_flag)
+        return f;
+    memset(f->d_kernels[0],0,sizeof(float)*f->n_kernels*f->channels*f->kernel_rows*f->kernel_cols);
+    memset(f->d_biases,0,sizeof(float)*f->n_kernels);
+    return f;
+}
+
+/* same as reset_cl but d_kernels and d_biases are not touched,
+ * used by the models that reset all the partial derivatives at once in their arena
+ * 
+ * Input:
+ * 
+ *             @ cl* f:= a cl* f layer
+ * 
+ * */
+cl* reset_cl_except_partial_derivatives(cl* f){
     if(f == NULL)
         return NULL;
     
-    int i,j;
-    for(i = 0; i < f->n_kernels; i++){
-        for(j = 0; j < f->channels*f->kernel_rows*f->kernel_cols; j++){
-            f->d_kernels[i][j] = 0;
-        }
-        
-        f->d_biases[i] = 0;
-    }
-    
+    int i;
     for(i = 0; i < f->n_kernels*f->rows1*f->cols1; i++){
         f->pre_activation[i] = 0;
         f->post_activation[i] = 0;
         f->post_normalization[i] = 0;
-        f->temp[i] = 0;
-        f->temp2[i] = 0;
-        f->temp3[i] = 0;
     }
     
     for(i = 0; i < f->n_kernels*f->rows2*f->cols2; i++){
         f->post_pooling[i] = 0;
     }
     
+    if(f->inference_only_flag)
+        return f;
+    
+    for(i = 0; i < f->n_kernels*f->rows1*f->cols1; i++){
+        f->temp[i] = 0;
+        f->temp2[i] = 0;
+        f->temp3[i] = 0;
+    }
+    
     for(i = 0; i < f->channels*f->input_rows*f->input_cols; i++){
         f->error2[i] = 0;
     }
@@ -1655,6 +2006,32 @@ rl* reset_rl(rl* f){
     return f;
 }
 
+/* same as reset_rl but the partial derivatives of the convolutional layers inside the residual layer
+ * are not touched (the ones of cl_output are not in the arena and they are resetted)
+ * 
+ * Input:
+ * 
+ *             @ rl* f:= a rl* f layer
+ * 
+ * */
+rl* reset_rl_except_partial_derivatives(rl* f){
+    if(f == NULL)
+        return NULL;
+    
+    int i;
+    for(i = 0; i < f->n_cl; i++){
+        reset_cl_except_partial_derivatives(f->cls[i]);
+    }
+    
+    reset_cl(f->cl_output);
+    
+    for(i = 0; i < f->channels*f->input_rows*f->input_cols; i++){
+        f->input[i] = 0;
+    }
+    
+    return f;
+}
+
 /* this function compute the space allocated by the arrays of f
  * 
  * Input:
@@ -1664,6 +2041,11 @@ rl* reset_rl(rl* f){
  * */
 unsigned long long int size_of_fcls(fcl* f){
     unsigned long long int sum = 0;
+    if(f->inference_only_flag){
+        sum += ((unsigned long long int)(f->input*f->output*sizeof(float)));
+        sum += ((unsigned long long int)(f->output*5*sizeof(float)));
+        return sum;
+    }
     sum += ((unsigned long long int)(f->input*f->output*4*sizeof(float)));
     sum += ((unsigned long long int)(f->output*10*sizeof(float)));
     sum += ((unsigned long long int)(f->input*2*sizeof(float)));
@@ -1680,11 +2062,23 @@ unsigned long long int size_of_fcls(fcl* f){
  * */
 unsigned long long int size_of_cls(cl* f){
     unsigned long long int sum = 0;
-    sum += ((unsigned long long int)(f->n_kernels*f->channels*f->kernel_cols*f->kernel_rows*4*sizeof(float)));
-    sum += ((unsigned long long int)(f->n_kernels*4*sizeof(float)));
-    sum += ((unsigned long long int)(f->n_kernels*f->rows1*f->cols1*6*sizeof(float)));
+    int slabs = f->inference_only_flag ? 1 : 4;
+    sum += ((unsigned long long int)(f->n_kernels*f->channels*f->kernel_cols*f->kernel_rows*slabs*sizeof(float)));
+    sum += ((unsigned long long int)(f->n_kernels*slabs*sizeof(float)));
+    sum += ((unsigned long long int)(f->n_kernels*f->rows1*f->cols1*(f->inference_only_flag ? 3 : 6)*sizeof(float)));
     sum += ((unsigned long long int)(f->n_kernels*f->rows2*f->cols2*sizeof(float)));
-    sum += ((unsigned long long int)(f->channels*f->input_rows*f->input_cols*sizeof(float)));
+    if(!f->inference_only_flag)
+        sum += ((unsigned long long int)(f->channels*f->input_rows*f->input_cols*sizeof(float)));
+    if(f->algorithm_flag == IM2COL_CONVOLUTION){
+        sum += ((unsigned long long int)((f->channels*f->kernel_rows*f->kernel_cols+f->n_kernels)*f->batch_size*((f->input_rows-f->kernel_rows)/f->stride1_rows + 1)*((f->input_cols-f->kernel_cols)/f->stride1_cols + 1)*sizeof(float)));
+    }
+    else if(f->algorithm_flag == WINOGRAD_CONVOLUTION){
+        sum += ((unsigned long long int)(WINOGRAD_TILE*(f->channels+f->n_kernels)*f->batch_size*((f->input_rows-1)/2)*((f->input_cols-1)/2)*sizeof(float)));
+        sum += ((unsigned long long int)(WINOGRAD_TILE*f->n_kernels*f->channels*(f->inference_only_flag ? 1 : 2)*sizeof(float)));
+    }
+    if(f->pooling_indices != NULL){
+        sum += ((unsigned long long int)(f->n_kernels*f->rows2*f->cols2*sizeof(unsigned short)));
+    }
     return sum;
 }
 
@@ -1718,6 +2112,11 @@ unsigned long long int size_of_rls(rl* f){
  * */
 unsigned long long int size_of_bn(bn* b){
     unsigned long long int sum = 0;
+    if(b->inference_only_flag){
+        sum+= (b->batch_size*b->vector_dim*4);
+        sum+= (b->vector_dim*7);
+        return sum;
+    }
     sum+= (b->batch_size*b->vector_dim*6);
     sum+= (b->vector_dim*13);
     return sum;
@@ -1738,10 +2137,12 @@ void paste_fcl(fcl* f,fcl* copy){
     if(f == NULL)
         return;
     copy_array(f->weights,copy->weights,f->output*f->input);
+    copy_array(f->biases,copy->biases,f->output);
+    if(f->inference_only_flag || copy->inference_only_flag)
+        return;
     copy_array(f->d_weights,copy->d_weights,f->output*f->input);
     copy_array(f->d1_weights,copy->d1_weights,f->output*f->input);
     copy_array(f->d2_weights,copy->d2_weights,f->output*f->input);
-    copy_array(f->biases,copy->biases,f->output);
     copy_array(f->d_biases,copy->d_biases,f->output);
     copy_array(f->d1_biases,copy->d1_biases,f->output);
     copy_array(f->d2_biases,copy->d2_biases,f->output);
@@ -1784,14 +2185,20 @@ void paste_cl(cl* f, cl* copy){
         return;
     
     int i;
+    copy->winograd_kernels_flag = 0;
     for(i = 0; i < f->n_kernels; i++){
         copy_array(f->kernels[i],copy->kernels[i],f->channels*f->kernel_rows*f->kernel_cols);
+    }
+    copy_array(f->biases,copy->biases,f->n_kernels);
+    if(f->inference_only_flag || copy->inference_only_flag)
+        return;
+    
+    for(i = 0; i < f->n_kernels; i++){
         copy_array(f->d_kernels[i],copy->d_kernels[i],f->channels*f->kernel_rows*f->kernel_cols);
         copy_array(f->d1_kernels[i],copy->d1_kernels[i],f->channels*f->kernel_rows*f->kernel_cols);
         copy_array(f->d2_kernels[i],copy->d2_kernels[i],f->channels*f->kernel_rows*f->kernel_cols);
     }
     
-    copy_array(f->biases,copy->biases,f->n_kernels);
     copy_array(f->d_biases,copy->d_biases,f->n_kernels);
     copy_array(f->d1_biases,copy->d1_biases,f->n_kernels);
     copy_array(f->d2_biases,copy->d2_biases,f->n_kernels);
@@ -1820,6 +2227,7 @@ void slow_paste_cl(cl* f, cl* copy,float tau){
         
         copy->biases[i] = tau*f->biases[i] + (1-tau)*copy->biases[i];
     }
+    copy->winograd_kernels_flag = 0;
     
     return;
 }
@@ -1838,15 +2246,17 @@ void paste_bn(bn* b1, bn* b2){
         return;
     
     copy_array(b1->gamma,b2->gamma,b1->vector_dim);
+    copy_array(b1->beta,b2->beta,b1->vector_dim);
+    copy_array(b1->final_mean,b2->final_mean,b1->vector_dim);
+    copy_array(b1->final_var,b2->final_var,b1->vector_dim);
+    if(b1->inference_only_flag || b2->inference_only_flag)
+        return;
     copy_array(b1->d_gamma,b2->d_gamma,b1->vector_dim);
     copy_array(b1->d1_gamma,b2->d1_gamma,b1->vector_dim);
     copy_array(b1->d2_gamma,b2->d2_gamma,b1->vector_dim);
-    copy_array(b1->beta,b2->beta,b1->vector_dim);
     copy_array(b1->d_beta,b2->d_beta,b1->vector_dim);
     copy_array(b1->d1_beta,b2->d1_beta,b1->vector_dim);
     copy_array(b1->d2_beta,b2->d2_beta,b1->vector_dim);
-    copy_array(b1->final_mean,b2->final_mean,b1->vector_dim);
-    copy_array(b1->final_var,b2->final_var,b1->vector_dim);
     
     return;
 }
@@ -1918,3 +2328,116 @@ void slow_paste_rl(rl* f, rl* copy,float tau){
     return;
 }
 
+
+
+/* This function copies an array in a slab of an arena and frees it
+ * 
+ * Input:
+ * 
+ *             @ float* array:= the array, it is freed
+ *             @ float* slab:= the slab, NULL if the arena has not this slab (see inference_parameters_arena)
+ *             @ int offset:= the position in the slab
+ *             @ int size:= the size of the array
+ * 
+ * returns the position in the slab (NULL if the slab is NULL)
+ * */
+static float* move_array_to_arena(float* array, float* slab, int offset, int size){
+    if(slab == NULL){
+        free(array);
+        return NULL;
+    }
+    if(array != NULL)
+        memcpy(&slab[offset],array,sizeof(float)*size);
+    free(array);
+    return &slab[offset];
+}
+
+/* This function moves weights, biases and their D, D1, D2 of a fully-connected layer
+ * inside the slabs of a model arena, the layer keeps only the views
+ * 
+ * Input:
+ * 
+ *             @ fcl* f:= the fully-connected layer
+ *             @ float** arena:= the ARENA_SLABS slabs: parameters, D, D1, D2
+ *             @ int weights_offset:= the position of the weights in each slab
+ *             @ int biases_offset:= the position of the biases in each slab
+ * 
+ * */
+void move_fcl_to_arena(fcl* f, float** arena, int weights_offset, int biases_offset){
+    if(f->arena_flag){
+        fprintf(stderr,"Error: the fully-connected layer %d belongs already to a model\n",f->layer);
+        exit(1);
+    }
+    f->weights = move_array_to_arena(f->weights,arena[0],weights_offset,f->output*f->input);
+    f->d_weights = move_array_to_arena(f->d_weights,arena[1],weights_offset,f->output*f->input);
+    f->d1_weights = move_array_to_arena(f->d1_weights,arena[2],weights_offset,f->output*f->input);
+    f->d2_weights = move_array_to_arena(f->d2_weights,arena[3],weights_offset,f->output*f->input);
+    f->biases = move_array_to_arena(f->biases,arena[0],biases_offset,f->output);
+    f->d_biases = move_array_to_arena(f->d_biases,arena[1],biases_offset,f->output);
+    f->d1_biases = move_array_to_arena(f->d1_biases,arena[2],biases_offset,f->output);
+    f->d2_biases = move_array_to_arena(f->d2_biases,arena[3],biases_offset,f->output);
+    f->arena_flag = 1;
+}
+
+/* This function moves kernels, biases and their D, D1, D2 of a convolutional layer
+ * inside the slabs of a model arena, the layer keeps only the views
+ * 
+ * Input:
+ * 
+ *             @ cl* c:= the convolutional layer
+ *             @ float** arena:= the ARENA_SLABS slabs: parameters, D, D1, D2
+ *             @ int kernels_offset:= the position of the kernels in each slab
+ *             @ int biases_offset:= the position of the biases in each slab
+ * 
+ * */
+void move_cl_to_arena(cl* c, float** arena, int kernels_offset, int biases_offset){
+    if(c->arena_flag){
+        fprintf(stderr,"Error: the convolutional layer %d belongs already to a model\n",c->layer);
+        exit(1);
+    }
+    int i, kernel_size = c->channels*c->kernel_rows*c->kernel_cols;
+    c->kernels[0] = move_array_to_arena(c->kernels[0],arena[0],kernels_offset,c->n_kernels*kernel_size);
+    c->d_kernels[0] = move_array_to_arena(c->d_kernels[0],arena[1],kernels_offset,c->n_kernels*kernel_size);
+    c->d1_kernels[0] = move_array_to_arena(c->d1_kernels[0],arena[2],kernels_offset,c->n_kernels*kernel_size);
+    c->d2_kernels[0] = move_array_to_arena(c->d2_kernels[0],arena[3],kernels_offset,c->n_kernels*kernel_size);
+    for(i = 1; i < c->n_kernels; i++){
+        c->kernels[i] = c->kernels[0] + i*kernel_size;
+        if(c->d_kernels[0] != NULL){
+            c->d_kernels[i] = c->d_kernels[0] + i*kernel_size;
+            c->d1_kernels[i] = c->d1_kernels[0] + i*kernel_size;
+            c->d2_kernels[i] = c->d2_kernels[0] + i*kernel_size;
+        }
+    }
+    c->biases = move_array_to_arena(c->biases,arena[0],biases_offset,c->n_kernels);
+    c->d_biases = move_array_to_arena(c->d_biases,arena[1],biases_offset,c->n_kernels);
+    c->d1_biases = move_array_to_arena(c->d1_biases,arena[2],biases_offset,c->n_kernels);
+    c->d2_biases = move_array_to_arena(c->d2_biases,arena[3],biases_offset,c->n_kernels);
+    c->arena_flag = 1;
+}
+
+/* This function moves gamma, beta and their D, D1, D2 of a batch normalization layer
+ * inside the slabs of a bmodel arena, the layer keeps only the views
+ * 
+ * Input:
+ * 
+ *             @ bn* b:= the batch normalization layer
+ *             @ float** arena:= the ARENA_SLABS slabs: parameters, D, D1, D2
+ *             @ int gamma_offset:= the position of gamma in each slab
+ *             @ int beta_offset:= the position of beta in each slab
+ * 
+ * */
+void move_bn_to_arena(bn* b, float** arena, int gamma_offset, int beta_offset){
+    if(b->arena_flag){
+        fprintf(stderr,"Error: the batch normalization layer %d belongs already to a model\n",b->layer);
+        exit(1);
+    }
+    b->gamma = move_array_to_arena(b->gamma,arena[0],gamma_offset,b->vector_dim);
+    b->d_gamma = move_array_to_arena(b->d_gamma,arena[1],gamma_offset,b->vector_dim);
+    b->d1_gamma = move_array_to_arena(b->d1_gamma,arena[2],gamma_offset,b->vector_dim);
+    b->d2_gamma = move_array_to_arena(b->d2_gamma,arena[3],gamma_offset,b->vector_dim);
+    b->beta = move_array_to_arena(b->beta,arena[0],beta_offset,b->vector_dim);
+    b->d_beta = move_array_to_arena(b->d_beta,arena[1],beta_offset,b->vector_dim);
+    b->d1_beta = move_array_to_arena(b->d1_beta,arena[2],beta_offset,b->vector_dim);
+    b->d2_beta = move_array_to_arena(b->d2_beta,arena[3],beta_offset,b->vector_dim);
+    b->arena_flag = 1;
+}
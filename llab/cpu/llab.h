@@ -7,6 +7,7 @@
 #include <math.h>
 #include <string.h>
 #include <time.h>
+#include <pthread.h>
 
 
 #define N_NORMALIZATION 5
@@ -44,6 +45,71 @@
 #define CONVOLUTION 2
 #define BATCH_NORMALIZATION_TRAINING_MODE 1
 #define BATCH_NORMALIZATION_FINAL_MODE 2
+#define BATCH_NORMALIZATION_MOMENTUM 0.9
+#define NO_TRANSPOSE 0
+#define TRANSPOSE 1
+#define FULLY_CONNECTED_BLOCK 2048
+#define FULLY_CONNECTED_L2_SIZE 524288 // the floats of the weights and weight errors above which fully_connected_back_prop goes 1 row at time (2 MB)
+#define LOCAL_RESPONSE_NORMALIZATION_BLOCK 256
+#define DIRECT_CONVOLUTION 0
+#define IM2COL_CONVOLUTION 1
+#define WINOGRAD_CONVOLUTION 2
+#define WINOGRAD_TILE 16
+#define TRAINING_MODE 1
+#define INFERENCE_MODE 2
+#define MAX_POOLING_WINDOW 65536
+#define FAST_MATH 0
+#define STRICT_MATH 1
+#define ARENA_ALIGNMENT 16 // floats (64 bytes), alignment of each layer view inside the parameters arena
+#define ARENA_SLABS 4
+#define MAPPED_MODEL_VERSION 1
+#define MAPPED_MODEL_ALIGNMENT 64 // bytes, alignment of each section of a mapped model file
+#define MAPPED_MODEL 1
+#define MAPPED_BMODEL 2
+#define MAPPED_RL_DESCRIPTION 4 // ints of the description of a residual layer (see model_description)
+#define MAPPED_CL_DESCRIPTION 21 // ints of the description of a convolutional layer
+#define MAPPED_FCL_DESCRIPTION 6 // ints of the description of a fully-connected layer
+#define MAPPED_BN_DESCRIPTION 4 // ints of the description of a batch normalization layer
+#define CHECKPOINT_VERSION 1
+#define PARALLEL_GRAIN 32768 // the minimum number of multiply-adds of each chunk of the kernels split by parallel_for
+#define ISA_SSE2 0
+#define ISA_AVX 1
+#define ISA_AVX2 2 // avx2 + fma
+#define ISA_AVX512 3 // avx512 f, dq, bw, vl + fma
+
+/* The kernels are written once in an always inline function name_kernel, ISA_DISPATCH compiles it
+ * for each instruction set and defines name, that calls the version chosen at startup (see isa.c).
+ * ISA_DISPATCH is for the void kernels, ISA_DISPATCH_RETURN for the kernels that return a type*/
+#define ISA_INLINE static inline __attribute__((always_inline))
+#define ISA_TARGET_AVX512 __attribute__((target("avx512f,avx512dq,avx512bw,avx512vl,avx2,fma,prefer-vector-width=512")))
+#define ISA_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#define ISA_TARGET_AVX __attribute__((target("avx")))
+#define ISA_DISPATCH(storage, name, params, args) \
+    ISA_TARGET_AVX512 static void name##_avx512 params {name##_kernel args;} \
+    ISA_TARGET_AVX2 static void name##_avx2 params {name##_kernel args;} \
+    ISA_TARGET_AVX static void name##_avx params {name##_kernel args;} \
+    static void name##_sse2 params {name##_kernel args;} \
+    storage void name params { \
+        switch(get_isa()){ \
+            case ISA_AVX512: name##_avx512 args; break; \
+            case ISA_AVX2: name##_avx2 args; break; \
+            case ISA_AVX: name##_avx args; break; \
+            default: name##_sse2 args; \
+        } \
+    }
+#define ISA_DISPATCH_RETURN(storage, type, name, params, args) \
+    ISA_TARGET_AVX512 static type name##_avx512 params {return name##_kernel args;} \
+    ISA_TARGET_AVX2 static type name##_avx2 params {return name##_kernel args;} \
+    ISA_TARGET_AVX static type name##_avx params {return name##_kernel args;} \
+    static type name##_sse2 params {return name##_kernel args;} \
+    storage type name params { \
+        switch(get_isa()){ \
+            case ISA_AVX512: return name##_avx512 args; \
+            case ISA_AVX2: return name##_avx2 args; \
+            case ISA_AVX: return name##_avx args; \
+            default: return name##_sse2 args; \
+        } \
+    }
 
 /* LAYERS MUST START FROM 0*/
 typedef struct fcl { //fully-connected-layers
@@ -66,6 +132,8 @@ typedef struct fcl { //fully-connected-layers
     float* temp2;//input
     float* error2;//input
     float dropout_threshold;
+    int arena_flag;// = 1 if weights, biases and their D, D1, D2 are views of a model arena (they are freed with the model)
+    int inference_only_flag;// = 1 if the layer has only weights, biases and the feed forward arrays (see set_fully_connected_inference_only)
 } fcl;
 
 /* PADDING_ROWS MUST BE = PADDING_COLS AND ALSO STRIDE_ROWS = STRIDE_COLS*/
@@ -77,6 +145,10 @@ typedef struct cl { //convolutional-layers
     int pooling_rows, pooling_cols;
     int normalization_flag, activation_flag, pooling_flag; // activation flag = 0, no activation, = 1 sigmoid, = 2 relu, pooling flag = 1 max-pooling, = 2 avarage-pooling
     int rows1, cols1, rows2,cols2;
+    int algorithm_flag; // algorithm flag = 0 direct convolution, = 1 im2col + sgemm, = 2 winograd F(2x2,3x3)
+    int batch_size; // the instances that col and col_temp can hold (see set_convolutional_batch_size)
+    int winograd_kernels_flag; // = 1 if winograd_kernels is the transform of the current kernels
+    int mode_flag; // mode flag = 1 training, = 2 inference (no backpropagation)
     float** kernels; //n_kernels - channels*kernel_rows*kernel_cols
     float** d_kernels; //n_kernels - channels*kernel_rows*kernel_cols
     float** d1_kernels; //n_kernels - channels*kernel_rows*kernel_cols
@@ -93,6 +165,13 @@ typedef struct cl { //convolutional-layers
     float* temp2;//n_kernels*rows1*cols1
     float* temp3;//n_kernels*rows1*cols1
     float* error2;//channels*input_rows*input_cols
+    float* col;//channels*kernel_rows*kernel_cols*batch_size*((input_rows-kernel_rows)/stride1_rows +1)*((input_cols-kernel_cols)/stride1_cols +1) with IM2COL_CONVOLUTION, 16*channels*batch_size*((input_rows-1)/2)*((input_cols-1)/2) with WINOGRAD_CONVOLUTION
+    float* col_temp;//n_kernels*batch_size*((input_rows-kernel_rows)/stride1_rows +1)*((input_cols-kernel_cols)/stride1_cols +1) with IM2COL_CONVOLUTION, 16*n_kernels*batch_size*((input_rows-1)/2)*((input_cols-1)/2) with WINOGRAD_CONVOLUTION
+    float* winograd_kernels;//16*n_kernels*channels, only with WINOGRAD_CONVOLUTION
+    float* winograd_d_kernels;//16*n_kernels*channels, only with WINOGRAD_CONVOLUTION
+    unsigned short* pooling_indices;//n_kernels*rows2*cols2, only with MAX_POOLING in TRAINING_MODE
+    int arena_flag;// = 1 if kernels, biases and their D, D1, D2 are views of a model arena (they are freed with the model)
+    int inference_only_flag;// = 1 if the layer has only kernels, biases and the feed forward arrays (see set_convolutional_inference_only)
 } cl;
 
 typedef struct rl { //residual-layers
@@ -106,6 +185,7 @@ typedef struct rl { //residual-layers
 typedef struct bn{//batch_normalization layer
     int batch_size, vector_dim, layer, activation_flag, mode_flag;
     float epsilon;
+    float momentum;//the final mean and variance are updated as final = momentum*final + (1-momentum)*batch statistic
     float** input_vectors;//batch_size*vector_dim
     float** temp_vectors;//batch_size*vector_dim
     float* gamma;//vector_dim
@@ -118,21 +198,80 @@ typedef struct bn{//batch_normalization layer
     float* d2_beta;//vector_dim
     float* mean;//vector_dim
     float* var;//vector_dim
+    float* inv_std;//vector_dim, 1/sqrt(var+epsilon) of the last feed forward
     float** outputs;//batch_size*vector_dim
     float** error2;//batch_size*vector_dim
     float** temp1;//batch_size*vector_dim
-    float* temp2;//vector_dim
+    float* temp2;//2*vector_dim
     float** post_activation;//batch_size*vector_dim
-    float* final_mean;//vector_dim
-    float* final_var;//vector_dim
+    float* final_mean;//vector_dim, running mean updated by batch_normalization_layer_feed_forward
+    float* final_var;//vector_dim, running variance updated by batch_normalization_layer_feed_forward
+    int arena_flag;// = 1 if gamma, beta and their D, D1, D2 are views of a bmodel arena (they are freed with the bmodel)
+    int inference_only_flag;// = 1 if the layer has only gamma, beta, the final mean and variance and the feed forward arrays
 }bn;
 
+typedef struct model_step {//a step of the feed forward or back propagation plan of a model, built by network()
+    int sla;// FCLS, CLS or RLS, the layer computed in this step
+    fcl* f;// the fully-connected layer if sla = FCLS
+    cl* c;// the convolutional layer if sla = CLS or RLS
+    rl* r;// the residual layer of c if sla = RLS
+    int input_flag;// 0 if the input of the step is the input tensor, FCLS if it is in_f, CLS if it is in_c
+    fcl* in_f;
+    cl* in_c;
+    rl* in_rl;// != NULL if in_c is the cl_output of this residual layer (its activation must be derived in back propagation)
+    void (*in_rl_derivative)(float* input, float* output, int size);// derivative of the activation of in_rl->cl_output, NULL for no activation
+    int rl_first, rl_last;// = 1 if c is the first / last convolutional layer of r
+    int rl_size;// r->channels*r->input_rows*r->input_cols
+    float* rl_copy_source;// copied in r->input by the first layer of r, NULL for the input tensor
+    fcl* rl_copy_dropout;// if != NULL and its dropout is on rl_copy_source is multiplied by its dropout mask
+    float* rl_sum_source;// summed to r->input in r->cl_output->pre_activation by the last layer of r
+    void (*rl_activation)(float* input, float* output, int size);// activation of r->cl_output, NULL for no activation
+} model_step;
+
+typedef struct batch_view {//an activation array of a layer sized for max_batch_size instances one after the other, the layer sees the first one
+    float** field;// the field of the layer, NULL if the array is indices
+    unsigned short** indices;// the field of the layer for the pooling indices, NULL if the array is field
+    float* base;// the first instance of field
+    unsigned short* indices_base;// the first instance of indices
+    int size;// the size of each instance
+} batch_view;
+
+typedef struct activation_array {//an activation array of a layer assigned by plan_model_activations to a buffer shared with the arrays that are not alive at the same time
+    float** field;// the field of the layer
+    void* layer;// the fcl, cl or rl that owns the field
+    int output;// = 1 if the array is read by the steps that take the layer as input
+    int size;// the size of each instance
+    int first, last;// the step of the feed forward plan that writes the array and the last step that reads it
+    int buffer;// the buffer of the array
+} activation_array;
+
 typedef struct model {
     int layers, n_rl, n_cl, n_fcl;
     rl** rls;//rls = residual-layers
     cl** cls;//cls = convolutional-layers
     fcl** fcls; // fcls = fully-connected-layers
     int** sla; //layers*layers, 1 for fcls, 2 for cls, 3 for rls, sla = sequential layers array
+    int arena_size;// floats in each slab of the arena
+    int arena_weights;// the first arena_weights floats of each slab are weights and kernels, the others are biases
+    float** arena;// ARENA_SLABS slabs: parameters, D, D1, D2 of all the layers, each layer is a view in them (only the parameters with inference_only_flag)
+    int inference_only_flag;// = 1 if the model is built for the feed forward only (see inference_network)
+    int arena_shared;// = 1 if the parameters, D1 and D2 slabs belong to another model (see share_model_parameters and model_inference_context) or to the caller (see external_inference_network)
+    void* mapping;// the file mapped by load_mapped_model, the parameters slab is a view of it (NULL otherwise)
+    size_t mapping_size;
+    int parameters_generation;// incremented each time the library changes the parameters (see model_parameters_changed)
+    struct model* parent;// the model that owns the parameters slab of an inference context (see model_inference_context), NULL otherwise
+    int parent_generation;// the parameters_generation of parent when the context computed its winograd kernels
+    int n_ff_steps, n_bp_steps;
+    model_step* ff_plan;// n_ff_steps, the layers of sla in feed forward order with resolved inputs
+    model_step* bp_plan;// n_bp_steps, the first layer of each row of sla in back propagation order
+    cl* input_layer;// the input tensor seen as the output of a convolutional layer, post_activation is the input of the caller
+    int max_batch_size;// the activation arrays of the layers hold max_batch_size instances one after the other, 1 by default
+    int n_batch_views;
+    batch_view* batch_views;// n_batch_views, the activation arrays of the layers if max_batch_size > 1
+    int n_activation_arrays, n_activation_buffers;// 0 if the activations are not planned (see plan_model_activations)
+    activation_array* activation_arrays;// n_activation_arrays, in the order of the steps that write them
+    int* activation_steps;// n_ff_steps+1, the arrays written by the step k are activation_arrays[activation_steps[k]...activation_steps[k+1]-1]
+    float** activation_buffers;// n_activation_buffers, each one sized for max_batch_size instances
 } model;
 
 typedef struct bmodel {
@@ -142,9 +281,98 @@ typedef struct bmodel {
     fcl** fcls; // fcls = fully-connected-layers
     bn** bns; // bn = bacth-normalization layer
     int** sla; //layers*layers, 1 for fcls, 2 for cls, 3 for rls, 4 = batch normalization sla = sequential layers array
+    int arena_size;// floats in each slab of the arena
+    int arena_weights;// the first arena_weights floats of each slab are weights and kernels, then biases
+    int arena_bn;// from arena_bn to arena_size each slab holds the gamma and beta of the batch normalization layers
+    float** arena;// ARENA_SLABS slabs: parameters, D, D1, D2 of all the layers, each layer is a view in them (only the parameters with inference_only_flag)
+    int inference_only_flag;// = 1 if the bmodel is built for the feed forward only (see inference_batch_network)
+    int arena_shared;// = 1 if the parameters slab belongs to the caller (see external_inference_batch_network)
+    void* mapping;// the file mapped by load_mapped_bmodel, the parameters slab is a view of it (NULL otherwise)
+    size_t mapping_size;
 } bmodel;
 
+typedef struct mapped_model_header {//the first 64 bytes of a file saved by save_mapped_model or save_mapped_bmodel
+    char magic[8];// "LLABMAP" and a 0
+    int version;// MAPPED_MODEL_VERSION
+    int kind;// MAPPED_MODEL or MAPPED_BMODEL
+    int description_size;// ints of the description: layers, n_rl, n_cl, n_fcl, n_bn and the constructor arguments of the layers
+    int statistics_size;// floats of the statistics: final mean and variance of the batch normalization layers
+    int arena_size, arena_weights, arena_bn;// the layout of the parameters slab of the arena
+    int flags;// 0, reserved
+    long long int description_offset, statistics_offset, parameters_offset;// bytes from the start of the file, multiples of MAPPED_MODEL_ALIGNMENT
+} mapped_model_header;
+
+typedef struct checkpoint_entry {//an entry of the table of contents of a checkpoint, one for each convolutional and fully-connected layer
+    int type;// CLS or FCLS
+    int layer;// the layer index
+    int residual;// the residual layer that holds the convolutional layer, -1 otherwise
+    int description_offset;// the position of the constructor arguments of the layer in the description
+    int weights_offset, weights_size;// the weights or kernels in each slab, floats
+    int biases_offset, biases_size;// the biases in each slab, floats
+} checkpoint_entry;
+
+typedef struct checkpoint_header {//the first bytes of a file saved by save_checkpoint
+    char magic[8];// "LLABCKPT"
+    int version;// CHECKPOINT_VERSION
+    int n_entries;// entries of the table of contents
+    int description_size;// ints of the description of the layers (see model_description)
+    int arena_size, arena_weights;// the layout of the slabs of the arena
+    int slabs;// bit i = 1 if the slab i of the arena is saved: parameters, D1 and D2 (the partial derivatives are never saved)
+    int flags;// 0, reserved
+    float b1, b2;// the adam accumulators passed to update_model
+    long long int toc_offset, description_offset, slabs_offset[ARENA_SLABS];// bytes from the start of the file, multiples of MAPPED_MODEL_ALIGNMENT
+    long long int file_size;
+    unsigned long long int checksum[2];// fletcher sums of the 32 bit words of the header (with checksum = 0) and of the sections
+} checkpoint_header;
+
+typedef struct checkpoint_snapshot {//a copy of a model taken by save_checkpoint_async, written by the thread of a checkpoint writer
+    char* file;
+    int checkpoint;// the number of the checkpoint in the writer, from 0
+    int published;// = 1 when the copy is complete and the thread of the writer can write it
+    checkpoint_header h;
+    checkpoint_entry* toc;
+    int* description;
+    float* slabs[ARENA_SLABS];// views of buffer, NULL for the slabs that are not saved
+    float* buffer;// kept for the next snapshots in the same place
+    long long int buffer_size;// floats
+} checkpoint_snapshot;
+
+typedef struct checkpoint_writer {//writes the checkpoints taken by save_checkpoint_async in a background thread
+    int max_in_flight;// the snapshots taken and not written yet are at most max_in_flight
+    int first, n_in_flight;// the snapshots reserved and not written yet are snapshots[first], snapshots[(first+1)%max_in_flight] ...
+    int submitted, completed;// the checkpoints reserved and the checkpoints handled by the thread (written or failed)
+    int failed, error;// the checkpoints that could not be written and the errno of the last one
+    int exit_flag;// = 1 when the thread must terminate
+    checkpoint_snapshot* snapshots;// max_in_flight
+    void (*callback)(char* file, int checkpoint, int error, void* data);// called by the thread after each checkpoint with 0 or the errno, it can be NULL
+    void* data;// passed to callback
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} checkpoint_writer;
+
+typedef struct trainer {//data parallel trainer: each thread runs a replica of the model on a shard of the mini batch
+    int n_threads, tensor_depth, tensor_i, tensor_j, output_dimension, total_number_weights;
+    int exit_flag;// = 1 when the threads must terminate
+    int hogwild_flag;// = 1 if the replicas share the parameters of the model and update them after each sample without locks
+    model* m;// the trained model, it is also the replica of the thread 0
+    model** replicas;//n_threads
+    float** output_errors;//n_threads*output_dimension
+    double* squared_norms;//n_threads, squared norm of the partial derivatives of the weights reduced by each thread
+    int** spans;//n_threads, the ranges (start, size) of the arena updated by each hogwild thread
+    int* spans_size;//n_threads, the ints allocated in each spans[i]
+    void (*error_function)(model* m, int sample, float* output_error, void* data);// computes the output error of the sample after its feed forward
+    void* data;// passed to error_function
+    float** inputs;// the current mini batch, batch_size*tensor_depth*tensor_i*tensor_j
+    int batch_size, gradient_descent_flag, regularization;
+    float lr, momentum, b1, b2, lambda, threshold;
+    pthread_t* threads;//n_threads-1, the thread 0 is the caller
+    pthread_barrier_t barrier;
+    void* workers;// arguments of the threads
+} trainer;
+
 // Functions defined in math.c
+void set_math_precision(int flag);
 void softmax(float* input, float* output, int size);
 float sigmoid(float x);
 void sigmoid_array(float* input, float* output, int size);//can be transposed in opencl
@@ -173,27 +401,69 @@ void derivative_cross_entropy_reduced_form_with_softmax_array(float* y_hat, floa
 // Functions defined in fully_connected.c
 void fully_connected_feed_forward(float* input, float* output, float* weight,float* bias, int input_size, int output_size);//can be transposed in opencl
 void fully_connected_back_prop(float* input, float* output_error, float* weight,float* input_error, float* weight_error,float* bias_error, int input_size, int output_size);//can be transposed in opencl
+void fully_connected_transposed_gemv(float* weight, float* output_error, float* input_error, int input_size, int output_size);
+void fully_connected_outer_product(float* output_error, float* input, float* weight_error, int input_size, int output_size);
+void fully_connected_feed_forward_batch(float* input, float* output, float* weight,float* bias, int input_size, int output_size, int batch_size);
+void fully_connected_back_prop_batch(float* input, float* output_error, float* weight,float* input_error, float* weight_error,float* bias_error, int input_size, int output_size, int batch_size);
+
+// Functions defined in gemm.c
+void sgemm(int trans_a, int trans_b, int m, int n, int k, float* a, int lda, float* b, int ldb, float* c, int ldc, float* bias);
+void free_sgemm_buffers(void);
+
 
+// Functions defined in isa.c
+int get_isa(void);
+void set_isa(int isa);
+const char* isa_name(int isa);
+
+// Functions defined in thread_pool.c
+void set_thread_pool_size(int n_threads);
+int get_thread_pool_size(void);
+void set_thread_pool_affinity(int* cpus, int n_cpus);
+void set_thread_pool_serial(int flag);
+void parallel_for(int n, int grain, void (*function)(void* data, int start, int end), void* data);
+void free_thread_pool(void);
 
 // Functions defined in convolutional.c
 void convolutional_feed_forward(float* input, float* kernel, int input_i, int input_j, int kernel_i, int kernel_j, float bias, int channels, float* output, int stride, int padding);//can be transposed in opencl
 void convolutional_back_prop(float* input, float* kernel, int input_i, int input_j, int kernel_i, int kernel_j, float bias, int channels, float* output_error,float* input_error, float* kernel_error, float* bias_error, int stride, int padding);//can be transposed in opencl
-void max_pooling_feed_forward(float* input, float* output, int input_i, int input_j, int sub_pool_i, int sub_pool_j, int stride, int padding);//can be transposed in opencl
-void max_pooling_back_prop(float* input, float* output_error, int input_i, int input_j, int sub_pool_i, int sub_pool_j, int stride, int padding, float* input_error);//can be transposed in opencl
+void max_pooling_feed_forward_indices(float* input, float* output, unsigned short* indices, int input_i, int input_j, int sub_pool_i, int sub_pool_j, int stride, int padding);//can be transposed in opencl
+void max_pooling_back_prop_indices(unsigned short* indices, float* output_error, int input_i, int input_j, int sub_pool_i, int sub_pool_j, int stride, int padding, float* input_error);//can be transposed in opencl
+void max_pooling_feed_forward(float* input, float* output, int input_i, int input_j, int sub_pool_i, int sub_pool_j, int stride, int padding);
+void max_pooling_back_prop(float* input, float* output_error, int input_i, int input_j, int sub_pool_i, int sub_pool_j, int stride, int padding, float* input_error);
 void avarage_pooling_feed_forward(float* input, float* output, int input_i, int input_j, int sub_pool_i, int sub_pool_j, int stride, int padding);//can be transposed in opencl
 void avarage_pooling_back_prop(float* input_error, float* output_error, int input_i, int input_j, int sub_pool_i, int sub_pool_j, int stride, int padding);//can be transposed in opencl
+void im2col(float* input, int channels, int input_i, int input_j, int kernel_i, int kernel_j, int stride, float* col, int ld);
+void col2im(float* col, int channels, int input_i, int input_j, int kernel_i, int kernel_j, int stride, float* input_error, int ld);
+void convolutional_feed_forward_im2col(float* input, float* kernels, int input_i, int input_j, int kernel_i, int kernel_j, float* biases, int channels, int n_kernels, float* output, int stride, int padding, float* col, float* temp, int batch_size);
+void convolutional_back_prop_im2col(float* input, float* kernels, int input_i, int input_j, int kernel_i, int kernel_j, int channels, int n_kernels, float* output_error, float* input_error, float* kernels_error, float* biases_error, int stride, int padding, float* col, float* temp, int batch_size);
+void winograd_kernels_transform(float* kernels, int channels, int n_kernels, float* winograd_kernels);
+void convolutional_feed_forward_winograd(float* input, float* winograd_kernels, int input_i, int input_j, float* biases, int channels, int n_kernels, float* output, int padding, float* winograd_input, float* winograd_output, int batch_size);
+void convolutional_back_prop_winograd(float* input, float* winograd_kernels, int input_i, int input_j, int channels, int n_kernels, float* output_error, float* input_error, float* kernels_error, float* biases_error, int padding, float* winograd_input, float* winograd_output, float* winograd_kernels_error, int batch_size);
+void convolutional_layer_feed_forward(cl* c, float* input);
+void convolutional_layer_feed_forward_batch(cl* c, float* input, int batch_size);
+void convolutional_layer_back_prop(cl* c, float* input, float* output_error);
+void convolutional_layer_back_prop_batch(cl* c, float* input, float* output_error, int batch_size);
 
 
 // Functions defined in normalization.c
 void local_response_normalization_feed_forward(float* tensor,float* output, int index_ac,int index_ai,int index_aj, int tensor_depth, int tensor_i, int tensor_j, float n_constant, float beta, float alpha, float k);//can be transposed in opencl
 void local_response_normalization_back_prop(float* tensor,float* tensor_error,float* output_error, int index_ac,int index_ai,int index_aj, int tensor_depth, int tensor_i, int tensor_j, float n_constant, float beta, float alpha, float k);//can be transposed in opencl
+void local_response_normalization_feed_forward_tensor(float* tensor, float* output, int tensor_depth, int tensor_i, int tensor_j, int padding, float n_constant, float beta, float alpha, float k);
+void local_response_normalization_back_prop_tensor(float* tensor, float* tensor_error, float* output_error, int tensor_depth, int tensor_i, int tensor_j, int padding, float n_constant, float beta, float alpha, float k, float* temp);
+void batch_normalization_feed_forward_inv_std(int batch_size, float** input_vectors,float** temp_vectors, int size_vectors, float* gamma, float* beta, float* mean, float* var, float* inv_std, float** outputs,float epsilon);
+void batch_normalization_back_prop_inv_std(int batch_size, float** temp_vectors, int size_vectors, float* gamma, float* inv_std, float** outputs_error, float* gamma_error, float* beta_error, float** input_error, float* temp_array);
 void batch_normalization_feed_forward(int batch_size, float** input_vectors,float** temp_vectors, int size_vectors, float* gamma, float* beta, float* mean, float* var, float** outputs,float epsilon);
 void batch_normalization_back_prop(int batch_size, float** input_vectors,float** temp_vectors, int size_vectors, float* gamma, float* beta, float* mean, float* var, float** outputs_error, float* gamma_error, float* beta_error, float** input_error, float** temp_vectors_error,float* temp_array, float epsilon);
 void batch_normalization_final_mean_variance(float** input_vectors, int n_vectors, int vector_size, int mini_batch_size, bn* bn_layer);
+void batch_normalization_layer_feed_forward(bn* b, float** input_vectors);
+void batch_normalization_layer_back_prop(bn* b, float** outputs_error);
 
 // Functions defined in gd.c
 void nesterov_momentum(float* p, float lr, float m, int mini_batch_size, float dp, float* delta);
 void adam_algorithm(float* p,float* delta1, float* delta2, float dp, float lr, float b1, float b2, float bb1, float bb2, float epsilon, int mini_batch_size);
+void nesterov_momentum_array(float* p, float* dp, float* delta, int size, float lr, float m, int mini_batch_size, float gradient_scale, float weight_decay, int reset_flag);
+void adam_algorithm_array(float* p, float* dp, float* delta1, float* delta2, int size, float lr, float b1, float b2, float bb1, float bb2, float epsilon, int mini_batch_size, float gradient_scale, float weight_decay, int reset_flag);
 
 
 // Functions defined in utils.c
@@ -218,6 +488,8 @@ void read_file_in_char_vector(char** ksource, char* fname, int* size);
 void dot1D(float* input1, float* input2, float* output, int size); //can be transposed in opencl
 void copy_array(float* input, float* output, int size);//can be transposed in opencl
 void sum1D(float* input1, float* input2, float* output, int size);//can be transposed in opencl
+float sum_squares(float* input, int size);
+float sum1D_sum_squares(float* input1, float* input2, float* output, int size);
 void mul_value(float* input, float value, float* output, int dimension);//can be transposed in opencl
 void update_residual_layer_nesterov(model* m, float lr, float momentum, int mini_batch_size);//can be transposed in opencl
 void update_residual_layer_nesterov_bmodel(bmodel* m, float lr, float momentum, int mini_batch_size);//can be transposed in opencl
@@ -248,6 +520,11 @@ void copy_char_array(char* input, char* output, int size);
 int shuffle_char_matrices_float_int_int_vectors(char** m,char** m1,float* f, int* v, int* v2, int n);
 void update_batch_normalized_layer_nesterov_bmodel(bmodel* m, float lr, float momentum, int mini_batch_size);
 void update_batch_normalized_layer_adam_bmodel(bmodel* m, float lr, int mini_batch_size, float b1, float b2);
+int arena_aligned(int size);
+float** parameters_arena(int size);
+float** inference_parameters_arena(int size);
+void free_parameters_arena(float** arena);
+int sync_directory(char* file);
 
 
 // Functions defined in layers.c
@@ -255,6 +532,13 @@ fcl* fully_connected(int input, int output, int layer, int dropout_flag, int act
 void free_fully_connected(fcl* f);
 cl* convolutional(int channels, int input_rows, int input_cols, int kernel_rows, int kernel_cols, int n_kernels, int stride1_rows, int stride1_cols, int padding1_rows, int padding1_cols, int stride2_rows, int stride2_cols, int padding2_rows, int padding2_cols, int pooling_rows, int pooling_cols, int normalization_flag, int activation_flag, int pooling_flag, int layer, int convolutional_flag);
 void free_convolutional(cl* c);
+void set_convolutional_algorithm(cl* c, int algorithm_flag);
+void set_convolutional_batch_size(cl* c, int batch_size);
+void set_convolutional_mode(cl* c, int mode_flag);
+void set_fully_connected_inference_only(fcl* f);
+void set_convolutional_inference_only(cl* c);
+void set_residual_inference_only(rl* r);
+void set_batch_normalization_inference_only(bn* b);
 rl* residual(int channels, int input_rows, int input_cols, int n_cl, cl** cls);
 void free_residual(rl* r);
 void save_fcl(fcl* f, int n);
@@ -289,13 +573,28 @@ void slow_paste_fcl(fcl* f,fcl* copy, float tau);
 void slow_paste_cl(cl* f, cl* copy,float tau);
 void slow_paste_rl(rl* f, rl* copy,float tau);
 void slow_paste_bn(bn* f, bn* copy,float tau);
+fcl* reset_fcl_except_partial_derivatives(fcl* f);
+cl* reset_cl_except_partial_derivatives(cl* f);
+rl* reset_rl_except_partial_derivatives(rl* f);
+bn* reset_bn_except_partial_derivatives(bn* b);
+void move_fcl_to_arena(fcl* f, float** arena, int weights_offset, int biases_offset);
+void move_cl_to_arena(cl* c, float** arena, int kernels_offset, int biases_offset);
+void move_bn_to_arena(bn* b, float** arena, int gamma_offset, int beta_offset);
+void set_layers_parameters_allocation(int flag);
 
 // Functions defined in model.c
 model* network(int layers, int n_rl, int n_cl, int n_fcl, rl** rls, cl** cls, fcl** fcls);
+model* inference_network(int layers, int n_rl, int n_cl, int n_fcl, rl** rls, cl** cls, fcl** fcls);
+model* external_inference_network(int layers, int n_rl, int n_cl, int n_fcl, rl** rls, cl** cls, fcl** fcls, float* parameters);
 void free_model(model* m);
 model* copy_model(model* m);
+void share_model_parameters(model* m, model* replica);
+model* model_inference_context(model* m);
+void model_parameters_changed(model* m);
 void save_model(model* m, int n);
 model* load_model(char* file);
+model* load_inference_model(char* file);
+void set_model_mode(model* m, int mode_flag);
 void ff_fcl_fcl(fcl* f1, fcl* f2);
 void ff_fcl_cl(fcl* f1, cl* f2);
 void ff_cl_fcl(cl* f1, fcl* f2);
@@ -306,9 +605,16 @@ float* bp_cl_cl(cl* f1, cl* f2, float* error);
 float* bp_cl_fcl(cl* f1, fcl* f2, float* error);
 void model_tensor_input_ff(model* m, int tensor_depth, int tensor_i, int tensor_j, float* input);
 float* model_tensor_input_bp(model* m, int tensor_depth, int tensor_i, int tensor_j, float* input, float* error, int error_dimension);
+void set_model_max_batch_size(model* m, int max_batch_size);
+void plan_model_activations(model* m);
+void model_tensor_input_ff_batch(model* m, int batch_size, int tensor_depth, int tensor_i, int tensor_j, float* inputs);
+float* model_tensor_input_bp_batch(model* m, int batch_size, int tensor_depth, int tensor_i, int tensor_j, float* inputs, float* errors, int error_dimension);
 model* reset_model(model* m);
+model* reset_model_except_partial_derivatives(model* m);
 void update_model(model* m, float lr, float momentum, int mini_batch_size, int gradient_descent_flag, float* b1, float* b2, int regularization, int total_number_weights, float lambda);
 void sum_model_partial_derivatives(model* m, model* m2, model* m3);
+float sum_model_partial_derivatives_with_norm(model* m, model* m2, model* m3);
+void update_model_fused(model* m, float lr, float momentum, int mini_batch_size, int gradient_descent_flag, float* b1, float* b2, int regularization, int total_number_weights, float lambda, float threshold, float squared_norm);
 unsigned long long int size_of_model(model* m);
 void paste_model(model* m, model* copy);
 int count_weights(model* m);
@@ -322,9 +628,18 @@ void clip_fcls(fcl** fcls, int n, float threshold, float norm);
 float sum_all_quadratic_derivative_weights_rls(rl** rls, int n);
 float sum_all_quadratic_derivative_weights_cls(cl** cls, int n);
 float sum_all_quadratic_derivative_weights_fcls(fcl** fcls, int n);
+float sum_all_quadratic_derivative_weights_model(model* m);
+
+// Functions defined in trainer.c
+trainer* model_trainer(model* m, int n_threads, int tensor_depth, int tensor_i, int tensor_j, int output_dimension, void (*error_function)(model* m, int sample, float* output_error, void* data), void* data);
+trainer* model_hogwild_trainer(model* m, int n_threads, int tensor_depth, int tensor_i, int tensor_j, int output_dimension, void (*error_function)(model* m, int sample, float* output_error, void* data), void* data);
+void free_trainer(trainer* t);
+void trainer_train_mini_batch(trainer* t, float** inputs, int batch_size, float lr, float momentum, int gradient_descent_flag, float* b1, float* b2, int regularization, float lambda, float threshold);
 
 // Functions defined in bmodel.c
 bmodel* batch_network(int layers, int n_rl, int n_cl, int n_fcl, int n_bnl, rl** rls, cl** cls, fcl** fcls, bn** bnls);
+bmodel* inference_batch_network(int layers, int n_rl, int n_cl, int n_fcl, int n_bnl, rl** rls, cl** cls, fcl** fcls, bn** bnls);
+bmodel* external_inference_batch_network(int layers, int n_rl, int n_cl, int n_fcl, int n_bnl, rl** rls, cl** cls, fcl** fcls, bn** bnls, float* parameters);
 void free_bmodel(bmodel* m);
 bmodel* copy_bmodel(bmodel* m);
 void paste_bmodel(bmodel* m, bmodel* copy);
@@ -333,8 +648,28 @@ bmodel* reset_bmodel(bmodel* m);
 unsigned long long int size_of_bmodel(bmodel* m);
 void save_bmodel(bmodel* m, int n);
 bmodel* load_bmodel(char* file);
+bmodel* load_inference_bmodel(char* file);
 int count_bmodel_weights(bmodel* m);
 void update_bmodel(bmodel* m, float lr, float momentum, int mini_batch_size, int gradient_descent_flag, float* b1, float* b2, int regularization, int total_number_weights, float lambda);
 void sum_model_partial_derivatives_bmodel(bmodel* m, bmodel* m2, bmodel* m3);
+void set_bmodel_mode(bmodel* m, int mode_flag);
+
+// Functions defined in mapped_model.c
+int model_description_size(int n_rl, int n_cl, int n_fcl, int n_bn, rl** rls);
+void model_description(int* d, int layers, int n_rl, int n_cl, int n_fcl, int n_bn, rl** rls, cl** cls, fcl** fcls, bn** bns);
+void model_description_layers(int* d, int size, int* counts, rl*** rls, cl*** cls, fcl*** fcls, bn*** bns);
+void save_mapped_model(model* m, char* file);
+model* load_mapped_model(char* file);
+void save_mapped_bmodel(bmodel* m, char* file);
+bmodel* load_mapped_bmodel(char* file);
+
+// Functions defined in checkpoint.c
+void save_checkpoint(model* m, char* file, float b1, float b2);
+model* load_checkpoint(char* file, float* b1, float* b2);
+checkpoint_writer* async_checkpoint_writer(int max_in_flight, void (*callback)(char* file, int checkpoint, int error, void* data), void* data);
+int save_checkpoint_async(checkpoint_writer* w, model* m, char* file, float b1, float b2);
+int checkpoints_completed(checkpoint_writer* w, int* failed);
+int wait_checkpoints(checkpoint_writer* w);
+int free_checkpoint_writer(checkpoint_writer* w);
 
 #endif
@@ -0,0 +1,452 @@
+#include "llab.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* A mapped model file holds a model (or a bmodel) in a layout that can be used without reading it:
+ *
+ *     the header (mapped_model_header, 64 bytes)
+ *     the description: layers, n_rl, n_cl, n_fcl, n_bn and then the constructor arguments of the residual,
+ *                      convolutional, fully-connected and batch normalization layers in the order of the model
+ *     the statistics: final mean and final variance of each batch normalization layer (only for the bmodels)
+ *     the parameters: the parameters slab of the arena of the model (see model_arena)
+ *
+ * each section starts on a MAPPED_MODEL_ALIGNMENT boundary. load_mapped_model maps the file read only
+ * and the weights of the layers are views of the mapping, so nothing is read or copied at the loading,
+ * the pages are read from the page cache when the feed forward uses them and all the processes
+ * that map the same file share a single physical copy of the parameters
+ * */
+
+/* This function rounds an offset up to a multiple of MAPPED_MODEL_ALIGNMENT*/
+static long long int mapped_aligned(long long int offset){
+    return (offset+MAPPED_MODEL_ALIGNMENT-1)/MAPPED_MODEL_ALIGNMENT*MAPPED_MODEL_ALIGNMENT;
+}
+
+/* This function returns the ints of the description of the layers of a model or of a bmodel (see model_description)*/
+int model_description_size(int n_rl, int n_cl, int n_fcl, int n_bn, rl** rls){
+    int i, size = 5+n_rl*MAPPED_RL_DESCRIPTION+n_cl*MAPPED_CL_DESCRIPTION+n_fcl*MAPPED_FCL_DESCRIPTION+n_bn*MAPPED_BN_DESCRIPTION;
+    for(i = 0; i < n_rl; i++){
+        size+=rls[i]->n_cl*MAPPED_CL_DESCRIPTION;
+    }
+    return size;
+}
+
+/* This function writes the constructor arguments of a convolutional layer in d, it returns the next position*/
+static int mapped_cl_description(cl* c, int* d, int p){
+    d[p++] = c->channels;
+    d[p++] = c->input_rows;
+    d[p++] = c->input_cols;
+    d[p++] = c->kernel_rows;
+    d[p++] = c->kernel_cols;
+    d[p++] = c->n_kernels;
+    d[p++] = c->stride1_rows;
+    d[p++] = c->stride1_cols;
+    d[p++] = c->padding1_rows;
+    d[p++] = c->padding1_cols;
+    d[p++] = c->stride2_rows;
+    d[p++] = c->stride2_cols;
+    d[p++] = c->padding2_rows;
+    d[p++] = c->padding2_cols;
+    d[p++] = c->pooling_rows;
+    d[p++] = c->pooling_cols;
+    d[p++] = c->normalization_flag;
+    d[p++] = c->activation_flag;
+    d[p++] = c->pooling_flag;
+    d[p++] = c->layer;
+    d[p++] = c->convolutional_flag;
+    return p;
+}
+
+/* This function builds the description of the layers of a model or of a bmodel (n_bn = 0 for a model):
+ * layers, n_rl, n_cl, n_fcl, n_bn and then the constructor arguments of the residual, convolutional,
+ * fully-connected and batch normalization layers. The layers can be built again with model_description_layers
+ *
+ * Input:
+ *             @ int* d:= the description, model_description_size ints
+ *             @ the others:= the layers of the model
+ *
+ * */
+void model_description(int* d, int layers, int n_rl, int n_cl, int n_fcl, int n_bn, rl** rls, cl** cls, fcl** fcls, bn** bns){
+    int i,j,p = 0;
+    d[p++] = layers;
+    d[p++] = n_rl;
+    d[p++] = n_cl;
+    d[p++] = n_fcl;
+    d[p++] = n_bn;
+    for(i = 0; i < n_rl; i++){
+        d[p++] = rls[i]->channels;
+        d[p++] = rls[i]->input_rows;
+        d[p++] = rls[i]->input_cols;
+        d[p++] = rls[i]->n_cl;
+        for(j = 0; j < rls[i]->n_cl; j++){
+            p = mapped_cl_description(rls[i]->cls[j],d,p);
+        }
+    }
+    for(i = 0; i < n_cl; i++){
+        p = mapped_cl_description(cls[i],d,p);
+    }
+    for(i = 0; i < n_fcl; i++){
+        d[p++] = fcls[i]->input;
+        d[p++] = fcls[i]->output;
+        d[p++] = fcls[i]->layer;
+        d[p++] = fcls[i]->dropout_flag;
+        d[p++] = fcls[i]->activation_flag;
+        memcpy(&d[p++],&fcls[i]->dropout_threshold,sizeof(float));
+    }
+    for(i = 0; i < n_bn; i++){
+        d[p++] = bns[i]->layer;
+        d[p++] = bns[i]->batch_size;
+        d[p++] = bns[i]->vector_dim;
+        d[p++] = bns[i]->activation_flag;
+    }
+}
+
+/* This function writes size bytes in the file and updates the position*/
+static void mapped_write(FILE* fw, void* data, long long int size, long long int* position, char* file){
+    if(size > 0 && fwrite(data,size,1,fw) != 1){
+        fprintf(stderr,"Error: an error occurred writing the file %s\n",file);
+        exit(1);
+    }
+    (*position)+=size;
+}
+
+/* This function writes zeros in the file up to offset*/
+static void mapped_pad(FILE* fw, long long int offset, long long int* position, char* file){
+    char zeros[MAPPED_MODEL_ALIGNMENT] = {0};
+    mapped_write(fw,zeros,offset-(*position),position,file);
+}
+
+/* This function writes a mapped model file: the sections are written in file.tmp, that is synced on the disk
+ * and renamed in file, the directory is synced too so the rename survives a crash. The processes that mapped the previous file keep it and never see a partial file
+ *
+ * Input:
+ *             @ char* file:= the name of the file
+ *             @ mapped_model_header* h:= the header, the offsets are set here
+ *             @ int* description:= h->description_size ints
+ *             @ float* statistics:= h->statistics_size floats
+ *             @ float* parameters:= h->arena_size floats
+ *
+ * */
+static void save_mapped_file(char* file, mapped_model_header* h, int* description, float* statistics, float* parameters){
+    long long int position = 0;
+    char* temp = (char*)malloc(sizeof(char)*(strlen(file)+5));
+    sprintf(temp,"%s.tmp",file);
+
+    memset(h->magic,0,sizeof(h->magic));
+    memcpy(h->magic,"LLABMAP",7);
+    h->version = MAPPED_MODEL_VERSION;
+    h->flags = 0;
+    h->description_offset = mapped_aligned(sizeof(mapped_model_header));
+    h->statistics_offset = mapped_aligned(h->description_offset+sizeof(int)*(long long int)h->description_size);
+    h->parameters_offset = mapped_aligned(h->statistics_offset+sizeof(float)*(long long int)h->statistics_size);
+
+    FILE* fw = fopen(temp,"w");
+    if(fw == NULL){
+        fprintf(stderr,"Error: error during the opening of the file %s\n",temp);
+        exit(1);
+    }
+    mapped_write(fw,h,sizeof(mapped_model_header),&position,temp);
+    mapped_pad(fw,h->description_offset,&position,temp);
+    mapped_write(fw,description,sizeof(int)*(long long int)h->description_size,&position,temp);
+    mapped_pad(fw,h->statistics_offset,&position,temp);
+    mapped_write(fw,statistics,sizeof(float)*(long long int)h->statistics_size,&position,temp);
+    mapped_pad(fw,h->parameters_offset,&position,temp);
+    mapped_write(fw,parameters,sizeof(float)*(long long int)h->arena_size,&position,temp);
+
+    if(fflush(fw) || fsync(fileno(fw)) || fclose(fw)){
+        fprintf(stderr,"Error: an error occurred closing the file %s\n",temp);
+        exit(1);
+    }
+    if(rename(temp,file)){
+        fprintf(stderr,"Error: an error occurred renaming the file %s in %s\n",temp,file);
+        exit(1);
+    }
+    if(sync_directory(file)){
+        fprintf(stderr,"Error: an error occurred syncing the directory of the file %s\n",file);
+        exit(1);
+    }
+    free(temp);
+}
+
+/* This function maps a mapped model file read only and checks its header
+ *
+ * Input:
+ *             @ char* file:= the name of the file
+ *             @ int kind:= MAPPED_MODEL or MAPPED_BMODEL
+ *             @ size_t* size:= where the size of the mapping is stored
+ *
+ * returns the mapping, it starts with the header
+ * */
+static void* map_model_file(char* file, int kind, size_t* size){
+    struct stat st;
+    int fd = open(file,O_RDONLY);
+    if(fd < 0){
+        fprintf(stderr,"Error: error during the opening of the file %s\n",file);
+        exit(1);
+    }
+    if(fstat(fd,&st) || st.st_size < (off_t)sizeof(mapped_model_header)){
+        fprintf(stderr,"Error: the file %s is not a mapped model\n",file);
+        exit(1);
+    }
+    void* mapping = mmap(NULL,st.st_size,PROT_READ,MAP_SHARED,fd,0);
+    close(fd);
+    if(mapping == MAP_FAILED){
+        fprintf(stderr,"Error: an error occurred mapping the file %s\n",file);
+        exit(1);
+    }
+
+    mapped_model_header* h = (mapped_model_header*)mapping;
+    long long int description_end = h->description_offset+sizeof(int)*(long long int)h->description_size;
+    long long int statistics_end = h->statistics_offset+sizeof(float)*(long long int)h->statistics_size;
+    long long int parameters_end = h->parameters_offset+sizeof(float)*(long long int)h->arena_size;
+    if(memcmp(h->magic,"LLABMAP",8)){
+        fprintf(stderr,"Error: the file %s is not a mapped model\n",file);
+        exit(1);
+    }
+    if(h->version != MAPPED_MODEL_VERSION){
+        fprintf(stderr,"Error: the file %s has the version %d of the mapped models, this library reads the version %d\n",file,h->version,MAPPED_MODEL_VERSION);
+        exit(1);
+    }
+    if(h->kind != kind){
+        fprintf(stderr,"Error: the file %s holds a %s, use %s\n",file,h->kind == MAPPED_BMODEL ? "bmodel" : "model",h->kind == MAPPED_BMODEL ? "load_mapped_bmodel" : "load_mapped_model");
+        exit(1);
+    }
+    if(h->description_size < 5 || h->statistics_size < 0 || h->arena_weights < 0 || h->arena_bn < h->arena_weights || h->arena_size < h->arena_bn ||
+       h->description_offset%MAPPED_MODEL_ALIGNMENT || h->statistics_offset%MAPPED_MODEL_ALIGNMENT || h->parameters_offset%MAPPED_MODEL_ALIGNMENT ||
+       h->description_offset < (long long int)sizeof(mapped_model_header) || h->statistics_offset < description_end ||
+       h->parameters_offset < statistics_end || parameters_end > (long long int)st.st_size){
+        fprintf(stderr,"Error: the file %s is a corrupted mapped model\n",file);
+        exit(1);
+    }
+    (*size) = st.st_size;
+    return mapping;
+}
+
+/* This function returns the next int of the description*/
+static int mapped_next(int* d, int size, int* p){
+    if((*p) >= size){
+        fprintf(stderr,"Error: the description of the mapped model is corrupted\n");
+        exit(1);
+    }
+    return d[(*p)++];
+}
+
+/* This function builds a convolutional layer from the description*/
+static cl* mapped_cl(int* d, int size, int* p){
+    int i,a[MAPPED_CL_DESCRIPTION];
+    for(i = 0; i < MAPPED_CL_DESCRIPTION; i++){
+        a[i] = mapped_next(d,size,p);
+    }
+    return convolutional(a[0],a[1],a[2],a[3],a[4],a[5],a[6],a[7],a[8],a[9],a[10],a[11],a[12],a[13],a[14],a[15],a[16],a[17],a[18],a[19],a[20]);
+}
+
+/* This function builds the layers of a description without parameters (see set_layers_parameters_allocation),
+ * the model built with them gets its parameters from its arena
+ *
+ * Input:
+ *             @ int* d:= the description
+ *             @ int size:= the ints of the description
+ *             @ int* counts:= where layers, n_rl, n_cl, n_fcl, n_bn are stored
+ *             @ the others:= where the arrays of the layers are stored (NULL if there are no layers of that type)
+ *
+ * */
+void model_description_layers(int* d, int size, int* counts, rl*** rls, cl*** cls, fcl*** fcls, bn*** bns){
+    int i,j,k,p = 0,a[MAPPED_FCL_DESCRIPTION];
+    float dropout_threshold;
+    cl** rl_cls;
+    for(i = 0; i < 5; i++){
+        counts[i] = mapped_next(d,size,&p);
+        if(counts[i] < 0 || counts[i] > size){
+            fprintf(stderr,"Error: the description of the mapped model is corrupted\n");
+            exit(1);
+        }
+    }
+    (*rls) = counts[1] ? (rl**)malloc(sizeof(rl*)*counts[1]) : NULL;
+    (*cls) = counts[2] ? (cl**)malloc(sizeof(cl*)*counts[2]) : NULL;
+    (*fcls) = counts[3] ? (fcl**)malloc(sizeof(fcl*)*counts[3]) : NULL;
+    (*bns) = counts[4] ? (bn**)malloc(sizeof(bn*)*counts[4]) : NULL;
+
+    set_layers_parameters_allocation(0);
+    for(i = 0; i < counts[1]; i++){
+        for(j = 0; j < MAPPED_RL_DESCRIPTION; j++){
+            a[j] = mapped_next(d,size,&p);
+        }
+        if(a[3] <= 0 || a[3] > size){
+            fprintf(stderr,"Error: the description of the mapped model is corrupted\n");
+            exit(1);
+        }
+        rl_cls = (cl**)malloc(sizeof(cl*)*a[3]);
+        for(k = 0; k < a[3]; k++){
+            rl_cls[k] = mapped_cl(d,size,&p);
+        }
+        (*rls)[i] = residual(a[0],a[1],a[2],a[3],rl_cls);
+    }
+    for(i = 0; i < counts[2]; i++){
+        (*cls)[i] = mapped_cl(d,size,&p);
+    }
+    for(i = 0; i < counts[3]; i++){
+        for(j = 0; j < MAPPED_FCL_DESCRIPTION; j++){
+            a[j] = mapped_next(d,size,&p);
+        }
+        memcpy(&dropout_threshold,&a[5],sizeof(float));
+        (*fcls)[i] = fully_connected(a[0],a[1],a[2],a[3],a[4],dropout_threshold);
+    }
+    for(i = 0; i < counts[4]; i++){
+        for(j = 0; j < MAPPED_BN_DESCRIPTION; j++){
+            a[j] = mapped_next(d,size,&p);
+        }
+        (*bns)[i] = batch_normalization(a[1],a[2],a[0],a[3]);
+    }
+    set_layers_parameters_allocation(1);
+}
+
+/* This function saves a model in a mapped model file that can be loaded with load_mapped_model.
+ * The file is written in file.tmp and then renamed, so a file mapped by other processes can be replaced
+ *
+ * Input:
+ *
+ *             @ model* m:= the model, built with network or inference_network
+ *             @ char* file:= the name of the file
+ *
+ * */
+void save_mapped_model(model* m, char* file){
+    if(m == NULL || file == NULL)
+        return;
+    if(m->arena == NULL){
+        fprintf(stderr,"Error: save_mapped_model needs a model built with network() or inference_network()\n");
+        exit(1);
+    }
+    mapped_model_header h;
+    memset(&h,0,sizeof(mapped_model_header));
+    h.kind = MAPPED_MODEL;
+    h.description_size = model_description_size(m->n_rl,m->n_cl,m->n_fcl,0,m->rls);
+    h.statistics_size = 0;
+    h.arena_size = m->arena_size;
+    h.arena_weights = m->arena_weights;
+    h.arena_bn = m->arena_size;
+    int* description = (int*)malloc(sizeof(int)*h.description_size);
+    model_description(description,m->layers,m->n_rl,m->n_cl,m->n_fcl,0,m->rls,m->cls,m->fcls,NULL);
+    save_mapped_file(file,&h,description,NULL,m->arena[0]);
+    free(description);
+}
+
+/* This function loads a model saved by save_mapped_model: the file is mapped read only and the weights,
+ * kernels and biases of the layers are views of the mapping, so the loading reads only the description
+ * of the layers and the processes that load the same file share the parameters in memory.
+ * The model can be used only for the feed forward (see inference_network), its parameters can't be changed
+ * and the file is unmapped by free_model (the inference contexts of the model must be freed before)
+ *
+ * Input:
+ *
+ *             @ char* file:= the name of the file
+ *
+ * */
+model* load_mapped_model(char* file){
+    if(file == NULL)
+        return NULL;
+    size_t size;
+    void* mapping = map_model_file(file,MAPPED_MODEL,&size);
+    mapped_model_header* h = (mapped_model_header*)mapping;
+    int counts[5];
+    rl** rls;
+    cl** cls;
+    fcl** fcls;
+    bn** bns;
+    model_description_layers((int*)((char*)mapping+h->description_offset),h->description_size,counts,&rls,&cls,&fcls,&bns);
+    if(counts[4]){
+        fprintf(stderr,"Error: the file %s is a corrupted mapped model\n",file);
+        exit(1);
+    }
+    model* m = external_inference_network(counts[0],counts[1],counts[2],counts[3],rls,cls,fcls,(float*)((char*)mapping+h->parameters_offset));
+    if(m->arena_size != h->arena_size || m->arena_weights != h->arena_weights){
+        fprintf(stderr,"Error: the parameters of the file %s don't match its layers\n",file);
+        exit(1);
+    }
+    m->mapping = mapping;
+    m->mapping_size = size;
+    return m;
+}
+
+/* This function saves a bmodel in a mapped model file that can be loaded with load_mapped_bmodel,
+ * the final mean and variance of the batch normalization layers are saved with the parameters (see save_mapped_model)
+ *
+ * Input:
+ *
+ *             @ bmodel* m:= the bmodel, built with batch_network or inference_batch_network
+ *             @ char* file:= the name of the file
+ *
+ * */
+void save_mapped_bmodel(bmodel* m, char* file){
+    if(m == NULL || file == NULL)
+        return;
+    if(m->arena == NULL){
+        fprintf(stderr,"Error: save_mapped_bmodel needs a bmodel built with batch_network() or inference_batch_network()\n");
+        exit(1);
+    }
+    int i,j = 0;
+    mapped_model_header h;
+    memset(&h,0,sizeof(mapped_model_header));
+    h.kind = MAPPED_BMODEL;
+    h.description_size = model_description_size(m->n_rl,m->n_cl,m->n_fcl,m->n_bn,m->rls);
+    for(i = 0; i < m->n_bn; i++){
+        h.statistics_size+=2*m->bns[i]->vector_dim;
+    }
+    h.arena_size = m->arena_size;
+    h.arena_weights = m->arena_weights;
+    h.arena_bn = m->arena_bn;
+    int* description = (int*)malloc(sizeof(int)*h.description_size);
+    float* statistics = (float*)malloc(sizeof(float)*(h.statistics_size+1));
+    model_description(description,m->layers,m->n_rl,m->n_cl,m->n_fcl,m->n_bn,m->rls,m->cls,m->fcls,m->bns);
+    for(i = 0; i < m->n_bn; i++){
+        copy_array(m->bns[i]->final_mean,&statistics[j],m->bns[i]->vector_dim);
+        copy_array(m->bns[i]->final_var,&statistics[j+m->bns[i]->vector_dim],m->bns[i]->vector_dim);
+        j+=2*m->bns[i]->vector_dim;
+    }
+    save_mapped_file(file,&h,description,statistics,m->arena[0]);
+    free(description);
+    free(statistics);
+}
+
+/* This function loads a bmodel saved by save_mapped_bmodel, the parameters are views of the read only mapping
+ * of the file (see load_mapped_model) and the batch normalization layers use the saved final mean and variance
+ *
+ * Input:
+ *
+ *             @ char* file:= the name of the file
+ *
+ * */
+bmodel* load_mapped_bmodel(char* file){
+    if(file == NULL)
+        return NULL;
+    size_t size;
+    void* mapping = map_model_file(file,MAPPED_BMODEL,&size);
+    mapped_model_header* h = (mapped_model_header*)mapping;
+    int i,j = 0,counts[5];
+    rl** rls;
+    cl** cls;
+    fcl** fcls;
+    bn** bns;
+    model_description_layers((int*)((char*)mapping+h->description_offset),h->description_size,counts,&rls,&cls,&fcls,&bns);
+    bmodel* m = external_inference_batch_network(counts[0],counts[1],counts[2],counts[3],counts[4],rls,cls,fcls,bns,(float*)((char*)mapping+h->parameters_offset));
+    if(m->arena_size != h->arena_size || m->arena_weights != h->arena_weights || m->arena_bn != h->arena_bn){
+        fprintf(stderr,"Error: the parameters of the file %s don't match its layers\n",file);
+        exit(1);
+    }
+    float* statistics = (float*)((char*)mapping+h->statistics_offset);
+    for(i = 0; i < m->n_bn; i++){
+        j+=2*m->bns[i]->vector_dim;
+    }
+    if(j != h->statistics_size){
+        fprintf(stderr,"Error: the statistics of the file %s don't match its layers\n",file);
+        exit(1);
+    }
+    for(i = 0, j = 0; i < m->n_bn; i++){
+        copy_array(&statistics[j],m->bns[i]->final_mean,m->bns[i]->vector_dim);
+        copy_array(&statistics[j+m->bns[i]->vector_dim],m->bns[i]->final_var,m->bns[i]->vector_dim);
+        j+=2*m->bns[i]->vector_dim;
+    }
+    m->mapping = mapping;
+    m->mapping_size = size;
+    return m;
+}
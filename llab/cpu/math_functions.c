@@ -1,39 +1,256 @@
 #include "llab.h"
 
-void softmax(float* input, float* output, int size){
-    int i;
-    float sum = 0;
-    for(i = 0; i < size; i++){
-        sum+=exp(input[i]);
+/* 8 floats (and 8 ints) vectors, lowered by the compiler to the instruction set of each version of the kernels (see ISA_DISPATCH)*/
+typedef float v8sf __attribute__((vector_size(32)));
+typedef int v8si __attribute__((vector_size(32)));
+
+/* FAST_MATH: the array functions use the polynomial kernels below (max error ~2 ulp for exp, sigmoid and tanh)
+ * STRICT_MATH: the array functions call libm element by element*/
+static int math_precision_flag = FAST_MATH;
+
+/* This function sets how the transcendental array functions (sigmoid, tanh, softmax and their derivatives) are computed
+ *
+ * Input:
+ *
+ *             @ int flag:= FAST_MATH or STRICT_MATH
+ * */
+void set_math_precision(int flag){
+    if(flag != FAST_MATH && flag != STRICT_MATH){
+        fprintf(stderr,"Error: the math precision must be FAST_MATH or STRICT_MATH\n");
+        exit(1);
     }
-    
+    math_precision_flag = flag;
+}
+
+ISA_INLINE v8sf load_v8sf(float* p){
+    v8sf v;
+    memcpy(&v,p,sizeof(v8sf));
+    return v;
+}
+
+ISA_INLINE void store_v8sf(float* p, v8sf v){
+    memcpy(p,&v,sizeof(v8sf));
+}
+
+ISA_INLINE v8sf broadcast_v8sf(float x){
+    return (v8sf){x,x,x,x,x,x,x,x};
+}
+
+/* returns a where mask is set (-1), b elsewhere*/
+ISA_INLINE v8sf select_v8sf(v8si mask, v8sf a, v8sf b){
+    return (v8sf)(((v8si)a & mask) | ((v8si)b & ~mask));
+}
+
+/* This function computes exp(x) on 8 floats: x = n*ln(2) + r with |r| <= ln(2)/2 (Cody-Waite reduction),
+ * exp(r) is a degree 7 polynomial and 2^n is built in the exponent bits. The input is clamped
+ * to the range where the result is a normal float, below it the result is flushed to 0
+ *
+ * Input:
+ *
+ *             @ v8sf x:= the input vector
+ * */
+ISA_INLINE v8sf exp_v8sf(v8sf x){
+    v8sf fx,r,p,tf;
+    v8si n,underflow = (v8si)(x < broadcast_v8sf(-87.3365447505531f));
+    x = select_v8sf(x > broadcast_v8sf(88.3762626647949f),broadcast_v8sf(88.3762626647949f),x);
+    x = select_v8sf(x < broadcast_v8sf(-87.3365447505531f),broadcast_v8sf(-87.3365447505531f),x);
+
+    fx = x*broadcast_v8sf(1.44269504088896341f)+broadcast_v8sf(0.5f);
+    n = __builtin_convertvector(fx,v8si);
+    tf = __builtin_convertvector(n,v8sf);
+    n += (v8si)(tf > fx);// truncation -> floor
+    tf = __builtin_convertvector(n,v8sf);
+
+    r = x-tf*broadcast_v8sf(0.693359375f);
+    r = r-tf*broadcast_v8sf(-2.12194440e-4f);
+
+    p = broadcast_v8sf(1.9875691500e-4f);
+    p = p*r+broadcast_v8sf(1.3981999507e-3f);
+    p = p*r+broadcast_v8sf(8.3334519073e-3f);
+    p = p*r+broadcast_v8sf(4.1665795894e-2f);
+    p = p*r+broadcast_v8sf(1.6666665459e-1f);
+    p = p*r+broadcast_v8sf(5.0000001201e-1f);
+    p = p*r*r+r+broadcast_v8sf(1.0f);
+
+    n = (n+127) << 23;
+    return (v8sf)((v8si)(p*(v8sf)n) & ~underflow);
+}
+
+/* This function computes 1/(1+exp(-x)) on 8 floats*/
+ISA_INLINE v8sf sigmoid_v8sf(v8sf x){
+    v8sf one = broadcast_v8sf(1.0f);
+    return one/(one+exp_v8sf(-x));
+}
+
+/* This function computes tanh(x) on 8 floats: for |x| >= 0.625 tanh(|x|) = 1-2/(exp(2|x|)+1),
+ * below it an odd polynomial avoids the cancellation of that formula
+ *
+ * Input:
+ *
+ *             @ v8sf x:= the input vector
+ * */
+ISA_INLINE v8sf tanh_v8sf(v8sf x){
+    v8si sign = (v8si)x & (v8si){(int)0x80000000,(int)0x80000000,(int)0x80000000,(int)0x80000000,(int)0x80000000,(int)0x80000000,(int)0x80000000,(int)0x80000000};
+    v8sf a = (v8sf)((v8si)x ^ sign);
+    v8sf one = broadcast_v8sf(1.0f);
+    v8sf big,small,z;
+
+    big = one-broadcast_v8sf(2.0f)/(exp_v8sf(a+a)+one);
+    big = (v8sf)((v8si)big ^ sign);
+
+    z = x*x;
+    small = broadcast_v8sf(-5.70498872745e-3f);
+    small = small*z+broadcast_v8sf(2.06390887954e-2f);
+    small = small*z+broadcast_v8sf(-5.37397155531e-2f);
+    small = small*z+broadcast_v8sf(1.33314422036e-1f);
+    small = small*z+broadcast_v8sf(-3.33332819422e-1f);
+    small = small*z*x+x;
+
+    return select_v8sf(a < broadcast_v8sf(0.625f),small,big);
+}
+
+/* This function applies a v8sf kernel to an array, the last size%8 elements
+ * are computed on a padded copy
+ *
+ * Input:
+ *
+ *             @ v8sf (*f)(v8sf):= the kernel
+ *             @ float* input:= the input array
+ *             @ float* output:= the output array
+ *             @ int size:= the size of the arrays
+ * */
+ISA_INLINE void map_v8sf(v8sf (*f)(v8sf), float* input, float* output, int size){
+    int i,j;
+    float tail[8] = {0};
+    for(i = 0; i+8 <= size; i+=8){
+        store_v8sf(&output[i],f(load_v8sf(&input[i])));
+    }
+    if(i < size){
+        for(j = 0; j < size-i; j++){
+            tail[j] = input[i+j];
+        }
+        store_v8sf(tail,f(load_v8sf(tail)));
+        for(j = 0; j < size-i; j++){
+            output[i+j] = tail[j];
+        }
+    }
+}
+
+ISA_INLINE v8sf derivative_sigmoid_v8sf(v8sf x){
+    v8sf y = sigmoid_v8sf(x);
+    return y*(broadcast_v8sf(1.0f)-y);
+}
+
+ISA_INLINE v8sf derivative_tanh_v8sf(v8sf x){
+    v8sf y = tanh_v8sf(x);
+    return broadcast_v8sf(1.0f)-y*y;
+}
+
+/* This function computes the softmax of the input in two passes: the first one finds the max,
+ * the second one computes exp(input[i]-max) and their sum, so exp never overflows.
+ * The output is finally scaled by 1/sum
+ *
+ * Input:
+ *
+ *             @ float* input:= the input array
+ *             @ float* output:= the output array, can be the same of input
+ *             @ int size:= the size of the arrays
+ * */
+ISA_INLINE void softmax_kernel(float* input, float* output, int size){
+    int i,j;
+    float max,sum = 0;
+    if(size <= 0)
+        return;
+
+    max = input[0];
+    if(size >= 8){
+        v8sf vmax = load_v8sf(input),v;
+        for(i = 8; i+8 <= size; i+=8){
+            v = load_v8sf(&input[i]);
+            vmax = select_v8sf(v > vmax,v,vmax);
+        }
+        for(j = 0; j < 8; j++){
+            if(vmax[j] > max)
+                max = vmax[j];
+        }
+    }
+    for(i = size-size%8; i < size; i++){
+        if(input[i] > max)
+            max = input[i];
+    }
+
+    if(math_precision_flag == STRICT_MATH){
+        for(i = 0; i < size; i++){
+            output[i] = expf(input[i]-max);
+            sum+=output[i];
+        }
+    }
+    else{
+        v8sf vmax = broadcast_v8sf(max), vsum = {0};
+        for(i = 0; i+8 <= size; i+=8){
+            v8sf v = exp_v8sf(load_v8sf(&input[i])-vmax);
+            store_v8sf(&output[i],v);
+            vsum += v;
+        }
+        for(j = 0; j < 8; j++){
+            sum+=vsum[j];
+        }
+        if(i < size){
+            float tail[8] = {0};
+            for(j = 0; j < size-i; j++){
+                tail[j] = input[i+j]-max;
+            }
+            store_v8sf(tail,exp_v8sf(load_v8sf(tail)));
+            for(j = 0; j < size-i; j++){
+                output[i+j] = tail[j];
+                sum+=tail[j];
+            }
+        }
+    }
+
+    sum = 1/sum;
     for(i = 0; i < size; i++){
-        output[i] = exp(input[i])/sum;
+        output[i]*=sum;
     }
 }
+
+ISA_DISPATCH(, softmax, (float* input, float* output, int size), (input,output,size))
+
 float sigmoid(float x){
     return 1/(1+exp(-x));
 }
 
-void sigmoid_array(float* input, float* output, int size){
+ISA_INLINE void sigmoid_array_kernel(float* input, float* output, int size){
     int i;
+    if(math_precision_flag == FAST_MATH){
+        map_v8sf(sigmoid_v8sf,input,output,size);
+        return;
+    }
     for(i = 0; i < size; i++){
         output[i] = sigmoid(input[i]);
     }
 }
 
+ISA_DISPATCH(, sigmoid_array, (float* input, float* output, int size), (input,output,size))
+
 float derivative_sigmoid(float x){
     float y = sigmoid(x);
     return y*(1-y);
 }
 
-void derivative_sigmoid_array(float* input, float* output, int size){
+ISA_INLINE void derivative_sigmoid_array_kernel(float* input, float* output, int size){
     int i;
+    if(math_precision_flag == FAST_MATH){
+        map_v8sf(derivative_sigmoid_v8sf,input,output,size);
+        return;
+    }
     for(i = 0; i < size; i++){
         output[i] = derivative_sigmoid(input[i]);
     }
 }
 
+ISA_DISPATCH(, derivative_sigmoid_array, (float* input, float* output, int size), (input,output,size))
+
 float relu(float x){
     if(x > 0)
         return x;
@@ -41,13 +258,15 @@ float relu(float x){
         return 0;
 }
 
-void relu_array(float* input, float* output, int size){
+ISA_INLINE void relu_array_kernel(float* input, float* output, int size){
     int i;
     for(i = 0; i < size; i++){
         output[i] = relu(input[i]);
     }
 }
 
+ISA_DISPATCH(, relu_array, (float* input, float* output, int size), (input,output,size))
+
 float derivative_relu(float x){
     if(x > 0)
         return 1;
@@ -55,13 +274,15 @@ float derivative_relu(float x){
         return 0;
 }
 
-void derivative_relu_array(float* input, float* output, int size){
+ISA_INLINE void derivative_relu_array_kernel(float* input, float* output, int size){
     int i;
     for(i = 0; i < size; i++){
         output[i] = derivative_relu(input[i]);
     }
 }
 
+ISA_DISPATCH(, derivative_relu_array, (float* input, float* output, int size), (input,output,size))
+
 float leaky_relu(float x){
     if(x > 0)
         return x;
@@ -69,13 +290,15 @@ float leaky_relu(float x){
         return x*0.01;
 }
 
-void leaky_relu_array(float* input, float* output, int size){
+ISA_INLINE void leaky_relu_array_kernel(float* input, float* output, int size){
     int i;
     for(i = 0; i < size; i++){
         output[i] = leaky_relu(input[i]);
     }
 }
 
+ISA_DISPATCH(, leaky_relu_array, (float* input, float* output, int size), (input,output,size))
+
 float derivative_leaky_relu(float x){
     if(x > 0)
         return 1;
@@ -83,37 +306,50 @@ float derivative_leaky_relu(float x){
         return 0.01;
 }
 
-void derivative_leaky_relu_array(float* input, float* output, int size){
+ISA_INLINE void derivative_leaky_relu_array_kernel(float* input, float* output, int size){
     int i;
     for(i = 0; i < size; i++){
         output[i] = derivative_leaky_relu(input[i]);
     }
 }
 
+ISA_DISPATCH(, derivative_leaky_relu_array, (float* input, float* output, int size), (input,output,size))
+
 float tanhh(float x){
-    float y = exp(2*x);
-    return (y-1)/(y+1);
+    return tanhf(x);
 }
 
-void tanhh_array(float* input, float* output, int size){
+ISA_INLINE void tanhh_array_kernel(float* input, float* output, int size){
     int i;
+    if(math_precision_flag == FAST_MATH){
+        map_v8sf(tanh_v8sf,input,output,size);
+        return;
+    }
     for(i = 0; i < size; i++){
         output[i] = tanhh(input[i]);
     }
 }
 
+ISA_DISPATCH(, tanhh_array, (float* input, float* output, int size), (input,output,size))
+
 float derivative_tanhh(float x){
     float y = tanhh(x);
     return 1-y*y;
 }
 
-void derivative_tanhh_array(float* input, float* output, int size){
+ISA_INLINE void derivative_tanhh_array_kernel(float* input, float* output, int size){
     int i;
+    if(math_precision_flag == FAST_MATH){
+        map_v8sf(derivative_tanh_v8sf,input,output,size);
+        return;
+    }
     for(i = 0; i < size; i++){
         output[i] = derivative_tanhh(input[i]);
     }
 }
 
+ISA_DISPATCH(, derivative_tanhh_array, (float* input, float* output, int size), (input,output,size))
+
 float mse(float y_hat, float y){
     float z = y_hat-y;
     return z*z/2;
@@ -160,13 +396,15 @@ float derivative_cross_entropy_reduced_form_with_softmax(float y_hat, float y){
     return y_hat -y;
 }
 
-void derivative_cross_entropy_reduced_form_with_softmax_array(float* y_hat, float* y,float* output, int size){
+ISA_INLINE void derivative_cross_entropy_reduced_form_with_softmax_array_kernel(float* y_hat, float* y,float* output, int size){
     int i;
     for(i = 0; i < size; i++){
         output[i] = derivative_cross_entropy_reduced_form_with_softmax(y_hat[i],y[i]);
     }
 }
 
+ISA_DISPATCH(, derivative_cross_entropy_reduced_form_with_softmax_array, (float* y_hat, float* y,float* output, int size), (y_hat,y,output,size))
+
 
 
 
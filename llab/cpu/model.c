@@ -1,22 +1,413 @@
 #include "llab.h"
+#include <sys/mman.h>
 
-/* This function builds a model* structure which can be used to train the network
+/* This function places kernels, weights, biases and their D, D1, D2 of all the layers of the model
+ * in the ARENA_SLABS slabs of m->arena: first all the kernels and weights, then all the biases.
+ * Each layer view starts on a 64 bytes boundary (the gaps are 0 and stay 0 during the training)
+ * 
+ * Input:
+ *             @ model* m:= the model
+ *             @ float* parameters:= the parameters slab of an inference only model given by the caller, NULL to allocate the arena
+ * 
+ * */
+static void model_arena(model* m, float* parameters){
+    int i,j,w = 0,b;
+    cl* c;
+    for(i = 0; i < m->n_rl; i++){
+        for(j = 0; j < m->rls[i]->n_cl; j++){
+            c = m->rls[i]->cls[j];
+            w+=arena_aligned(c->n_kernels*c->channels*c->kernel_rows*c->kernel_cols);
+        }
+    }
+    for(i = 0; i < m->n_cl; i++){
+        c = m->cls[i];
+        w+=arena_aligned(c->n_kernels*c->channels*c->kernel_rows*c->kernel_cols);
+    }
+    for(i = 0; i < m->n_fcl; i++){
+        w+=arena_aligned(m->fcls[i]->output*m->fcls[i]->input);
+    }
+    b = w;
+    for(i = 0; i < m->n_rl; i++){
+        for(j = 0; j < m->rls[i]->n_cl; j++){
+            b+=arena_aligned(m->rls[i]->cls[j]->n_kernels);
+        }
+    }
+    for(i = 0; i < m->n_cl; i++){
+        b+=arena_aligned(m->cls[i]->n_kernels);
+    }
+    for(i = 0; i < m->n_fcl; i++){
+        b+=arena_aligned(m->fcls[i]->output);
+    }
+    
+    m->arena_weights = w;
+    m->arena_size = b;
+    m->arena_shared = parameters != NULL;
+    if(parameters != NULL){
+        m->arena = (float**)calloc(ARENA_SLABS,sizeof(float*));
+        m->arena[0] = parameters;
+    }
+    else
+        m->arena = m->inference_only_flag ? inference_parameters_arena(m->arena_size) : parameters_arena(m->arena_size);
+    
+    w = 0;
+    b = m->arena_weights;
+    for(i = 0; i < m->n_rl; i++){
+        for(j = 0; j < m->rls[i]->n_cl; j++){
+            c = m->rls[i]->cls[j];
+            move_cl_to_arena(c,m->arena,w,b);
+            w+=arena_aligned(c->n_kernels*c->channels*c->kernel_rows*c->kernel_cols);
+            b+=arena_aligned(c->n_kernels);
+        }
+    }
+    for(i = 0; i < m->n_cl; i++){
+        c = m->cls[i];
+        move_cl_to_arena(c,m->arena,w,b);
+        w+=arena_aligned(c->n_kernels*c->channels*c->kernel_rows*c->kernel_cols);
+        b+=arena_aligned(c->n_kernels);
+    }
+    for(i = 0; i < m->n_fcl; i++){
+        move_fcl_to_arena(m->fcls[i],m->arena,w,b);
+        w+=arena_aligned(m->fcls[i]->output*m->fcls[i]->input);
+        b+=arena_aligned(m->fcls[i]->output);
+    }
+}
+
+/* the view p of the slab "from" becomes the same view of the slab "to" (the missing arrays stay NULL)*/
+static float* arena_rebase(float* p, float* from, float* to){
+    if(p == NULL)
+        return NULL;
+    return to + (p-from);
+}
+
+/* This function moves the views of the parameters, D1 and D2 of the layers of a convolutional layer
+ * from the slabs "from" to the slabs "to", the D slab is not touched
+ * 
+ * Input:
+ *             @ cl* c:= the convolutional layer
+ *             @ float** from:= the current slabs of the layer
+ *             @ float** to:= the new slabs, with the same layout
+ * 
+ * */
+static void rebase_cl(cl* c, float** from, float** to){
+    int i;
+    for(i = 0; i < c->n_kernels; i++){
+        c->kernels[i] = arena_rebase(c->kernels[i],from[0],to[0]);
+        c->d1_kernels[i] = arena_rebase(c->d1_kernels[i],from[2],to[2]);
+        c->d2_kernels[i] = arena_rebase(c->d2_kernels[i],from[3],to[3]);
+    }
+    c->biases = arena_rebase(c->biases,from[0],to[0]);
+    c->d1_biases = arena_rebase(c->d1_biases,from[2],to[2]);
+    c->d2_biases = arena_rebase(c->d2_biases,from[3],to[3]);
+}
+
+/* This function returns 1 if m and m2 have arenas with the same layout, 0 otherwise
+ * 
+ * Input:
+ *             @ model* m:= the first model
+ *             @ model* m2:= the second model
+ * 
+ * */
+static int same_model_arena(model* m, model* m2){
+    return m->arena != NULL && m2->arena != NULL && m->arena_size == m2->arena_size && m->arena_weights == m2->arena_weights;
+}
+
+/* This function moves the views of the parameters, D1 and D2 of all the layers of the model
+ * from its slabs to the slabs "to" (with the same layout), the D slab is not touched
+ * 
+ * Input:
+ *             @ model* m:= the model
+ *             @ float** to:= the new slabs
+ * 
+ * */
+static void model_rebase(model* m, float** to){
+    int i,j;
+    for(i = 0; i < m->n_rl; i++){
+        for(j = 0; j < m->rls[i]->n_cl; j++){
+            rebase_cl(m->rls[i]->cls[j],m->arena,to);
+        }
+    }
+    for(i = 0; i < m->n_cl; i++){
+        rebase_cl(m->cls[i],m->arena,to);
+    }
+    for(i = 0; i < m->n_fcl; i++){
+        fcl* f = m->fcls[i];
+        f->weights = arena_rebase(f->weights,m->arena[0],to[0]);
+        f->d1_weights = arena_rebase(f->d1_weights,m->arena[2],to[2]);
+        f->d2_weights = arena_rebase(f->d2_weights,m->arena[3],to[3]);
+        f->biases = arena_rebase(f->biases,m->arena[0],to[0]);
+        f->d1_biases = arena_rebase(f->d1_biases,m->arena[2],to[2]);
+        f->d2_biases = arena_rebase(f->d2_biases,m->arena[3],to[3]);
+    }
+}
+
+/* This function must be called after the parameters of the model have been changed outside the library functions:
+ * the winograd kernels of the convolutional layers are computed again and the inference contexts
+ * of the model (see model_inference_context) compute again their winograd kernels at their next feed forward.
+ * The update, paste and training functions of the library call it
+ * 
+ * Input:
+ *             @ model* m:= the model
+ * 
+ * */
+void model_parameters_changed(model* m){
+    if(m == NULL)
+        return;
+    int i,j;
+    m->parameters_generation++;
+    for(i = 0; i < m->n_rl; i++){
+        for(j = 0; j < m->rls[i]->n_cl; j++){
+            m->rls[i]->cls[j]->winograd_kernels_flag = 0;
+        }
+    }
+    for(i = 0; i < m->n_cl; i++){
+        m->cls[i]->winograd_kernels_flag = 0;
+    }
+}
+
+/* This function updates all the parameters in the arena of the model in a single pass:
+ * the partial derivatives of the weights are scaled by gradient_scale, the weight decay is added
+ * and then the nesterov or adam step is applied. The biases are neither scaled nor decayed
+ * 
+ * Input:
+ *             @ model* m:= the model
+ *             @ float lr:= the learning rate
+ *             @ float momentum:= the momentum
+ *             @ int mini_batch_size:= the batch used
+ *             @ int gradient_descent_flag:= NESTEROV or ADAM
+ *             @ float* b1:= the hyper parameter b1 of adam algorithm
+ *             @ float* b2:= the hyper parameter b2 of adam algorithm
+ *             @ float gradient_scale:= the clipping factor of the partial derivatives of the weights
+ *             @ float weight_decay:= the l2 term, the derivative of the weight w becomes D*gradient_scale + weight_decay*w
+ * 
+ * */
+static void model_arena_update(model* m, float lr, float momentum, int mini_batch_size, int gradient_descent_flag, float* b1, float* b2, float gradient_scale, float weight_decay){
+    float* p = m->arena[0];
+    float* d = m->arena[1];
+    float* d1 = m->arena[2];
+    float* d2 = m->arena[3];
+    int w = m->arena_weights;
+    if(gradient_descent_flag == NESTEROV){
+        nesterov_momentum_array(p,d,d1,w,lr,momentum,mini_batch_size,gradient_scale,weight_decay,0);
+        nesterov_momentum_array(&p[w],&d[w],&d1[w],m->arena_size-w,lr,momentum,mini_batch_size,1,0,0);
+    }
+    else if(gradient_descent_flag == ADAM){
+        adam_algorithm_array(p,d,d1,d2,w,lr,BETA1_ADAM,BETA2_ADAM,(*b1),(*b2),EPSILON_ADAM,mini_batch_size,gradient_scale,weight_decay,0);
+        adam_algorithm_array(&p[w],&d[w],&d1[w],&d2[w],m->arena_size-w,lr,BETA1_ADAM,BETA2_ADAM,(*b1),(*b2),EPSILON_ADAM,mini_batch_size,1,0,0);
+        (*b1)*=BETA1_ADAM;
+        (*b2)*=BETA2_ADAM;
+    }
+    model_parameters_changed(m);
+}
+
+/* This function returns the activation function array used for the output of a residual layer
+ * with that activation_flag, NULL if the flag is not an activation of the residual layers
+ * 
+ * Input:
+ *             @ int activation_flag:= the activation flag
+ *             @ int derivative_flag:= 1 for the derivative of the activation
+ * 
+ * */
+static void (*residual_activation(int activation_flag, int derivative_flag))(float* input, float* output, int size){
+    if(activation_flag == LEAKY_RELU)
+        return derivative_flag ? derivative_leaky_relu_array : leaky_relu_array;
+    else if(activation_flag == RELU)
+        return derivative_flag ? derivative_relu_array : relu_array;
+    else if(activation_flag == SIGMOID)
+        return derivative_flag ? derivative_sigmoid_array : sigmoid_array;
+    else if(activation_flag == TANH)
+        return derivative_flag ? derivative_tanhh_array : tanhh_array;
+    return NULL;
+}
+
+/* This function returns the output of a convolutional layer (after pooling, normalization or activation)*/
+static float* cl_output_array(cl* c){
+    if(c->pooling_flag)
+        return c->post_pooling;
+    else if(c->normalization_flag)
+        return c->post_normalization;
+    else if(c->activation_flag)
+        return c->post_activation;
+    return c->pre_activation;
+}
+
+/* This function returns the residual layer that contains the k-th convolutional layer
+ * of all the residual layers and in count the number of convolutional layers of the previous residual layers
+ * 
+ * Input:
+ *             @ model* m:= the model
+ *             @ int k:= the index of the convolutional layer among the convolutional layers of the residual layers
+ *             @ int* count:= where the number of the previous convolutional layers is stored
+ * 
+ * */
+static int model_residual_index(model* m, int k, int* count){
+    int z;
+    (*count) = 0;
+    for(z = 0; z < m->n_rl && (*count) <= k; z++){
+        (*count)+=m->rls[z]->n_cl;
+    }
+    z--;
+    (*count)-=m->rls[z]->n_cl;
+    return z;
+}
+
+/* This function resolves the arrays of the layers read by the residual connections of a step of the plan,
+ * they are resolved again when the activation arrays of the layers are reallocated (see set_model_max_batch_size)
+ * 
+ * Input:
+ *             @ model_step* s:= the step
+ * 
+ * */
+static void model_step_sources(model_step* s){
+    if(s->sla == RLS)
+        s->rl_sum_source = cl_output_array(s->c);
+    if(s->input_flag == FCLS)
+        s->rl_copy_source = s->in_f->activation_flag ? s->in_f->post_activation : s->in_f->pre_activation;
+    else if(s->in_rl != NULL)
+        s->rl_copy_source = s->in_rl->cl_output->post_activation;
+    else if(s->input_flag == CLS)
+        s->rl_copy_source = cl_output_array(s->in_c);
+}
+
+/* This function resolves a step of the plan: the layer at the row i of m->sla, its input and the residual buffers
+ * 
+ * Input:
+ *             @ model* m:= the model
+ *             @ model_step* s:= the step
+ *             @ int i:= the row of m->sla
+ *             @ int sla:= FCLS, CLS or RLS
+ *             @ int k1:= the index of the fully-connected layer if sla = FCLS, else the fully-connected layers before this one
+ *             @ int k2:= the same for the convolutional layers
+ *             @ int k3:= the same for the convolutional layers of the residual layers
+ * 
+ * */
+static void model_plan_step(model* m, model_step* s, int i, int sla, int k1, int k2, int k3){
+    int z,z2,count,count2;
+    memset(s,0,sizeof(model_step));
+    s->sla = sla;
+    
+    if(sla == FCLS){
+        s->f = m->fcls[k1];
+        if(s->f->activation_flag == SOFTMAX && i != m->layers-1 && m->sla[i+1][0] != 0){
+            fprintf(stderr,"Error: the softmax can be applied only on the last fully-connected layers\n");
+            exit(1);
+        }
+    }
+    else if(sla == CLS)
+        s->c = m->cls[k2];
+    else{
+        z = model_residual_index(m,k3,&count);
+        s->r = m->rls[z];
+        s->c = s->r->cls[k3-count];
+        s->rl_first = k3-count == 0;
+        s->rl_last = k3-count == s->r->n_cl-1;
+        s->rl_size = s->r->channels*s->r->input_rows*s->r->input_cols;
+        s->rl_activation = residual_activation(s->r->cl_output->activation_flag,0);
+    }
+    if(sla != FCLS && s->c->activation_flag == SOFTMAX){
+        fprintf(stderr,"Error: the softmax can be applied only on the last fully-connected layers\n");
+        exit(1);
+    }
+    
+    if(!i)
+        return;
+    
+    if(m->sla[i-1][0] == FCLS){
+        s->input_flag = FCLS;
+        s->in_f = m->fcls[k1-1];
+        s->rl_copy_dropout = s->in_f;
+    }
+    else if(m->sla[i-1][0] == CLS){
+        s->input_flag = CLS;
+        s->in_c = m->cls[k2-1];
+    }
+    else if(m->sla[i-1][0] == RLS){
+        s->input_flag = CLS;
+        z2 = model_residual_index(m,k3-1,&count2);
+        if(sla == RLS && m->rls[z2] == s->r)
+            s->in_c = s->r->cls[k3-1-count2];
+        else{
+            s->in_c = m->rls[z2]->cl_output;
+            s->in_rl = m->rls[z2];
+            s->in_rl_derivative = residual_activation(s->in_rl->cl_output->activation_flag,1);
+        }
+    }
+}
+
+/* This function compiles m->sla in the feed forward and back propagation plans of the model,
+ * so model_tensor_input_ff and model_tensor_input_bp don't search the layers at each call
+ * 
+ * Input:
+ *             @ model* m:= the model
+ * 
+ * */
+static void model_plan(model* m){
+    int i,j,k1 = 0,k2 = 0,k3 = 0;
+    m->n_ff_steps = 0;
+    m->n_bp_steps = 0;
+    for(i = 0; i < m->layers; i++){
+        for(j = 0; j < m->layers && m->sla[i][j] != 0; j++){
+            m->n_ff_steps++;
+        }
+        if(m->sla[i][0] != 0)
+            m->n_bp_steps++;
+    }
+    m->ff_plan = (model_step*)malloc(sizeof(model_step)*(m->n_ff_steps > 0 ? m->n_ff_steps : 1));
+    m->bp_plan = (model_step*)malloc(sizeof(model_step)*(m->n_bp_steps > 0 ? m->n_bp_steps : 1));
+    
+    m->n_ff_steps = 0;
+    for(i = 0; i < m->layers; i++){
+        for(j = 0; j < m->layers && m->sla[i][j] != 0; j++){
+            model_plan_step(m,&m->ff_plan[m->n_ff_steps],i,m->sla[i][j],k1,k2,k3);
+            model_step_sources(&m->ff_plan[m->n_ff_steps]);
+            m->n_ff_steps++;
+            if(m->sla[i][j] == FCLS)
+                k1++;
+            else if(m->sla[i][j] == CLS)
+                k2++;
+            else
+                k3++;
+        }
+    }
+    
+    /* the back propagation counts only the first layer of each row*/
+    k1 = m->n_fcl;
+    k2 = m->n_cl;
+    k3 = 0;
+    for(i = 0; i < m->n_rl; i++){
+        k3+=m->rls[i]->n_cl;
+    }
+    m->n_bp_steps = 0;
+    for(i = m->layers-1; i >= 0; i--){
+        if(m->sla[i][0] == 0)
+            continue;
+        if(m->sla[i][0] == FCLS)
+            k1--;
+        else if(m->sla[i][0] == CLS)
+            k2--;
+        else
+            k3--;
+        model_plan_step(m,&m->bp_plan[m->n_bp_steps],i,m->sla[i][0],k1,k2,k3);
+        model_step_sources(&m->bp_plan[m->n_bp_steps]);
+        m->n_bp_steps++;
+    }
+}
+
+/* This function builds a model* structure, see network and inference_network
  * 
  * Input:
  *             
- *             @ int layers:= number of total layers, this means that if you have 2 layers with the same layer id 
- *                            then layers = 2. For example if you have 2 fully-connected layers with same layer id = 0
- *                            then layers param must be set to 2. if you have 3 layers, 2 with same layer id and 1 with another
- *                            layer id, then layers = 3
+ *             @ int layers:= number of total layers
  *             @ int n_rl:= same as layers but only for residual layers
- *             @ int n_cl:= same as layer but only for convolutional layers. (the convolutional layers inside residual layer must not be count)
+ *             @ int n_cl:= same as layer but only for convolutional layers
  *             @ int n_fcl:= same as layer, but only for fully-connected layers
  *             @ rl** rls:= your residual layers
  *             @ cl** cls:= your convolutional layers
  *             @ fcl** fcls:= your fully-connected layers
+ *             @ int inference_only_flag:= 1 if the model computes only the feed forward
+ *             @ float* parameters:= the parameters slab given by the caller (only with inference_only_flag), NULL to allocate the arena
  * 
  * */
-model* network(int layers, int n_rl, int n_cl, int n_fcl, rl** rls, cl** cls, fcl** fcls){
+static model* new_network(int layers, int n_rl, int n_cl, int n_fcl, rl** rls, cl** cls, fcl** fcls, int inference_only_flag, float* parameters){
     if(!layers || (!n_rl && !n_cl && !n_fcl) || (!n_rl && rls != NULL) || (!n_cl && cls!= NULL) || (!n_fcl && fcls != NULL)){
         fprintf(stderr,"Error: layers must be > 0 and at least one between n_rl, n_cl, n_fcl must be > 0\n");
         exit(1); 
@@ -24,6 +415,32 @@ model* network(int layers, int n_rl, int n_cl, int n_fcl, rl** rls, cl** cls, fc
     
     int i,j,k, position, count, k1,k2,k3;
     
+    /* the layers built for inference only have no partial derivatives, they can't be trained*/
+    for(i = 0; i < n_rl; i++){
+        if(inference_only_flag)
+            set_residual_inference_only(rls[i]);
+        else if(rls[i]->cl_output->inference_only_flag){
+            fprintf(stderr,"Error: the residual layer %d has been built for inference only, use inference_network\n",i);
+            exit(1);
+        }
+    }
+    for(i = 0; i < n_cl; i++){
+        if(inference_only_flag)
+            set_convolutional_inference_only(cls[i]);
+        else if(cls[i]->inference_only_flag){
+            fprintf(stderr,"Error: the convolutional layer %d has been built for inference only, use inference_network\n",cls[i]->layer);
+            exit(1);
+        }
+    }
+    for(i = 0; i < n_fcl; i++){
+        if(inference_only_flag)
+            set_fully_connected_inference_only(fcls[i]);
+        else if(fcls[i]->inference_only_flag){
+            fprintf(stderr,"Error: the fully-connected layer %d has been built for inference only, use inference_network\n",fcls[i]->layer);
+            exit(1);
+        }
+    }
+    
     
     /*checking if the residual layer has the right size from the input to the output*/
     for(i = 0; i < n_rl; i++){
@@ -166,10 +583,114 @@ model* network(int layers, int n_rl, int n_cl, int n_fcl, rl** rls, cl** cls, fc
     m->rls = rls;
     m->cls = cls;
     m->fcls = fcls;
+    m->inference_only_flag = inference_only_flag;
+    m->mapping = NULL;
+    m->mapping_size = 0;
+    m->parameters_generation = 0;
+    m->parent = NULL;
+    m->parent_generation = 0;
+    model_arena(m,parameters);
+    model_plan(m);
+    m->input_layer = (cl*)calloc(1,sizeof(cl));
+    m->input_layer->normalization_flag = NO_NORMALIZATION;
+    m->input_layer->pooling_flag = NO_POOLING;
+    m->input_layer->activation_flag = SIGMOID;
+    m->input_layer->layer = -1;
+    m->max_batch_size = 1;
+    m->n_batch_views = 0;
+    m->batch_views = NULL;
+    m->n_activation_arrays = 0;
+    m->n_activation_buffers = 0;
+    m->activation_arrays = NULL;
+    m->activation_steps = NULL;
+    m->activation_buffers = NULL;
         
     return m;
 }
 
+/* This function builds a model* structure which can be used to train the network.
+ * The parameters of the layers (and their D, D1, D2) are moved in the contiguous slabs of the model arena
+ * and they are freed with the model
+ * 
+ * Input:
+ *             
+ *             @ int layers:= number of total layers, this means that if you have 2 layers with the same layer id 
+ *                            then layers = 2. For example if you have 2 fully-connected layers with same layer id = 0
+ *                            then layers param must be set to 2. if you have 3 layers, 2 with same layer id and 1 with another
+ *                            layer id, then layers = 3
+ *             @ int n_rl:= same as layers but only for residual layers
+ *             @ int n_cl:= same as layer but only for convolutional layers. (the convolutional layers inside residual layer must not be count)
+ *             @ int n_fcl:= same as layer, but only for fully-connected layers
+ *             @ rl** rls:= your residual layers
+ *             @ cl** cls:= your convolutional layers
+ *             @ fcl** fcls:= your fully-connected layers
+ * 
+ * */
+model* network(int layers, int n_rl, int n_cl, int n_fcl, rl** rls, cl** cls, fcl** fcls){
+    return new_network(layers,n_rl,n_cl,n_fcl,rls,cls,fcls,0,NULL);
+}
+
+/* This function builds a model* structure which can be used only for the feed forward (as network).
+ * The partial derivatives, the arrays of the optimizers and the arrays used only by the back propagation
+ * of the layers are freed and the arena of the model holds only the parameters, so the model takes
+ * about 1/4 of the memory of a model built by network. The back propagation, the updates and the
+ * training mode are rejected
+ * 
+ * Input:
+ *             
+ *             @ int layers:= number of total layers (see network)
+ *             @ int n_rl:= same as layers but only for residual layers
+ *             @ int n_cl:= same as layer but only for convolutional layers. (the convolutional layers inside residual layer must not be count)
+ *             @ int n_fcl:= same as layer, but only for fully-connected layers
+ *             @ rl** rls:= your residual layers
+ *             @ cl** cls:= your convolutional layers
+ *             @ fcl** fcls:= your fully-connected layers
+ * 
+ * */
+model* inference_network(int layers, int n_rl, int n_cl, int n_fcl, rl** rls, cl** cls, fcl** fcls){
+    return new_network(layers,n_rl,n_cl,n_fcl,rls,cls,fcls,1,NULL);
+}
+
+/* This function builds a model* structure which can be used only for the feed forward (as inference_network),
+ * but the parameters slab of its arena is given by the caller and it is not freed with the model.
+ * The slab must be 64 bytes aligned and it must hold the parameters in the layout of the arena
+ * (see model_arena), the parameters of the layers are copied in the slab, so the layers built without
+ * parameters (see set_layers_parameters_allocation) use the slab as it is, for example a read only mapping of a file
+ * 
+ * Input:
+ *             
+ *             @ int layers:= number of total layers (see network)
+ *             @ int n_rl:= same as layers but only for residual layers
+ *             @ int n_cl:= same as layer but only for convolutional layers. (the convolutional layers inside residual layer must not be count)
+ *             @ int n_fcl:= same as layer, but only for fully-connected layers
+ *             @ rl** rls:= your residual layers
+ *             @ cl** cls:= your convolutional layers
+ *             @ fcl** fcls:= your fully-connected layers
+ *             @ float* parameters:= the parameters slab
+ * 
+ * */
+model* external_inference_network(int layers, int n_rl, int n_cl, int n_fcl, rl** rls, cl** cls, fcl** fcls, float* parameters){
+    if(parameters == NULL || (size_t)parameters%(ARENA_ALIGNMENT*sizeof(float))){
+        fprintf(stderr,"Error: the parameters slab must be 64 bytes aligned\n");
+        exit(1);
+    }
+    return new_network(layers,n_rl,n_cl,n_fcl,rls,cls,fcls,1,parameters);
+}
+
+/* This function exits if the model has been built for inference only
+ * 
+ * Input:
+ *             @ model* m:= the model
+ *             @ char* function:= the name of the function that needs the partial derivatives
+ * 
+ * */
+static void model_training_check(model* m, char* function){
+    if(m->inference_only_flag){
+        fprintf(stderr,"Error: the model has been built for inference only, %s can't be used\n",function);
+        exit(1);
+    }
+}
+
 /* This function frees the space allocated by a model structure
  * 
  * Input:
@@ -181,6 +702,17 @@ void free_model(model* m){
         return;
     int i;
     
+    /* the planned activation arrays are views of the buffers of the model*/
+    for(i = 0; i < m->n_activation_arrays; i++){
+        *m->activation_arrays[i].field = NULL;
+    }
+    for(i = 0; i < m->n_activation_buffers; i++){
+        free(m->activation_buffers[i]);
+    }
+    free(m->activation_arrays);
+    free(m->activation_steps);
+    free(m->activation_buffers);
+    
     for(i = 0; i < m->n_rl; i++){
         free_residual(m->rls[i]);
     }
@@ -197,21 +729,31 @@ void free_model(model* m){
         free(m->sla[i]);
     }
     free(m->sla);
+    free(m->ff_plan);
+    free(m->bp_plan);
+    free(m->input_layer);
+    free(m->batch_views);
+    if(m->arena_shared){
+        free(m->arena[1]);
+        free(m->arena);
+    }
+    else
+        free_parameters_arena(m->arena);
+    if(m->mapping != NULL)
+        munmap(m->mapping,m->mapping_size);
     free(m);
 }
 
 
-/* This function copies a model using the copy function for the layers
- * see layers.c file
+/* This function copies the layers of a model and builds a new model with them
  * 
  * Input:
  *         
  *             @ model* m:= the model that must be copied
+ *             @ int inference_only_flag:= 1 if the copy is built with inference_network
  * 
  * */
-model* copy_model(model* m){
-    if(m == NULL)
-        return NULL;
+static model* copy_network(model* m, int inference_only_flag){
     int i;
     
     fcl** fcls = NULL;
@@ -233,26 +775,146 @@ model* copy_model(model* m){
     for(i = 0; i < m->n_rl; i++){
         rls[i] = copy_rl(m->rls[i]);
     }
-    model* copy = network(m->layers, m->n_rl, m->n_cl, m->n_fcl, rls, cls, fcls);
-    return copy;
+    return new_network(m->layers, m->n_rl, m->n_cl, m->n_fcl, rls, cls, fcls, inference_only_flag, NULL);
 }
 
-
-
-/* This function copies a model using the paste function for the layers
+/* This function copies a model using the copy function for the layers
  * see layers.c file
  * 
  * Input:
  *         
  *             @ model* m:= the model that must be copied
- *             @ model* copy:= the model where m is copied
  * 
  * */
-void paste_model(model* m, model* copy){
+model* copy_model(model* m){
     if(m == NULL)
-        return;
+        return NULL;
+    return copy_network(m,m->inference_only_flag);
+}
+
+/* This function makes the layers of the model "replica" use the parameters, D1 and D2 slabs of the model m:
+ * the replica keeps its own activations and its own partial derivatives (the D slab), so more threads
+ * can run feed forward and back propagation on the replicas and update the same weights (hogwild).
+ * The slabs of m are not freed with the replica, m must be freed after the replica
+ * 
+ * Input:
+ *             @ model* m:= the model that owns the parameters
+ *             @ model* replica:= a copy of m (see copy_model)
+ * 
+ * */
+void share_model_parameters(model* m, model* replica){
+    model_training_check(m,"share_model_parameters");
+    if(!same_model_arena(m,replica) || m->n_fcl != replica->n_fcl || m->n_cl != replica->n_cl || m->n_rl != replica->n_rl){
+        fprintf(stderr,"Error: the replica must be a copy of the model\n");
+        exit(1);
+    }
+    if(replica->arena_shared || m->arena_shared){
+        fprintf(stderr,"Error: the parameters of the replica or of the model are already shared\n");
+        exit(1);
+    }
+    int i;
+    float* slabs[ARENA_SLABS];
+    for(i = 0; i < ARENA_SLABS; i++){
+        slabs[i] = i == 1 ? replica->arena[1] : m->arena[i];
+    }
+    model_rebase(replica,slabs);
+    for(i = 0; i < ARENA_SLABS; i++){
+        if(i != 1){
+            free(replica->arena[i]);
+            replica->arena[i] = slabs[i];
+        }
+    }
+    replica->arena_shared = 1;
+}
+
+/* This function builds an execution context of the model m for the feed forward: the context is an inference only
+ * model (see inference_network) whose layers are built without parameters straight on the parameters slab of m,
+ * it owns only the arrays of the feed forward (and its winograd kernels). Each thread can run model_tensor_input_ff
+ * (or model_tensor_input_ff_batch) on its own context at the same time of the others, and all the threads share
+ * a single read only copy of the weights. The parameters of m must not change while the contexts are used,
+ * between two uses they can be changed: the contexts compute again their winograd kernels when the parameters
+ * generation of m changes (see model_parameters_changed). m must be freed after its contexts (free_model frees a context)
+ * 
+ * Input:
+ *             @ model* m:= the model that owns the parameters, it can be a training or an inference only model
+ * 
+ * */
+model* model_inference_context(model* m){
+    if(m == NULL)
+        return NULL;
+    if(m->arena == NULL){
+        fprintf(stderr,"Error: the inference context needs a model built with network() or inference_network()\n");
+        exit(1);
+    }
+    int i,j;
+    cl* c;
+    fcl* f;
+    rl** rls = m->n_rl ? (rl**)malloc(sizeof(rl*)*m->n_rl) : NULL;
+    cl** cls = m->n_cl ? (cl**)malloc(sizeof(cl*)*m->n_cl) : NULL;
+    fcl** fcls = m->n_fcl ? (fcl**)malloc(sizeof(fcl*)*m->n_fcl) : NULL;
+    cl** rl_cls;
+    
+    /* the layers get the views of the parameters of m when they are moved in the arena of the context*/
+    set_layers_parameters_allocation(0);
+    for(i = 0; i < m->n_rl; i++){
+        rl_cls = (cl**)malloc(sizeof(cl*)*m->rls[i]->n_cl);
+        for(j = 0; j < m->rls[i]->n_cl; j++){
+            c = m->rls[i]->cls[j];
+            rl_cls[j] = convolutional(c->channels,c->input_rows,c->input_cols,c->kernel_rows,c->kernel_cols,c->n_kernels,c->stride1_rows,c->stride1_cols,c->padding1_rows,c->padding1_cols,c->stride2_rows,c->stride2_cols,c->padding2_rows,c->padding2_cols,c->pooling_rows,c->pooling_cols,c->normalization_flag,c->activation_flag,c->pooling_flag,c->layer,c->convolutional_flag);
+            set_convolutional_algorithm(rl_cls[j],c->algorithm_flag);
+        }
+        rls[i] = residual(m->rls[i]->channels,m->rls[i]->input_rows,m->rls[i]->input_cols,m->rls[i]->n_cl,rl_cls);
+    }
+    for(i = 0; i < m->n_cl; i++){
+        c = m->cls[i];
+        cls[i] = convolutional(c->channels,c->input_rows,c->input_cols,c->kernel_rows,c->kernel_cols,c->n_kernels,c->stride1_rows,c->stride1_cols,c->padding1_rows,c->padding1_cols,c->stride2_rows,c->stride2_cols,c->padding2_rows,c->padding2_cols,c->pooling_rows,c->pooling_cols,c->normalization_flag,c->activation_flag,c->pooling_flag,c->layer,c->convolutional_flag);
+        set_convolutional_algorithm(cls[i],c->algorithm_flag);
+    }
+    for(i = 0; i < m->n_fcl; i++){
+        f = m->fcls[i];
+        fcls[i] = fully_connected(f->input,f->output,f->layer,f->dropout_flag,f->activation_flag,f->dropout_threshold);
+    }
+    set_layers_parameters_allocation(1);
+    
+    model* context = new_network(m->layers,m->n_rl,m->n_cl,m->n_fcl,rls,cls,fcls,1,m->arena[0]);
+    context->parent = m;
+    context->parent_generation = m->parameters_generation;
+    return context;
+}
+
+/* This function computes again the winograd kernels of an inference context if the parameters of its model have been changed*/
+static void model_context_check(model* m){
+    if(m->parent != NULL && m->parent_generation != m->parent->parameters_generation){
+        model_parameters_changed(m);
+        m->parent_generation = m->parent->parameters_generation;
+    }
+}
+
+
+
+/* This function copies a model using the paste function for the layers
+ * see layers.c file
+ * 
+ * Input:
+ *         
+ *             @ model* m:= the model that must be copied
+ *             @ model* copy:= the model where m is copied
+ * 
+ * */
+void paste_model(model* m, model* copy){
+    if(m == NULL)
+        return;
     int i;
     
+    if(same_model_arena(m,copy)){
+        for(i = 0; i < ARENA_SLABS; i++){
+            if(copy->arena[i] != NULL && m->arena[i] != NULL)
+                memcpy(copy->arena[i],m->arena[i],sizeof(float)*m->arena_size);
+        }
+        model_parameters_changed(copy);
+        return;
+    }
+    
     for(i = 0; i < m->n_fcl; i++){
         paste_fcl(m->fcls[i],copy->fcls[i]);
     }
@@ -262,6 +924,7 @@ void paste_model(model* m, model* copy){
     for(i = 0; i < m->n_rl; i++){
         paste_rl(m->rls[i],copy->rls[i]);
     }
+    model_parameters_changed(copy);
     return;
 }
 
@@ -279,6 +942,16 @@ void slow_paste_model(model* m, model* copy, float tau){
         return;
     int i;
     
+    if(same_model_arena(m,copy)){
+        float* p = m->arena[0];
+        float* p2 = copy->arena[0];
+        for(i = 0; i < m->arena_size; i++){
+            p2[i] = tau*p[i] + (1-tau)*p2[i];
+        }
+        model_parameters_changed(copy);
+        return;
+    }
+    
     for(i = 0; i < m->n_fcl; i++){
         slow_paste_fcl(m->fcls[i],copy->fcls[i],tau);
     }
@@ -288,6 +961,7 @@ void slow_paste_model(model* m, model* copy, float tau){
     for(i = 0; i < m->n_rl; i++){
         slow_paste_rl(m->rls[i],copy->rls[i],tau);
     }
+    model_parameters_changed(copy);
     return;
 }
 /* This function resets a model using the copy model function
@@ -297,6 +971,11 @@ model* reset_model(model* m){
     if(m == NULL)
         return NULL;
     int i;
+    if(m->arena != NULL){
+        if(m->arena[1] != NULL)
+            memset(m->arena[1],0,sizeof(float)*m->arena_size);
+        return reset_model_except_partial_derivatives(m);
+    }
     for(i = 0; i < m->n_fcl; i++){
         reset_fcl(m->fcls[i]);
     }
@@ -309,6 +988,28 @@ model* reset_model(model* m){
     return m;
 }
 
+/* This function resets all the arrays used by the feed forward and the back propagation of the model
+ * except for the partial derivatives, so the partial derivatives of more inputs can be accumulated
+ * 
+ * Input:
+ *             @ model* m:= the model
+ * */
+model* reset_model_except_partial_derivatives(model* m){
+    if(m == NULL)
+        return NULL;
+    int i;
+    for(i = 0; i < m->n_fcl; i++){
+        reset_fcl_except_partial_derivatives(m->fcls[i]);
+    }
+    for(i = 0; i < m->n_cl; i++){
+        reset_cl_except_partial_derivatives(m->cls[i]);
+    }
+    for(i = 0; i < m->n_rl; i++){
+        reset_rl_except_partial_derivatives(m->rls[i]);
+    }
+    return m;
+}
+
 
 /* this function compute the space allocated by the arrays of m
  * 
@@ -360,7 +1061,8 @@ void save_model(model* m, int n){
     s = itoa(n,s);
     s = strcat(s,t);
     
-    fw = fopen(s,"a");
+    /* a new file, the layers are appended to it*/
+    fw = fopen(s,"w");
     
     if(fw == NULL){
         fprintf(stderr,"Error: error during the opening of the file %s\n",s);
@@ -416,14 +1118,15 @@ void save_model(model* m, int n){
     free(s);
 }
 
-/* This function loads a network model from a .bin file with name file
+/* This function loads a network model from a .bin file with name file, see load_model and load_inference_model
  * 
  * Input:
  * 
  *             @ char* file:= the binary file from which the model will be loaded
+ *             @ int inference_only_flag:= 1 if the model is built with inference_network
  * 
  * */
-model* load_model(char* file){
+static model* load_network(char* file, int inference_only_flag){
     if(file == NULL)
         return NULL;
     int i;
@@ -499,10 +1202,63 @@ model* load_model(char* file){
         exit(1);
     }
     
-    model* m = network(layers,n_rl,n_cl,n_fcl,rls,cls,fcls);
+    if(inference_only_flag)
+        return inference_network(layers,n_rl,n_cl,n_fcl,rls,cls,fcls);
+    return network(layers,n_rl,n_cl,n_fcl,rls,cls,fcls);
     
-    return m;
+}
+
+/* This function loads a network model from a .bin file with name file
+ * 
+ * Input:
+ * 
+ *             @ char* file:= the binary file from which the model will be loaded
+ * 
+ * */
+model* load_model(char* file){
+    return load_network(file,0);
+}
+
+/* This function loads a network model from a .bin file with name file, the model
+ * can be used only for the feed forward (see inference_network). The file is the same
+ * saved by save_model
+ * 
+ * Input:
+ * 
+ *             @ char* file:= the binary file from which the model will be loaded
+ * 
+ * */
+model* load_inference_model(char* file){
+    return load_network(file,1);
+}
+
+/* This function computes the activation of a fully-connected layer f2 from its pre activation
+ * and sets its dropout mask (if the dropout flag is != 0). The softmax is computed for each instance,
+ * the other activations are element-wise
+ * 
+ * Input:
+ *             @ fcl* f2:= the fully-connected layer
+ *             @ int n:= the number of instances stored one after the other in the arrays of f2
+ * 
+ * */
+static void ff_fcl_activation(fcl* f2, int n){
+    int i,size = f2->output*n;
+    if(f2->activation_flag == SIGMOID)
+        sigmoid_array(f2->pre_activation,f2->post_activation,size);
+    else if(f2->activation_flag == RELU)
+        relu_array(f2->pre_activation,f2->post_activation,size);
+    else if(f2->activation_flag == SOFTMAX){
+        for(i = 0; i < n; i++){
+            softmax(&f2->pre_activation[i*f2->output],&f2->post_activation[i*f2->output],f2->output);
+        }
+    }
+    else if(f2->activation_flag == TANH)
+        tanhh_array(f2->pre_activation,f2->post_activation,size);
+    else if(f2->activation_flag == LEAKY_RELU)
+        leaky_relu_array(f2->pre_activation,f2->post_activation,size);
     
+    if(f2->dropout_flag)
+        set_dropout_mask(size, f2->dropout_mask, f2->dropout_threshold);
 }
 
 /* This function compute the feed forward between 2 fully-connected layer
@@ -546,7 +1302,7 @@ void ff_fcl_fcl(fcl* f1, fcl* f2){
             }
             
             else if(f1->dropout_flag == DROPOUT_TEST){
-                mul_value(f2->pre_activation,f1->dropout_threshold,f1->dropout_temp,f2->input);
+                mul_value(f1->pre_activation,f1->dropout_threshold,f1->dropout_temp,f2->input);
                 fully_connected_feed_forward(f1->dropout_temp, f2->pre_activation, f2->weights,f2->biases, f2->input, f2->output);
             }
         }
@@ -564,150 +1320,37 @@ void ff_fcl_fcl(fcl* f1, fcl* f2){
             }
             
             else if(f1->dropout_flag == DROPOUT_TEST){
-                mul_value(f2->post_activation,f1->dropout_threshold,f1->dropout_temp,f2->input);
+                mul_value(f1->post_activation,f1->dropout_threshold,f1->dropout_temp,f2->input);
                 fully_connected_feed_forward(f1->dropout_temp, f2->pre_activation, f2->weights,f2->biases, f2->input, f2->output);
             }
         }
     }
     
-    /* computing the activation for f2 (if the activation_flag is > 0)*/
-    if(f2->activation_flag == SIGMOID)
-        sigmoid_array(f2->pre_activation,f2->post_activation,f2->output);
-    else if(f2->activation_flag == RELU)
-        relu_array(f2->pre_activation,f2->post_activation,f2->output);
-    else if(f2->activation_flag == SOFTMAX)
-        softmax(f2->pre_activation,f2->post_activation,f2->output);
-    else if(f2->activation_flag == TANH)
-        tanhh_array(f2->pre_activation,f2->post_activation,f2->output);
-    else if(f2->activation_flag == LEAKY_RELU)
-        leaky_relu_array(f2->pre_activation,f2->post_activation,f2->output);
-    
-    /* setting the dropout mask, if dropout flag is != 0*/
-    if(f2->dropout_flag)
-        set_dropout_mask(f2->output, f2->dropout_mask, f2->dropout_threshold);
+    /* computing the activation and the dropout mask for f2*/
+    ff_fcl_activation(f2,1);
 
 }
 
 
-/* This function compute the feed forward between a fully-connected input layer
- * and a convolutional output layer
+/* This function computes the output of a convolutional layer from its pre activation:
+ * the activation, the local response normalization and the pooling.
+ * The feature maps of the instances are one after the other, so the activation and the pooling
+ * compute n instances as n*f2->n_kernels feature maps, the normalization is computed for each instance
  * 
  * Input:
- *             @ fcl* f1:= the input fully-connected layer
- *             @ cl* f2:= the output convolutional layer
- * Warning:
- *             The dropout between 2 layers is not applied immediately but only
- *             during the next layer.
- *             For example:
- *                 f1 at the end of activation must apply dropout, this means that
- *                 the f1 mask is already applied, but f1->post_activation doesn't have
- *                 the dropout, so in this case during this feed forward we must apply
- *                 the dropout to the f1->post_activation array.
- *  
+ *             @ cl* f2:= the convolutional layer
+ *             @ float* temp:= the input of the pooling if f2 has no convolution, dimensions: n*f2->channels*f2->input_rows*f2->input_cols
+ *             @ int n:= the number of instances stored one after the other in the arrays of f2
+ * 
  * */
-void ff_fcl_cl(fcl* f1, cl* f2){
-    if(f1->output != f2->channels*f2->input_rows*f2->input_cols){
-        fprintf(stderr,"Error: the sizes between an input fully-connected layer and an output convolutional layer don't match, layer1: %d, layer2: %d\n",f1->layer,f2->layer);
-        exit(1);
-    }
-
-    int i,j,k,z;
-    float* temp = NULL;
-    /* f2 pre activation with no activation for f1*/
-     if(f1->activation_flag == NO_ACTIVATION){
-        if(f1->dropout_flag == NO_DROPOUT){
-            if(f2->convolutional_flag == CONVOLUTION){
-                for(i = 0; i < f2->n_kernels; i++){
-                    convolutional_feed_forward(f1->pre_activation, f2->kernels[i], f2->input_rows, f2->input_cols, f2->kernel_rows, f2->kernel_cols, f2->biases[i], f2->channels, &f2->pre_activation[i*f2->rows1*f2->cols1], f2->stride1_rows, f2->padding1_rows);
-                }
-            }
-            
-            else{
-                temp = (float*)malloc(sizeof(float)*f2->channels*f2->input_rows*f2->input_cols);
-                copy_array(f1->pre_activation,temp,f2->channels*f2->input_rows*f2->input_cols);
-            }
-        }
-        else{
-            if(f1->dropout_flag == DROPOUT){
-                get_dropout_array(f1->output,f1->dropout_mask,f1->pre_activation,f1->dropout_temp);
-                if(f2->convolutional_flag == CONVOLUTION){
-                    for(i = 0; i < f2->n_kernels; i++){
-                        convolutional_feed_forward(f1->dropout_temp, f2->kernels[i], f2->input_rows, f2->input_cols, f2->kernel_rows, f2->kernel_cols, f2->biases[i], f2->channels, &f2->pre_activation[i*f2->rows1*f2->cols1], f2->stride1_rows, f2->padding1_rows);
-                    }
-                }
-                
-                else{
-                    temp = (float*)malloc(sizeof(float)*f2->channels*f2->input_rows*f2->input_cols);
-                    copy_array(f1->dropout_temp,temp,f2->channels*f2->input_rows*f2->input_cols);
-                }
-            }
-            
-            else if(f1->dropout_flag == DROPOUT_TEST){
-                mul_value(f1->pre_activation,f1->dropout_threshold,f1->dropout_temp,f1->output);
-                if(f2->convolutional_flag == CONVOLUTION){
-                    for(i = 0; i < f2->n_kernels; i++){
-                        convolutional_feed_forward(f1->dropout_temp, f2->kernels[i], f2->input_rows, f2->input_cols, f2->kernel_rows, f2->kernel_cols, f2->biases[i], f2->channels, &f2->pre_activation[i*f2->rows1*f2->cols1], f2->stride1_rows, f2->padding1_rows);
-                    }
-                }
-                
-                else{
-                    temp = (float*)malloc(sizeof(float)*f2->channels*f2->input_rows*f2->input_cols);
-                    copy_array(f1->dropout_temp,temp,f2->channels*f2->input_rows*f2->input_cols);
-                }
-                
-            }
-        }
-    }
-    
-    /* f2 pre activation with activation for f1*/
-    else{
-        if(f1->dropout_flag == NO_DROPOUT){
-            if(f2->convolutional_flag == CONVOLUTION){
-                for(i = 0; i < f2->n_kernels; i++){
-                    convolutional_feed_forward(f1->post_activation, f2->kernels[i], f2->input_rows, f2->input_cols, f2->kernel_rows, f2->kernel_cols, f2->biases[i], f2->channels, &f2->pre_activation[i*f2->rows1*f2->cols1], f2->stride1_rows, f2->padding1_rows);
-                }
-            }
-            
-            else{
-                temp = (float*)malloc(sizeof(float)*f2->channels*f2->input_rows*f2->input_cols);
-                copy_array(f1->post_activation,temp,f2->channels*f2->input_rows*f2->input_cols);
-            }
-            
-        }
-        else{
-            if(f1->dropout_flag == DROPOUT){
-                get_dropout_array(f1->output,f1->dropout_mask,f1->post_activation,f1->dropout_temp);
-                if(f2->convolutional_flag == CONVOLUTION){
-                    for(i = 0; i < f2->n_kernels; i++){
-                        convolutional_feed_forward(f1->dropout_temp, f2->kernels[i], f2->input_rows, f2->input_cols, f2->kernel_rows, f2->kernel_cols, f2->biases[i], f2->channels, &f2->pre_activation[i*f2->rows1*f2->cols1], f2->stride1_rows, f2->padding1_rows);
-                    }
-                }
-                else{
-                    temp = (float*)malloc(sizeof(float)*f2->channels*f2->input_rows*f2->input_cols);
-                    copy_array(f1->dropout_temp,temp,f2->channels*f2->input_rows*f2->input_cols);
-                }
-            }
-            
-            else if(f1->dropout_flag == DROPOUT_TEST){
-                mul_value(f1->post_activation,f1->dropout_threshold,f1->dropout_temp,f1->output);
-                if(f2->convolutional_flag == CONVOLUTION){
-                    for(i = 0; i < f2->n_kernels; i++){
-                        convolutional_feed_forward(f1->dropout_temp, f2->kernels[i], f2->input_rows, f2->input_cols, f2->kernel_rows, f2->kernel_cols, f2->biases[i], f2->channels, &f2->pre_activation[i*f2->rows1*f2->cols1], f2->stride1_rows, f2->padding1_rows);
-                    }
-                }
-                else{
-                    temp = (float*)malloc(sizeof(float)*f2->channels*f2->input_rows*f2->input_cols);
-                    copy_array(f1->dropout_temp,temp,f2->channels*f2->input_rows*f2->input_cols);
-                }
-            }
-        }
-    }
-    
+static void ff_cl_output(cl* f2, float* temp, int n){
+    int i,j,b;
+    int maps = f2->n_kernels*n, size1 = f2->n_kernels*f2->rows1*f2->cols1;
     if(f2->convolutional_flag == CONVOLUTION){
         /* activation for f2, if there is any activation*/
         if(f2->activation_flag == SIGMOID){
             if(f2->padding1_rows){
-                for(i = 0; i < f2->n_kernels; i++){
+                for(i = 0; i < maps; i++){
                     for(j = f2->padding1_rows; j < f2->rows1-f2->padding1_rows; j++){
                         sigmoid_array(&f2->pre_activation[i*f2->rows1*f2->cols1 + j*f2->cols1 + f2->padding1_rows],&f2->post_activation[i*f2->rows1*f2->cols1 + j*f2->cols1 + f2->padding1_cols],f2->cols1-2*f2->padding1_rows);
                     }
@@ -715,14 +1358,14 @@ void ff_fcl_cl(fcl* f1, cl* f2){
             }
             
             else
-                sigmoid_array(f2->pre_activation,f2->post_activation,f2->n_kernels*f2->rows1*f2->cols1);
+                sigmoid_array(f2->pre_activation,f2->post_activation,size1*n);
 
         }
             
         
         else if(f2->activation_flag == RELU){
             if(f2->padding1_rows){
-                for(i = 0; i < f2->n_kernels; i++){
+                for(i = 0; i < maps; i++){
                     for(j = f2->padding1_rows; j < f2->rows1-f2->padding1_rows; j++){
                         relu_array(&f2->pre_activation[i*f2->rows1*f2->cols1 + j*f2->cols1 + f2->padding1_rows],&f2->post_activation[i*f2->rows1*f2->cols1 + j*f2->cols1 + f2->padding1_cols],f2->cols1-2*f2->padding1_rows);
                     }
@@ -730,12 +1373,12 @@ void ff_fcl_cl(fcl* f1, cl* f2){
             }
             
             else
-                relu_array(f2->pre_activation,f2->post_activation,f2->n_kernels*f2->rows1*f2->cols1);
+                relu_array(f2->pre_activation,f2->post_activation,size1*n);
 
         }
         else if(f2->activation_flag == TANH){
             if(f2->padding1_rows){
-                for(i = 0; i < f2->n_kernels; i++){
+                for(i = 0; i < maps; i++){
                     for(j = f2->padding1_rows; j < f2->rows1-f2->padding1_rows; j++){
                         tanhh_array(&f2->pre_activation[i*f2->rows1*f2->cols1 + j*f2->cols1 + f2->padding1_rows],&f2->post_activation[i*f2->rows1*f2->cols1 + j*f2->cols1 + f2->padding1_cols],f2->cols1-2*f2->padding1_rows);
                     }
@@ -743,13 +1386,13 @@ void ff_fcl_cl(fcl* f1, cl* f2){
             }
             
             else
-                tanhh_array(f2->pre_activation,f2->post_activation,f2->n_kernels*f2->rows1*f2->cols1);
+                tanhh_array(f2->pre_activation,f2->post_activation,size1*n);
 
         }
         
         else if(f2->activation_flag == LEAKY_RELU){
             if(f2->padding1_rows){
-                for(i = 0; i < f2->n_kernels; i++){
+                for(i = 0; i < maps; i++){
                     for(j = f2->padding1_rows; j < f2->rows1-f2->padding1_rows; j++){
                         leaky_relu_array(&f2->pre_activation[i*f2->rows1*f2->cols1 + j*f2->cols1 + f2->padding1_rows],&f2->post_activation[i*f2->rows1*f2->cols1 + j*f2->cols1 + f2->padding1_cols],f2->cols1-2*f2->padding1_rows);
                     }
@@ -757,48 +1400,43 @@ void ff_fcl_cl(fcl* f1, cl* f2){
             }
             
             else
-                leaky_relu_array(f2->pre_activation,f2->post_activation,f2->n_kernels*f2->rows1*f2->cols1);
+                leaky_relu_array(f2->pre_activation,f2->post_activation,size1*n);
 
         }
         /* normalization for f2, if there is any normalization*/
         if(f2->normalization_flag){
-            for(i = 0; i < f2->n_kernels; i++){
-                for(j = f2->padding1_rows; j < f2->rows1-f2->padding1_rows; j++){
-                    for(k = f2->padding1_rows; k < f2->cols1-f2->padding1_rows;k++){
-                        if(f2->activation_flag != NO_ACTIVATION)
-                            local_response_normalization_feed_forward(f2->post_activation,f2->post_normalization, i,j,k, f2->n_kernels, f2->rows1, f2->cols1,N_NORMALIZATION,BETA_NORMALIZATION,ALPHA_NORMALIZATION,K_NORMALIZATION);
-                        else
-                            local_response_normalization_feed_forward(f2->pre_activation,f2->post_normalization, i,j,k, f2->n_kernels, f2->rows1, f2->cols1,N_NORMALIZATION,BETA_NORMALIZATION,ALPHA_NORMALIZATION,K_NORMALIZATION);
-                    }
-                }
-            }    
+            for(b = 0; b < n; b++){
+                if(f2->activation_flag)
+                    local_response_normalization_feed_forward_tensor(&f2->post_activation[b*size1],&f2->post_normalization[b*size1],f2->n_kernels,f2->rows1,f2->cols1,f2->padding1_rows,N_NORMALIZATION,BETA_NORMALIZATION,ALPHA_NORMALIZATION,K_NORMALIZATION);
+                else
+                    local_response_normalization_feed_forward_tensor(&f2->pre_activation[b*size1],&f2->post_normalization[b*size1],f2->n_kernels,f2->rows1,f2->cols1,f2->padding1_rows,N_NORMALIZATION,BETA_NORMALIZATION,ALPHA_NORMALIZATION,K_NORMALIZATION);
+            }
         }
     }
     
     /* pooling for f2, if there is any pooling*/
-    if(f2->pooling_flag != NO_POOLING){
-        for(i = 0; i < f2->n_kernels; i++){
+    if(f2->pooling_flag){
+        for(i = 0; i < maps; i++){
             if(f2->convolutional_flag == NO_CONVOLUTION){
                 if(f2->pooling_flag == MAX_POOLING){
-                    max_pooling_feed_forward(&temp[i*f2->input_rows*f2->input_cols], &f2->post_pooling[i*f2->rows2*f2->cols2], f2->input_rows, f2->input_cols, f2->pooling_rows, f2->pooling_cols, f2->stride2_rows, f2->padding2_rows);
+                    max_pooling_feed_forward_indices(&temp[i*f2->input_rows*f2->input_cols], &f2->post_pooling[i*f2->rows2*f2->cols2], f2->pooling_indices == NULL ? NULL : &f2->pooling_indices[i*f2->rows2*f2->cols2], f2->input_rows, f2->input_cols, f2->pooling_rows, f2->pooling_cols, f2->stride2_rows, f2->padding2_rows);
                 }
                 else{
                     avarage_pooling_feed_forward(&temp[i*f2->input_rows*f2->input_cols], &f2->post_pooling[i*f2->rows2*f2->cols2], f2->input_rows, f2->input_cols, f2->pooling_rows, f2->pooling_cols, f2->stride2_rows, f2->padding2_rows);
                 }
             }
-               
-            else if(f2->normalization_flag != NO_NORMALIZATION){
+            else if(f2->normalization_flag){
                 if(f2->pooling_flag == MAX_POOLING){
-                    max_pooling_feed_forward(&f2->post_normalization[i*f2->rows1*f2->cols1], &f2->post_pooling[i*f2->rows2*f2->cols2], f2->rows1, f2->cols1, f2->pooling_rows, f2->pooling_cols, f2->stride2_rows, f2->padding2_rows);
+                    max_pooling_feed_forward_indices(&f2->post_normalization[i*f2->rows1*f2->cols1], &f2->post_pooling[i*f2->rows2*f2->cols2], f2->pooling_indices == NULL ? NULL : &f2->pooling_indices[i*f2->rows2*f2->cols2], f2->rows1, f2->cols1, f2->pooling_rows, f2->pooling_cols, f2->stride2_rows, f2->padding2_rows);
                 }
                 else{
                     avarage_pooling_feed_forward(&f2->post_normalization[i*f2->rows1*f2->cols1], &f2->post_pooling[i*f2->rows2*f2->cols2], f2->rows1, f2->cols1, f2->pooling_rows, f2->pooling_cols, f2->stride2_rows, f2->padding2_rows);
                 }
             }
             
-            else if(f2->activation_flag != NO_ACTIVATION){
+            else if(f2->activation_flag){
                 if(f2->pooling_flag == MAX_POOLING){
-                    max_pooling_feed_forward(&f2->post_activation[i*f2->rows1*f2->cols1], &f2->post_pooling[i*f2->rows2*f2->cols2], f2->rows1, f2->cols1, f2->pooling_rows, f2->pooling_cols, f2->stride2_rows, f2->padding2_rows);
+                    max_pooling_feed_forward_indices(&f2->post_activation[i*f2->rows1*f2->cols1], &f2->post_pooling[i*f2->rows2*f2->cols2], f2->pooling_indices == NULL ? NULL : &f2->pooling_indices[i*f2->rows2*f2->cols2], f2->rows1, f2->cols1, f2->pooling_rows, f2->pooling_cols, f2->stride2_rows, f2->padding2_rows);
                 }
                 else{
                     avarage_pooling_feed_forward(&f2->post_activation[i*f2->rows1*f2->cols1], &f2->post_pooling[i*f2->rows2*f2->cols2], f2->rows1, f2->cols1, f2->pooling_rows, f2->pooling_cols, f2->stride2_rows, f2->padding2_rows);
@@ -807,7 +1445,7 @@ void ff_fcl_cl(fcl* f1, cl* f2){
             
             else{
                 if(f2->pooling_flag == MAX_POOLING){
-                    max_pooling_feed_forward(&f2->pre_activation[i*f2->rows1*f2->cols1], &f2->post_pooling[i*f2->rows2*f2->cols2], f2->rows1, f2->cols1, f2->pooling_rows, f2->pooling_cols, f2->stride2_rows, f2->padding2_rows);
+                    max_pooling_feed_forward_indices(&f2->pre_activation[i*f2->rows1*f2->cols1], &f2->post_pooling[i*f2->rows2*f2->cols2], f2->pooling_indices == NULL ? NULL : &f2->pooling_indices[i*f2->rows2*f2->cols2], f2->rows1, f2->cols1, f2->pooling_rows, f2->pooling_cols, f2->stride2_rows, f2->padding2_rows);
                 }
                 else{
                     avarage_pooling_feed_forward(&f2->pre_activation[i*f2->rows1*f2->cols1], &f2->post_pooling[i*f2->rows2*f2->cols2], f2->rows1, f2->cols1, f2->pooling_rows, f2->pooling_cols, f2->stride2_rows, f2->padding2_rows);
@@ -815,51 +1453,144 @@ void ff_fcl_cl(fcl* f1, cl* f2){
             }
         }
     }
-    
-    free(temp);
-    
-
-    
 }
 
-
-/* This function compute the feed forward between a convolutional input layer
- * and a fully-connected output layer
+/* This function compute the feed forward between a fully-connected input layer
+ * and a convolutional output layer
  * 
  * Input:
- *             @ cl* f1:= the input convolutional layer
- *             @ fcl* f2:= the output fully-connected layer
+ *             @ fcl* f1:= the input fully-connected layer
+ *             @ cl* f2:= the output convolutional layer
  * Warning:
  *             The dropout between 2 layers is not applied immediately but only
  *             during the next layer.
  *             For example:
- *                 if we must apply the dropout to f2 then in this function
- *                 we set the dropout_mask of f2, but f2->post_activation doesn't have the dropout
- * 
+ *                 f1 at the end of activation must apply dropout, this means that
+ *                 the f1 mask is already applied, but f1->post_activation doesn't have
+ *                 the dropout, so in this case during this feed forward we must apply
+ *                 the dropout to the f1->post_activation array.
+ *  
  * */
-void ff_cl_fcl(cl* f1, fcl* f2){
-    if(f1->pooling_flag && f1->n_kernels*f1->rows2*f1->cols2 != f2->input){
-        fprintf(stderr,"Error: the sizes between an input convolutional layer and an output fully-connected layer don't match, layer1: %d, layer2: %d\n",f1->layer,f2->layer);
-        exit(1);
-    }
-    
-    else if(!f1->pooling_flag && f1->n_kernels*f1->rows1*f1->cols1 != f2->input){
-        fprintf(stderr,"Error: the sizes between an input convolutional layer and an output fully-connected layer don't match, layer1: %d, layer2: %d\n",f1->layer,f2->layer);
+void ff_fcl_cl(fcl* f1, cl* f2){
+    if(f1->output != f2->channels*f2->input_rows*f2->input_cols){
+        fprintf(stderr,"Error: the sizes between an input fully-connected layer and an output convolutional layer don't match, layer1: %d, layer2: %d\n",f1->layer,f2->layer);
         exit(1);
     }
-    
-    int i;
-    
-    /* computing the pre-activation array for f2 from f1*/
-    
-    /* pooling for f1*/
-    if(f1->pooling_flag)
-        fully_connected_feed_forward(f1->post_pooling, f2->pre_activation, f2->weights,f2->biases, f2->input, f2->output);
-    
-    /* no pooling for f1, but normalization*/
-    else if(f1->normalization_flag)
-        fully_connected_feed_forward(f1->post_normalization, f2->pre_activation, f2->weights,f2->biases, f2->input, f2->output);
-    
+
+    float* temp = NULL;// the input of the pooling with NO_CONVOLUTION, a view of the output of f1
+    /* f2 pre activation with no activation for f1*/
+     if(f1->activation_flag == NO_ACTIVATION){
+        if(f1->dropout_flag == NO_DROPOUT){
+            if(f2->convolutional_flag == CONVOLUTION){
+                convolutional_layer_feed_forward(f2,f1->pre_activation);
+            }
+            
+            else{
+                temp = f1->pre_activation;
+            }
+        }
+        else{
+            if(f1->dropout_flag == DROPOUT){
+                get_dropout_array(f1->output,f1->dropout_mask,f1->pre_activation,f1->dropout_temp);
+                if(f2->convolutional_flag == CONVOLUTION){
+                    convolutional_layer_feed_forward(f2,f1->dropout_temp);
+                }
+                
+                else{
+                    temp = f1->dropout_temp;
+                }
+            }
+            
+            else if(f1->dropout_flag == DROPOUT_TEST){
+                mul_value(f1->pre_activation,f1->dropout_threshold,f1->dropout_temp,f1->output);
+                if(f2->convolutional_flag == CONVOLUTION){
+                    convolutional_layer_feed_forward(f2,f1->dropout_temp);
+                }
+                
+                else{
+                    temp = f1->dropout_temp;
+                }
+                
+            }
+        }
+    }
+    
+    /* f2 pre activation with activation for f1*/
+    else{
+        if(f1->dropout_flag == NO_DROPOUT){
+            if(f2->convolutional_flag == CONVOLUTION){
+                convolutional_layer_feed_forward(f2,f1->post_activation);
+            }
+            
+            else{
+                temp = f1->post_activation;
+            }
+            
+        }
+        else{
+            if(f1->dropout_flag == DROPOUT){
+                get_dropout_array(f1->output,f1->dropout_mask,f1->post_activation,f1->dropout_temp);
+                if(f2->convolutional_flag == CONVOLUTION){
+                    convolutional_layer_feed_forward(f2,f1->dropout_temp);
+                }
+                else{
+                    temp = f1->dropout_temp;
+                }
+            }
+            
+            else if(f1->dropout_flag == DROPOUT_TEST){
+                mul_value(f1->post_activation,f1->dropout_threshold,f1->dropout_temp,f1->output);
+                if(f2->convolutional_flag == CONVOLUTION){
+                    convolutional_layer_feed_forward(f2,f1->dropout_temp);
+                }
+                else{
+                    temp = f1->dropout_temp;
+                }
+            }
+        }
+    }
+    
+    ff_cl_output(f2,temp,1);
+}
+
+
+/* This function compute the feed forward between a convolutional input layer
+ * and a fully-connected output layer
+ * 
+ * Input:
+ *             @ cl* f1:= the input convolutional layer
+ *             @ fcl* f2:= the output fully-connected layer
+ * Warning:
+ *             The dropout between 2 layers is not applied immediately but only
+ *             during the next layer.
+ *             For example:
+ *                 if we must apply the dropout to f2 then in this function
+ *                 we set the dropout_mask of f2, but f2->post_activation doesn't have the dropout
+ * 
+ * */
+void ff_cl_fcl(cl* f1, fcl* f2){
+    if(f1->pooling_flag && f1->n_kernels*f1->rows2*f1->cols2 != f2->input){
+        fprintf(stderr,"Error: the sizes between an input convolutional layer and an output fully-connected layer don't match, layer1: %d, layer2: %d\n",f1->layer,f2->layer);
+        exit(1);
+    }
+    
+    else if(!f1->pooling_flag && f1->n_kernels*f1->rows1*f1->cols1 != f2->input){
+        fprintf(stderr,"Error: the sizes between an input convolutional layer and an output fully-connected layer don't match, layer1: %d, layer2: %d\n",f1->layer,f2->layer);
+        exit(1);
+    }
+    
+    int i;
+    
+    /* computing the pre-activation array for f2 from f1*/
+    
+    /* pooling for f1*/
+    if(f1->pooling_flag)
+        fully_connected_feed_forward(f1->post_pooling, f2->pre_activation, f2->weights,f2->biases, f2->input, f2->output);
+    
+    /* no pooling for f1, but normalization*/
+    else if(f1->normalization_flag)
+        fully_connected_feed_forward(f1->post_normalization, f2->pre_activation, f2->weights,f2->biases, f2->input, f2->output);
+    
     /* no pooling, no normalization for f1, but activation*/
     else if(f1->activation_flag)
         fully_connected_feed_forward(f1->post_activation, f2->pre_activation, f2->weights,f2->biases, f2->input, f2->output);
@@ -868,24 +1599,8 @@ void ff_cl_fcl(cl* f1, fcl* f2){
     else
         fully_connected_feed_forward(f1->pre_activation, f2->pre_activation, f2->weights,f2->biases, f2->input, f2->output);
     
-    /* computing the activation for f2 (if the activation_flag is > 0)*/
-    if(f2->activation_flag == SIGMOID)
-        sigmoid_array(f2->pre_activation,f2->post_activation,f2->output);
-    else if(f2->activation_flag == RELU)
-        relu_array(f2->pre_activation,f2->post_activation,f2->output);
-    else if(f2->activation_flag == SOFTMAX)
-        softmax(f2->pre_activation,f2->post_activation,f2->output);
-    else if(f2->activation_flag == TANH)
-        tanhh_array(f2->pre_activation,f2->post_activation,f2->output);
-    else if(f2->activation_flag == LEAKY_RELU)
-        leaky_relu_array(f2->pre_activation,f2->post_activation,f2->output);
-    
-
-    
-    /* setting the dropout mask, if dropout flag is != 0*/
-    if(f2->dropout_flag)
-        set_dropout_mask(f2->output, f2->dropout_mask, f2->dropout_threshold);
-    
+    /* computing the activation and the dropout mask for f2*/
+    ff_fcl_activation(f2,1);
     
 }
 
@@ -908,260 +1623,147 @@ void ff_cl_cl(cl* f1, cl* f2){
         exit(1);
     }
 
-    int i,j,k,z;
-    float* temp = NULL;
+    float* temp = NULL;// the input of the pooling with NO_CONVOLUTION, a view of the output of f1
     /* pooling for f1*/
     if(f1->pooling_flag){
         if(f2->convolutional_flag == CONVOLUTION){
-            for(i = 0; i < f2->n_kernels; i++){
-                convolutional_feed_forward(f1->post_pooling, f2->kernels[i], f2->input_rows, f2->input_cols, f2->kernel_rows, f2->kernel_cols, f2->biases[i], f2->channels, &f2->pre_activation[i*f2->rows1*f2->cols1], f2->stride1_rows, f2->padding1_rows);
-            }
+            convolutional_layer_feed_forward(f2,f1->post_pooling);
         }
         
         else{
-            temp = (float*)malloc(sizeof(float)*f2->input_rows*f2->input_cols*f2->channels);
-            copy_array(f1->post_pooling,temp,f2->input_rows*f2->input_cols*f2->channels);
+            temp = f1->post_pooling;
         }    
     }
             
     /* no pooling for f1, but normalization*/
     else if(f1->normalization_flag){
         if(f2->convolutional_flag == CONVOLUTION){
-            for(i = 0; i < f2->n_kernels; i++){
-                convolutional_feed_forward(f1->post_normalization, f2->kernels[i], f2->input_rows, f2->input_cols, f2->kernel_rows, f2->kernel_cols, f2->biases[i], f2->channels, &f2->pre_activation[i*f2->rows1*f2->cols1], f2->stride1_rows, f2->padding1_rows);
-            }
+            convolutional_layer_feed_forward(f2,f1->post_normalization);
         }
         
         else{
-            temp = (float*)malloc(sizeof(float)*f2->input_rows*f2->input_cols*f2->channels);
-            copy_array(f1->post_normalization,temp,f2->input_rows*f2->input_cols*f2->channels);
+            temp = f1->post_normalization;
         }   
     }
     /* no pooling, no normalization for f1, but activation*/
     else if(f1->activation_flag){
         if(f2->convolutional_flag == CONVOLUTION){
-            for(i = 0; i < f2->n_kernels; i++){
-                convolutional_feed_forward(f1->post_activation, f2->kernels[i], f2->input_rows, f2->input_cols, f2->kernel_rows, f2->kernel_cols, f2->biases[i], f2->channels, &f2->pre_activation[i*f2->rows1*f2->cols1], f2->stride1_rows, f2->padding1_rows);
-            }
+            convolutional_layer_feed_forward(f2,f1->post_activation);
         }
         
         else{
-            temp = (float*)malloc(sizeof(float)*f2->input_rows*f2->input_cols*f2->channels);
-            copy_array(f1->post_activation,temp,f2->input_rows*f2->input_cols*f2->channels);
+            temp = f1->post_activation;
         }
     }
     /* no pooling, no normalization, no activation for f1*/
     else{
         if(f2->convolutional_flag == CONVOLUTION){
-            for(i = 0; i < f2->n_kernels; i++){
-                convolutional_feed_forward(f1->pre_activation, f2->kernels[i], f2->input_rows, f2->input_cols, f2->kernel_rows, f2->kernel_cols, f2->biases[i], f2->channels, &f2->pre_activation[i*f2->rows1*f2->cols1], f2->stride1_rows, f2->padding1_rows);
-            }  
+            convolutional_layer_feed_forward(f2,f1->pre_activation);
         } 
         
         else{
-            temp = (float*)malloc(sizeof(float)*f2->input_rows*f2->input_cols*f2->channels);
-            copy_array(f1->pre_activation,temp,f2->input_rows*f2->input_cols*f2->channels);
-        }
-    }
-    
-    
-    if(f2->convolutional_flag == CONVOLUTION){
-        /* activation for f2, if there is any activation*/
-        if(f2->activation_flag == SIGMOID){
-            if(f2->padding1_rows){
-                for(i = 0; i < f2->n_kernels; i++){
-                    for(j = f2->padding1_rows; j < f2->rows1-f2->padding1_rows; j++){
-                        sigmoid_array(&f2->pre_activation[i*f2->rows1*f2->cols1 + j*f2->cols1 + f2->padding1_rows],&f2->post_activation[i*f2->rows1*f2->cols1 + j*f2->cols1 + f2->padding1_cols],f2->cols1-2*f2->padding1_rows);
-                    }
-                }
-            }
-            
-            else
-                sigmoid_array(f2->pre_activation,f2->post_activation,f2->n_kernels*f2->rows1*f2->cols1);
-
-        }
-            
-        
-        else if(f2->activation_flag == RELU){
-            if(f2->padding1_rows){
-                for(i = 0; i < f2->n_kernels; i++){
-                    for(j = f2->padding1_rows; j < f2->rows1-f2->padding1_rows; j++){
-                        relu_array(&f2->pre_activation[i*f2->rows1*f2->cols1 + j*f2->cols1 + f2->padding1_rows],&f2->post_activation[i*f2->rows1*f2->cols1 + j*f2->cols1 + f2->padding1_cols],f2->cols1-2*f2->padding1_rows);
-                    }
-                }
-            }
-            
-            else
-                relu_array(f2->pre_activation,f2->post_activation,f2->n_kernels*f2->rows1*f2->cols1);
-
-        }
-        else if(f2->activation_flag == TANH){
-            if(f2->padding1_rows){
-                for(i = 0; i < f2->n_kernels; i++){
-                    for(j = f2->padding1_rows; j < f2->rows1-f2->padding1_rows; j++){
-                        tanhh_array(&f2->pre_activation[i*f2->rows1*f2->cols1 + j*f2->cols1 + f2->padding1_rows],&f2->post_activation[i*f2->rows1*f2->cols1 + j*f2->cols1 + f2->padding1_cols],f2->cols1-2*f2->padding1_rows);
-                    }
-                }
-            }
-            
-            else
-                tanhh_array(f2->pre_activation,f2->post_activation,f2->n_kernels*f2->rows1*f2->cols1);
-
-        }
-        
-        else if(f2->activation_flag == LEAKY_RELU){
-            if(f2->padding1_rows){
-                for(i = 0; i < f2->n_kernels; i++){
-                    for(j = f2->padding1_rows; j < f2->rows1-f2->padding1_rows; j++){
-                        leaky_relu_array(&f2->pre_activation[i*f2->rows1*f2->cols1 + j*f2->cols1 + f2->padding1_rows],&f2->post_activation[i*f2->rows1*f2->cols1 + j*f2->cols1 + f2->padding1_cols],f2->cols1-2*f2->padding1_rows);
-                    }
-                }
-            }
-            
-            else
-                leaky_relu_array(f2->pre_activation,f2->post_activation,f2->n_kernels*f2->rows1*f2->cols1);
-
-        }
-        /* normalization for f2, if there is any normalization*/
-        if(f2->normalization_flag){
-            for(i = 0; i < f2->n_kernels; i++){
-                for(j = f2->padding1_rows; j < f2->rows1-f2->padding1_rows; j++){
-                    for(k = f2->padding1_rows; k < f2->cols1-f2->padding1_rows;k++){
-                        if(f2->activation_flag)
-                            local_response_normalization_feed_forward(f2->post_activation,f2->post_normalization, i,j,k, f2->n_kernels, f2->rows1, f2->cols1,N_NORMALIZATION,BETA_NORMALIZATION,ALPHA_NORMALIZATION,K_NORMALIZATION);
-                        else
-                            local_response_normalization_feed_forward(f2->pre_activation,f2->post_normalization, i,j,k, f2->n_kernels, f2->rows1, f2->cols1,N_NORMALIZATION,BETA_NORMALIZATION,ALPHA_NORMALIZATION,K_NORMALIZATION);
-                    }
-                }
-            }    
-        }
-    }
-    
-    /* pooling for f2, if there is any pooling*/
-    if(f2->pooling_flag){
-        for(i = 0; i < f2->n_kernels; i++){
-            if(f2->convolutional_flag == NO_CONVOLUTION){
-                if(f2->pooling_flag == MAX_POOLING){
-                    max_pooling_feed_forward(&temp[i*f2->input_rows*f2->input_cols], &f2->post_pooling[i*f2->rows2*f2->cols2], f2->input_rows, f2->input_cols, f2->pooling_rows, f2->pooling_cols, f2->stride2_rows, f2->padding2_rows);
-                }
-                else{
-                    avarage_pooling_feed_forward(&temp[i*f2->input_rows*f2->input_cols], &f2->post_pooling[i*f2->rows2*f2->cols2], f2->input_rows, f2->input_cols, f2->pooling_rows, f2->pooling_cols, f2->stride2_rows, f2->padding2_rows);
-                }
-            }
-            else if(f2->normalization_flag){
-                if(f2->pooling_flag == MAX_POOLING){
-                    max_pooling_feed_forward(&f2->post_normalization[i*f2->rows1*f2->cols1], &f2->post_pooling[i*f2->rows2*f2->cols2], f2->rows1, f2->cols1, f2->pooling_rows, f2->pooling_cols, f2->stride2_rows, f2->padding2_rows);
-                }
-                else{
-                    avarage_pooling_feed_forward(&f2->post_normalization[i*f2->rows1*f2->cols1], &f2->post_pooling[i*f2->rows2*f2->cols2], f2->rows1, f2->cols1, f2->pooling_rows, f2->pooling_cols, f2->stride2_rows, f2->padding2_rows);
-                }
-            }
-            
-            else if(f2->activation_flag){
-                if(f2->pooling_flag == MAX_POOLING){
-                    max_pooling_feed_forward(&f2->post_activation[i*f2->rows1*f2->cols1], &f2->post_pooling[i*f2->rows2*f2->cols2], f2->rows1, f2->cols1, f2->pooling_rows, f2->pooling_cols, f2->stride2_rows, f2->padding2_rows);
-                }
-                else{
-                    avarage_pooling_feed_forward(&f2->post_activation[i*f2->rows1*f2->cols1], &f2->post_pooling[i*f2->rows2*f2->cols2], f2->rows1, f2->cols1, f2->pooling_rows, f2->pooling_cols, f2->stride2_rows, f2->padding2_rows);
-                }
-            }
-            
-            else{
-                if(f2->pooling_flag == MAX_POOLING){
-                    max_pooling_feed_forward(&f2->pre_activation[i*f2->rows1*f2->cols1], &f2->post_pooling[i*f2->rows2*f2->cols2], f2->rows1, f2->cols1, f2->pooling_rows, f2->pooling_cols, f2->stride2_rows, f2->padding2_rows);
-                }
-                else{
-                    avarage_pooling_feed_forward(&f2->pre_activation[i*f2->rows1*f2->cols1], &f2->post_pooling[i*f2->rows2*f2->cols2], f2->rows1, f2->cols1, f2->pooling_rows, f2->pooling_cols, f2->stride2_rows, f2->padding2_rows);
-                }
-            }
+            temp = f1->pre_activation;
         }
     }
     
-    free(temp);
-    
     
+    ff_cl_output(f2,temp,1);
 }
 
-/* This function computes the derivative of weights and biases of a fully-connected layer f2
- * applied to a previous fully connected layer f1, and returns the error of the last function of the
- * previous layer. For example:
- * if the previous layer applied only the pre_activation then the float* vector returned is the DL/df1->pre_activation
- * if the previous layer applied only pre_activation and post activation then the float* vector returned is DL/df1->post_activation
- * if the previous layer applied pre activation, post activation and dropout then the float* vector returned is
- * DL/df1->post_activation without the dropout applied, in this case the dropout must be applied during the backpropagation of f1.
- * If f2 applied the dropout, then the float* error passed as param could be DL/df2->pre_activation or DL/df2->post_activation
- * in both the cases we must apply the dropout_mask to this error.
+/* This function computes in f2->temp the error of the pre activation of a fully-connected layer
+ * from the error of its output (dropout mask and derivative of the activation).
+ * All these functions are element-wise, so n instances are computed at once
  * 
  * Input:
+ *             @ fcl* f2:= the fully-connected layer
+ *             @ float* error:= the error of the output of f2, dimensions: n*f2->output
+ *             @ int n:= the number of instances stored one after the other in the arrays of f2
  * 
- *             @ fcl* f1:= the fully-connected input layer
- *             @ fcl* f2:= the fully-connected current layer
- *             @ float* error:= the error passed
- * 
- * Warning:
- *             if we have softmax as activation function of f2, (softmax can be applied only for the last fully-connected layers)
- *             then the error passed as param is not DL/Df2->post_activation but is L where L is the error
  * */
-float* bp_fcl_fcl(fcl* f1, fcl* f2, float* error){
-    int i;
-    
-    /*computing the backpropagation for f2*/
+static void bp_fcl_error(fcl* f2, float* error, int n){
+    int size = f2->output*n;
     if(f2->dropout_flag){
-        dot1D(error,f2->dropout_mask,f2->temp,f2->output);
+        dot1D(error,f2->dropout_mask,f2->temp,size);
         if(f2->activation_flag == SIGMOID){
-            derivative_sigmoid_array(f2->pre_activation,f2->temp3,f2->output);
-            dot1D(f2->temp3,f2->temp,f2->temp,f2->output);
+            derivative_sigmoid_array(f2->pre_activation,f2->temp3,size);
+            dot1D(f2->temp3,f2->temp,f2->temp,size);
         }
         else if(f2->activation_flag == RELU){
-            derivative_relu_array(f2->pre_activation,f2->temp3,f2->output);
-            dot1D(f2->temp3,f2->temp,f2->temp,f2->output);
+            derivative_relu_array(f2->pre_activation,f2->temp3,size);
+            dot1D(f2->temp3,f2->temp,f2->temp,size);
         }
         
         else if(f2->activation_flag == SOFTMAX){
-            derivative_cross_entropy_reduced_form_with_softmax_array(f2->post_activation,  error,f2->temp3, f2->output);
-            dot1D(f2->temp3,f2->temp,f2->temp,f2->output);
+            derivative_cross_entropy_reduced_form_with_softmax_array(f2->post_activation,  error,f2->temp3, size);
+            dot1D(f2->temp3,f2->temp,f2->temp,size);
         }
         
         else if(f2->activation_flag == TANH){
-            derivative_tanhh_array(f2->pre_activation,f2->temp3,f2->output);
-            dot1D(f2->temp3,f2->temp,f2->temp,f2->output);
+            derivative_tanhh_array(f2->pre_activation,f2->temp3,size);
+            dot1D(f2->temp3,f2->temp,f2->temp,size);
         }
         
         else if(f2->activation_flag == LEAKY_RELU){
-            derivative_leaky_relu_array(f2->pre_activation,f2->temp3,f2->output);
-            dot1D(f2->temp3,f2->temp,f2->temp,f2->output);
+            derivative_leaky_relu_array(f2->pre_activation,f2->temp3,size);
+            dot1D(f2->temp3,f2->temp,f2->temp,size);
         }
     }
     
     else{
         if(f2->activation_flag == SIGMOID){
-            derivative_sigmoid_array(f2->pre_activation,f2->temp3,f2->output);
-            dot1D(f2->temp3,error,f2->temp,f2->output);
+            derivative_sigmoid_array(f2->pre_activation,f2->temp3,size);
+            dot1D(f2->temp3,error,f2->temp,size);
         }
         else if(f2->activation_flag == RELU){
-            derivative_relu_array(f2->pre_activation,f2->temp3,f2->output);
-            dot1D(f2->temp3,error,f2->temp,f2->output);
+            derivative_relu_array(f2->pre_activation,f2->temp3,size);
+            dot1D(f2->temp3,error,f2->temp,size);
         }
         
         else if(f2->activation_flag == SOFTMAX){
-            derivative_cross_entropy_reduced_form_with_softmax_array(f2->post_activation,  error,f2->temp3, f2->output);
-            copy_array(f2->temp3,f2->temp,f2->output);
+            derivative_cross_entropy_reduced_form_with_softmax_array(f2->post_activation,  error,f2->temp3, size);
+            copy_array(f2->temp3,f2->temp,size);
         }
         
         else if(f2->activation_flag == TANH){
-            derivative_tanhh_array(f2->pre_activation,f2->temp3,f2->output);
-            dot1D(f2->temp3,error,f2->temp,f2->output);
+            derivative_tanhh_array(f2->pre_activation,f2->temp3,size);
+            dot1D(f2->temp3,error,f2->temp,size);
         }
         
         else if(f2->activation_flag == LEAKY_RELU){
-            derivative_leaky_relu_array(f2->pre_activation,f2->temp3,f2->output);
-            dot1D(f2->temp3,error,f2->temp,f2->output);
+            derivative_leaky_relu_array(f2->pre_activation,f2->temp3,size);
+            dot1D(f2->temp3,error,f2->temp,size);
         }
         
         else{
-            copy_array(error,f2->temp,f2->output);
+            copy_array(error,f2->temp,size);
         }
     }
+}
+
+/* This function computes the derivative of weights and biases of a fully-connected layer f2
+ * applied to a previous fully connected layer f1, and returns the error of the last function of the
+ * previous layer. For example:
+ * if the previous layer applied only the pre_activation then the float* vector returned is the DL/df1->pre_activation
+ * if the previous layer applied only pre_activation and post activation then the float* vector returned is DL/df1->post_activation
+ * if the previous layer applied pre activation, post activation and dropout then the float* vector returned is
+ * DL/df1->post_activation without the dropout applied, in this case the dropout must be applied during the backpropagation of f1.
+ * If f2 applied the dropout, then the float* error passed as param could be DL/df2->pre_activation or DL/df2->post_activation
+ * in both the cases we must apply the dropout_mask to this error.
+ * 
+ * Input:
+ * 
+ *             @ fcl* f1:= the fully-connected input layer
+ *             @ fcl* f2:= the fully-connected current layer
+ *             @ float* error:= the error passed
+ * 
+ * Warning:
+ *             if we have softmax as activation function of f2, (softmax can be applied only for the last fully-connected layers)
+ *             then the error passed as param is not DL/Df2->post_activation but is L where L is the error
+ * */
+float* bp_fcl_fcl(fcl* f1, fcl* f2, float* error){
+    /*computing the backpropagation for f2*/
+    bp_fcl_error(f2,error,1);
+    
     /* computing the weight and bias derivatives for f2 applied to f1 output*/
     if(f1->dropout_flag){
         if(f1->activation_flag){
@@ -1190,141 +1792,141 @@ float* bp_fcl_fcl(fcl* f1, fcl* f2, float* error){
 }
 
 
-/* This function computes the derivative of weights and biases of a convolutional layer f2
- * applied to a previous fully connected layer f1, and returns the error of the last function of the
- * previous layer. For example:
- * if the previous layer applied only the pre_activation then the float* vector returned is the DL/df1->pre_activation
- * if the previous layer applied only pre_activation and post activation then the float* vector returned is DL/df1->post_activation
- * if the previous layer applied pre activation, post activation and dropout then the float* vector returned is
- * DL/df1->post_activation without the dropout applied, in this case the dropout must be applied during the backpropagation of f1.
+/* This function computes in f2->temp the error of the pre activation of a convolutional layer
+ * from the error of its output (pooling, local response normalization and derivative of the activation),
+ * if f2 has no convolution f2->temp is the error of its input.
+ * The feature maps of the instances are one after the other, so the pooling and the activation
+ * compute n instances as n*f2->n_kernels feature maps, the normalization is computed for each instance
  * 
  * Input:
+ *             @ cl* f2:= the convolutional layer
+ *             @ float* error:= the error of the output of f2, dimensions: n times the output of f2
+ *             @ int n:= the number of instances stored one after the other in the arrays of f2
  * 
- *             @ fcl* f1:= the fully-connected input layer
- *             @ cl* f2:= the convolutional current layer
- *             @ float* error:= the error passed
- * */ 
-float* bp_fcl_cl(fcl* f1, cl* f2, float* error){
-    int i,j,k;
-    /* computing backpropagation for f2*/
+ * */
+static void bp_cl_error(cl* f2, float* error, int n){
+    int i,b;
+    int maps = f2->n_kernels*n, size1 = f2->n_kernels*f2->rows1*f2->cols1, size = size1*n;
     if(f2->pooling_flag == MAX_POOLING){
-        for(i = 0; i < f2->n_kernels; i++){
-            if(f2->normalization_flag){
-                max_pooling_back_prop(&f2->post_normalization[i*f2->rows1*f2->cols1], &error[i*f2->rows2*f2->cols2], f2->rows1, f2->cols1, f2->pooling_rows, f2->pooling_cols, f2->stride2_rows, f2->padding2_rows, &f2->temp[i*f2->rows1*f2->cols1]);
-            }
-            else if(f2->activation_flag){
-                max_pooling_back_prop(&f2->post_activation[i*f2->rows1*f2->cols1], &error[i*f2->rows2*f2->cols2], f2->rows1, f2->cols1, f2->pooling_rows, f2->pooling_cols, f2->stride2_rows, f2->padding2_rows, &f2->temp[i*f2->rows1*f2->cols1]);
-            }
-            else{
-                max_pooling_back_prop(&f2->pre_activation[i*f2->rows1*f2->cols1], &error[i*f2->rows2*f2->cols2], f2->rows1, f2->cols1, f2->pooling_rows, f2->pooling_cols, f2->stride2_rows, f2->padding2_rows, &f2->temp[i*f2->rows1*f2->cols1]);
-            }
+        if(f2->pooling_indices == NULL){
+            fprintf(stderr,"Error: the max-pooling backpropagation needs the indices of the feed forward, the layer is in inference mode\n");
+            exit(1);
+        }
+        for(i = 0; i < maps; i++){
+            max_pooling_back_prop_indices(&f2->pooling_indices[i*f2->rows2*f2->cols2], &error[i*f2->rows2*f2->cols2], f2->rows1, f2->cols1, f2->pooling_rows, f2->pooling_cols, f2->stride2_rows, f2->padding2_rows, &f2->temp[i*f2->rows1*f2->cols1]);
         }
     }
     
     else if(f2->pooling_flag == AVARAGE_POOLING){
-        for(i = 0; i < f2->n_kernels; i++){
+        for(i = 0; i < maps; i++){
             avarage_pooling_back_prop(&f2->temp[i*f2->rows1*f2->cols1], &error[i*f2->rows2*f2->cols2], f2->rows1, f2->cols1, f2->pooling_rows, f2->pooling_cols, f2->stride2_rows, f2->padding2_rows);
         }
     }
     
     else{
-        copy_array(error,f2->temp,f2->n_kernels*f2->rows1*f2->cols1);
+        copy_array(error,f2->temp,size);
     }
     
-    if(f2->convolutional_flag == CONVOLUTION){
-        if(f2->normalization_flag){
-            for(i = 0; i < f2->n_kernels; i++){
-                for(j = f2->padding1_rows; j < f2->rows1-f2->padding1_rows; j++){
-                    for(k = f2->padding1_rows; k < f2->cols1-f2->padding1_rows; k++){
-                        if(f2->activation_flag)
-                            local_response_normalization_back_prop(f2->post_activation,f2->temp2,f2->temp, i,j,k,f2->n_kernels,f2->rows1, f2->cols1, N_NORMALIZATION,BETA_NORMALIZATION,ALPHA_NORMALIZATION,K_NORMALIZATION);
-                        else
-                            local_response_normalization_back_prop(f2->pre_activation,f2->temp2,f2->temp, i,j,k,f2->n_kernels,f2->rows1, f2->cols1, N_NORMALIZATION,BETA_NORMALIZATION,ALPHA_NORMALIZATION,K_NORMALIZATION);
-
-                    }
-                }
-            }
-            
-            if(f2->activation_flag == SIGMOID){
-                derivative_sigmoid_array(f2->pre_activation,f2->temp3,f2->n_kernels*f2->rows1*f2->cols1);
-                dot1D(f2->temp3,f2->temp2,f2->temp,f2->n_kernels*f2->rows1*f2->cols1);
-            }
-            
-            if(f2->activation_flag == RELU){
-                derivative_relu_array(f2->pre_activation,f2->temp3,f2->n_kernels*f2->rows1*f2->cols1);
-                dot1D(f2->temp3,f2->temp2,f2->temp,f2->n_kernels*f2->rows1*f2->cols1);
-            }
-            
-            if(f2->activation_flag == TANH){
-                derivative_tanhh_array(f2->pre_activation,f2->temp3,f2->n_kernels*f2->rows1*f2->cols1);
-                dot1D(f2->temp3,f2->temp2,f2->temp,f2->n_kernels*f2->rows1*f2->cols1);
-            }
-            
-            if(f2->activation_flag == LEAKY_RELU){
-                derivative_leaky_relu_array(f2->pre_activation,f2->temp3,f2->n_kernels*f2->rows1*f2->cols1);
-                dot1D(f2->temp3,f2->temp2,f2->temp,f2->n_kernels*f2->rows1*f2->cols1);
-            }
-            
-            if(f2->activation_flag == NO_ACTIVATION){
-                copy_array(f2->temp2,f2->temp,f2->n_kernels*f2->rows1*f2->cols1);
-            }
-            
-            
+    if(f2->convolutional_flag != CONVOLUTION)
+        return;
+    
+    if(f2->normalization_flag){
+        for(b = 0; b < n; b++){
+            if(f2->activation_flag)
+                local_response_normalization_back_prop_tensor(&f2->post_activation[b*size1],&f2->temp2[b*size1],&f2->temp[b*size1],f2->n_kernels,f2->rows1,f2->cols1,f2->padding1_rows,N_NORMALIZATION,BETA_NORMALIZATION,ALPHA_NORMALIZATION,K_NORMALIZATION,&f2->temp3[b*size1]);
+            else
+                local_response_normalization_back_prop_tensor(&f2->pre_activation[b*size1],&f2->temp2[b*size1],&f2->temp[b*size1],f2->n_kernels,f2->rows1,f2->cols1,f2->padding1_rows,N_NORMALIZATION,BETA_NORMALIZATION,ALPHA_NORMALIZATION,K_NORMALIZATION,&f2->temp3[b*size1]);
         }
         
-        else{
-            if(f2->activation_flag == SIGMOID){
-                derivative_sigmoid_array(f2->pre_activation,f2->temp3,f2->n_kernels*f2->rows1*f2->cols1);
-                dot1D(f2->temp3,f2->temp,f2->temp,f2->n_kernels*f2->rows1*f2->cols1);
-            }
-            
-            if(f2->activation_flag == RELU){
-                derivative_relu_array(f2->pre_activation,f2->temp3,f2->n_kernels*f2->rows1*f2->cols1);
-                dot1D(f2->temp3,f2->temp,f2->temp,f2->n_kernels*f2->rows1*f2->cols1);
-            }
-            
-            if(f2->activation_flag == TANH){
-                derivative_tanhh_array(f2->pre_activation,f2->temp3,f2->n_kernels*f2->rows1*f2->cols1);
-                dot1D(f2->temp3,f2->temp,f2->temp,f2->n_kernels*f2->rows1*f2->cols1);
-            }
-            
-            if(f2->activation_flag == LEAKY_RELU){
-                derivative_leaky_relu_array(f2->pre_activation,f2->temp3,f2->n_kernels*f2->rows1*f2->cols1);
-                dot1D(f2->temp3,f2->temp,f2->temp,f2->n_kernels*f2->rows1*f2->cols1);
-            }
+        if(f2->activation_flag == SIGMOID){
+            derivative_sigmoid_array(f2->pre_activation,f2->temp3,size);
+            dot1D(f2->temp3,f2->temp2,f2->temp,size);
+        }
+        
+        if(f2->activation_flag == RELU){
+            derivative_relu_array(f2->pre_activation,f2->temp3,size);
+            dot1D(f2->temp3,f2->temp2,f2->temp,size);
+        }
+        
+        if(f2->activation_flag == TANH){
+            derivative_tanhh_array(f2->pre_activation,f2->temp3,size);
+            dot1D(f2->temp3,f2->temp2,f2->temp,size);
+        }
+        
+        if(f2->activation_flag == LEAKY_RELU){
+            derivative_leaky_relu_array(f2->pre_activation,f2->temp3,size);
+            dot1D(f2->temp3,f2->temp2,f2->temp,size);
+        }
+        
+        if(f2->activation_flag == NO_ACTIVATION){
+            copy_array(f2->temp2,f2->temp,size);
+        }
+    }
+    
+    else{
+        if(f2->activation_flag == SIGMOID){
+            derivative_sigmoid_array(f2->pre_activation,f2->temp3,size);
+            dot1D(f2->temp3,f2->temp,f2->temp,size);
+        }
+        
+        if(f2->activation_flag == RELU){
+            derivative_relu_array(f2->pre_activation,f2->temp3,size);
+            dot1D(f2->temp3,f2->temp,f2->temp,size);
         }
         
+        if(f2->activation_flag == TANH){
+            derivative_tanhh_array(f2->pre_activation,f2->temp3,size);
+            dot1D(f2->temp3,f2->temp,f2->temp,size);
+        }
+        
+        if(f2->activation_flag == LEAKY_RELU){
+            derivative_leaky_relu_array(f2->pre_activation,f2->temp3,size);
+            dot1D(f2->temp3,f2->temp,f2->temp,size);
+        }
+    }
+}
+
+/* This function computes the derivative of weights and biases of a convolutional layer f2
+ * applied to a previous fully connected layer f1, and returns the error of the last function of the
+ * previous layer. For example:
+ * if the previous layer applied only the pre_activation then the float* vector returned is the DL/df1->pre_activation
+ * if the previous layer applied only pre_activation and post activation then the float* vector returned is DL/df1->post_activation
+ * if the previous layer applied pre activation, post activation and dropout then the float* vector returned is
+ * DL/df1->post_activation without the dropout applied, in this case the dropout must be applied during the backpropagation of f1.
+ * 
+ * Input:
+ * 
+ *             @ fcl* f1:= the fully-connected input layer
+ *             @ cl* f2:= the convolutional current layer
+ *             @ float* error:= the error passed
+ * */ 
+float* bp_fcl_cl(fcl* f1, cl* f2, float* error){
+    bp_cl_error(f2,error,1);
+    
+    if(f2->convolutional_flag == CONVOLUTION){
         /* computing the weight and bias derivatives for f2 applied to f1 output*/
         if(f1->dropout_flag){
             if(f1->activation_flag){
                 
                 dot1D(f1->post_activation,f1->dropout_mask,f2->temp2,f1->output);
-                for(i = 0; i < f2->n_kernels; i++){
-                    convolutional_back_prop(f2->temp2, f2->kernels[i], f2->input_rows,f2->input_cols,f2->kernel_rows,f2->kernel_cols,f2->biases[i],f2->channels,&f2->temp[i*f2->rows1*f2->cols1],f2->error2,f2->d_kernels[i], &f2->d_biases[i], f2->stride1_rows, f2->padding1_rows);                
-                }
+                convolutional_layer_back_prop(f2,f2->temp2,f2->temp);
 
             }
             
             else{
                 dot1D(f1->pre_activation,f1->dropout_mask,f2->temp2,f1->output);
                 
-                for(i = 0; i < f2->n_kernels; i++){
-                    convolutional_back_prop(f2->temp2, f2->kernels[i], f2->input_rows,f2->input_cols,f2->kernel_rows,f2->kernel_cols,f2->biases[i],f2->channels,&f2->temp[i*f2->rows1*f2->cols1],f2->error2,f2->d_kernels[i], &f2->d_biases[i], f2->stride1_rows, f2->padding1_rows);                
-                }
+                convolutional_layer_back_prop(f2,f2->temp2,f2->temp);
             }
         }
         
         else{
             if(f1->activation_flag){
-                for(i = 0; i < f2->n_kernels; i++){
-                    convolutional_back_prop(f1->post_activation, f2->kernels[i], f2->input_rows,f2->input_cols,f2->kernel_rows,f2->kernel_cols,f2->biases[i],f2->channels,&f2->temp[i*f2->rows1*f2->cols1],f2->error2,f2->d_kernels[i], &f2->d_biases[i], f2->stride1_rows, f2->padding1_rows);                
-                }
+                convolutional_layer_back_prop(f2,f1->post_activation,f2->temp);
             }
             
             else{
-                for(i = 0; i < f2->n_kernels; i++){
-                    convolutional_back_prop(f1->pre_activation, f2->kernels[i], f2->input_rows,f2->input_cols,f2->kernel_rows,f2->kernel_cols,f2->biases[i],f2->channels,&f2->temp[i*f2->rows1*f2->cols1],f2->error2,f2->d_kernels[i], &f2->d_biases[i], f2->stride1_rows, f2->padding1_rows);                
-                }
+                convolutional_layer_back_prop(f2,f1->pre_activation,f2->temp);
             }
         }
         
@@ -1355,106 +1957,19 @@ float* bp_fcl_cl(fcl* f1, cl* f2, float* error){
  *             @ float* error:= the error passed
  * */
 float* bp_cl_cl(cl* f1, cl* f2, float* error){
-    int i,j,k;
-
-    
-    /* computing backpropagation for f2*/
-    if(f2->pooling_flag == MAX_POOLING){
-        for(i = 0; i < f2->n_kernels; i++){
-            if(f2->normalization_flag)
-                max_pooling_back_prop(&f2->post_normalization[i*f2->rows1*f2->cols1], &error[i*f2->rows2*f2->cols2], f2->rows1, f2->cols1, f2->pooling_rows, f2->pooling_cols, f2->stride2_rows, f2->padding2_rows, &f2->temp[i*f2->rows1*f2->cols1]);
-            else if(f2->activation_flag)
-                max_pooling_back_prop(&f2->post_activation[i*f2->rows1*f2->cols1], &error[i*f2->rows2*f2->cols2], f2->rows1, f2->cols1, f2->pooling_rows, f2->pooling_cols, f2->stride2_rows, f2->padding2_rows, &f2->temp[i*f2->rows1*f2->cols1]);
-            else
-                max_pooling_back_prop(&f2->pre_activation[i*f2->rows1*f2->cols1], &error[i*f2->rows2*f2->cols2], f2->rows1, f2->cols1, f2->pooling_rows, f2->pooling_cols, f2->stride2_rows, f2->padding2_rows, &f2->temp[i*f2->rows1*f2->cols1]);
-        }
-    }
-    
-    else if(f2->pooling_flag == AVARAGE_POOLING){
-        for(i = 0; i < f2->n_kernels; i++){
-            avarage_pooling_back_prop(&f2->temp[i*f2->rows1*f2->cols1], &error[i*f2->rows2*f2->cols2], f2->rows1, f2->cols1, f2->pooling_rows, f2->pooling_cols, f2->stride2_rows, f2->padding2_rows);
-        }
-    }
-    
-    else{
-        copy_array(error,f2->temp,f2->n_kernels*f2->rows1*f2->cols1);
-    }
+    bp_cl_error(f2,error,1);
     
     if(f2->convolutional_flag == CONVOLUTION){
-        if(f2->normalization_flag){
-            for(i = 0; i < f2->n_kernels; i++){
-                for(j = f2->padding1_rows; j < f2->rows1-f2->padding1_rows; j++){
-                    for(k = f2->padding1_rows; k < f2->cols1-f2->padding1_rows; k++){
-                        if(f2->activation_flag)
-                            local_response_normalization_back_prop(f2->post_activation,f2->temp2,f2->temp, i,j-f2->padding1_rows,k-f2->padding1_rows,f2->n_kernels,f2->rows1, f2->cols1, N_NORMALIZATION,BETA_NORMALIZATION,ALPHA_NORMALIZATION,K_NORMALIZATION);
-                        else
-                            local_response_normalization_back_prop(f2->pre_activation,f2->temp2,f2->temp, i,j,k,f2->n_kernels,f2->rows1, f2->cols1, N_NORMALIZATION,BETA_NORMALIZATION,ALPHA_NORMALIZATION,K_NORMALIZATION);
-
-                    }
-                }
-            }
-            
-            if(f2->activation_flag == SIGMOID){
-                derivative_sigmoid_array(f2->pre_activation,f2->temp3,f2->n_kernels*f2->rows1*f2->cols1);
-                dot1D(f2->temp3,f2->temp2,f2->temp,f2->n_kernels*f2->rows1*f2->cols1);
-            }
-            
-            if(f2->activation_flag == RELU){
-                derivative_relu_array(f2->pre_activation,f2->temp3,f2->n_kernels*f2->rows1*f2->cols1);
-                dot1D(f2->temp3,f2->temp2,f2->temp,f2->n_kernels*f2->rows1*f2->cols1);
-            }
-            
-            if(f2->activation_flag == TANH){
-                derivative_tanhh_array(f2->pre_activation,f2->temp3,f2->n_kernels*f2->rows1*f2->cols1);
-                dot1D(f2->temp3,f2->temp2,f2->temp,f2->n_kernels*f2->rows1*f2->cols1);
-            }
-            
-            if(f2->activation_flag == LEAKY_RELU){
-                derivative_leaky_relu_array(f2->pre_activation,f2->temp3,f2->n_kernels*f2->rows1*f2->cols1);
-                dot1D(f2->temp3,f2->temp2,f2->temp,f2->n_kernels*f2->rows1*f2->cols1);
-            }
-            
-            if(f2->activation_flag == NO_ACTIVATION){
-                copy_array(f2->temp2,f2->temp,f2->n_kernels*f2->rows1*f2->cols1);
-            }
-            
-            
-        }
-        
-        else{
-            if(f2->activation_flag == SIGMOID){
-                derivative_sigmoid_array(f2->pre_activation,f2->temp3,f2->n_kernels*f2->rows1*f2->cols1);
-                dot1D(f2->temp3,f2->temp,f2->temp,f2->n_kernels*f2->rows1*f2->cols1);
-            }
-            
-            if(f2->activation_flag == RELU){
-                derivative_relu_array(f2->pre_activation,f2->temp3,f2->n_kernels*f2->rows1*f2->cols1);
-                dot1D(f2->temp3,f2->temp,f2->temp,f2->n_kernels*f2->rows1*f2->cols1);
-            }
-            
-            if(f2->activation_flag == TANH){
-                derivative_tanhh_array(f2->pre_activation,f2->temp3,f2->n_kernels*f2->rows1*f2->cols1);
-                dot1D(f2->temp3,f2->temp,f2->temp,f2->n_kernels*f2->rows1*f2->cols1);
-            }
-            
-            if(f2->activation_flag == LEAKY_RELU){
-                derivative_leaky_relu_array(f2->pre_activation,f2->temp3,f2->n_kernels*f2->rows1*f2->cols1);
-                dot1D(f2->temp3,f2->temp,f2->temp,f2->n_kernels*f2->rows1*f2->cols1);
-            }
-        }
-        
         /* computing the weight and bias derivatives for f2 applied to f1 output*/
         
-        for(i = 0; i < f2->n_kernels; i++){
-            if(f1->pooling_flag)
-                convolutional_back_prop(f1->post_pooling, f2->kernels[i], f2->input_rows,f2->input_cols,f2->kernel_rows,f2->kernel_cols,f2->biases[i],f2->channels,&f2->temp[i*f2->rows1*f2->cols1],f2->error2,f2->d_kernels[i], &f2->d_biases[i], f2->stride1_rows, f2->padding1_rows);                
-            else if(f1->normalization_flag)
-                convolutional_back_prop(f1->post_normalization, f2->kernels[i], f2->input_rows,f2->input_cols,f2->kernel_rows,f2->kernel_cols,f2->biases[i],f2->channels,&f2->temp[i*f2->rows1*f2->cols1],f2->error2,f2->d_kernels[i], &f2->d_biases[i], f2->stride1_rows, f2->padding1_rows);                
-            else if(f1->activation_flag)
-                convolutional_back_prop(f1->post_activation, f2->kernels[i], f2->input_rows,f2->input_cols,f2->kernel_rows,f2->kernel_cols,f2->biases[i],f2->channels,&f2->temp[i*f2->rows1*f2->cols1],f2->error2,f2->d_kernels[i], &f2->d_biases[i], f2->stride1_rows, f2->padding1_rows);                
-            else
-                convolutional_back_prop(f1->pre_activation, f2->kernels[i], f2->input_rows,f2->input_cols,f2->kernel_rows,f2->kernel_cols,f2->biases[i],f2->channels,&f2->temp[i*f2->rows1*f2->cols1],f2->error2,f2->d_kernels[i], &f2->d_biases[i], f2->stride1_rows, f2->padding1_rows);                
-        }
+        if(f1->pooling_flag)
+            convolutional_layer_back_prop(f2,f1->post_pooling,f2->temp);
+        else if(f1->normalization_flag)
+            convolutional_layer_back_prop(f2,f1->post_normalization,f2->temp);
+        else if(f1->activation_flag)
+            convolutional_layer_back_prop(f2,f1->post_activation,f2->temp);
+        else
+            convolutional_layer_back_prop(f2,f1->pre_activation,f2->temp);
         
         
         return f2->error2;
@@ -1485,65 +2000,9 @@ float* bp_cl_cl(cl* f1, cl* f2, float* error){
  *             then the error passed as param is not DL/Df2->post_activation but is L where L is the error
  * */
 float* bp_cl_fcl(cl* f1, fcl* f2, float* error){
-    int i;
-    
     /*computing the backpropagation for f2*/
-    if(f2->dropout_flag){
-        dot1D(error,f2->dropout_mask,f2->temp,f2->output);
-        if(f2->activation_flag == SIGMOID){
-            derivative_sigmoid_array(f2->pre_activation,f2->temp3,f2->output);
-            dot1D(f2->temp3,f2->temp,f2->temp,f2->output);
-        }
-        else if(f2->activation_flag == RELU){
-            derivative_relu_array(f2->pre_activation,f2->temp3,f2->output);
-            dot1D(f2->temp3,f2->temp,f2->temp,f2->output);
-        }
-        
-        else if(f2->activation_flag == SOFTMAX){
-            derivative_cross_entropy_reduced_form_with_softmax_array(f2->post_activation,  error,f2->temp3, f2->output);
-            dot1D(f2->temp3,f2->temp,f2->temp,f2->output);
-        }
-        
-        else if(f2->activation_flag == TANH){
-            derivative_tanhh_array(f2->pre_activation,f2->temp3,f2->output);
-            dot1D(f2->temp3,f2->temp,f2->temp,f2->output);
-        }
-        
-        else if(f2->activation_flag == LEAKY_RELU){
-            derivative_leaky_relu_array(f2->pre_activation,f2->temp3,f2->output);
-            dot1D(f2->temp3,f2->temp,f2->temp,f2->output);
-        }
-    }
+    bp_fcl_error(f2,error,1);
     
-    else{
-        if(f2->activation_flag == SIGMOID){
-            derivative_sigmoid_array(f2->pre_activation,f2->temp3,f2->output);
-            dot1D(f2->temp3,error,f2->temp,f2->output);
-        }
-        else if(f2->activation_flag == RELU){
-            derivative_relu_array(f2->pre_activation,f2->temp3,f2->output);
-            dot1D(f2->temp3,error,f2->temp,f2->output);
-        }
-        
-        else if(f2->activation_flag == SOFTMAX){
-            derivative_cross_entropy_reduced_form_with_softmax_array(f2->post_activation,  error,f2->temp3, f2->output);
-            copy_array(f2->temp3,f2->temp,f2->output);
-        }
-        
-        else if(f2->activation_flag == TANH){
-            derivative_tanhh_array(f2->pre_activation,f2->temp3,f2->output);
-            dot1D(f2->temp3,error,f2->temp,f2->output);
-        }
-        
-        else if(f2->activation_flag == LEAKY_RELU){
-            derivative_leaky_relu_array(f2->pre_activation,f2->temp3,f2->output);
-            dot1D(f2->temp3,error,f2->temp,f2->output);
-        }
-        
-        else{
-            copy_array(error,f2->temp,f2->output);
-        }
-    }
     /* computing the weight and bias derivatives for f2 applied to f1 output*/
         if(f1->pooling_flag)
             fully_connected_back_prop(f1->post_pooling, f2->temp, f2->weights,f2->error2, f2->d_weights,f2->d_biases, f2->input, f2->output);
@@ -1560,6 +2019,136 @@ float* bp_cl_fcl(cl* f1, fcl* f2, float* error){
 }
 
 
+/* This function binds the input tensor to the input layer of the model, the input is not copied
+ * (the layers only read it)
+ * 
+ * Input:
+ *             @ model* m:= the model
+ *             @ int tensor_depth:= the depth of the input tensor
+ *             @ int tensor_i:= the number of rows of the tensor
+ *             @ int tensor_j:= the number of columns of the tensor
+ *             @ float* input:= the input array
+ * 
+ * */
+static cl* model_input_layer(model* m, int tensor_depth, int tensor_i, int tensor_j, float* input){
+    cl* temp = m->input_layer;
+    temp->n_kernels = tensor_depth;
+    temp->rows1 = tensor_i;
+    temp->cols1 = tensor_j;
+    temp->post_activation = input;
+    return temp;
+}
+
+/* This function computes the feed forward of a step of the plan of a model
+ * 
+ * Input:
+ *             @ model_step* s:= the step
+ *             @ cl* temp:= the input layer of the model
+ * 
+ * */
+static void model_ff_step(model_step* s, cl* temp){
+    cl* in = s->input_flag == CLS ? s->in_c : temp;
+    
+    if(s->sla == FCLS){
+        if(s->input_flag == FCLS)
+            ff_fcl_fcl(s->in_f,s->f);
+        else
+            ff_cl_fcl(in,s->f);
+        return;
+    }
+    
+    if(s->sla == RLS && s->rl_first){
+        float* source = s->rl_copy_source != NULL ? s->rl_copy_source : temp->post_activation;
+        if(s->rl_copy_dropout != NULL && s->rl_copy_dropout->dropout_flag)
+            dot1D(source,s->rl_copy_dropout->dropout_mask,s->r->input,s->rl_size);
+        else
+            copy_array(source,s->r->input,s->rl_size);
+    }
+    
+    if(s->input_flag == FCLS)
+        ff_fcl_cl(s->in_f,s->c);
+    else
+        ff_cl_cl(in,s->c);
+    
+    if(s->sla == RLS && s->rl_last){
+        sum1D(s->r->input,s->rl_sum_source,s->r->cl_output->pre_activation,s->rl_size);
+        if(s->rl_activation != NULL)
+            (*s->rl_activation)(s->r->cl_output->pre_activation,s->r->cl_output->post_activation,s->r->cl_output->n_kernels*s->r->cl_output->rows1*s->r->cl_output->cols1);
+    }
+}
+
+/* This function resets the planned activation arrays written by a step of the feed forward plan
+ * (the layers accumulate in their arrays and the buffers hold the arrays of the previous steps)
+ * 
+ * Input:
+ *             @ model* m:= the model
+ *             @ int k:= the step
+ *             @ int batch_size:= the number of instances from the selected one
+ * 
+ * */
+static void model_reset_step(model* m, int k, int batch_size){
+    int i;
+    activation_array* a;
+    for(i = m->activation_steps[k]; i < m->activation_steps[k+1]; i++){
+        a = &m->activation_arrays[i];
+        memset(*a->field,0,sizeof(float)*a->size*batch_size);
+    }
+}
+
+/* This function computes the back propagation of the layer of a step of the plan of a model
+ * and returns the error of its input
+ * 
+ * Input:
+ *             @ model_step* s:= the step
+ *             @ cl* temp:= the input layer of the model
+ *             @ float* error1:= the error of the output of the layer
+ * 
+ * */
+static float* model_bp_step_layer(model_step* s, cl* temp, float* error1){
+    cl* in = s->input_flag == CLS ? s->in_c : temp;
+    
+    if(s->sla == FCLS){
+        if(s->input_flag == FCLS)
+            return bp_fcl_fcl(s->in_f,s->f,error1);
+        return bp_cl_fcl(in,s->f,error1);
+    }
+    if(s->input_flag == FCLS)
+        return bp_fcl_cl(s->in_f,s->c,error1);
+    return bp_cl_cl(in,s->c,error1);
+}
+
+/* This function brings the error of the input of a step back through the residual connections:
+ * the activation of the output of the previous residual layer and the sum at the beginning of a residual layer.
+ * All these functions are element-wise, so n instances are computed at once
+ * 
+ * Input:
+ *             @ model_step* s:= the step
+ *             @ float* error1:= the error of the input of the layer of the step
+ *             @ float* error_residual:= the error of the output of the residual layer of the step
+ *             @ int n:= the number of instances stored one after the other in error1, error_residual and the arrays of the layers
+ * 
+ * */
+static float* model_bp_step_residual(model_step* s, float* error1, float* error_residual, int n){
+    int size;
+    
+    /* the error goes back through the activation of the output of the previous residual layer*/
+    if(s->in_rl != NULL){
+        cl* out = s->in_rl->cl_output;
+        size = out->n_kernels*out->rows1*out->cols1*n;
+        if(s->in_rl_derivative != NULL){
+            (*s->in_rl_derivative)(out->pre_activation,out->temp3,size);
+            dot1D(out->temp3,error1,out->temp,size);
+        }
+        else
+            copy_array(error1,out->temp,size);
+        error1 = out->temp;
+    }
+    
+    if(s->sla == RLS && s->rl_first)
+        sum1D(error1,error_residual,error1,s->rl_size*n);
+    return error1;
+}
+
 /* This function computes the feed-forward for a model m. each layer at the index l makes the feed-forward
  * for the first layer at the index l-1. if the input is a 1d array then you should split its dimension
  * in 3 dimension to turn the input in a tensor, for example:
@@ -1577,267 +2166,20 @@ float* bp_cl_fcl(cl* f1, fcl* f2, float* error){
 void model_tensor_input_ff(model* m, int tensor_depth, int tensor_i, int tensor_j, float* input){
     if(m == NULL)
         return;
-    int i,j,z,w,count,count2,z2,k1 = 0, k2 = 0, k3 = 0;
-    
-    /* Setting the input inside a convolutional structure*/
-    cl* temp = (cl*)malloc(sizeof(cl));
-    temp->post_activation = (float*)malloc(sizeof(float)*tensor_depth*tensor_i*tensor_j);
-    temp->normalization_flag = NO_NORMALIZATION;
-    temp->pooling_flag = NO_POOLING;
-    temp->activation_flag = SIGMOID;
-    temp->n_kernels = tensor_depth;
-    temp->rows1 = tensor_i;
-    temp->cols1 = tensor_j;
-    copy_array(input,temp->post_activation,tensor_depth*tensor_i*tensor_j);
+    int i;
+    
+    model_context_check(m);
+    
+    /* the input is read in place through the input layer of the model*/
+    cl* temp = model_input_layer(m,tensor_depth,tensor_i,tensor_j,input);
         
     /* apply the feed forward to the model*/
-    for(i = 0; i < m->layers; i++){
-        for(j = 0; j < m->layers && m->sla[i][j] != 0; j++){
-            
-                
-            if(!i){
-                if(m->sla[i][j] == FCLS){
-                    if(m->fcls[k1]->activation_flag == SOFTMAX && i != m->layers-1 && m->sla[i+1][0] != 0){
-                        fprintf(stderr,"Error: the softmax can be applied only on the last fully-connected layers\n");
-                        exit(1);
-                    }
-                    
-                    ff_cl_fcl(temp,m->fcls[k1]);
-                    k1++;
-                }
-                
-                else if(m->sla[i][j] == CLS){
-                    if(m->cls[k2]->activation_flag == SOFTMAX){
-                        fprintf(stderr,"Error: the softmax can be applied only on the last fully-connected layers\n");
-                        exit(1);
-                    }
-                    
-                    ff_cl_cl(temp,m->cls[k2]);
-                    k2++;
-                }
-                
-                else if(m->sla[i][j] == RLS){
-                    count = 0;
-                    for(z = 0; z < m->n_rl && count <= k3; z++){
-                        count+=m->rls[z]->n_cl;
-                    }
-                    
-                    z--;
-                    count-=m->rls[z]->n_cl;
-                
-                    
-                    if(m->rls[z]->cls[k3-count]->activation_flag == SOFTMAX){
-                        fprintf(stderr,"Error: the softmax can be applied only on the last fully-connected layers\n");
-                        exit(1);
-                    }
-                    
-                    if(k3-count == 0)
-                        copy_array(temp->post_activation,m->rls[z]->input,m->rls[z]->channels*m->rls[z]->input_rows*m->rls[z]->input_cols);
-                    
-                    ff_cl_cl(temp,m->rls[z]->cls[k3-count]);
-                    
-                    if(k3-count == m->rls[z]->n_cl-1){
-                        if(m->rls[z]->cls[k3-count]->pooling_flag)
-                            sum1D(m->rls[z]->input,m->rls[z]->cls[k3-count]->post_pooling,m->rls[z]->cl_output->pre_activation,m->rls[z]->cls[k3-count]->n_kernels*m->rls[z]->cls[k3-count]->rows2*m->rls[z]->cls[k3-count]->cols2);
-                        
-                        else if(m->rls[z]->cls[k3-count]->normalization_flag)
-                            sum1D(m->rls[z]->input,m->rls[z]->cls[k3-count]->post_normalization,m->rls[z]->cl_output->pre_activation,m->rls[z]->cls[k3-count]->n_kernels*m->rls[z]->cls[k3-count]->rows1*m->rls[z]->cls[k3-count]->cols1);
-                        
-                        else if(m->rls[z]->cls[k3-count]->activation_flag)
-                            sum1D(m->rls[z]->input,m->rls[z]->cls[k3-count]->post_activation,m->rls[z]->cl_output->pre_activation,m->rls[z]->cls[k3-count]->n_kernels*m->rls[z]->cls[k3-count]->rows1*m->rls[z]->cls[k3-count]->cols1);
-                        
-                        else
-                            sum1D(m->rls[z]->input,m->rls[z]->cls[k3-count]->pre_activation,m->rls[z]->cl_output->pre_activation,m->rls[z]->cls[k3-count]->n_kernels*m->rls[z]->cls[k3-count]->rows1*m->rls[z]->cls[k3-count]->cols1);
-                        
-                        if(m->rls[z]->cl_output->activation_flag == LEAKY_RELU)
-                            leaky_relu_array(m->rls[z]->cl_output->pre_activation,m->rls[z]->cl_output->post_activation, m->rls[z]->cl_output->n_kernels*m->rls[z]->cl_output->rows1*m->rls[z]->cl_output->cols1);
-                        else if(m->rls[z]->cl_output->activation_flag == RELU)
-                            relu_array(m->rls[z]->cl_output->pre_activation,m->rls[z]->cl_output->post_activation, m->rls[z]->cl_output->n_kernels*m->rls[z]->cl_output->rows1*m->rls[z]->cl_output->cols1);
-                        else if(m->rls[z]->cl_output->activation_flag == SIGMOID)
-                            sigmoid_array(m->rls[z]->cl_output->pre_activation,m->rls[z]->cl_output->post_activation, m->rls[z]->cl_output->n_kernels*m->rls[z]->cl_output->rows1*m->rls[z]->cl_output->cols1);
-                        else if(m->rls[z]->cl_output->activation_flag == TANH)
-                            tanhh_array(m->rls[z]->cl_output->pre_activation,m->rls[z]->cl_output->post_activation, m->rls[z]->cl_output->n_kernels*m->rls[z]->cl_output->rows1*m->rls[z]->cl_output->cols1);
-                    }
-                    
-                    k3++;
-                    
-                    
-                }
-            }
-            
-            else{
-                
-                if(m->sla[i][j] == FCLS){
-                    if(m->fcls[k1]->activation_flag == SOFTMAX && i != m->layers-1 && m->sla[i+1][0] != 0){
-                        fprintf(stderr,"Error: the softmax can be applied only on the last fully-connected layers\n");
-                        exit(1);
-                    }
-                    
-                    if(m->sla[i-1][0] == FCLS){
-                        ff_fcl_fcl(m->fcls[k1-1],m->fcls[k1]);
-                    }
-                    
-                    else if(m->sla[i-1][0] == CLS){
-                        ff_cl_fcl(m->cls[k2-1],m->fcls[k1]);
-                    }
-                    
-                    if(m->sla[i-1][0] == RLS){
-                        count2 = 0;
-                        for(z2 = 0; z2 < m->n_rl && count2 <= k3-1; z2++){
-                            count2+=m->rls[z2]->n_cl;
-                        }
-                        z2--;
-                        count2-=m->rls[z2]->n_cl;
-                    
-                        
-                        ff_cl_fcl(m->rls[z2]->cl_output,m->fcls[k1]);
-                    }
-                    
-                    k1++;
-                }
-                
-                else if(m->sla[i][j] == CLS){
-                    if(m->cls[k2]->activation_flag == SOFTMAX){
-                        fprintf(stderr,"Error: the softmax can be applied only on the last fully-connected layers\n");
-                        exit(1);
-                    }
-                    
-                    if(m->sla[i-1][0] == FCLS){
-                        ff_fcl_cl(m->fcls[k1-1],m->cls[k2]);
-                    }
-                    
-                    else if(m->sla[i-1][0] == CLS){
-                        ff_cl_cl(m->cls[k2-1],m->cls[k2]);
-                    }
-                    
-                    if(m->sla[i-1][0] == RLS){
-                        count2 = 0;
-                        for(z2 = 0; z2 < m->n_rl && count2 <= k3-1; z2++){
-                            count2+=m->rls[z2]->n_cl;
-                        }
-                        
-                        z2--;
-                        count2-=m->rls[z2]->n_cl;
-                    
-                        
-                        ff_cl_cl(m->rls[z2]->cl_output,m->cls[k2]);
-                    }
-                    k2++;
-                }
-                
-                else if(m->sla[i][j] == RLS){
-                    count = 0;
-                    for(z = 0; z < m->n_rl && count <= k3; z++){
-                        count+=m->rls[z]->n_cl;
-                    }
-                    
-                    
-                    z--;
-                    count-=m->rls[z]->n_cl;
-                
-                    
-                    if(m->rls[z]->cls[k3-count]->activation_flag == SOFTMAX){
-                        fprintf(stderr,"Error: the softmax can be applied only on the last fully-connected layers\n");
-                        exit(1);
-                    }
-                    
-                    
-                    if(m->sla[i-1][0] == FCLS){
-                        if(k3-count == 0){
-                            if(m->fcls[k1-1]->dropout_flag){
-                                if(m->fcls[k1-1]->activation_flag){
-                                    dot1D(m->fcls[k1-1]->post_activation,m->fcls[k1-1]->dropout_mask,m->rls[z]->input,m->rls[z]->channels*m->rls[z]->input_rows*m->rls[z]->input_cols);
-                                }
-                                else{
-                                    dot1D(m->fcls[k1-1]->pre_activation,m->fcls[k1-1]->dropout_mask,m->rls[z]->input,m->rls[z]->channels*m->rls[z]->input_rows*m->rls[z]->input_cols);
-                                }
-                            }
-                            else{
-                                if(m->fcls[k1-1]->activation_flag){
-                                    copy_array(m->fcls[k1-1]->post_activation,m->rls[z]->input,m->rls[z]->channels*m->rls[z]->input_rows*m->rls[z]->input_cols);
-                                }
-                                else{
-                                    copy_array(m->fcls[k1-1]->pre_activation,m->rls[z]->input,m->rls[z]->channels*m->rls[z]->input_rows*m->rls[z]->input_cols);
-                                }
-                            }
-                        }
-                    
-                        ff_fcl_cl(m->fcls[k1-1],m->rls[z]->cls[k3-count]);
-                    }
-                    
-                    else if(m->sla[i-1][0] == CLS){
-                        if(k3-count == 0){
-                            if(m->cls[k2-1]->pooling_flag){
-                                copy_array(m->cls[k2-1]->post_pooling,m->rls[z]->input,m->rls[z]->channels*m->rls[z]->input_rows*m->rls[z]->input_cols);
-                            }
-                            else if(m->cls[k2-1]->normalization_flag){
-                                copy_array(m->cls[k2-1]->post_normalization,m->rls[z]->input,m->rls[z]->channels*m->rls[z]->input_rows*m->rls[z]->input_cols);
-                            }
-                            
-                            else if(m->cls[k2-1]->activation_flag){
-                                copy_array(m->cls[k2-1]->post_activation,m->rls[z]->input,m->rls[z]->channels*m->rls[z]->input_rows*m->rls[z]->input_cols);
-                            }
-                            else{
-                                copy_array(m->cls[k2-1]->pre_activation,m->rls[z]->input,m->rls[z]->channels*m->rls[z]->input_rows*m->rls[z]->input_cols);                                
-                            }
-                        }
-                        ff_cl_cl(m->cls[k2-1],m->rls[z]->cls[k3-count]);
-                    }
-                    
-                    if(m->sla[i-1][0] == RLS){
-                        count2 = 0;
-                        for(z2 = 0; z2 < m->n_rl && count2 <= k3-1; z2++){
-                            count2+=m->rls[z2]->n_cl;
-                        }
-                        
-                        z2--;
-                        count2-=m->rls[z2]->n_cl;
-                        
-                        if(k3-count == 0){
-                            copy_array(m->rls[z2]->cl_output->post_activation,m->rls[z]->input,m->rls[z]->channels*m->rls[z]->input_rows*m->rls[z]->input_cols);
-                        }
-                        if(z2!=z){
-                            ff_cl_cl(m->rls[z2]->cl_output,m->rls[z]->cls[k3-count]);
-
-                        }
-                        else{
-                            ff_cl_cl(m->rls[z2]->cls[k3-1-count2],m->rls[z]->cls[k3-count]);
-                        }
-                    }
-                    
-                    if(k3-count == m->rls[z]->n_cl-1){
-                        if(m->rls[z]->cls[k3-count]->pooling_flag)
-                            sum1D(m->rls[z]->input,m->rls[z]->cls[k3-count]->post_pooling,m->rls[z]->cl_output->pre_activation,m->rls[z]->cls[k3-count]->n_kernels*m->rls[z]->cls[k3-count]->rows2*m->rls[z]->cls[k3-count]->cols2);
-                        else if(m->rls[z]->cls[k3-count]->normalization_flag)
-                            sum1D(m->rls[z]->input,m->rls[z]->cls[k3-count]->post_normalization,m->rls[z]->cl_output->pre_activation,m->rls[z]->cls[k3-count]->n_kernels*m->rls[z]->cls[k3-count]->rows1*m->rls[z]->cls[k3-count]->cols1);
-                        else if(m->rls[z]->cls[k3-count]->activation_flag)
-                            sum1D(m->rls[z]->input,m->rls[z]->cls[k3-count]->post_activation,m->rls[z]->cl_output->pre_activation,m->rls[z]->cls[k3-count]->n_kernels*m->rls[z]->cls[k3-count]->rows1*m->rls[z]->cls[k3-count]->cols1);
-                        else
-                            sum1D(m->rls[z]->input,m->rls[z]->cls[k3-count]->pre_activation,m->rls[z]->cl_output->pre_activation,m->rls[z]->cls[k3-count]->n_kernels*m->rls[z]->cls[k3-count]->rows1*m->rls[z]->cls[k3-count]->cols1);
-                        
-                        if(m->rls[z]->cl_output->activation_flag == LEAKY_RELU)
-                            leaky_relu_array(m->rls[z]->cl_output->pre_activation,m->rls[z]->cl_output->post_activation, m->rls[z]->cl_output->n_kernels*m->rls[z]->cl_output->rows1*m->rls[z]->cl_output->cols1);
-                        else if(m->rls[z]->cl_output->activation_flag == RELU)
-                            relu_array(m->rls[z]->cl_output->pre_activation,m->rls[z]->cl_output->post_activation, m->rls[z]->cl_output->n_kernels*m->rls[z]->cl_output->rows1*m->rls[z]->cl_output->cols1);
-                        else if(m->rls[z]->cl_output->activation_flag == SIGMOID)
-                            sigmoid_array(m->rls[z]->cl_output->pre_activation,m->rls[z]->cl_output->post_activation, m->rls[z]->cl_output->n_kernels*m->rls[z]->cl_output->rows1*m->rls[z]->cl_output->cols1);
-                        else if(m->rls[z]->cl_output->activation_flag == TANH)
-                            tanhh_array(m->rls[z]->cl_output->pre_activation,m->rls[z]->cl_output->post_activation, m->rls[z]->cl_output->n_kernels*m->rls[z]->cl_output->rows1*m->rls[z]->cl_output->cols1);
-
-                    }
-                    
-                    k3++;
-                    
-                    
-                }
-                
-            }
-            
-        }
+    for(i = 0; i < m->n_ff_steps; i++){
+        if(m->n_activation_arrays)
+            model_reset_step(m,i,1);
+        model_ff_step(&m->ff_plan[i],temp);
     }
     
-    free(temp->post_activation);
-    free(temp);
 }
 
 
@@ -1863,267 +2205,641 @@ void model_tensor_input_ff(model* m, int tensor_depth, int tensor_i, int tensor_
 float* model_tensor_input_bp(model* m, int tensor_depth, int tensor_i, int tensor_j, float* input, float* error, int error_dimension){
     if(m == NULL)
         return NULL;
+    model_training_check(m,"model_tensor_input_bp");
         
-    int i,j,z,w,count,count2,z2,k1 = m->n_fcl, k2 = m->n_cl, k3 = 0;
-    for(i = 0; i < m->n_rl; i++){
-        k3+=m->rls[i]->n_cl;
-    }
- 
+    int i;
+    model_step* s;
     
-    /* Setting the input inside a convolutional structure*/
-    cl* temp = (cl*)malloc(sizeof(cl));
-    temp->post_activation = (float*)malloc(sizeof(float)*tensor_depth*tensor_i*tensor_j);
-    temp->normalization_flag = NO_NORMALIZATION;
-    temp->pooling_flag = NO_POOLING;
-    temp->activation_flag = SIGMOID;
-    temp->n_kernels = tensor_depth;
-    temp->rows1 = tensor_i;
-    temp->cols1 = tensor_j;
-    copy_array(input,temp->post_activation,tensor_depth*tensor_i*tensor_j);
+    /* the input is read in place through the input layer of the model*/
+    cl* temp = model_input_layer(m,tensor_depth,tensor_i,tensor_j,input);
     
     float* error1 = error;
          
     float* error_residual = NULL;    
     /* apply the backpropagation to the model*/
-    for(i = m->layers-1; i >= 0; i--){
-        for(j = 0; j < 1 && m->sla[i][j] != 0; j++){
-            
-            
-            if(!i){
-                if(m->sla[i][j] == FCLS){
-                    k1--;
-                    if(m->fcls[k1]->activation_flag == SOFTMAX && i != m->layers-1 && m->sla[i+1][0] != 0){
-                        fprintf(stderr,"Error: the softmax can be applied only on the last fully-connected layers\n");
-                        exit(1);
-                    }
-                    
-                    error1 = bp_cl_fcl(temp,m->fcls[k1],error1);
-                    
-                }
-                
-                else if(m->sla[i][j] == CLS){
-                    k2--;
-                    if(m->cls[k2]->activation_flag == SOFTMAX){
-                        fprintf(stderr,"Error: the softmax can be applied only on the last fully-connected layers\n");
-                        exit(1);
-                    }
-                    
-                    error1 = bp_cl_cl(temp,m->cls[k2],error1);
-                    
-                    
-                }
-                
-                else if(m->sla[i][j] == RLS){
-                    k3--;
-                    count = 0;
-                    for(z = 0; z < m->n_rl && count <= k3; z++){
-                        count+=m->rls[z]->n_cl;
-                    }
-                    
-                    z--;
-                    count-=m->rls[z]->n_cl;
-                    
-                    if(k3-count == m->rls[z]->n_cl-1){
-                        error_residual = error1; 
-                    }
-                    
-                    if(m->rls[z]->cls[k3-count]->activation_flag == SOFTMAX){
-                        fprintf(stderr,"Error: the softmax can be applied only on the last fully-connected layers\n");
-                        exit(1);
-                    }
-                    
-                    
-                    
-                    error1 = bp_cl_cl(temp,m->rls[z]->cls[k3-count],error1);
-                    
-                    
-                    if(k3-count == 0)
-                        sum1D(error1,error_residual,error1,m->rls[z]->channels*m->rls[z]->input_rows*m->rls[z]->input_cols);
-                    
-                    
-                    
-                    
-                }
-            }
-            
-            else{
-                
-                if(m->sla[i][j] == FCLS){
-                    k1--;
-                    if(m->fcls[k1]->activation_flag == SOFTMAX && i != m->layers-1 && m->sla[i+1][0] != 0){
-                        fprintf(stderr,"Error: the softmax can be applied only on the last fully-connected layers\n");
-                        exit(1);
-                    }
-                    
-                    if(m->sla[i-1][0] == FCLS){
-                        error1 = bp_fcl_fcl(m->fcls[k1-1],m->fcls[k1],error1);
-                        }
-                    
-                    else if(m->sla[i-1][0] == CLS){
-                        error1 = bp_cl_fcl(m->cls[k2-1],m->fcls[k1], error1);
-                        }
-                    
-                    if(m->sla[i-1][0] == RLS){
-                        count2 = 0;
-                        for(z2 = 0; z2 < m->n_rl && count2 <= k3-1; z2++){
-                            count2+=m->rls[z2]->n_cl;
-                        }
-                        z2--;
-                        count2-=m->rls[z2]->n_cl;
-                    
-                        
-                        error1 = bp_cl_fcl(m->rls[z2]->cl_output,m->fcls[k1],error1);
-                        if(m->rls[z2]->cl_output->activation_flag == LEAKY_RELU)
-                            derivative_leaky_relu_array(m->rls[z2]->cl_output->pre_activation,m->rls[z2]->cl_output->temp3,m->rls[z2]->cl_output->n_kernels*m->rls[z2]->cl_output->rows1*m->rls[z2]->cl_output->cols1);
-                        else if(m->rls[z2]->cl_output->activation_flag == RELU)
-                            derivative_relu_array(m->rls[z2]->cl_output->pre_activation,m->rls[z2]->cl_output->temp3,m->rls[z2]->cl_output->n_kernels*m->rls[z2]->cl_output->rows1*m->rls[z2]->cl_output->cols1);
-                        else if(m->rls[z2]->cl_output->activation_flag == SIGMOID)
-                            derivative_sigmoid_array(m->rls[z2]->cl_output->pre_activation,m->rls[z2]->cl_output->temp3,m->rls[z2]->cl_output->n_kernels*m->rls[z2]->cl_output->rows1*m->rls[z2]->cl_output->cols1);
-                        else if(m->rls[z2]->cl_output->activation_flag == TANH)
-                            derivative_tanhh_array(m->rls[z2]->cl_output->pre_activation,m->rls[z2]->cl_output->temp3,m->rls[z2]->cl_output->n_kernels*m->rls[z2]->cl_output->rows1*m->rls[z2]->cl_output->cols1);
-                        
-                        if(m->rls[z2]->cl_output->activation_flag != NO_ACTIVATION)
-                            dot1D(m->rls[z2]->cl_output->temp3,error1,m->rls[z2]->cl_output->temp,m->rls[z2]->cl_output->n_kernels*m->rls[z2]->cl_output->rows1*m->rls[z2]->cl_output->cols1);
-                        else
-                            copy_array(error1,m->rls[z2]->cl_output->temp,m->rls[z2]->cl_output->n_kernels*m->rls[z2]->cl_output->rows1*m->rls[z2]->cl_output->cols1);
-                            
-                        error1 = m->rls[z2]->cl_output->temp;
-                        
-                    }
-                    
-                    
-                }
-                
-                else if(m->sla[i][j] == CLS){
-                    k2--;
-                    if(m->cls[k2]->activation_flag == SOFTMAX){
-                        fprintf(stderr,"Error: the softmax can be applied only on the last fully-connected layers\n");
-                        exit(1);
-                    }
-                    
-                    if(m->sla[i-1][0] == FCLS){
-                        error1 = bp_fcl_cl(m->fcls[k1-1],m->cls[k2],error1);
-                        
-                    }
-                    
-                    else if(m->sla[i-1][0] == CLS){
-                        error1 = bp_cl_cl(m->cls[k2-1],m->cls[k2],error1);
-                        
-                    }
-                    
-                    if(m->sla[i-1][0] == RLS){
-                        count2 = 0;
-                        for(z2 = 0; z2 < m->n_rl && count2 <= k3-1; z2++){
-                            count2+=m->rls[z2]->n_cl;
-                        }
-                        
-                        z2--;
-                        count2-=m->rls[z2]->n_cl;
-                    
-                        
-                        error1 = bp_cl_cl(m->rls[z2]->cl_output,m->cls[k2],error1);
-                        if(m->rls[z2]->cl_output->activation_flag == LEAKY_RELU)
-                            derivative_leaky_relu_array(m->rls[z2]->cl_output->pre_activation,m->rls[z2]->cl_output->temp3,m->rls[z2]->cl_output->n_kernels*m->rls[z2]->cl_output->rows1*m->rls[z2]->cl_output->cols1);
-                        else if(m->rls[z2]->cl_output->activation_flag == RELU)
-                            derivative_relu_array(m->rls[z2]->cl_output->pre_activation,m->rls[z2]->cl_output->temp3,m->rls[z2]->cl_output->n_kernels*m->rls[z2]->cl_output->rows1*m->rls[z2]->cl_output->cols1);
-                        else if(m->rls[z2]->cl_output->activation_flag == SIGMOID)
-                            derivative_sigmoid_array(m->rls[z2]->cl_output->pre_activation,m->rls[z2]->cl_output->temp3,m->rls[z2]->cl_output->n_kernels*m->rls[z2]->cl_output->rows1*m->rls[z2]->cl_output->cols1);
-                        else if(m->rls[z2]->cl_output->activation_flag == TANH)
-                            derivative_tanhh_array(m->rls[z2]->cl_output->pre_activation,m->rls[z2]->cl_output->temp3,m->rls[z2]->cl_output->n_kernels*m->rls[z2]->cl_output->rows1*m->rls[z2]->cl_output->cols1);
-                        if(m->rls[z2]->cl_output->activation_flag != NO_ACTIVATION)
-                            dot1D(m->rls[z2]->cl_output->temp3,error1,m->rls[z2]->cl_output->temp,m->rls[z2]->cl_output->n_kernels*m->rls[z2]->cl_output->rows1*m->rls[z2]->cl_output->cols1);
-                        else
-                            copy_array(error1,m->rls[z2]->cl_output->temp,m->rls[z2]->cl_output->n_kernels*m->rls[z2]->cl_output->rows1*m->rls[z2]->cl_output->cols1);
-                        error1 = m->rls[z2]->cl_output->temp;
-                        }
-                    
-                }
-                
-                else if(m->sla[i][j] == RLS){
-                    k3--;
-                    count = 0;
-                    for(z = 0; z < m->n_rl && count <= k3; z++){
-                        count+=m->rls[z]->n_cl;
-                    }
-                    
-                    
-                    z--;
-                    count-=m->rls[z]->n_cl;
-                    
-                    if(k3-count == m->rls[z]->n_cl-1){
-                        
-                        error_residual = error1;                    
-                        
-                    }
-                    
-                    if(m->rls[z]->cls[k3-count]->activation_flag == SOFTMAX){
-                        fprintf(stderr,"Error: the softmax can be applied only on the last fully-connected layers\n");
-                        exit(1);
-                    }
-                    
-                    
-                    if(m->sla[i-1][0] == FCLS){
-                        
-                    
-                        error1 = bp_fcl_cl(m->fcls[k1-1],m->rls[z]->cls[k3-count],error1);
-                       
-                        
-                        
-                    }
-                    
-                    else if(m->sla[i-1][0] == CLS){
-                        error1 = bp_cl_cl(m->cls[k2-1],m->rls[z]->cls[k3-count],error1);
-                       
-                        
-                    }
-                    
-                    if(m->sla[i-1][0] == RLS){
-                        count2 = 0;
-                        for(z2 = 0; z2 < m->n_rl && count2 <= k3-1; z2++){
-                            count2+=m->rls[z2]->n_cl;
-                        }
-                        
-                        z2--;
-                        count2-=m->rls[z2]->n_cl;
-                        if(z2 == z)
-                            error1 = bp_cl_cl(m->rls[z2]->cls[k3-1-count2],m->rls[z]->cls[k3-count],error1);
-                        else{
-                            error1 = bp_cl_cl(m->rls[z2]->cl_output,m->rls[z]->cls[k3-count],error1);
-                            if(m->rls[z2]->cl_output->activation_flag == LEAKY_RELU)
-                            derivative_leaky_relu_array(m->rls[z2]->cl_output->pre_activation,m->rls[z2]->cl_output->temp3,m->rls[z2]->cl_output->n_kernels*m->rls[z2]->cl_output->rows1*m->rls[z2]->cl_output->cols1);
-                            else if(m->rls[z2]->cl_output->activation_flag == RELU)
-                                derivative_relu_array(m->rls[z2]->cl_output->pre_activation,m->rls[z2]->cl_output->temp3,m->rls[z2]->cl_output->n_kernels*m->rls[z2]->cl_output->rows1*m->rls[z2]->cl_output->cols1);
-                            else if(m->rls[z2]->cl_output->activation_flag == SIGMOID)
-                                derivative_sigmoid_array(m->rls[z2]->cl_output->pre_activation,m->rls[z2]->cl_output->temp3,m->rls[z2]->cl_output->n_kernels*m->rls[z2]->cl_output->rows1*m->rls[z2]->cl_output->cols1);
-                            else if(m->rls[z2]->cl_output->activation_flag == TANH)
-                                derivative_tanhh_array(m->rls[z2]->cl_output->pre_activation,m->rls[z2]->cl_output->temp3,m->rls[z2]->cl_output->n_kernels*m->rls[z2]->cl_output->rows1*m->rls[z2]->cl_output->cols1);
-                            if(m->rls[z2]->cl_output->activation_flag != NO_ACTIVATION)
-                                dot1D(m->rls[z2]->cl_output->temp3,error1,m->rls[z2]->cl_output->temp,m->rls[z2]->cl_output->n_kernels*m->rls[z2]->cl_output->rows1*m->rls[z2]->cl_output->cols1);
-                            else
-                                copy_array(error1,m->rls[z2]->cl_output->temp,m->rls[z2]->cl_output->n_kernels*m->rls[z2]->cl_output->rows1*m->rls[z2]->cl_output->cols1);
-                            error1 = m->rls[z2]->cl_output->temp;
-                        }
-                        
-                        
-                    }
-                    
-                    
-                    
-                    if(k3-count == 0)
-                        sum1D(error1,error_residual,error1,m->rls[z]->channels*m->rls[z]->input_rows*m->rls[z]->input_cols);
-                    
-                    
-                    
-                    
-                }
-                
-            }
-            
+    for(i = 0; i < m->n_bp_steps; i++){
+        s = &m->bp_plan[i];
+        
+        if(s->sla == RLS && s->rl_last)
+            error_residual = error1;
+        
+        error1 = model_bp_step_layer(s,temp,error1);
+        error1 = model_bp_step_residual(s,error1,error_residual,1);
+    }
+
+    if(!bool_is_real(error1[0])){
+        fprintf(stderr,"Error: nan occurred, probably due to the exploiting gradient problem, or you just found a perfect function that match your data and you should not keep training\n");
+        exit(1);
+    }
+    return error1;
+}
+
+/* This function reallocates an activation array of a layer for batch_size instances stored one after the other,
+ * the current instance is kept as the first one. If batch_size > 1 the array is added to the batch views of the model
+ * 
+ * Input:
+ *             @ model* m:= the model
+ *             @ float** field:= the field of the layer
+ *             @ unsigned short** indices:= the field of the layer if the array holds pooling indices (field is NULL)
+ *             @ int size:= the size of each instance
+ *             @ int batch_size:= the number of instances
+ * 
+ * */
+static void model_batch_array(model* m, float** field, unsigned short** indices, int size, int batch_size){
+    batch_view* v;
+    if(size <= 0 || (field != NULL && *field == NULL) || (field == NULL && *indices == NULL))
+        return;
+    v = &m->batch_views[m->n_batch_views];
+    memset(v,0,sizeof(batch_view));
+    v->size = size;
+    if(field != NULL){
+        v->field = field;
+        v->base = (float*)calloc(batch_size*size,sizeof(float));
+        copy_array(*field,v->base,size);
+        free(*field);
+        *field = v->base;
+    }
+    else{
+        v->indices = indices;
+        v->indices_base = (unsigned short*)calloc(batch_size*size,sizeof(unsigned short));
+        memcpy(v->indices_base,*indices,sizeof(unsigned short)*size);
+        free(*indices);
+        *indices = v->indices_base;
+    }
+    if(batch_size > 1)
+        m->n_batch_views++;
+}
+
+/* This function reallocates the activation arrays of a convolutional layer for batch_size instances*/
+static void model_batch_cl(model* m, cl* c, int batch_size){
+    int size1 = c->n_kernels*c->rows1*c->cols1, size2 = c->n_kernels*c->rows2*c->cols2;
+    model_batch_array(m,&c->pre_activation,NULL,size1,batch_size);
+    model_batch_array(m,&c->post_activation,NULL,size1,batch_size);
+    model_batch_array(m,&c->post_normalization,NULL,size1,batch_size);
+    model_batch_array(m,&c->temp,NULL,size1,batch_size);
+    model_batch_array(m,&c->temp2,NULL,size1,batch_size);
+    model_batch_array(m,&c->temp3,NULL,size1,batch_size);
+    model_batch_array(m,&c->post_pooling,NULL,size2,batch_size);
+    model_batch_array(m,NULL,&c->pooling_indices,size2,batch_size);
+    model_batch_array(m,&c->error2,NULL,c->channels*c->input_rows*c->input_cols,batch_size);
+}
+
+/* This function resolves again the arrays read by the residual connections of all the steps of the plans*/
+static void model_plan_sources(model* m){
+    int i;
+    for(i = 0; i < m->n_ff_steps; i++){
+        model_step_sources(&m->ff_plan[i]);
+    }
+    for(i = 0; i < m->n_bp_steps; i++){
+        model_step_sources(&m->bp_plan[i]);
+    }
+}
+
+/* This function adds an activation array to the plan of the model, if the layer has that array
+ * 
+ * Input:
+ *             @ model* m:= the model
+ *             @ float** field:= the field of the layer
+ *             @ void* layer:= the layer
+ *             @ int output:= 1 if the array is read by the steps that take the layer as input
+ *             @ int size:= the size of each instance
+ *             @ int k:= the step that writes the array
+ * 
+ * */
+static void model_plan_array(model* m, float** field, void* layer, int output, int size, int k){
+    activation_array* a;
+    if(*field == NULL || size <= 0)
+        return;
+    a = &m->activation_arrays[m->n_activation_arrays];
+    a->field = field;
+    a->layer = layer;
+    a->output = output;
+    a->size = size;
+    a->first = k;
+    a->last = k;
+    a->buffer = -1;
+    m->n_activation_arrays++;
+}
+
+/* This function adds to the plan of the model the arrays written by a convolutional layer*/
+static void model_plan_cl(model* m, cl* c, int k){
+    int size1 = c->n_kernels*c->rows1*c->cols1, size2 = c->n_kernels*c->rows2*c->cols2;
+    float* output = cl_output_array(c);
+    model_plan_array(m,&c->pre_activation,c,c->pre_activation == output,size1,k);
+    if(c->activation_flag)
+        model_plan_array(m,&c->post_activation,c,c->post_activation == output,size1,k);
+    if(c->normalization_flag)
+        model_plan_array(m,&c->post_normalization,c,c->post_normalization == output,size1,k);
+    if(c->pooling_flag)
+        model_plan_array(m,&c->post_pooling,c,c->post_pooling == output,size2,k);
+}
+
+/* This function extends the life of the arrays of a layer until the step k*/
+static void model_plan_read(model* m, void* layer, int output_flag, int k){
+    int i;
+    for(i = 0; i < m->n_activation_arrays; i++){
+        if(m->activation_arrays[i].layer == layer && (m->activation_arrays[i].output || !output_flag))
+            m->activation_arrays[i].last = k;
+    }
+}
+
+/* This function makes the batch view of a field (if there is any) start from base*/
+static void model_batch_base(model* m, float** field, float* base){
+    int i;
+    for(i = 0; i < m->n_batch_views; i++){
+        if(m->batch_views[i].field == field)
+            m->batch_views[i].base = base;
+    }
+}
+
+/* This function gives back to the layers their own activation arrays and frees the buffers of the plan
+ * 
+ * Input:
+ *             @ model* m:= the model
+ * 
+ * */
+static void model_unplan_activations(model* m){
+    int i;
+    activation_array* a;
+    for(i = 0; i < m->n_activation_arrays; i++){
+        a = &m->activation_arrays[i];
+        *a->field = (float*)calloc(a->size*m->max_batch_size,sizeof(float));
+        model_batch_base(m,a->field,*a->field);
+    }
+    for(i = 0; i < m->n_activation_buffers; i++){
+        free(m->activation_buffers[i]);
+    }
+    free(m->activation_arrays);
+    free(m->activation_steps);
+    free(m->activation_buffers);
+    m->activation_arrays = NULL;
+    m->activation_steps = NULL;
+    m->activation_buffers = NULL;
+    m->n_activation_arrays = 0;
+    m->n_activation_buffers = 0;
+    model_plan_sources(m);
+}
+
+/* This function sets the maximum number of instances computed at once by model_tensor_input_ff_batch
+ * and model_tensor_input_bp_batch: the activation arrays of all the layers are reallocated for max_batch_size
+ * instances stored one after the other (the current activations are kept as the first instance)
+ * and the im2col and winograd buffers of the convolutional layers are allocated for max_batch_size instances
+ * (see set_convolutional_batch_size). The layers see the first instance at the beginning of their arrays,
+ * so the single instance functions of the model work as usual and the outputs of the last batch
+ * are stored one after the other in the arrays of the layers
+ * 
+ * Input:
+ *             @ model* m:= the model
+ *             @ int max_batch_size:= the maximum batch size, >= 1
+ * 
+ * */
+void set_model_max_batch_size(model* m, int max_batch_size){
+    if(m == NULL)
+        return;
+    if(max_batch_size < 1){
+        fprintf(stderr,"Error: the max batch size must be >= 1\n");
+        exit(1);
+    }
+    int i,j,n_views = 0,planned = m->n_activation_arrays > 0;
+    fcl* f;
+    
+    /* the planned arrays are reallocated as the others and then planned again*/
+    if(planned)
+        model_unplan_activations(m);
+    
+    for(i = 0; i < m->n_rl; i++){
+        n_views+=10*(m->rls[i]->n_cl+1)+1;
+    }
+    n_views+=10*m->n_cl+8*m->n_fcl;
+    
+    free(m->batch_views);
+    m->batch_views = (batch_view*)malloc(sizeof(batch_view)*n_views);
+    m->n_batch_views = 0;
+    m->max_batch_size = max_batch_size;
+    
+    for(i = 0; i < m->n_fcl; i++){
+        f = m->fcls[i];
+        model_batch_array(m,&f->pre_activation,NULL,f->output,max_batch_size);
+        model_batch_array(m,&f->post_activation,NULL,f->output,max_batch_size);
+        model_batch_array(m,&f->dropout_mask,NULL,f->output,max_batch_size);
+        model_batch_array(m,&f->dropout_temp,NULL,f->output,max_batch_size);
+        model_batch_array(m,&f->temp,NULL,f->output,max_batch_size);
+        model_batch_array(m,&f->temp3,NULL,f->output,max_batch_size);
+        model_batch_array(m,&f->temp2,NULL,f->input,max_batch_size);
+        model_batch_array(m,&f->error2,NULL,f->input,max_batch_size);
+    }
+    for(i = 0; i < m->n_cl; i++){
+        model_batch_cl(m,m->cls[i],max_batch_size);
+        set_convolutional_batch_size(m->cls[i],max_batch_size);
+    }
+    for(i = 0; i < m->n_rl; i++){
+        for(j = 0; j < m->rls[i]->n_cl; j++){
+            model_batch_cl(m,m->rls[i]->cls[j],max_batch_size);
+            set_convolutional_batch_size(m->rls[i]->cls[j],max_batch_size);
         }
+        model_batch_cl(m,m->rls[i]->cl_output,max_batch_size);
+        model_batch_array(m,&m->rls[i]->input,NULL,m->rls[i]->channels*m->rls[i]->input_rows*m->rls[i]->input_cols,max_batch_size);
     }
+    
+    model_plan_sources(m);
+    if(planned)
+        plan_model_activations(m);
+}
 
-    free(temp->post_activation);
-    free(temp);
+/* This function plans the memory of the activations of an inference only model (see inference_network).
+ * The arrays written by each step of the feed forward plan (pre activation, post activation, post normalization,
+ * post pooling of the layers, the input and the output of the residual layers) are alive from their step
+ * to the last step that reads them (the residual input until the end of its residual layer, the arrays of the last
+ * row of sla until the end). The arrays that are not alive at the same time share the same buffer,
+ * so the buffers work as ping-pong buffers and the activation memory of the model is about the one
+ * of the largest adjacent layers instead of the sum of all the layers.
+ * After the feed forward only the arrays of the layers of the last row of sla hold their outputs,
+ * the other activation arrays of the layers can hold the outputs of other layers.
+ * The plan is kept by set_model_max_batch_size
+ * 
+ * Input:
+ *             @ model* m:= the model
+ * 
+ * */
+void plan_model_activations(model* m){
+    if(m == NULL)
+        return;
+    if(!m->inference_only_flag){
+        fprintf(stderr,"Error: the activations can be planned only for a model built for inference only\n");
+        exit(1);
+    }
+    if(m->n_activation_arrays)
+        model_unplan_activations(m);
+    
+    int i,j,k,n = 2*m->n_fcl,last_row = 0,best;
+    int* buffer_size;
+    int* buffer_last;
+    model_step* s;
+    activation_array* a;
+    
+    for(i = 0; i < m->n_rl; i++){
+        n+=4*m->rls[i]->n_cl+3;
+    }
+    n+=4*m->n_cl;
+    m->activation_arrays = (activation_array*)malloc(sizeof(activation_array)*(n > 0 ? n : 1));
+    m->activation_steps = (int*)malloc(sizeof(int)*(m->n_ff_steps+1));
+    
+    /* the first step of the last row of sla*/
+    for(i = 0, k = 0; i < m->layers; i++){
+        if(m->sla[i][0] != 0)
+            last_row = k;
+        for(j = 0; j < m->layers && m->sla[i][j] != 0; j++, k++);
+    }
+    
+    for(k = 0; k < m->n_ff_steps; k++){
+        s = &m->ff_plan[k];
+        m->activation_steps[k] = m->n_activation_arrays;
+        
+        /* the input of the step*/
+        if(s->input_flag == FCLS)
+            model_plan_read(m,s->in_f,1,k);
+        else if(s->input_flag == CLS)
+            model_plan_read(m,s->in_c,1,k);
+        
+        if(s->sla == FCLS){
+            model_plan_array(m,&s->f->pre_activation,s->f,1,s->f->output,k);
+            model_plan_array(m,&s->f->post_activation,s->f,1,s->f->output,k);
+            continue;
+        }
+        if(s->sla == RLS && s->rl_first)
+            model_plan_array(m,&s->r->input,s->r,0,s->rl_size,k);
+        model_plan_cl(m,s->c,k);
+        if(s->sla == RLS && s->rl_last){
+            model_plan_read(m,s->r,0,k);
+            model_plan_array(m,&s->r->cl_output->pre_activation,s->r->cl_output,1,s->rl_size,k);
+            model_plan_array(m,&s->r->cl_output->post_activation,s->r->cl_output,1,s->rl_size,k);
+        }
+    }
+    m->activation_steps[m->n_ff_steps] = m->n_activation_arrays;
+    for(i = 0; i < m->n_activation_arrays; i++){
+        if(m->activation_arrays[i].first >= last_row)
+            m->activation_arrays[i].last = m->n_ff_steps;
+    }
+    
+    /* each array takes a buffer free before its step: the smallest one that fits it, or the largest one*/
+    buffer_size = (int*)calloc(m->n_activation_arrays+1,sizeof(int));
+    buffer_last = (int*)calloc(m->n_activation_arrays+1,sizeof(int));
+    for(i = 0; i < m->n_activation_arrays; i++){
+        a = &m->activation_arrays[i];
+        best = -1;
+        for(j = 0; j < m->n_activation_buffers; j++){
+            if(buffer_last[j] >= a->first)
+                continue;
+            if(best == -1)
+                best = j;
+            else if(buffer_size[best] >= a->size)
+                best = buffer_size[j] >= a->size && buffer_size[j] < buffer_size[best] ? j : best;
+            else if(buffer_size[j] > buffer_size[best])
+                best = j;
+        }
+        if(best == -1){
+            best = m->n_activation_buffers;
+            m->n_activation_buffers++;
+        }
+        if(a->size > buffer_size[best])
+            buffer_size[best] = a->size;
+        buffer_last[best] = a->last;
+        a->buffer = best;
+    }
+    
+    m->activation_buffers = (float**)malloc(sizeof(float*)*(m->n_activation_buffers > 0 ? m->n_activation_buffers : 1));
+    for(i = 0; i < m->n_activation_buffers; i++){
+        m->activation_buffers[i] = (float*)calloc(buffer_size[i]*m->max_batch_size,sizeof(float));
+    }
+    for(i = 0; i < m->n_activation_arrays; i++){
+        a = &m->activation_arrays[i];
+        free(*a->field);
+        *a->field = m->activation_buffers[a->buffer];
+        model_batch_base(m,a->field,*a->field);
+    }
+    free(buffer_size);
+    free(buffer_last);
+    model_plan_sources(m);
+}
+
+/* This function returns the input of the layer of a step of the plan for a batch of instances
+ * (the output of the previous layer, the input tensors or the output of the previous layer with its dropout)
+ * 
+ * Input:
+ *             @ model_step* s:= the step
+ *             @ int batch_size:= the number of instances
+ *             @ float* inputs:= the input tensors of the instances one after the other
+ *             @ int bp_flag:= 1 if the input is used for the back propagation (the dropout is applied with the mask also in test)
+ * 
+ * */
+static float* model_batch_input(model_step* s, int batch_size, float* inputs, int bp_flag){
+    fcl* f1;
+    float* input;
+    float* temp2;
+    int size;
+    
+    if(s->input_flag == CLS)
+        return cl_output_array(s->in_c);
+    if(s->input_flag != FCLS)
+        return inputs;
+    
+    f1 = s->in_f;
+    input = f1->activation_flag ? f1->post_activation : f1->pre_activation;
+    temp2 = s->sla == FCLS ? s->f->temp2 : s->c->temp2;
+    size = f1->output*batch_size;
+    if(bp_flag){
+        if(f1->dropout_flag){
+            dot1D(input,f1->dropout_mask,temp2,size);
+            input = temp2;
+        }
+    }
+    else if(f1->dropout_flag == DROPOUT){
+        get_dropout_array(size,f1->dropout_mask,input,f1->dropout_temp);
+        input = f1->dropout_temp;
+    }
+    else if(f1->dropout_flag == DROPOUT_TEST){
+        mul_value(input,f1->dropout_threshold,f1->dropout_temp,size);
+        input = f1->dropout_temp;
+    }
+    return input;
+}
+
+/* This function returns the size of the input of each instance of the layer of a step of the plan*/
+static int model_batch_input_size(model_step* s, int input_size){
+    if(s->input_flag == FCLS)
+        return s->in_f->output;
+    else if(s->input_flag == CLS)
+        return s->in_c->pooling_flag ? s->in_c->n_kernels*s->in_c->rows2*s->in_c->cols2 : s->in_c->n_kernels*s->in_c->rows1*s->in_c->cols1;
+    return input_size;
+}
+
+/* This function computes the feed forward of a fully-connected layer of the plan
+ * for a batch of instances with a single sgemm
+ * 
+ * Input:
+ *             @ model_step* s:= the step of the fully-connected layer
+ *             @ int batch_size:= the number of instances
+ *             @ float* inputs:= the input tensors of the instances one after the other
+ *             @ int input_size:= the size of each input tensor
+ * 
+ * */
+static void model_ff_fcl_batch(model_step* s, int batch_size, float* inputs, int input_size){
+    fcl* f = s->f;
+    int size = model_batch_input_size(s,input_size);
+    
+    if(size != f->input){
+        fprintf(stderr,"Error: the sizes between the input of a fully-connected layer and the layer don't match, layer: %d, input: %d, layer input: %d\n",f->layer,size,f->input);
+        exit(1);
+    }
+    
+    fully_connected_feed_forward_batch(model_batch_input(s,batch_size,inputs,0),f->pre_activation,f->weights,f->biases,f->input,f->output,batch_size);
+    ff_fcl_activation(f,batch_size);
+}
+
+/* This function computes the feed forward of a convolutional layer of the plan (and of the residual connections
+ * of its step) for a batch of instances: the convolution computes all the instances with the same sgemm
+ * (see convolutional_layer_feed_forward_batch), the activation, normalization, pooling and the residual sums
+ * are computed over the arrays of the instances one after the other
+ * 
+ * Input:
+ *             @ model_step* s:= the step of the convolutional layer
+ *             @ int batch_size:= the number of instances
+ *             @ float* inputs:= the input tensors of the instances one after the other
+ *             @ int input_size:= the size of each input tensor
+ * 
+ * */
+static void model_ff_cl_batch(model_step* s, int batch_size, float* inputs, int input_size){
+    cl* c = s->c;
+    int size = model_batch_input_size(s,input_size);
+    float* input;
+    float* source;
+    
+    if(size != c->channels*c->input_rows*c->input_cols){
+        fprintf(stderr,"Error: the sizes between the input of a convolutional layer and the layer don't match, layer: %d, input: %d, layer input: %d\n",c->layer,size,c->channels*c->input_rows*c->input_cols);
+        exit(1);
+    }
+    
+    if(s->sla == RLS && s->rl_first){
+        source = s->rl_copy_source != NULL ? s->rl_copy_source : inputs;
+        if(s->rl_copy_dropout != NULL && s->rl_copy_dropout->dropout_flag)
+            dot1D(source,s->rl_copy_dropout->dropout_mask,s->r->input,s->rl_size*batch_size);
+        else
+            copy_array(source,s->r->input,s->rl_size*batch_size);
+    }
+    
+    input = model_batch_input(s,batch_size,inputs,0);
+    if(c->convolutional_flag == CONVOLUTION){
+        convolutional_layer_feed_forward_batch(c,input,batch_size);
+        ff_cl_output(c,NULL,batch_size);
+    }
+    else
+        ff_cl_output(c,input,batch_size);
+    
+    if(s->sla == RLS && s->rl_last){
+        sum1D(s->r->input,s->rl_sum_source,s->r->cl_output->pre_activation,s->rl_size*batch_size);
+        if(s->rl_activation != NULL)
+            (*s->rl_activation)(s->r->cl_output->pre_activation,s->r->cl_output->post_activation,s->r->cl_output->n_kernels*s->r->cl_output->rows1*s->r->cl_output->cols1*batch_size);
+    }
+}
+
+/* This function computes the back propagation of a fully-connected layer of the plan
+ * for a batch of instances with a single sgemm and returns the errors of the input of the instances one after the other
+ * 
+ * Input:
+ *             @ model_step* s:= the step of the fully-connected layer
+ *             @ int batch_size:= the number of instances
+ *             @ float* inputs:= the input tensors of the instances one after the other
+ *             @ float* error:= the errors of the output of the instances one after the other
+ * 
+ * */
+static float* model_bp_fcl_batch(model_step* s, int batch_size, float* inputs, float* error){
+    fcl* f = s->f;
+    bp_fcl_error(f,error,batch_size);
+    fully_connected_back_prop_batch(model_batch_input(s,batch_size,inputs,1),f->temp,f->weights,f->error2,f->d_weights,f->d_biases,f->input,f->output,batch_size);
+    return f->error2;
+}
+
+/* This function computes the back propagation of a convolutional layer of the plan for a batch of instances
+ * (the errors of the kernels of all the instances are computed with the same sgemm, see convolutional_layer_back_prop_batch)
+ * and returns the errors of the input of the instances one after the other
+ * 
+ * Input:
+ *             @ model_step* s:= the step of the convolutional layer
+ *             @ int batch_size:= the number of instances
+ *             @ float* inputs:= the input tensors of the instances one after the other
+ *             @ float* error:= the errors of the output of the instances one after the other
+ * 
+ * */
+static float* model_bp_cl_batch(model_step* s, int batch_size, float* inputs, float* error){
+    cl* c = s->c;
+    bp_cl_error(c,error,batch_size);
+    if(c->convolutional_flag != CONVOLUTION)
+        return c->temp;
+    convolutional_layer_back_prop_batch(c,model_batch_input(s,batch_size,inputs,1),c->temp,batch_size);
+    return c->error2;
+}
+
+/* This function resets the activation arrays of the first batch_size instances of the layers of the model
+ * as reset_model_except_partial_derivatives: the first instance is reset and copied to the others
+ * 
+ * Input:
+ *             @ model* m:= the model
+ *             @ int batch_size:= the number of instances
+ * 
+ * */
+static void model_batch_reset(model* m, int batch_size){
+    int i,b;
+    batch_view* v;
+    reset_model_except_partial_derivatives(m);
+    for(i = 0; i < m->n_batch_views; i++){
+        v = &m->batch_views[i];
+        if(v->field == NULL)
+            continue;
+        for(b = 1; b < batch_size; b++){
+            copy_array(v->base,&v->base[b*v->size],v->size);
+        }
+    }
+}
+
+/* This function computes the feed-forward for a batch of instances, as model_tensor_input_ff.
+ * Each step of the plan computes all the instances at once: the fully-connected layers with a single sgemm,
+ * the convolutional layers with the same sgemm for the im2col and winograd algorithms (the inputs of the instances
+ * are lowered side by side), the other functions of the layers and the residual connections over the arrays
+ * of the instances one after the other. The activations of the layers are reset before the feed forward,
+ * the outputs of the instances are stored one after the other in the arrays of the layers (for example
+ * the outputs of the last fully-connected layer f are f->post_activation[b*f->output + i]).
+ * With the planned activations the arrays of each step are reset before the step
+ * (the buffers of the arrays that are not alive at the same time overlap)
+ * 
+ * Input:
+ *             
+ *             @ model* m:= the model with the layers
+ *             @ int batch_size:= the number of instances, 1 <= batch_size <= m->max_batch_size (see set_model_max_batch_size)
+ *             @ int tensor_depth:= the depth of each input tensor
+ *             @ int tensor_i:= the number of rows of each tensor
+ *             @ int tensor_j:= the number of columns of each tensor
+ *             @ float* inputs:= the input tensors one after the other, dimensions: batch_size*tensor_depth*tensor_i*tensor_j
+ * 
+ * */
+void model_tensor_input_ff_batch(model* m, int batch_size, int tensor_depth, int tensor_i, int tensor_j, float* inputs){
+    if(m == NULL)
+        return;
+    if(batch_size < 1 || batch_size > m->max_batch_size){
+        fprintf(stderr,"Error: the batch size must be between 1 and the max batch size of the model (%d)\n",m->max_batch_size);
+        exit(1);
+    }
+    
+    int i,size = tensor_depth*tensor_i*tensor_j;
+    
+    model_batch_reset(m,batch_size);
+    model_context_check(m);
+    
+    for(i = 0; i < m->n_ff_steps; i++){
+        if(m->n_activation_arrays)
+            model_reset_step(m,i,batch_size);
+        if(m->ff_plan[i].sla == FCLS)
+            model_ff_fcl_batch(&m->ff_plan[i],batch_size,inputs,size);
+        else
+            model_ff_cl_batch(&m->ff_plan[i],batch_size,inputs,size);
+    }
+}
+
+/* This function computes the back-propagation for a batch of instances, as model_tensor_input_bp,
+ * after model_tensor_input_ff_batch has been called with the same inputs.
+ * Each step of the plan computes all the instances at once (see model_tensor_input_ff_batch),
+ * the partial derivatives of the weights, kernels and biases are summed over the instances,
+ * so they are ready for update_model as after the single back propagation of each instance.
+ * 
+ * Input:
+ *             
+ *             @ model* m:= the model with the layers
+ *             @ int batch_size:= the number of instances, 1 <= batch_size <= m->max_batch_size (see set_model_max_batch_size)
+ *             @ int tensor_depth:= the depth of each input tensor
+ *             @ int tensor_i:= the number of rows of each tensor
+ *             @ int tensor_j:= the number of columns of each tensor
+ *             @ float* inputs:= the input tensors one after the other, dimensions: batch_size*tensor_depth*tensor_i*tensor_j
+ *             @ float* errors:= the errors of the last layer of the instances one after the other, dimensions: batch_size*error_dimension
+ *             @ int error_dimension:= the dimension of the error of each instance, the output size of the last layer if batch_size > 1
+ * 
+ * Output:
+ *             the errors of the input tensors one after the other, dimensions: batch_size*tensor_depth*tensor_i*tensor_j
+ * 
+ * */
+float* model_tensor_input_bp_batch(model* m, int batch_size, int tensor_depth, int tensor_i, int tensor_j, float* inputs, float* errors, int error_dimension){
+    if(m == NULL)
+        return NULL;
+    model_training_check(m,"model_tensor_input_bp_batch");
+    if(batch_size < 1 || batch_size > m->max_batch_size){
+        fprintf(stderr,"Error: the batch size must be between 1 and the max batch size of the model (%d)\n",m->max_batch_size);
+        exit(1);
+    }
+    
+    int i,output_size;
+    model_step* s = &m->bp_plan[0];
+    float* error1 = errors;
+    float* error_residual = NULL;
+    
+    /* the errors of the instances are read one after the other by the layers*/
+    if(s->sla == FCLS)
+        output_size = s->f->output;
+    else
+        output_size = s->c->pooling_flag ? s->c->n_kernels*s->c->rows2*s->c->cols2 : s->c->n_kernels*s->c->rows1*s->c->cols1;
+    if(batch_size > 1 && error_dimension != output_size){
+        fprintf(stderr,"Error: the dimension of the errors of the instances must be the output size of the last layer, error dimension: %d, output size: %d\n",error_dimension,output_size);
+        exit(1);
+    }
+    
+    for(i = 0; i < m->n_bp_steps; i++){
+        s = &m->bp_plan[i];
+        if(s->sla == RLS && s->rl_last)
+            error_residual = error1;
+        if(s->sla == FCLS)
+            error1 = model_bp_fcl_batch(s,batch_size,inputs,error1);
+        else
+            error1 = model_bp_cl_batch(s,batch_size,inputs,error1);
+        error1 = model_bp_step_residual(s,error1,error_residual,batch_size);
+    }
+    
     if(!bool_is_real(error1[0])){
         fprintf(stderr,"Error: nan occurred, probably due to the exploiting gradient problem, or you just found a perfect function that match your data and you should not keep training\n");
         exit(1);
@@ -2176,9 +2892,15 @@ int count_weights(model* m){
 void update_model(model* m, float lr, float momentum, int mini_batch_size, int gradient_descent_flag, float* b1, float* b2, int regularization, int total_number_weights, float lambda){
     if(m == NULL)
         return;
+    model_training_check(m,"update_model");
     
     lambda*=mini_batch_size;
     
+    if(m->arena != NULL){
+        model_arena_update(m,lr,momentum,mini_batch_size,gradient_descent_flag,b1,b2,1,regularization == L2_REGULARIZATION ? lambda/(float)total_number_weights : 0);
+        return;
+    }
+    
     if(regularization == L2_REGULARIZATION){
         add_l2_residual_layer(m,total_number_weights,lambda);
         add_l2_convolutional_layer(m,total_number_weights,lambda);
@@ -2217,7 +2939,118 @@ void sum_model_partial_derivatives(model* m, model* m2, model* m3){
         fprintf(stderr,"Error: passed NULL pointer as values in sum_model_partial_derivatives\n");
         exit(1);
     }
+    model_training_check(m,"sum_model_partial_derivatives");
+    model_training_check(m2,"sum_model_partial_derivatives");
+    model_training_check(m3,"sum_model_partial_derivatives");
+    if(same_model_arena(m,m2) && same_model_arena(m,m3)){
+        sum1D(m->arena[1],m2->arena[1],m3->arena[1],m->arena_size);
+        return;
+    }
     sum_fully_connected_layers_partial_derivatives(m,m2,m3);
     sum_convolutional_layers_partial_derivatives(m,m2,m3);
     sum_residual_layers_partial_derivatives(m,m2,m3);
 }
+
+/* This function sums the partial derivatives in model m1 and m2 in m3 like sum_model_partial_derivatives
+ * and in the same pass computes the squared norm of the partial derivatives of the weights of m3,
+ * so update_model_fused can clip them without reading them again
+ * 
+ * Input:
+ *     
+ *             @ model* m:= first input model
+ *             @ model* m2:= second input model
+ *             @ model* m3:= output model
+ * 
+ * returns ||DL/Dw||^2 of m3
+ * */
+float sum_model_partial_derivatives_with_norm(model* m, model* m2, model* m3){
+    if(m == NULL || m2 == NULL || m3 == NULL){
+        fprintf(stderr,"Error: passed NULL pointer as values in sum_model_partial_derivatives_with_norm\n");
+        exit(1);
+    }
+    model_training_check(m,"sum_model_partial_derivatives_with_norm");
+    model_training_check(m2,"sum_model_partial_derivatives_with_norm");
+    model_training_check(m3,"sum_model_partial_derivatives_with_norm");
+    if(same_model_arena(m,m2) && same_model_arena(m,m3)){
+        float sum = sum1D_sum_squares(m->arena[1],m2->arena[1],m3->arena[1],m->arena_weights);
+        sum1D(&m->arena[1][m->arena_weights],&m2->arena[1][m->arena_weights],&m3->arena[1][m->arena_weights],m->arena_size-m->arena_weights);
+        return sum;
+    }
+    sum_model_partial_derivatives(m,m2,m3);
+    return sum_all_quadratic_derivative_weights_model(m3);
+}
+
+/* This function updates the model like update_model but the l2 regularization, the gradient clipping
+ * (see clipping_gradient) and the nesterov or adam step are applied in a single pass over the parameters
+ * of the arena (the models without arena are clipped, regularized and updated in separate passes).
+ * The squared norm of the partial derivatives of the weights must be already known: it is returned
+ * by sum_model_partial_derivatives_with_norm in the pass that merges the partial derivatives of 2 models,
+ * for a single model it is returned by sum_all_quadratic_derivative_weights_model, that reads
+ * the partial derivatives once more (the back propagation doesn't compute it)
+ * 
+ * Input:
+ * 
+ *             @ model* m:= the model that must be update
+ *             @ float lr:= the learning rate
+ *             @ float momentum:= the momentum
+ *             @ int mini_batch_size:= the batch used
+ *             @ int gradient_descent_flag:= NESTEROV or ADAM (1,2)
+ *             @ float* b1:= the hyper parameter b1 of adam algorithm
+ *             @ float* b2:= the hyper parameter b2 of adam algorithm
+ *             @ int regularization:= NO_REGULARIZATION or L2 (0,1)
+ *             @ int total_number_weights:= the number of total weights of the network (for l2 regularization)
+ *             @ float lambda:= a float value for l2 regularization
+ *             @ float threshold:= the clipping threshold, if ||DL/Dw|| >= threshold DL/Dw_i *= threshold/||DL/Dw||, 0 for no clipping
+ *             @ float squared_norm:= ||DL/Dw||^2
+ * 
+ * */
+void update_model_fused(model* m, float lr, float momentum, int mini_batch_size, int gradient_descent_flag, float* b1, float* b2, int regularization, int total_number_weights, float lambda, float threshold, float squared_norm){
+    if(m == NULL)
+        return;
+    model_training_check(m,"update_model_fused");
+    
+    float norm = sqrtf(squared_norm);
+    float gradient_scale = 1;
+    if(threshold > 0 && norm >= threshold)
+        gradient_scale = threshold/norm;
+    
+    if(m->arena == NULL){
+        if(gradient_scale != 1){
+            clip_fcls(m->fcls, m->n_fcl, threshold, norm);
+            clip_cls(m->cls, m->n_cl, threshold, norm);
+            clip_rls(m->rls, m->n_rl, threshold, norm);
+        }
+        update_model(m,lr,momentum,mini_batch_size,gradient_descent_flag,b1,b2,regularization,total_number_weights,lambda);
+        return;
+    }
+    
+    lambda*=mini_batch_size;
+    model_arena_update(m,lr,momentum,mini_batch_size,gradient_descent_flag,b1,b2,gradient_scale,regularization == L2_REGULARIZATION ? lambda/(float)total_number_weights : 0);
+}
+
+/* This function sets the training or inference mode of all the convolutional layers of the model
+ * (see set_convolutional_mode)
+ * 
+ * Input:
+ *             @ model* m:= the model
+ *             @ int mode_flag:= TRAINING_MODE or INFERENCE_MODE
+ * */
+void set_model_mode(model* m, int mode_flag){
+    int i,j,max_batch_size = m->max_batch_size;
+    if(mode_flag == TRAINING_MODE)
+        model_training_check(m,"the training mode");
+    
+    /* the pooling indices are freed or allocated for a single instance*/
+    if(max_batch_size > 1)
+        set_model_max_batch_size(m,1);
+    for(i = 0; i < m->n_rl; i++){
+        for(j = 0; j < m->rls[i]->n_cl; j++){
+            set_convolutional_mode(m->rls[i]->cls[j],mode_flag);
+        }
+    }
+    for(i = 0; i < m->n_cl; i++){
+        set_convolutional_mode(m->cls[i],mode_flag);
+    }
+    if(max_batch_size > 1)
+        set_model_max_batch_size(m,max_batch_size);
+}
@@ -96,6 +96,177 @@ void local_response_normalization_back_prop(float* tensor,float* tensor_error,fl
     }
 }
 
+/* This function computes scale = norm^(-beta). The usual beta = 0.75 is computed
+ * with 2 square roots instead of pow, so the loop can be vectorized
+ * (normalization.c is compiled with -fno-math-errno for the vector square root)*/
+ISA_INLINE void local_response_normalization_scale(float* norm, float* scale, int n, float beta){
+    int x;
+    float s;
+    if(beta == 0.75f){
+        for(x = 0; x < n; x++){
+            s = sqrtf(norm[x]);
+            scale[x] = 1.0f/(s*sqrtf(s));
+        }
+    }
+    else{
+        for(x = 0; x < n; x++){
+            scale[x] = powf(norm[x],-beta);
+        }
+    }
+}
+
+/* This function adds (sign = 1) or subtracts (sign = -1) the squares of a row of a feature map to the running sum*/
+ISA_INLINE void local_response_normalization_sum_squares(float* sum, float* row, int n, float sign){
+    int x;
+    for(x = 0; x < n; x++){
+        sum[x] += sign*row[x]*row[x];
+    }
+}
+
+ /* This function computes the local response normalization of a whole tensor (except for the padding):
+  * each row is split in blocks of LOCAL_RESPONSE_NORMALIZATION_BLOCK columns and the sum of squares
+  * over the n_constant neighbouring channels is kept as a running sum while moving across the channels
+  * 
+  * Input:
+  *           @ float* tensor:= is the tensor of feature map of the convolutional layer
+  *                                 dimensions: tensor_depth*tensor_i*tensor_j
+  *           @ float* output:= is the tensor of the output, or is the "tensor" normalized
+  *                                 dimensions: tensor_depth*tensor_i*tensor_j
+  *           @ int tensor_depth:= is the number of the channels of tensor and output
+  *           @ int tensor_i:= is the number of rows of each feature map of tensor and output
+  *           @ int tensor_j:= is the number of columns of each feature map of tensor and output
+  *           @ int padding:= the padding of the feature maps, that is not normalized
+  *           @ float n_constant:= is an hyper parameter (usually 5)
+  *           @ float beta:= is an hyper parameter (usually 0.75)
+  *           @ float alpha:= is an hyper parameter (usually 0.0001)
+  *           @ float k:= is an hyper parameter(usually 2)
+  * */
+ISA_INLINE void local_response_normalization_feed_forward_tensor_kernel(float* tensor, float* output, int tensor_depth, int tensor_i, int tensor_j, int padding, float n_constant, float beta, float alpha, float k){
+    int c,x,y,x0,n,base;
+    int half = (int)(n_constant/2);
+    int plane = tensor_i*tensor_j;
+    float sum[LOCAL_RESPONSE_NORMALIZATION_BLOCK], norm[LOCAL_RESPONSE_NORMALIZATION_BLOCK], scale[LOCAL_RESPONSE_NORMALIZATION_BLOCK];
+    float* in;
+    float* out;
+    
+    for(y = padding; y < tensor_i-padding; y++){
+        for(x0 = padding; x0 < tensor_j-padding; x0+=LOCAL_RESPONSE_NORMALIZATION_BLOCK){
+            n = tensor_j-padding-x0 < LOCAL_RESPONSE_NORMALIZATION_BLOCK ? tensor_j-padding-x0 : LOCAL_RESPONSE_NORMALIZATION_BLOCK;
+            base = y*tensor_j + x0;
+            memset(sum,0,sizeof(float)*n);
+            for(c = 0; c <= half && c < tensor_depth; c++){
+                local_response_normalization_sum_squares(sum,&tensor[c*plane+base],n,1);
+            }
+            
+            for(c = 0; c < tensor_depth; c++){
+                in = &tensor[c*plane+base];
+                out = &output[c*plane+base];
+                for(x = 0; x < n; x++){
+                    norm[x] = k + alpha*sum[x];
+                }
+                local_response_normalization_scale(norm,scale,n,beta);
+                for(x = 0; x < n; x++){
+                    out[x] = in[x]*scale[x];
+                }
+                if(c+half+1 < tensor_depth)
+                    local_response_normalization_sum_squares(sum,&tensor[(c+half+1)*plane+base],n,1);
+                if(c-half >= 0)
+                    local_response_normalization_sum_squares(sum,&tensor[(c-half)*plane+base],n,-1);
+            }
+        }
+    }
+}
+
+ISA_DISPATCH(, local_response_normalization_feed_forward_tensor, (float* tensor, float* output, int tensor_depth, int tensor_i, int tensor_j, int padding, float n_constant, float beta, float alpha, float k), (tensor,output,tensor_depth,tensor_i,tensor_j,padding,n_constant,beta,alpha,k))
+
+ /* This function computes the backpropagation of the local response normalization of a whole tensor (except for the padding).
+  * With y_c = x_c*S_c^(-beta), S_c = k + alpha*sum of x_a^2 over the window of c, the error of x_c is:
+  * dx_c = dy_c*S_c^(-beta) - 2*alpha*beta*x_c * sum of dy_a*y_a/S_a over the window of c
+  * both the sums are computed as running sums across the channels
+  * 
+  * Input:
+  *           @ float* tensor:= is the tensor of feature map of the convolutional layer
+  *                                 dimensions: tensor_depth*tensor_i*tensor_j
+  *           @ float* tensor_error:= is the error of the tensor of feature map of the convolutional layer, the errors are summed to it
+  *                                 dimensions: tensor_depth*tensor_i*tensor_j
+  *           @ float* output_error:= is the tensor of the error of the output
+  *                                 dimensions: tensor_depth*tensor_i*tensor_j
+  *           @ int tensor_depth:= is the number of the channels of tensor and output
+  *           @ int tensor_i:= is the number of rows of each feature map of tensor and output
+  *           @ int tensor_j:= is the number of columns of each feature map of tensor and output
+  *           @ int padding:= the padding of the feature maps, that is not normalized
+  *           @ float n_constant:= is an hyper parameter (usually 5)
+  *           @ float beta:= is an hyper parameter (usually 0.75)
+  *           @ float alpha:= is an hyper parameter (usually 0.0001)
+  *           @ float k:= is an hyper parameter(usually 2)
+  *           @ float* temp:= a temporary tensor
+  *                                 dimensions: tensor_depth*tensor_i*tensor_j
+  * */
+ISA_INLINE void local_response_normalization_back_prop_tensor_kernel(float* tensor, float* tensor_error, float* output_error, int tensor_depth, int tensor_i, int tensor_j, int padding, float n_constant, float beta, float alpha, float k, float* temp){
+    int c,x,y,x0,n,base;
+    int half = (int)(n_constant/2);
+    int plane = tensor_i*tensor_j;
+    float sum[LOCAL_RESPONSE_NORMALIZATION_BLOCK], norm[LOCAL_RESPONSE_NORMALIZATION_BLOCK], scale[LOCAL_RESPONSE_NORMALIZATION_BLOCK];
+    float* in;
+    float* in_error;
+    float* out_error;
+    float* r;
+    
+    for(y = padding; y < tensor_i-padding; y++){
+        for(x0 = padding; x0 < tensor_j-padding; x0+=LOCAL_RESPONSE_NORMALIZATION_BLOCK){
+            n = tensor_j-padding-x0 < LOCAL_RESPONSE_NORMALIZATION_BLOCK ? tensor_j-padding-x0 : LOCAL_RESPONSE_NORMALIZATION_BLOCK;
+            base = y*tensor_j + x0;
+            
+            /* first pass: dy_c*S_c^(-beta) and r_c = dy_c*y_c/S_c*/
+            memset(sum,0,sizeof(float)*n);
+            for(c = 0; c <= half && c < tensor_depth; c++){
+                local_response_normalization_sum_squares(sum,&tensor[c*plane+base],n,1);
+            }
+            for(c = 0; c < tensor_depth; c++){
+                in = &tensor[c*plane+base];
+                in_error = &tensor_error[c*plane+base];
+                out_error = &output_error[c*plane+base];
+                r = &temp[c*plane+base];
+                for(x = 0; x < n; x++){
+                    norm[x] = k + alpha*sum[x];
+                }
+                local_response_normalization_scale(norm,scale,n,beta);
+                for(x = 0; x < n; x++){
+                    in_error[x] += out_error[x]*scale[x];
+                    r[x] = out_error[x]*in[x]*scale[x]/norm[x];
+                }
+                if(c+half+1 < tensor_depth)
+                    local_response_normalization_sum_squares(sum,&tensor[(c+half+1)*plane+base],n,1);
+                if(c-half >= 0)
+                    local_response_normalization_sum_squares(sum,&tensor[(c-half)*plane+base],n,-1);
+            }
+            
+            /* second pass: - 2*alpha*beta*x_c * sum of r_a over the window*/
+            memset(sum,0,sizeof(float)*n);
+            for(c = 0; c <= half && c < tensor_depth; c++){
+                sum1D(sum,&temp[c*plane+base],sum,n);
+            }
+            for(c = 0; c < tensor_depth; c++){
+                in = &tensor[c*plane+base];
+                in_error = &tensor_error[c*plane+base];
+                for(x = 0; x < n; x++){
+                    in_error[x] -= 2*alpha*beta*in[x]*sum[x];
+                }
+                if(c+half+1 < tensor_depth)
+                    sum1D(sum,&temp[(c+half+1)*plane+base],sum,n);
+                if(c-half >= 0){
+                    r = &temp[(c-half)*plane+base];
+                    for(x = 0; x < n; x++){
+                        sum[x] -= r[x];
+                    }
+                }
+            }
+        }
+    }
+}
+
+ISA_DISPATCH(, local_response_normalization_back_prop_tensor, (float* tensor, float* tensor_error, float* output_error, int tensor_depth, int tensor_i, int tensor_j, int padding, float n_constant, float beta, float alpha, float k, float* temp), (tensor,tensor_error,output_error,tensor_depth,tensor_i,tensor_j,padding,n_constant,beta,alpha,k,temp))
+
 
 /* This computes the batch normalization across batches
  * 
@@ -109,95 +280,167 @@ void local_response_normalization_back_prop(float* tensor,float* tensor_error,fl
  *             @ float* beta:= other params that we must learn
  *             @ float* mean:= a vector initialized with all 0s where we store the mean
  *             @ float* var:= a vector initialized with all 0s where we store the variance
+ *             @ float* inv_std:= where we store 1/sqrt(var+epsilon), used again by the backpropagation
  *             @ float** outputs:= where we store the outputs coming from this normalization
  *             @ float epsilon:= a param that let us to avoid division by 0
  * 
  * */
-void batch_normalization_feed_forward(int batch_size, float** input_vectors,float** temp_vectors, int size_vectors, float* gamma, float* beta, float* mean, float* var, float** outputs,float epsilon){
+ISA_INLINE void batch_normalization_feed_forward_inv_std_kernel(int batch_size, float** input_vectors,float** temp_vectors, int size_vectors, float* gamma, float* beta, float* mean, float* var, float* inv_std, float** outputs,float epsilon){
     int i,j;
     float temp;
     /*mean*/
     for(i = 0; i < batch_size; i++){
         for(j = 0; j < size_vectors; j++){
             mean[j] += input_vectors[i][j];
-            if(i == batch_size-1)
-                mean[j]/=(float)batch_size;
         }
     }
+    for(j = 0; j < size_vectors; j++){
+        mean[j]/=(float)batch_size;
+    }
     
     /*variance*/
     for(i = 0; i < batch_size; i++){
         for(j = 0; j < size_vectors; j++){
             temp = input_vectors[i][j]-mean[j];
-            temp = temp*temp;
-            var[j] += temp;
-            if(i == batch_size-1)
-                var[j]/=(float)batch_size;
+            var[j] += temp*temp;
         }
     }
+    for(j = 0; j < size_vectors; j++){
+        var[j]/=(float)batch_size;
+        inv_std[j] = 1.0f/sqrtf(var[j]+epsilon);
+    }
     
     for(i = 0; i < batch_size; i++){
         for(j = 0; j < size_vectors; j++){
-            temp_vectors[i][j] = (input_vectors[i][j]-mean[j])/(sqrtf(var[j]+epsilon));
+            temp_vectors[i][j] = (input_vectors[i][j]-mean[j])*inv_std[j];
             outputs[i][j] = temp_vectors[i][j]*gamma[j] + beta[j];
         }
     }
 
 }
 
-/* This Function computes the error from a batch normalization
+ISA_DISPATCH(, batch_normalization_feed_forward_inv_std, (int batch_size, float** input_vectors,float** temp_vectors, int size_vectors, float* gamma, float* beta, float* mean, float* var, float* inv_std, float** outputs,float epsilon), (batch_size,input_vectors,temp_vectors,size_vectors,gamma,beta,mean,var,inv_std,outputs,epsilon))
+
+/* This Function computes the error from a batch normalization with the reduced formula:
+ * 
+ * dx_i = gamma*inv_std/batch_size * (batch_size*dy_i - sum(dy) - h_hat_i*sum(dy*h_hat))
+ * 
+ * so it needs one pass for the 2 sums and one pass for the input errors
  * 
  * Input:
  * 
  *             @ int batch_size:= the size of the batch (number of total instances actually running)
- *             @ float** input_vectors:= the total instances running, dimensions: batch_size*size_vectors
- *             @ float** temp_vectors:= a temporary vector where we store the h_hat_i, dimensions:= batch_size*size_vectors
+ *             @ float** temp_vectors:= the h_hat_i computed by batch_normalization_feed_forward_inv_std, dimensions:= batch_size*size_vectors
  *             @ int size_vectors:= the size of each vector
  *             @ float* gamma:= the parameters that we must learn
- *             @ float* beta:= other params that we must learn
- *             @ float* mean:= a vector initialized with all 0s where we store the mean
- *             @ float* var:= a vector initialized with all 0s where we store the variance
+ *             @ float* inv_std:= 1/sqrt(var+epsilon) computed by batch_normalization_feed_forward_inv_std
  *             @ float** outputs_error:= where are stored the output errors coming from the next layer
  *             @ float* gamma_error:= where we store the partial derivatives of gamma
  *             @ float* beta_error:= where we store the partial derivatives of beta
  *             @ float** input_error:= where we store the input error
- *             @ float** temp_vectors_error:= useful for the computation
- *             @ float* temp_array:= useful for the computation
- *             @ float epsilon:= a param that let us to avoid division by 0
+ *             @ float* temp_array:= useful for the computation, dimensions: 2*size_vectors
  * 
  * */
-void batch_normalization_back_prop(int batch_size, float** input_vectors,float** temp_vectors, int size_vectors, float* gamma, float* beta, float* mean, float* var, float** outputs_error, float* gamma_error, float* beta_error, float** input_error, float** temp_vectors_error,float* temp_array, float epsilon){
-    int i,j,z;
-
+ISA_INLINE void batch_normalization_back_prop_inv_std_kernel(int batch_size, float** temp_vectors, int size_vectors, float* gamma, float* inv_std, float** outputs_error, float* gamma_error, float* beta_error, float** input_error, float* temp_array){
+    int i,j;
+    float* sum_error = temp_array;
+    float* sum_error_h_hat = &temp_array[size_vectors];
+    float* error;
+    float* h_hat;
+    float* in_error;
     
-    /* gamma and beta error*/
+    memset(temp_array,0,sizeof(float)*2*size_vectors);
     for(i = 0; i < batch_size; i++){
+        error = outputs_error[i];
+        h_hat = temp_vectors[i];
         for(j = 0; j < size_vectors; j++){
-            gamma_error[j] += outputs_error[i][j]*temp_vectors[i][j];
-            beta_error[j] += outputs_error[i][j];
-            temp_vectors_error[i][j] = outputs_error[i][j]*gamma[j];
-            temp_array[j] += input_vectors[i][j] - mean[j];
+            sum_error[j] += error[j];
+            sum_error_h_hat[j] += error[j]*h_hat[j];
         }
     }
     
+    /* gamma and beta error*/
+    for(j = 0; j < size_vectors; j++){
+        gamma_error[j] += sum_error_h_hat[j];
+        beta_error[j] += sum_error[j];
+    }
+    
     /* input_error*/
     for(i = 0; i < batch_size; i++){
-        for(j = 0; j < batch_size; j++){
-            for(z = 0; z < size_vectors; z++){
-                if(i == j)
-                    input_error[j][z] += ((float)1-(float)1/(float)batch_size)/sqrtf(var[z]+epsilon)-((input_vectors[j][z]-mean[z])*2*((float)1-(float)1/(float)batch_size)*(input_vectors[j][z]-mean[z])-((float)2/(float)batch_size)*(temp_array[z]-input_vectors[j][z]+mean[z]))/((float)(2*batch_size)*(pow((double)var[z]+epsilon,(double)3/2)));
-                else
-                    input_error[j][z] += -(sqrtf(var[z]+epsilon)/(float)batch_size)-((input_vectors[i][z]-mean[z])*2*((float)1-(float)1/(float)batch_size)*(input_vectors[j][z]-mean[z])-((float)2/(float)batch_size)*(temp_array[z]-input_vectors[j][z]+mean[z]))/((float)(2*batch_size)*(pow((double)var[z]+epsilon,(double)3/2)));
-                
-            }
+        error = outputs_error[i];
+        h_hat = temp_vectors[i];
+        in_error = input_error[i];
+        for(j = 0; j < size_vectors; j++){
+            in_error[j] += gamma[j]*inv_std[j]/(float)batch_size*((float)batch_size*error[j] - sum_error[j] - h_hat[j]*sum_error_h_hat[j]);
         }
     }
+}
 
+ISA_DISPATCH(, batch_normalization_back_prop_inv_std, (int batch_size, float** temp_vectors, int size_vectors, float* gamma, float* inv_std, float** outputs_error, float* gamma_error, float* beta_error, float** input_error, float* temp_array), (batch_size,temp_vectors,size_vectors,gamma,inv_std,outputs_error,gamma_error,beta_error,input_error,temp_array))
+
+/* This computes the batch normalization across batches without keeping 1/sqrt(var+epsilon),
+ * it is batch_normalization_feed_forward_inv_std with a temporary inv_std
+ * 
+ * Input:
+ * 
+ *             @ int batch_size:= the size of the batch (number of total instances actually running)
+ *             @ float** input_vectors:= the total instances running, dimensions: batch_size*size_vectors
+ *             @ float** temp_vectors:= a temporary vector where we store the h_hat_i, dimensions:= batch_size*size_vectors
+ *             @ int size_vectors:= the size of each vector
+ *             @ float* gamma:= the parameters that we must learn
+ *             @ float* beta:= other params that we must learn
+ *             @ float* mean:= a vector initialized with all 0s where we store the mean
+ *             @ float* var:= a vector initialized with all 0s where we store the variance
+ *             @ float** outputs:= where we store the outputs coming from this normalization
+ *             @ float epsilon:= a param that let us to avoid division by 0
+ * 
+ * */
+void batch_normalization_feed_forward(int batch_size, float** input_vectors,float** temp_vectors, int size_vectors, float* gamma, float* beta, float* mean, float* var, float** outputs,float epsilon){
+    float* inv_std = (float*)malloc(sizeof(float)*size_vectors);
+    batch_normalization_feed_forward_inv_std(batch_size,input_vectors,temp_vectors,size_vectors,gamma,beta,mean,var,inv_std,outputs,epsilon);
+    free(inv_std);
+}
+
+/* This Function computes the error from a batch normalization with the arguments of the first versions of the library,
+ * 1/sqrt(var+epsilon) is computed again and the errors are computed by batch_normalization_back_prop_inv_std.
+ * input_vectors, beta, mean, temp_vectors_error and temp_array are not used anymore.
+ * The input errors of the first versions were wrong (they did not match the finite differences),
+ * now they are the true gradient, so the results of the callers change
+ * 
+ * Input:
+ * 
+ *             @ int batch_size:= the size of the batch (number of total instances actually running)
+ *             @ float** input_vectors:= the total instances running, dimensions: batch_size*size_vectors
+ *             @ float** temp_vectors:= the h_hat_i computed by batch_normalization_feed_forward, dimensions:= batch_size*size_vectors
+ *             @ int size_vectors:= the size of each vector
+ *             @ float* gamma:= the parameters that we must learn
+ *             @ float* beta:= other params that we must learn
+ *             @ float* mean:= the mean computed by batch_normalization_feed_forward
+ *             @ float* var:= the variance computed by batch_normalization_feed_forward
+ *             @ float** outputs_error:= where are stored the output errors coming from the next layer
+ *             @ float* gamma_error:= where we store the partial derivatives of gamma
+ *             @ float* beta_error:= where we store the partial derivatives of beta
+ *             @ float** input_error:= where we store the input error
+ *             @ float** temp_vectors_error:= useful for the computation
+ *             @ float* temp_array:= useful for the computation
+ *             @ float epsilon:= a param that let us to avoid division by 0
+ * 
+ * */
+void batch_normalization_back_prop(int batch_size, float** input_vectors,float** temp_vectors, int size_vectors, float* gamma, float* beta, float* mean, float* var, float** outputs_error, float* gamma_error, float* beta_error, float** input_error, float** temp_vectors_error,float* temp_array, float epsilon){
+    int j;
+    float* inv_std = (float*)malloc(sizeof(float)*3*size_vectors);
+    for(j = 0; j < size_vectors; j++){
+        inv_std[j] = 1.0f/sqrtf(var[j]+epsilon);
+    }
+    batch_normalization_back_prop_inv_std(batch_size,temp_vectors,size_vectors,gamma,inv_std,outputs_error,gamma_error,beta_error,input_error,&inv_std[size_vectors]);
+    free(inv_std);
 }
 
 
 /* This function computes the final mean and variance for a bn layer once the training is ended, according to the 
  * second part of the pseudocode that you can find here: https://standardfrancis.wordpress.com/2015/04/16/batch-normalization/
+ * If the layer is trained with batch_normalization_layer_feed_forward the final mean and variance are already
+ * kept up to date as running averages, so this extra pass over the training set is not needed
  * 
  * Input:
  *     
@@ -222,7 +465,7 @@ void batch_normalization_final_mean_variance(float** input_vectors, int n_vector
     }
     for(i = 0; i < n_vectors; i+=mini_batch_size){
         reset_bn(bn_layer);
-        batch_normalization_feed_forward(mini_batch_size,input_vectors,bn_layer->temp_vectors,vector_size,bn_layer->gamma,bn_layer->beta,bn_layer->mean,bn_layer->var, bn_layer->outputs,EPSILON);
+        batch_normalization_feed_forward_inv_std(mini_batch_size,&input_vectors[i],bn_layer->temp_vectors,vector_size,bn_layer->gamma,bn_layer->beta,bn_layer->mean,bn_layer->var,bn_layer->inv_std,bn_layer->outputs,EPSILON);
         sum1D(bn_layer->mean,mean,mean,vector_size);
         sum1D(bn_layer->var,var,var,vector_size);
         
@@ -242,3 +485,58 @@ void batch_normalization_final_mean_variance(float** input_vectors, int n_vector
     return;
 }
 
+
+/* This function computes the feed forward of a bn layer.
+ * In BATCH_NORMALIZATION_TRAINING_MODE the batch is normalized with its own mean and variance,
+ * and the final mean and variance of the layer are updated as exponential moving averages:
+ * final = momentum*final + (1-momentum)*batch statistic (the variance is the unbiased one).
+ * In BATCH_NORMALIZATION_FINAL_MODE the batch is normalized with the final mean and variance
+ * 
+ * Input:
+ * 
+ *             @ bn* b:= the batch normalized layer
+ *             @ float** input_vectors:= the inputs of the layer, dimensions: b->batch_size*b->vector_dim
+ * 
+ * */
+void batch_normalization_layer_feed_forward(bn* b, float** input_vectors){
+    int i,j;
+    float unbiased = (float)b->batch_size/(float)(b->batch_size-1);
+    
+    if(b->mode_flag == BATCH_NORMALIZATION_FINAL_MODE){
+        for(j = 0; j < b->vector_dim; j++){
+            b->inv_std[j] = 1.0f/sqrtf(b->final_var[j]+b->epsilon);
+        }
+        for(i = 0; i < b->batch_size; i++){
+            for(j = 0; j < b->vector_dim; j++){
+                b->temp_vectors[i][j] = (input_vectors[i][j]-b->final_mean[j])*b->inv_std[j];
+                b->outputs[i][j] = b->temp_vectors[i][j]*b->gamma[j] + b->beta[j];
+            }
+        }
+        return;
+    }
+    
+    memset(b->mean,0,sizeof(float)*b->vector_dim);
+    memset(b->var,0,sizeof(float)*b->vector_dim);
+    batch_normalization_feed_forward_inv_std(b->batch_size,input_vectors,b->temp_vectors,b->vector_dim,b->gamma,b->beta,b->mean,b->var,b->inv_std,b->outputs,b->epsilon);
+    for(j = 0; j < b->vector_dim; j++){
+        b->final_mean[j] = b->momentum*b->final_mean[j] + (1-b->momentum)*b->mean[j];
+        b->final_var[j] = b->momentum*b->final_var[j] + (1-b->momentum)*unbiased*b->var[j];
+    }
+}
+
+/* This function computes the backpropagation of a bn layer after batch_normalization_layer_feed_forward
+ * in BATCH_NORMALIZATION_TRAINING_MODE, the input errors are stored in b->error2
+ * 
+ * Input:
+ * 
+ *             @ bn* b:= the batch normalized layer
+ *             @ float** outputs_error:= the errors of the outputs, dimensions: b->batch_size*b->vector_dim
+ * 
+ * */
+void batch_normalization_layer_back_prop(bn* b, float** outputs_error){
+    if(b->mode_flag != BATCH_NORMALIZATION_TRAINING_MODE){
+        fprintf(stderr,"Error: the backpropagation of a bn layer can be computed only in training mode\n");
+        exit(1);
+    }
+    batch_normalization_back_prop_inv_std(b->batch_size,b->temp_vectors,b->vector_dim,b->gamma,b->inv_std,outputs_error,b->d_gamma,b->d_beta,b->error2,b->temp2);
+}
@@ -0,0 +1,297 @@
+#define _GNU_SOURCE
+#include "llab.h"
+#include <unistd.h>
+#include <sched.h>
+#include <immintrin.h>
+
+/* The thread pool of the library: n_threads-1 workers and the thread that calls parallel_for.
+ * A parallel_for splits [0,n) in chunks that are taken by the threads from a shared counter,
+ * so the threads that end their chunks first take the remaining ones.
+ * Only one parallel_for at time runs on the pool: a thread that finds the pool busy, a worker of the pool
+ * and a thread marked with set_thread_pool_serial run the whole loop by themselves, so the calls made from inside
+ * the workers (or from the threads of the trainer) never oversubscribe the cores.
+ * The threads that run kernels beside the pool (the serial threads and the callers of parallel_for) are counted,
+ * each one takes a core, so a parallel_for wakes only the workers for the cores left by the others
+ * */
+
+typedef struct thread_pool_job {
+    void (*function)(void* data, int start, int end);
+    void* data;
+    int n, chunk;
+    int n_workers;// the workers that run the job, the others wait for the next one
+    int next;// the first index not taken yet
+    unsigned int mxcsr;// the floating point mode of the calling thread (for example flush to zero), copied by the workers
+} thread_pool_job;
+
+static pthread_mutex_t thread_pool_lock = PTHREAD_MUTEX_INITIALIZER;// held by the thread that runs a parallel_for on the pool
+static pthread_mutex_t thread_pool_mutex = PTHREAD_MUTEX_INITIALIZER;// protects the state below
+static pthread_cond_t thread_pool_start = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t thread_pool_done = PTHREAD_COND_INITIALIZER;
+static pthread_t* thread_pool_workers = NULL;
+static int thread_pool_size = 0;// 0 until the pool is initialized, read with atomic loads outside the pool lock
+static int thread_pool_generation = 0;// incremented for each job and when the workers must exit
+static int thread_pool_running = 0;// the workers that are running the current job
+static int thread_pool_first_generation = 0;// the generation when the workers have been created
+static int thread_pool_exit_flag = 0;
+static thread_pool_job thread_pool_current;
+static int* thread_pool_cpus = NULL;
+static int thread_pool_n_cpus = 0;
+static int thread_pool_callers = 0;// the threads in a parallel_for or in a serial section, updated with atomic operations
+
+static __thread int thread_pool_worker_flag = 0;// = 1 in the workers of the pool
+static __thread int thread_pool_serial_depth = 0;// > 0 if the thread runs its parallel_for by itself
+
+/* This function runs the chunks of the job until there are no more chunks*/
+static void thread_pool_run(thread_pool_job* job){
+    int start,end;
+    while(1){
+        start = __sync_fetch_and_add(&job->next,job->chunk);
+        if(start >= job->n)
+            break;
+        end = start+job->chunk < job->n ? start+job->chunk : job->n;
+        (*job->function)(job->data,start,end);
+    }
+}
+
+/* This function pins the worker index to its cpu (see set_thread_pool_affinity)*/
+static void thread_pool_pin(pthread_t thread, int index){
+#ifdef __linux__
+    int i;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if(thread_pool_n_cpus > 0)
+        CPU_SET(thread_pool_cpus[index%thread_pool_n_cpus],&set);
+    else{
+        for(i = 0; i < CPU_SETSIZE; i++){
+            CPU_SET(i,&set);
+        }
+    }
+    pthread_setaffinity_np(thread,sizeof(cpu_set_t),&set);
+#endif
+}
+
+/* the function run by the workers of the pool, they wait for a new job until the pool is resized or freed*/
+static void* thread_pool_worker(void* arg){
+    int index = (int)(size_t)arg;
+    int generation = thread_pool_first_generation;
+    thread_pool_worker_flag = 1;
+    while(1){
+        pthread_mutex_lock(&thread_pool_mutex);
+        while(thread_pool_generation == generation)
+            pthread_cond_wait(&thread_pool_start,&thread_pool_mutex);
+        generation = thread_pool_generation;
+        if(thread_pool_exit_flag){
+            pthread_mutex_unlock(&thread_pool_mutex);
+            break;
+        }
+        if(index >= thread_pool_current.n_workers){
+            pthread_mutex_unlock(&thread_pool_mutex);
+            continue;
+        }
+        pthread_mutex_unlock(&thread_pool_mutex);
+
+        _mm_setcsr(thread_pool_current.mxcsr);
+        thread_pool_run(&thread_pool_current);
+
+        pthread_mutex_lock(&thread_pool_mutex);
+        thread_pool_running--;
+        if(!thread_pool_running)
+            pthread_cond_signal(&thread_pool_done);
+        pthread_mutex_unlock(&thread_pool_mutex);
+    }
+    free_sgemm_buffers();
+    return NULL;
+}
+
+/* This function joins the workers of the pool, the pool lock must be held*/
+static void thread_pool_stop(void){
+    int i;
+    if(thread_pool_workers == NULL)
+        return;
+    pthread_mutex_lock(&thread_pool_mutex);
+    thread_pool_exit_flag = 1;
+    thread_pool_generation++;
+    pthread_cond_broadcast(&thread_pool_start);
+    pthread_mutex_unlock(&thread_pool_mutex);
+    for(i = 0; i < thread_pool_size-1; i++){
+        pthread_join(thread_pool_workers[i],NULL);
+    }
+    free(thread_pool_workers);
+    thread_pool_workers = NULL;
+    thread_pool_exit_flag = 0;
+}
+
+/* This function starts n_threads-1 workers, the pool lock must be held*/
+static void thread_pool_init(int n_threads){
+    int i;
+    if(n_threads <= 0){
+        n_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+        if(n_threads < 1)
+            n_threads = 1;
+    }
+    __atomic_store_n(&thread_pool_size,n_threads,__ATOMIC_RELEASE);
+    if(n_threads == 1)
+        return;
+    thread_pool_first_generation = thread_pool_generation;
+    thread_pool_workers = (pthread_t*)malloc(sizeof(pthread_t)*(n_threads-1));
+    if(thread_pool_workers == NULL){
+        fprintf(stderr,"Error: not enough memory for the thread pool\n");
+        exit(1);
+    }
+    for(i = 0; i < n_threads-1; i++){
+        if(pthread_create(&thread_pool_workers[i],NULL,thread_pool_worker,(void*)(size_t)i)){
+            fprintf(stderr,"Error: an error occurred creating the threads of the thread pool\n");
+            exit(1);
+        }
+        thread_pool_pin(thread_pool_workers[i],i);
+    }
+}
+
+/* This function sets the number of threads used by the kernels of the library (the calling thread included),
+ * by default they are the online cpus. It must not be called while other threads use the library
+ *
+ * Input:
+ *             @ int n_threads:= the number of threads, <= 0 for the number of online cpus, 1 for no threads
+ *
+ * */
+void set_thread_pool_size(int n_threads){
+    pthread_mutex_lock(&thread_pool_lock);
+    thread_pool_stop();
+    thread_pool_init(n_threads);
+    pthread_mutex_unlock(&thread_pool_lock);
+}
+
+/* This function returns the number of threads used by the kernels of the library (the calling thread included)*/
+int get_thread_pool_size(void){
+    int size = __atomic_load_n(&thread_pool_size,__ATOMIC_ACQUIRE);
+    if(!size){
+        pthread_mutex_lock(&thread_pool_lock);
+        if(!thread_pool_size)
+            thread_pool_init(0);
+        size = thread_pool_size;
+        pthread_mutex_unlock(&thread_pool_lock);
+    }
+    return size;
+}
+
+/* This function pins the workers of the pool to some cpus: the worker i runs on cpus[i%n_cpus]
+ * (the calling threads are not pinned). It works only on linux
+ *
+ * Input:
+ *             @ int* cpus:= the cpus, NULL to let the workers run on all the cpus
+ *             @ int n_cpus:= the number of cpus
+ *
+ * */
+void set_thread_pool_affinity(int* cpus, int n_cpus){
+    int i;
+    pthread_mutex_lock(&thread_pool_lock);
+    free(thread_pool_cpus);
+    thread_pool_cpus = NULL;
+    thread_pool_n_cpus = 0;
+    if(cpus != NULL && n_cpus > 0){
+        thread_pool_cpus = (int*)malloc(sizeof(int)*n_cpus);
+        memcpy(thread_pool_cpus,cpus,sizeof(int)*n_cpus);
+        thread_pool_n_cpus = n_cpus;
+    }
+    for(i = 0; thread_pool_workers != NULL && i < thread_pool_size-1; i++){
+        thread_pool_pin(thread_pool_workers[i],i);
+    }
+    pthread_mutex_unlock(&thread_pool_lock);
+}
+
+/* This function makes the parallel_for called by the calling thread run only on that thread (flag = 1),
+ * for example in threads that already run in parallel with the others. The calls can be nested,
+ * each call with flag = 1 must be followed by a call with flag = 0. Until the end the thread is counted
+ * as a thread that takes a core, so the parallel_for of the other threads wake less workers
+ *
+ * Input:
+ *             @ int flag:= 1 to begin, 0 to end
+ *
+ * */
+void set_thread_pool_serial(int flag){
+    thread_pool_serial_depth+= flag ? 1 : -1;
+    if(flag && thread_pool_serial_depth == 1)
+        __sync_fetch_and_add(&thread_pool_callers,1);
+    else if(!flag && !thread_pool_serial_depth)
+        __sync_fetch_and_sub(&thread_pool_callers,1);
+}
+
+/* This function calls function(data,start,end) on chunks of [0,n) on the threads of the pool:
+ * each chunk has at least grain indices and the threads take the chunks until they end. The function
+ * must write disjoint data for disjoint ranges. The loop runs on the calling thread if there is a single chunk,
+ * if the pool has a single thread, if it is called by a worker of the pool or by a serial thread (see set_thread_pool_serial)
+ * or if another thread is running a parallel_for on the pool. Otherwise the loop runs on the calling thread and on
+ * the workers for the cores that are not taken by the other callers and serial threads
+ *
+ * Input:
+ *             @ int n:= the number of indices
+ *             @ int grain:= the minimum number of indices of a chunk
+ *             @ void (*function)(void* data, int start, int end):= the body of the loop for the indices start <= i < end
+ *             @ void* data:= the argument of the function
+ *
+ * */
+void parallel_for(int n, int grain, void (*function)(void* data, int start, int end), void* data){
+    if(n <= 0)
+        return;
+    if(grain < 1)
+        grain = 1;
+    if(n <= grain || thread_pool_worker_flag || thread_pool_serial_depth || get_thread_pool_size() == 1){
+        (*function)(data,0,n);
+        return;
+    }
+    
+    /* the caller takes a core until the end of the loop*/
+    int callers = __sync_add_and_fetch(&thread_pool_callers,1);
+    if(callers >= get_thread_pool_size() || pthread_mutex_trylock(&thread_pool_lock)){
+        (*function)(data,0,n);
+        __sync_fetch_and_sub(&thread_pool_callers,1);
+        return;
+    }
+    
+    /* the workers for the cores left by the other callers (read again, they can be changed in the meantime)*/
+    int n_workers = thread_pool_size-__atomic_load_n(&thread_pool_callers,__ATOMIC_ACQUIRE);
+    if(n_workers <= 0){
+        pthread_mutex_unlock(&thread_pool_lock);
+        (*function)(data,0,n);
+        __sync_fetch_and_sub(&thread_pool_callers,1);
+        return;
+    }
+
+    /* 4 chunks for each thread, so the threads that end first balance the others*/
+    int chunk = (n+4*(n_workers+1)-1)/(4*(n_workers+1));
+    thread_pool_current.function = function;
+    thread_pool_current.data = data;
+    thread_pool_current.n = n;
+    thread_pool_current.chunk = chunk > grain ? chunk : grain;
+    thread_pool_current.next = 0;
+    thread_pool_current.mxcsr = _mm_getcsr();
+
+    pthread_mutex_lock(&thread_pool_mutex);
+    thread_pool_current.n_workers = n_workers;
+    thread_pool_running = n_workers;
+    thread_pool_generation++;
+    pthread_cond_broadcast(&thread_pool_start);
+    pthread_mutex_unlock(&thread_pool_mutex);
+
+    thread_pool_worker_flag = 1;
+    thread_pool_run(&thread_pool_current);
+    thread_pool_worker_flag = 0;
+
+    pthread_mutex_lock(&thread_pool_mutex);
+    while(thread_pool_running)
+        pthread_cond_wait(&thread_pool_done,&thread_pool_mutex);
+    pthread_mutex_unlock(&thread_pool_mutex);
+    pthread_mutex_unlock(&thread_pool_lock);
+    __sync_fetch_and_sub(&thread_pool_callers,1);
+}
+
+/* This function joins the workers of the pool and frees it, the next parallel_for builds it again*/
+void free_thread_pool(void){
+    pthread_mutex_lock(&thread_pool_lock);
+    thread_pool_stop();
+    __atomic_store_n(&thread_pool_size,0,__ATOMIC_RELEASE);
+    free(thread_pool_cpus);
+    thread_pool_cpus = NULL;
+    thread_pool_n_cpus = 0;
+    pthread_mutex_unlock(&thread_pool_lock);
+}
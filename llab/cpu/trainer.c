@@ -0,0 +1,518 @@
+#include "llab.h"
+#include <immintrin.h>
+
+/* flush to zero and denormals are zero bits of the mxcsr: the momentum of the parameters that don't get
+ * partial derivatives (sparse inputs) decays in denormals that are very slow, above all with the hogwild updates*/
+#define TRAINER_MXCSR_FTZ_DAZ 0x8040
+/* a hogwild thread updates the runs of non zero partial derivatives of the rows of the fully-connected layers,
+ * 2 runs closer than TRAINER_SPAN_GAP zeros are updated as a single range*/
+#define TRAINER_SPAN_GAP 16
+
+/* arguments of a thread of the trainer*/
+typedef struct trainer_worker {
+    trainer* t;
+    int index;
+} trainer_worker;
+
+/* This function returns the first position of the arena that belongs to a thread,
+ * each thread owns a contiguous chunk of the slabs during the reduction, the update and the broadcast
+ *
+ * Input:
+ *
+ *             @ trainer* t:= the trainer
+ *             @ int index:= the index of the thread, index = n_threads returns the end of the last chunk
+ *
+ * */
+static int trainer_chunk(trainer* t, int index){
+    int chunk = arena_aligned((t->m->arena_size+t->n_threads-1)/t->n_threads);
+    int start = index*chunk;
+    return start < t->m->arena_size ? start : t->m->arena_size;
+}
+
+/* This function is one training step of a thread of the trainer:
+ *
+ * 1) feed forward and back propagation of the samples index, index+n_threads, ... of the mini batch on the replica of the thread,
+ *    the partial derivatives are accumulated in the arena of the replica
+ * 2) tree reduction of the partial derivatives of all the replicas in the model, only on the chunk of the thread,
+ *    the partial derivatives of the other replicas are resetted in the same pass
+ * 3) clipping, l2 regularization and nesterov or adam update of the chunk (the partial derivatives of the model are resetted)
+ * 4) broadcast of the updated parameters of the chunk to the other replicas
+ *
+ * Input:
+ *
+ *             @ trainer* t:= the trainer
+ *             @ int index:= the index of the thread
+ *
+ * */
+static void trainer_step(trainer* t, int index){
+    model* r = t->replicas[index];
+    model* m = t->m;
+    int i,s,k;
+    int start = trainer_chunk(t,index), end = trainer_chunk(t,index+1), w = m->arena_weights;
+    double sum = 0;
+    float gradient_scale = 1, norm, weight_decay = 0;
+
+    for(i = index; i < t->batch_size; i+=t->n_threads){
+        reset_model_except_partial_derivatives(r);
+        model_tensor_input_ff(r,t->tensor_depth,t->tensor_i,t->tensor_j,t->inputs[i]);
+        (*t->error_function)(r,i,t->output_errors[index],t->data);
+        model_tensor_input_bp(r,t->tensor_depth,t->tensor_i,t->tensor_j,t->inputs[i],t->output_errors[index],t->output_dimension);
+    }
+
+    pthread_barrier_wait(&t->barrier);
+
+    if(start < end){
+        for(s = 1; s < t->n_threads; s*=2){
+            for(k = 0; k+s < t->n_threads; k+=2*s){
+                sum1D(&t->replicas[k]->arena[1][start],&t->replicas[k+s]->arena[1][start],&t->replicas[k]->arena[1][start],end-start);
+                memset(&t->replicas[k+s]->arena[1][start],0,sizeof(float)*(end-start));
+            }
+        }
+        if(start < w)
+            t->squared_norms[index] = sum_squares(&m->arena[1][start],(end < w ? end : w)-start);
+        else
+            t->squared_norms[index] = 0;
+    }
+    else
+        t->squared_norms[index] = 0;
+
+    pthread_barrier_wait(&t->barrier);
+
+    for(i = 0; i < t->n_threads; i++){
+        sum+=t->squared_norms[i];
+    }
+    norm = sqrtf((float)sum);
+    if(t->threshold > 0 && norm >= t->threshold)
+        gradient_scale = t->threshold/norm;
+    if(t->regularization == L2_REGULARIZATION)
+        weight_decay = t->lambda*t->batch_size/(float)t->total_number_weights;
+
+    /* the weights of the chunk are clipped and decayed, the biases are not*/
+    for(k = 0; k < 2; k++){
+        int a = k == 0 ? start : (start > w ? start : w);
+        int b = k == 0 ? (end < w ? end : w) : end;
+        if(a >= b)
+            continue;
+        if(t->gradient_descent_flag == NESTEROV)
+            nesterov_momentum_array(&m->arena[0][a],&m->arena[1][a],&m->arena[2][a],b-a,t->lr,t->momentum,t->batch_size,k == 0 ? gradient_scale : 1,k == 0 ? weight_decay : 0,1);
+        else if(t->gradient_descent_flag == ADAM)
+            adam_algorithm_array(&m->arena[0][a],&m->arena[1][a],&m->arena[2][a],&m->arena[3][a],b-a,t->lr,BETA1_ADAM,BETA2_ADAM,t->b1,t->b2,EPSILON_ADAM,t->batch_size,k == 0 ? gradient_scale : 1,k == 0 ? weight_decay : 0,1);
+    }
+
+    pthread_barrier_wait(&t->barrier);
+
+    for(k = 1; k < t->n_threads && start < end; k++){
+        memcpy(&t->replicas[k]->arena[0][start],&m->arena[0][start],sizeof(float)*(end-start));
+    }
+}
+
+/* This function adds the range [start,start+size) of the arena to the ranges updated by a hogwild thread*/
+static void trainer_span(trainer* t, int index, int* n, int start, int size){
+    if(size <= 0)
+        return;
+    if(2*(*n)+2 > t->spans_size[index]){
+        t->spans_size[index] = 2*t->spans_size[index]+64;
+        t->spans[index] = (int*)realloc(t->spans[index],sizeof(int)*t->spans_size[index]);
+        if(t->spans[index] == NULL){
+            fprintf(stderr,"Error: not enough memory for the ranges of the hogwild trainer\n");
+            exit(1);
+        }
+    }
+    t->spans[index][2*(*n)] = start;
+    t->spans[index][2*(*n)+1] = size;
+    (*n)++;
+}
+
+/* This function returns 1 if d[0,TRAINER_SPAN_GAP) has a non zero element (-0 is 0), it reads the bits of the floats so it is vectorized*/
+static int trainer_nonzero_block(float* d){
+    unsigned int bits[TRAINER_SPAN_GAP],or = 0;
+    int i;
+    memcpy(bits,d,sizeof(bits));
+    for(i = 0; i < TRAINER_SPAN_GAP; i++){
+        or|=bits[i];
+    }
+    return (or & 0x7fffffff) != 0;
+}
+
+/* This function adds the runs of non zero partial derivatives of d[start,start+size) to the ranges updated by a hogwild thread,
+ * the blocks of TRAINER_SPAN_GAP zeros are skipped at once*/
+static void trainer_scan(trainer* t, int index, int* n, float* d, int start, int size){
+    int i,j,block,first = -1,last = -1,end = start+size;
+    for(i = start; i < end; i+=TRAINER_SPAN_GAP){
+        block = end-i < TRAINER_SPAN_GAP ? end-i : TRAINER_SPAN_GAP;
+        if(block == TRAINER_SPAN_GAP && !trainer_nonzero_block(&d[i]))
+            continue;
+        for(j = i; j < i+block; j++){
+            if(!d[j])
+                continue;
+            if(first >= 0 && j-last > TRAINER_SPAN_GAP){
+                trainer_span(t,index,n,first,last+1-first);
+                first = -1;
+            }
+            if(first < 0)
+                first = j;
+            last = j;
+        }
+    }
+    if(first >= 0)
+        trainer_span(t,index,n,first,last+1-first);
+}
+
+/* This function lists the ranges of the arena where the replica of a hogwild thread has partial derivatives
+ * after the back propagation of a sample: the rows of the weights of the fully-connected layers with a non zero
+ * output error (the d_biases of the row) split in the runs of non zero partial derivatives (sparse inputs),
+ * the biases of the fully-connected layers split in the same way, all the kernels and biases of the convolutional layers.
+ * Outside of these ranges the partial derivatives are 0. The layers are in the order of the arena (see model_arena)
+ *
+ * Input:
+ *
+ *             @ trainer* t:= the trainer
+ *             @ int index:= the index of the thread
+ *
+ * returns the number of ranges in t->spans[index]
+ * */
+static int trainer_hogwild_spans(trainer* t, int index){
+    model* r = t->replicas[index];
+    float* d = r->arena[1];
+    int i,j,k,n = 0,w = 0,b = r->arena_weights,size;
+    cl* c;
+    fcl* f;
+    for(i = 0; i < r->n_rl+1; i++){
+        for(j = 0; j < (i < r->n_rl ? r->rls[i]->n_cl : r->n_cl); j++){
+            c = i < r->n_rl ? r->rls[i]->cls[j] : r->cls[j];
+            size = c->n_kernels*c->channels*c->kernel_rows*c->kernel_cols;
+            trainer_span(t,index,&n,w,size);
+            trainer_span(t,index,&n,b,c->n_kernels);
+            w+=arena_aligned(size);
+            b+=arena_aligned(c->n_kernels);
+        }
+    }
+    for(i = 0; i < r->n_fcl; i++){
+        f = r->fcls[i];
+        for(k = 0; k < f->output; k++){
+            if(d[b+k])
+                trainer_scan(t,index,&n,d,w+k*f->input,f->input);
+        }
+        trainer_scan(t,index,&n,d,b,f->output);
+        w+=arena_aligned(f->output*f->input);
+        b+=arena_aligned(f->output);
+    }
+    return n;
+}
+
+/* This function is one training step of a thread of a hogwild trainer: for each sample index, index+n_threads, ...
+ * of the mini batch the replica of the thread runs feed forward and back propagation in its own partial derivatives
+ * and then updates the shared parameters of the model (clipping, l2 and nesterov or adam) without locks.
+ * Only the ranges with partial derivatives are updated (see trainer_hogwild_spans), so with sparse inputs
+ * and relu a sample touches a small part of the fully-connected weights, and the norm for the clipping
+ * is computed on the same ranges. Each sample is a step of size 1, the adam corrections b1, b2 advance with the steps of the thread
+ *
+ * Input:
+ *
+ *             @ trainer* t:= the trainer
+ *             @ int index:= the index of the thread
+ *
+ * */
+static void trainer_hogwild_step(trainer* t, int index){
+    model* r = t->replicas[index];
+    int i,j,k,n,a,size, w = r->arena_weights;
+    int* spans;
+    float* p = r->arena[0];
+    float* d = r->arena[1];
+    float* d1 = r->arena[2];
+    float* d2 = r->arena[3];
+    float b1 = t->b1, b2 = t->b2, gradient_scale, scale, decay, weight_decay = 0;
+    double sum;
+    if(t->regularization == L2_REGULARIZATION)
+        weight_decay = t->lambda/(float)t->total_number_weights;
+
+    for(i = index; i < t->batch_size; i+=t->n_threads){
+        /* the kernels are changed by the other threads*/
+        for(j = 0; j < r->n_cl; j++){
+            r->cls[j]->winograd_kernels_flag = 0;
+        }
+        for(j = 0; j < r->n_rl; j++){
+            for(k = 0; k < r->rls[j]->n_cl; k++){
+                r->rls[j]->cls[k]->winograd_kernels_flag = 0;
+            }
+        }
+        reset_model_except_partial_derivatives(r);
+        model_tensor_input_ff(r,t->tensor_depth,t->tensor_i,t->tensor_j,t->inputs[i]);
+        (*t->error_function)(r,i,t->output_errors[index],t->data);
+        model_tensor_input_bp(r,t->tensor_depth,t->tensor_i,t->tensor_j,t->inputs[i],t->output_errors[index],t->output_dimension);
+
+        n = trainer_hogwild_spans(t,index);
+        spans = t->spans[index];
+        gradient_scale = 1;
+        if(t->threshold > 0){
+            sum = 0;
+            for(k = 0; k < n; k++){
+                if(spans[2*k] < w)
+                    sum+=sum_squares(&d[spans[2*k]],spans[2*k+1]);
+            }
+            if(sqrtf((float)sum) >= t->threshold)
+                gradient_scale = t->threshold/sqrtf((float)sum);
+        }
+        /* the weights are clipped and decayed, the biases are not. The updates reset the partial derivatives*/
+        for(k = 0; k < n; k++){
+            a = spans[2*k];
+            size = spans[2*k+1];
+            scale = a < w ? gradient_scale : 1;
+            decay = a < w ? weight_decay : 0;
+            if(t->gradient_descent_flag == NESTEROV)
+                nesterov_momentum_array(&p[a],&d[a],&d1[a],size,t->lr,t->momentum,1,scale,decay,1);
+            else if(t->gradient_descent_flag == ADAM)
+                adam_algorithm_array(&p[a],&d[a],&d1[a],&d2[a],size,t->lr,BETA1_ADAM,BETA2_ADAM,b1,b2,EPSILON_ADAM,1,scale,decay,1);
+        }
+        if(t->gradient_descent_flag == ADAM){
+            b1*=BETA1_ADAM;
+            b2*=BETA2_ADAM;
+        }
+    }
+}
+
+/* the function run by the threads 1, ..., n_threads-1 of the trainer,
+ * they wait on the barrier for a new mini batch until free_trainer is called.
+ * The threads of the trainer already split the mini batch, so their kernels don't use the thread pool*/
+static void* trainer_thread(void* arg){
+    trainer_worker* worker = (trainer_worker*)arg;
+    trainer* t = worker->t;
+    _mm_setcsr(_mm_getcsr() | TRAINER_MXCSR_FTZ_DAZ);
+    set_thread_pool_serial(1);
+    while(1){
+        pthread_barrier_wait(&t->barrier);
+        if(t->exit_flag)
+            break;
+        if(t->hogwild_flag)
+            trainer_hogwild_step(t,worker->index);
+        else
+            trainer_step(t,worker->index);
+        pthread_barrier_wait(&t->barrier);
+    }
+    set_thread_pool_serial(0);
+    free_sgemm_buffers();
+    return NULL;
+}
+
+/* This function builds a trainer: the replicas of the model and the threads
+ *
+ * Input:
+ *
+ *             @ model* m:= the model that must be trained
+ *             @ int n_threads:= the number of threads (and replicas)
+ *             @ int tensor_depth:= the depth of the input tensors
+ *             @ int tensor_i:= the rows of the input tensors
+ *             @ int tensor_j:= the columns of the input tensors
+ *             @ int output_dimension:= the size of the output error
+ *             @ void (*error_function)(model* m, int sample, float* output_error, void* data):= see model_trainer
+ *             @ void* data:= a pointer passed to error_function
+ *             @ int hogwild_flag:= 1 if the replicas share the parameters of m, 0 otherwise
+ *
+ * */
+static trainer* new_trainer(model* m, int n_threads, int tensor_depth, int tensor_i, int tensor_j, int output_dimension, void (*error_function)(model* m, int sample, float* output_error, void* data), void* data, int hogwild_flag){
+    if(m == NULL || n_threads < 1 || error_function == NULL || output_dimension < 1){
+        fprintf(stderr,"Error: the trainer needs a model, an error function, n_threads > 0 and output_dimension > 0\n");
+        exit(1);
+    }
+    if(m->arena == NULL){
+        fprintf(stderr,"Error: the trainer needs a model built with network()\n");
+        exit(1);
+    }
+    if(m->inference_only_flag){
+        fprintf(stderr,"Error: the trainer can't train a model built for inference only\n");
+        exit(1);
+    }
+
+    int i;
+    trainer* t = (trainer*)malloc(sizeof(trainer));
+    t->n_threads = n_threads;
+    t->tensor_depth = tensor_depth;
+    t->tensor_i = tensor_i;
+    t->tensor_j = tensor_j;
+    t->output_dimension = output_dimension;
+    t->total_number_weights = count_weights(m);
+    t->exit_flag = 0;
+    t->hogwild_flag = hogwild_flag;
+    t->m = m;
+    t->error_function = error_function;
+    t->data = data;
+    t->inputs = NULL;
+    t->batch_size = 0;
+    t->replicas = (model**)malloc(sizeof(model*)*n_threads);
+    t->output_errors = (float**)malloc(sizeof(float*)*n_threads);
+    t->squared_norms = (double*)calloc(n_threads,sizeof(double));
+    t->spans = (int**)calloc(n_threads,sizeof(int*));
+    t->spans_size = (int*)calloc(n_threads,sizeof(int));
+    t->threads = (pthread_t*)malloc(sizeof(pthread_t)*n_threads);
+    t->workers = malloc(sizeof(trainer_worker)*n_threads);
+    t->replicas[0] = m;
+    for(i = 0; i < n_threads; i++){
+        if(i){
+            t->replicas[i] = copy_model(m);
+            if(hogwild_flag)
+                share_model_parameters(m,t->replicas[i]);
+        }
+        memset(t->replicas[i]->arena[1],0,sizeof(float)*m->arena_size);
+        t->output_errors[i] = (float*)calloc(output_dimension,sizeof(float));
+        ((trainer_worker*)t->workers)[i].t = t;
+        ((trainer_worker*)t->workers)[i].index = i;
+    }
+
+    if(pthread_barrier_init(&t->barrier,NULL,n_threads)){
+        fprintf(stderr,"Error: the barrier of the trainer can't be initialized\n");
+        exit(1);
+    }
+    for(i = 1; i < n_threads; i++){
+        if(pthread_create(&t->threads[i],NULL,trainer_thread,&((trainer_worker*)t->workers)[i])){
+            fprintf(stderr,"Error: the thread %d of the trainer can't be created\n",i);
+            exit(1);
+        }
+    }
+
+    return t;
+}
+
+/* This function builds a data parallel trainer for a model: it creates n_threads-1 replicas of the model
+ * (the model itself is the replica of the thread 0) and n_threads-1 threads that live until free_trainer.
+ * The model must not be changed by other functions while the trainer is used
+ *
+ * Input:
+ *
+ *             @ model* m:= the model that must be trained
+ *             @ int n_threads:= the number of threads (and replicas)
+ *             @ int tensor_depth:= the depth of the input tensors
+ *             @ int tensor_i:= the rows of the input tensors
+ *             @ int tensor_j:= the columns of the input tensors
+ *             @ int output_dimension:= the size of the output error
+ *             @ void (*error_function)(model* m, int sample, float* output_error, void* data):= the function that
+ *                       after the feed forward of the sample "sample" of the mini batch on the replica m must fill
+ *                       output_error (the error given to model_tensor_input_bp). It is called by more threads at the same time
+ *             @ void* data:= a pointer passed to error_function (for example the labels of the dataset)
+ *
+ * */
+trainer* model_trainer(model* m, int n_threads, int tensor_depth, int tensor_i, int tensor_j, int output_dimension, void (*error_function)(model* m, int sample, float* output_error, void* data), void* data){
+    return new_trainer(m,n_threads,tensor_depth,tensor_i,tensor_j,output_dimension,error_function,data,0);
+}
+
+/* This function builds a hogwild trainer for a model: the n_threads-1 replicas share the parameters
+ * (and D1, D2) of the model and each thread updates them after every sample of its shard without locks,
+ * there is no reduction of the partial derivatives. Useful for wide and sparse fully-connected models,
+ * the result of a mini batch depends on the scheduling of the threads.
+ * Each sample updates only the parameters with partial derivatives (the rows of the fully-connected weights
+ * with an output error, the columns with an input), so the momentum and the l2 decay of the other parameters
+ * are applied only when a sample reaches them (lazy updates)
+ *
+ * Input:
+ *
+ *             @ model* m:= the model that must be trained
+ *             @ int n_threads:= the number of threads (and replicas)
+ *             @ int tensor_depth:= the depth of the input tensors
+ *             @ int tensor_i:= the rows of the input tensors
+ *             @ int tensor_j:= the columns of the input tensors
+ *             @ int output_dimension:= the size of the output error
+ *             @ void (*error_function)(model* m, int sample, float* output_error, void* data):= see model_trainer
+ *             @ void* data:= a pointer passed to error_function
+ *
+ * */
+trainer* model_hogwild_trainer(model* m, int n_threads, int tensor_depth, int tensor_i, int tensor_j, int output_dimension, void (*error_function)(model* m, int sample, float* output_error, void* data), void* data){
+    return new_trainer(m,n_threads,tensor_depth,tensor_i,tensor_j,output_dimension,error_function,data,1);
+}
+
+/* This function stops the threads of the trainer and frees the replicas, the model is not freed
+ *
+ * Input:
+ *
+ *             @ trainer* t:= the trainer
+ *
+ * */
+void free_trainer(trainer* t){
+    if(t == NULL)
+        return;
+    int i;
+    t->exit_flag = 1;
+    pthread_barrier_wait(&t->barrier);
+    for(i = 1; i < t->n_threads; i++){
+        pthread_join(t->threads[i],NULL);
+        free_model(t->replicas[i]);
+    }
+    for(i = 0; i < t->n_threads; i++){
+        free(t->output_errors[i]);
+        free(t->spans[i]);
+    }
+    pthread_barrier_destroy(&t->barrier);
+    free(t->replicas);
+    free(t->output_errors);
+    free(t->squared_norms);
+    free(t->spans);
+    free(t->spans_size);
+    free(t->threads);
+    free(t->workers);
+    free(t);
+}
+
+/* This function trains the model of the trainer on a mini batch: the samples are sharded across the threads,
+ * the partial derivatives of the replicas are reduced with a parallel tree reduction over the arenas,
+ * then the model is updated once (clipping, l2 and nesterov or adam in a single pass, see update_model_fused)
+ * and the new parameters are copied back in the replicas. With a hogwild trainer each thread updates
+ * the shared parameters after each sample of its shard instead (lr is the learning rate of a single sample)
+ *
+ * Input:
+ *
+ *             @ trainer* t:= the trainer
+ *             @ float** inputs:= the mini batch, batch_size*tensor_depth*tensor_i*tensor_j
+ *             @ int batch_size:= the size of the mini batch
+ *             @ float lr:= the learning rate
+ *             @ float momentum:= the momentum
+ *             @ int gradient_descent_flag:= NESTEROV or ADAM
+ *             @ float* b1:= the hyper parameter b1 of adam algorithm
+ *             @ float* b2:= the hyper parameter b2 of adam algorithm
+ *             @ int regularization:= NO_REGULARIZATION or L2_REGULARIZATION
+ *             @ float lambda:= a float value for l2 regularization
+ *             @ float threshold:= the gradient clipping threshold, 0 for no clipping
+ *
+ * */
+void trainer_train_mini_batch(trainer* t, float** inputs, int batch_size, float lr, float momentum, int gradient_descent_flag, float* b1, float* b2, int regularization, float lambda, float threshold){
+    if(t == NULL || batch_size < 1)
+        return;
+    int i;
+    unsigned int mxcsr = _mm_getcsr();
+    t->inputs = inputs;
+    t->batch_size = batch_size;
+    t->lr = lr;
+    t->momentum = momentum;
+    t->gradient_descent_flag = gradient_descent_flag;
+    t->b1 = (*b1);
+    t->b2 = (*b2);
+    t->regularization = regularization;
+    t->lambda = lambda;
+    t->threshold = threshold;
+
+    _mm_setcsr(mxcsr | TRAINER_MXCSR_FTZ_DAZ);
+    if(t->n_threads > 1){
+        set_thread_pool_serial(1);
+        pthread_barrier_wait(&t->barrier);
+    }
+    if(t->hogwild_flag)
+        trainer_hogwild_step(t,0);
+    else
+        trainer_step(t,0);
+    if(t->n_threads > 1){
+        pthread_barrier_wait(&t->barrier);
+        set_thread_pool_serial(0);
+    }
+    _mm_setcsr(mxcsr);
+
+    if(gradient_descent_flag == ADAM){
+        /* a hogwild thread made up to (batch_size+n_threads-1)/n_threads steps*/
+        int steps = t->hogwild_flag ? (batch_size+t->n_threads-1)/t->n_threads : 1;
+        for(i = 0; i < steps; i++){
+            (*b1)*=BETA1_ADAM;
+            (*b2)*=BETA2_ADAM;
+        }
+    }
+
+    /* the kernels have been changed (the replica 0 is the model, its contexts see the new generation)*/
+    for(i = 0; i < t->n_threads; i++){
+        model_parameters_changed(t->replicas[i]);
+    }
+}
@@ -1,4 +1,7 @@
 #include "llab.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 /*random number between 0 and 1*/
 float r2(){
@@ -411,13 +414,15 @@ void read_file_in_char_vector(char** ksource, char* fname, int* size){
  *             @ float* output:= the output array
  *             @ int size:= the size of input1, input2, input3
  * */
-void dot1D(float* input1, float* input2, float* output, int size){
+ISA_INLINE void dot1D_kernel(float* input1, float* input2, float* output, int size){
     int i;
     for(i = 0; i < size; i++){
         output[i] = input1[i]*input2[i];
     }
 }
 
+ISA_DISPATCH(, dot1D, (float* input1, float* input2, float* output, int size), (input1,input2,output,size))
+
 /* given a float* input array this function copies it in float* output array
  * 
  * Input:
@@ -460,13 +465,78 @@ void copy_char_array(char* input, char* output, int size){
  *             @ float* output:= the output array
  *             @ int size:= the size of input1, input2, input3
  * */
-void sum1D(float* input1, float* input2, float* output, int size){
+ISA_INLINE void sum1D_kernel(float* input1, float* input2, float* output, int size){
     int i;
     for(i = 0; i < size; i++){
         output[i] = input1[i]+input2[i];
     }
 }
 
+ISA_DISPATCH(, sum1D, (float* input1, float* input2, float* output, int size), (input1,input2,output,size))
+
+/* This function returns the sum of the squares of an array. The sum is kept in 8 partial sums
+ * (so the loop is vectorized) that are added in double precision at the end
+ * 
+ * Input:
+ * 
+ *             @ float* input:= the array
+ *             @ int size:= the size of the array
+ * 
+ * */
+ISA_INLINE float sum_squares_kernel(float* input, int size){
+    int i,j;
+    float partial[8] = {0};
+    double sum = 0;
+    for(i = 0; i+8 <= size; i+=8){
+        for(j = 0; j < 8; j++){
+            partial[j] += input[i+j]*input[i+j];
+        }
+    }
+    for(; i < size; i++){
+        sum += input[i]*input[i];
+    }
+    for(j = 0; j < 8; j++){
+        sum += partial[j];
+    }
+    return (float)sum;
+}
+
+ISA_DISPATCH_RETURN(, float, sum_squares, (float* input, int size), (input,size))
+
+/* This function computes output = input1+input2 like sum1D and returns the sum of the squares of output,
+ * computed in the same pass
+ * 
+ * Input:
+ * 
+ *             @ float* input1:= the first array
+ *             @ float* input2:= the second array
+ *             @ float* output:= the output array
+ *             @ int size:= the size of the arrays
+ * 
+ * */
+ISA_INLINE float sum1D_sum_squares_kernel(float* input1, float* input2, float* output, int size){
+    int i,j;
+    float partial[8] = {0},temp;
+    double sum = 0;
+    for(i = 0; i+8 <= size; i+=8){
+        for(j = 0; j < 8; j++){
+            temp = input1[i+j]+input2[i+j];
+            output[i+j] = temp;
+            partial[j] += temp*temp;
+        }
+    }
+    for(; i < size; i++){
+        output[i] = input1[i]+input2[i];
+        sum += output[i]*output[i];
+    }
+    for(j = 0; j < 8; j++){
+        sum += partial[j];
+    }
+    return (float)sum;
+}
+
+ISA_DISPATCH_RETURN(, float, sum1D_sum_squares, (float* input1, float* input2, float* output, int size), (input1,input2,output,size))
+
 /* This function computes a dot product between an array and a float value: value
  * 
  * Input
@@ -477,13 +547,146 @@ void sum1D(float* input1, float* input2, float* output, int size){
  *             @ int dimension:= the dimension of input and output
  * 
  * */
-void mul_value(float* input, float value, float* output, int dimension){
+ISA_INLINE void mul_value_kernel(float* input, float value, float* output, int dimension){
     int i;
     for(i = 0; i < dimension; i++){
         output[i] = input[i]*value;
     }
 }
 
+ISA_DISPATCH(, mul_value, (float* input, float value, float* output, int dimension), (input,value,output,dimension))
+
+/* This function rounds a size up to a multiple of ARENA_ALIGNMENT floats,
+ * so each view of an arena starts on a 64 bytes boundary
+ * 
+ * Input:
+ * 
+ *             @ int size:= the size in floats
+ * 
+ * */
+int arena_aligned(int size){
+    return (size+ARENA_ALIGNMENT-1)/ARENA_ALIGNMENT*ARENA_ALIGNMENT;
+}
+
+/* This function allocates the ARENA_SLABS slabs of a parameters arena (parameters, D, D1, D2),
+ * each slab is 64 bytes aligned and filled with 0
+ * 
+ * Input:
+ * 
+ *             @ int size:= the floats of each slab, multiple of ARENA_ALIGNMENT
+ * 
+ * */
+float** parameters_arena(int size){
+    int i;
+    float** arena = (float**)malloc(sizeof(float*)*ARENA_SLABS);
+    for(i = 0; i < ARENA_SLABS; i++){
+        if(posix_memalign((void**)&arena[i],ARENA_ALIGNMENT*sizeof(float),sizeof(float)*(size > 0 ? size : ARENA_ALIGNMENT))){
+            fprintf(stderr,"Error: not enough memory for the parameters arena\n");
+            exit(1);
+        }
+        memset(arena[i],0,sizeof(float)*size);
+    }
+    return arena;
+}
+
+/* This function allocates a parameters arena for a model that computes only the feed forward:
+ * only the parameters slab is allocated, the D, D1 and D2 slabs are NULL
+ * 
+ * Input:
+ * 
+ *             @ int size:= the floats of the slab, multiple of ARENA_ALIGNMENT
+ * 
+ * */
+float** inference_parameters_arena(int size){
+    int i;
+    float** arena = (float**)malloc(sizeof(float*)*ARENA_SLABS);
+    for(i = 1; i < ARENA_SLABS; i++){
+        arena[i] = NULL;
+    }
+    if(posix_memalign((void**)&arena[0],ARENA_ALIGNMENT*sizeof(float),sizeof(float)*(size > 0 ? size : ARENA_ALIGNMENT))){
+        fprintf(stderr,"Error: not enough memory for the parameters arena\n");
+        exit(1);
+    }
+    memset(arena[0],0,sizeof(float)*size);
+    return arena;
+}
+
+/* This function frees the slabs allocated by parameters_arena
+ * 
+ * Input:
+ * 
+ *             @ float** arena:= the arena
+ * 
+ * */
+void free_parameters_arena(float** arena){
+    if(arena == NULL)
+        return;
+    int i;
+    for(i = 0; i < ARENA_SLABS; i++){
+        free(arena[i]);
+    }
+    free(arena);
+}
+
+
+/* This function updates kernels and biases of a convolutional layer with the nesterov momentum
+ * 
+ * Input:
+ *             
+ *             @ cl* c:= the convolutional layer
+ *             @ float lr:= the learning rate
+ *             @ float momentum:= the momentum
+ *             @ int mini_batch_size:= the size of the mini_batch
+ * 
+ * */
+static void update_cl_nesterov(cl* c, float lr, float momentum, int mini_batch_size){
+    nesterov_momentum_array(c->kernels[0],c->d_kernels[0],c->d1_kernels[0],c->n_kernels*c->channels*c->kernel_rows*c->kernel_cols,lr,momentum,mini_batch_size,1,0,0);
+    nesterov_momentum_array(c->biases,c->d_biases,c->d1_biases,c->n_kernels,lr,momentum,mini_batch_size,1,0,0);
+    c->winograd_kernels_flag = 0;
+}
+
+/* This function updates kernels and biases of a convolutional layer with the adam optimization algorithm
+ * 
+ * Input:
+ *             
+ *             @ cl* c:= the convolutional layer
+ *             @ float lr:= the learning rate
+ *             @ int mini_batch_size:= the size of the mini_batch
+ *             @ float b1:= BETA1_ADAM^t
+ *             @ float b2:= BETA2_ADAM^t
+ * 
+ * */
+static void update_cl_adam(cl* c, float lr, int mini_batch_size, float b1, float b2){
+    adam_algorithm_array(c->kernels[0],c->d_kernels[0],c->d1_kernels[0],c->d2_kernels[0],c->n_kernels*c->channels*c->kernel_rows*c->kernel_cols,lr,BETA1_ADAM,BETA2_ADAM,b1,b2,EPSILON_ADAM,mini_batch_size,1,0,0);
+    adam_algorithm_array(c->biases,c->d_biases,c->d1_biases,c->d2_biases,c->n_kernels,lr,BETA1_ADAM,BETA2_ADAM,b1,b2,EPSILON_ADAM,mini_batch_size,1,0,0);
+    c->winograd_kernels_flag = 0;
+}
+
+/* This function updates weights and biases of a fully-connected layer with the nesterov momentum*/
+static void update_fcl_nesterov(fcl* f, float lr, float momentum, int mini_batch_size){
+    nesterov_momentum_array(f->weights,f->d_weights,f->d1_weights,f->output*f->input,lr,momentum,mini_batch_size,1,0,0);
+    nesterov_momentum_array(f->biases,f->d_biases,f->d1_biases,f->output,lr,momentum,mini_batch_size,1,0,0);
+}
+
+/* This function updates weights and biases of a fully-connected layer with the adam optimization algorithm*/
+static void update_fcl_adam(fcl* f, float lr, int mini_batch_size, float b1, float b2){
+    adam_algorithm_array(f->weights,f->d_weights,f->d1_weights,f->d2_weights,f->output*f->input,lr,BETA1_ADAM,BETA2_ADAM,b1,b2,EPSILON_ADAM,mini_batch_size,1,0,0);
+    adam_algorithm_array(f->biases,f->d_biases,f->d1_biases,f->d2_biases,f->output,lr,BETA1_ADAM,BETA2_ADAM,b1,b2,EPSILON_ADAM,mini_batch_size,1,0,0);
+}
+
+/* This function updates gamma and beta of a batch normalization layer with the nesterov momentum,
+ * the derivatives are not divided by the mini batch size because the batch is already inside the layer*/
+static void update_bn_nesterov(bn* b, float lr, float momentum){
+    nesterov_momentum_array(b->gamma,b->d_gamma,b->d1_gamma,b->vector_dim,lr,momentum,1,1,0,0);
+    nesterov_momentum_array(b->beta,b->d_beta,b->d1_beta,b->vector_dim,lr,momentum,1,1,0,0);
+}
+
+/* This function updates gamma and beta of a batch normalization layer with the adam optimization algorithm,
+ * the derivatives are not divided by the mini batch size because the batch is already inside the layer*/
+static void update_bn_adam(bn* b, float lr, float b1, float b2){
+    adam_algorithm_array(b->gamma,b->d_gamma,b->d1_gamma,b->d2_gamma,b->vector_dim,lr,BETA1_ADAM,BETA2_ADAM,b1,b2,EPSILON_ADAM,1,1,0,0);
+    adam_algorithm_array(b->beta,b->d_beta,b->d1_beta,b->d2_beta,b->vector_dim,lr,BETA1_ADAM,BETA2_ADAM,b1,b2,EPSILON_ADAM,1,1,0,0);
+}
 
 /* Given a model, this function update the params of the residual layers of the model with the nesterov momentum
  * 
@@ -495,19 +698,10 @@ void mul_value(float* input, float value, float* output, int dimension){
  * 
  * */
 void update_residual_layer_nesterov(model* m, float lr, float momentum, int mini_batch_size){
-    int i,j,k,u,z,w;
+    int i,j;
     for(i = 0; i < m->n_rl; i++){
         for(j = 0; j < m->rls[i]->n_cl; j++){
-            for(k = 0; k < m->rls[i]->cls[j]->n_kernels; k++){
-                for(u = 0; u < m->rls[i]->cls[j]->channels; u++){
-                    for(z = 0; z < m->rls[i]->cls[j]->kernel_rows; z++){
-                        for(w = 0; w < m->rls[i]->cls[j]->kernel_cols; w++){
-                            nesterov_momentum(&m->rls[i]->cls[j]->kernels[k][u*m->rls[i]->cls[j]->kernel_rows*m->rls[i]->cls[j]->kernel_cols + z*m->rls[i]->cls[j]->kernel_cols + w],lr,momentum,mini_batch_size, m->rls[i]->cls[j]->d_kernels[k][u*m->rls[i]->cls[j]->kernel_rows*m->rls[i]->cls[j]->kernel_cols + z*m->rls[i]->cls[j]->kernel_cols + w],&m->rls[i]->cls[j]->d1_kernels[k][u*m->rls[i]->cls[j]->kernel_rows*m->rls[i]->cls[j]->kernel_cols + z*m->rls[i]->cls[j]->kernel_cols + w]);
-                        }
-                    }
-                }
-                nesterov_momentum(&m->rls[i]->cls[j]->biases[k],lr,momentum,mini_batch_size, m->rls[i]->cls[j]->d_biases[k],&m->rls[i]->cls[j]->d1_biases[k]);
-            }
+            update_cl_nesterov(m->rls[i]->cls[j],lr,momentum,mini_batch_size);
         }
     }
 }
@@ -522,19 +716,10 @@ void update_residual_layer_nesterov(model* m, float lr, float momentum, int mini
  * 
  * */
 void update_residual_layer_nesterov_bmodel(bmodel* m, float lr, float momentum, int mini_batch_size){
-    int i,j,k,u,z,w;
+    int i,j;
     for(i = 0; i < m->n_rl; i++){
         for(j = 0; j < m->rls[i]->n_cl; j++){
-            for(k = 0; k < m->rls[i]->cls[j]->n_kernels; k++){
-                for(u = 0; u < m->rls[i]->cls[j]->channels; u++){
-                    for(z = 0; z < m->rls[i]->cls[j]->kernel_rows; z++){
-                        for(w = 0; w < m->rls[i]->cls[j]->kernel_cols; w++){
-                            nesterov_momentum(&m->rls[i]->cls[j]->kernels[k][u*m->rls[i]->cls[j]->kernel_rows*m->rls[i]->cls[j]->kernel_cols + z*m->rls[i]->cls[j]->kernel_cols + w],lr,momentum,mini_batch_size, m->rls[i]->cls[j]->d_kernels[k][u*m->rls[i]->cls[j]->kernel_rows*m->rls[i]->cls[j]->kernel_cols + z*m->rls[i]->cls[j]->kernel_cols + w],&m->rls[i]->cls[j]->d1_kernels[k][u*m->rls[i]->cls[j]->kernel_rows*m->rls[i]->cls[j]->kernel_cols + z*m->rls[i]->cls[j]->kernel_cols + w]);
-                        }
-                    }
-                }
-                nesterov_momentum(&m->rls[i]->cls[j]->biases[k],lr,momentum,mini_batch_size, m->rls[i]->cls[j]->d_biases[k],&m->rls[i]->cls[j]->d1_biases[k]);
-            }
+            update_cl_nesterov(m->rls[i]->cls[j],lr,momentum,mini_batch_size);
         }
     }
 }
@@ -551,19 +736,10 @@ void update_residual_layer_nesterov_bmodel(bmodel* m, float lr, float momentum,
  * 
  * */
 void update_residual_layer_adam(model* m, float lr, int mini_batch_size, float b1, float b2){
-    int i,j,k,u,z,w;
+    int i,j;
     for(i = 0; i < m->n_rl; i++){
         for(j = 0; j < m->rls[i]->n_cl; j++){
-            for(k = 0; k < m->rls[i]->cls[j]->n_kernels; k++){
-                for(u = 0; u < m->rls[i]->cls[j]->channels; u++){
-                    for(z = 0; z < m->rls[i]->cls[j]->kernel_rows; z++){
-                        for(w = 0; w < m->rls[i]->cls[j]->kernel_cols; w++){
-                            adam_algorithm(&m->rls[i]->cls[j]->kernels[k][u*m->rls[i]->cls[j]->kernel_rows*m->rls[i]->cls[j]->kernel_cols + z*m->rls[i]->cls[j]->kernel_cols + w],&m->rls[i]->cls[j]->d1_kernels[k][u*m->rls[i]->cls[j]->kernel_rows*m->rls[i]->cls[j]->kernel_cols + z*m->rls[i]->cls[j]->kernel_cols + w],&m->rls[i]->cls[j]->d2_kernels[k][u*m->rls[i]->cls[j]->kernel_rows*m->rls[i]->cls[j]->kernel_cols + z*m->rls[i]->cls[j]->kernel_cols + w],m->rls[i]->cls[j]->d_kernels[k][u*m->rls[i]->cls[j]->kernel_rows*m->rls[i]->cls[j]->kernel_cols + z*m->rls[i]->cls[j]->kernel_cols + w],lr,BETA1_ADAM,BETA2_ADAM,b1,b2,EPSILON_ADAM,mini_batch_size);
-                        }
-                    }
-                }
-                adam_algorithm(&m->rls[i]->cls[j]->biases[k],&m->rls[i]->cls[j]->d1_biases[k],&m->rls[i]->cls[j]->d2_biases[k],m->rls[i]->cls[j]->d_biases[k],lr,BETA1_ADAM,BETA2_ADAM,b1,b2,EPSILON_ADAM,mini_batch_size);
-            }
+            update_cl_adam(m->rls[i]->cls[j],lr,mini_batch_size,b1,b2);
         }
     }
 }
@@ -580,19 +756,10 @@ void update_residual_layer_adam(model* m, float lr, int mini_batch_size, float b
  * 
  * */
 void update_residual_layer_adam_bmodel(bmodel* m, float lr, int mini_batch_size, float b1, float b2){
-    int i,j,k,u,z,w;
+    int i,j;
     for(i = 0; i < m->n_rl; i++){
         for(j = 0; j < m->rls[i]->n_cl; j++){
-            for(k = 0; k < m->rls[i]->cls[j]->n_kernels; k++){
-                for(u = 0; u < m->rls[i]->cls[j]->channels; u++){
-                    for(z = 0; z < m->rls[i]->cls[j]->kernel_rows; z++){
-                        for(w = 0; w < m->rls[i]->cls[j]->kernel_cols; w++){
-                            adam_algorithm(&m->rls[i]->cls[j]->kernels[k][u*m->rls[i]->cls[j]->kernel_rows*m->rls[i]->cls[j]->kernel_cols + z*m->rls[i]->cls[j]->kernel_cols + w],&m->rls[i]->cls[j]->d1_kernels[k][u*m->rls[i]->cls[j]->kernel_rows*m->rls[i]->cls[j]->kernel_cols + z*m->rls[i]->cls[j]->kernel_cols + w],&m->rls[i]->cls[j]->d2_kernels[k][u*m->rls[i]->cls[j]->kernel_rows*m->rls[i]->cls[j]->kernel_cols + z*m->rls[i]->cls[j]->kernel_cols + w],m->rls[i]->cls[j]->d_kernels[k][u*m->rls[i]->cls[j]->kernel_rows*m->rls[i]->cls[j]->kernel_cols + z*m->rls[i]->cls[j]->kernel_cols + w],lr,BETA1_ADAM,BETA2_ADAM,b1,b2,EPSILON_ADAM,mini_batch_size);
-                        }
-                    }
-                }
-                adam_algorithm(&m->rls[i]->cls[j]->biases[k],&m->rls[i]->cls[j]->d1_biases[k],&m->rls[i]->cls[j]->d2_biases[k],m->rls[i]->cls[j]->d_biases[k],lr,BETA1_ADAM,BETA2_ADAM,b1,b2,EPSILON_ADAM,mini_batch_size);
-            }
+            update_cl_adam(m->rls[i]->cls[j],lr,mini_batch_size,b1,b2);
         }
     }
 }
@@ -660,19 +827,9 @@ void sum_residual_layers_partial_derivatives_bmodel(bmodel* m, bmodel* m2, bmode
  * 
  * */
 void update_convolutional_layer_nesterov(model* m, float lr, float momentum, int mini_batch_size){
-    int j,k,u,z,w;
-    for(j = 0; j < m->n_cl; j++){
-        for(k = 0; k < m->cls[j]->n_kernels; k++){
-            for(u = 0; u < m->cls[j]->channels; u++){
-                for(z = 0; z < m->cls[j]->kernel_rows; z++){
-                    for(w = 0; w < m->cls[j]->kernel_cols; w++){
-                        nesterov_momentum(&m->cls[j]->kernels[k][u*m->cls[j]->kernel_rows*m->cls[j]->kernel_cols + z*m->cls[j]->kernel_cols + w],lr,momentum,mini_batch_size, m->cls[j]->d_kernels[k][u*m->cls[j]->kernel_rows*m->cls[j]->kernel_cols + z*m->cls[j]->kernel_cols + w],&m->cls[j]->d1_kernels[k][u*m->cls[j]->kernel_rows*m->cls[j]->kernel_cols + z*m->cls[j]->kernel_cols + w]);
-                    }
-                        
-                }
-            }
-            nesterov_momentum(&m->cls[j]->biases[k],lr,momentum,mini_batch_size, m->cls[j]->d_biases[k],&m->cls[j]->d1_biases[k]);
-        }
+    int i;
+    for(i = 0; i < m->n_cl; i++){
+        update_cl_nesterov(m->cls[i],lr,momentum,mini_batch_size);
     }
 }
 
@@ -686,19 +843,9 @@ void update_convolutional_layer_nesterov(model* m, float lr, float momentum, int
  * 
  * */
 void update_convolutional_layer_nesterov_bmodel(bmodel* m, float lr, float momentum, int mini_batch_size){
-    int j,k,u,z,w;
-    for(j = 0; j < m->n_cl; j++){
-        for(k = 0; k < m->cls[j]->n_kernels; k++){
-            for(u = 0; u < m->cls[j]->channels; u++){
-                for(z = 0; z < m->cls[j]->kernel_rows; z++){
-                    for(w = 0; w < m->cls[j]->kernel_cols; w++){
-                        nesterov_momentum(&m->cls[j]->kernels[k][u*m->cls[j]->kernel_rows*m->cls[j]->kernel_cols + z*m->cls[j]->kernel_cols + w],lr,momentum,mini_batch_size, m->cls[j]->d_kernels[k][u*m->cls[j]->kernel_rows*m->cls[j]->kernel_cols + z*m->cls[j]->kernel_cols + w],&m->cls[j]->d1_kernels[k][u*m->cls[j]->kernel_rows*m->cls[j]->kernel_cols + z*m->cls[j]->kernel_cols + w]);
-                    }
-                        
-                }
-            }
-            nesterov_momentum(&m->cls[j]->biases[k],lr,momentum,mini_batch_size, m->cls[j]->d_biases[k],&m->cls[j]->d1_biases[k]);
-        }
+    int i;
+    for(i = 0; i < m->n_cl; i++){
+        update_cl_nesterov(m->cls[i],lr,momentum,mini_batch_size);
     }
 }
 
@@ -714,19 +861,9 @@ void update_convolutional_layer_nesterov_bmodel(bmodel* m, float lr, float momen
  * 
  * */
 void update_convolutional_layer_adam(model* m, float lr, int mini_batch_size, float b1, float b2){
-    int j,k,u,z,w;
-    for(j = 0; j < m->n_cl; j++){
-        for(k = 0; k < m->cls[j]->n_kernels; k++){
-            for(u = 0; u < m->cls[j]->channels; u++){
-                for(z = 0; z < m->cls[j]->kernel_rows; z++){
-                    for(w = 0; w < m->cls[j]->kernel_cols; w++){
-                        adam_algorithm(&m->cls[j]->kernels[k][u*m->cls[j]->kernel_rows*m->cls[j]->kernel_cols + z*m->cls[j]->kernel_cols + w], &m->cls[j]->d1_kernels[k][u*m->cls[j]->kernel_rows*m->cls[j]->kernel_cols + z*m->cls[j]->kernel_cols + w],&m->cls[j]->d2_kernels[k][u*m->cls[j]->kernel_rows*m->cls[j]->kernel_cols + z*m->cls[j]->kernel_cols + w], m->cls[j]->d_kernels[k][u*m->cls[j]->kernel_rows*m->cls[j]->kernel_cols + z*m->cls[j]->kernel_cols + w],lr, BETA1_ADAM,BETA2_ADAM,b1,b2,EPSILON_ADAM,mini_batch_size);
-                    }
-                        
-                }
-            }
-            adam_algorithm(&m->cls[j]->biases[k],&m->cls[j]->d1_biases[k],&m->cls[j]->d2_biases[k], m->cls[j]->d_biases[k],lr,BETA1_ADAM,BETA2_ADAM,b1,b2,EPSILON_ADAM,mini_batch_size);
-        }
+    int i;
+    for(i = 0; i < m->n_cl; i++){
+        update_cl_adam(m->cls[i],lr,mini_batch_size,b1,b2);
     }
 }
 
@@ -742,19 +879,9 @@ void update_convolutional_layer_adam(model* m, float lr, int mini_batch_size, fl
  * 
  * */
 void update_convolutional_layer_adam_bmodel(bmodel* m, float lr, int mini_batch_size, float b1, float b2){
-    int j,k,u,z,w;
-    for(j = 0; j < m->n_cl; j++){
-        for(k = 0; k < m->cls[j]->n_kernels; k++){
-            for(u = 0; u < m->cls[j]->channels; u++){
-                for(z = 0; z < m->cls[j]->kernel_rows; z++){
-                    for(w = 0; w < m->cls[j]->kernel_cols; w++){
-                        adam_algorithm(&m->cls[j]->kernels[k][u*m->cls[j]->kernel_rows*m->cls[j]->kernel_cols + z*m->cls[j]->kernel_cols + w], &m->cls[j]->d1_kernels[k][u*m->cls[j]->kernel_rows*m->cls[j]->kernel_cols + z*m->cls[j]->kernel_cols + w],&m->cls[j]->d2_kernels[k][u*m->cls[j]->kernel_rows*m->cls[j]->kernel_cols + z*m->cls[j]->kernel_cols + w], m->cls[j]->d_kernels[k][u*m->cls[j]->kernel_rows*m->cls[j]->kernel_cols + z*m->cls[j]->kernel_cols + w],lr, BETA1_ADAM,BETA2_ADAM,b1,b2,EPSILON_ADAM,mini_batch_size);
-                    }
-                        
-                }
-            }
-            adam_algorithm(&m->cls[j]->biases[k],&m->cls[j]->d1_biases[k],&m->cls[j]->d2_biases[k], m->cls[j]->d_biases[k],lr,BETA1_ADAM,BETA2_ADAM,b1,b2,EPSILON_ADAM,mini_batch_size);
-        }
+    int i;
+    for(i = 0; i < m->n_cl; i++){
+        update_cl_adam(m->cls[i],lr,mini_batch_size,b1,b2);
     }
 }
 
@@ -820,14 +947,9 @@ void sum_convolutional_layers_partial_derivatives_bmodel(bmodel* m, bmodel* m2,
  * 
  * */
 void update_fully_connected_layer_nesterov(model* m, float lr, float momentum, int mini_batch_size){
-    int i,j,k;
+    int i;
     for(i = 0; i < m->n_fcl; i++){
-        for(j = 0; j < m->fcls[i]->output; j++){
-            for(k = 0; k < m->fcls[i]->input; k++){
-                nesterov_momentum(&m->fcls[i]->weights[j*m->fcls[i]->input+k], lr, momentum, mini_batch_size, m->fcls[i]->d_weights[j*m->fcls[i]->input+k],&m->fcls[i]->d1_weights[j*m->fcls[i]->input+k]);
-            }
-            nesterov_momentum(&m->fcls[i]->biases[j], lr, momentum, mini_batch_size, m->fcls[i]->d_biases[j],&m->fcls[i]->d1_biases[j]);
-        }
+        update_fcl_nesterov(m->fcls[i],lr,momentum,mini_batch_size);
     }
 }
 
@@ -841,14 +963,9 @@ void update_fully_connected_layer_nesterov(model* m, float lr, float momentum, i
  * 
  * */
 void update_fully_connected_layer_nesterov_bmodel(bmodel* m, float lr, float momentum, int mini_batch_size){
-    int i,j,k;
+    int i;
     for(i = 0; i < m->n_fcl; i++){
-        for(j = 0; j < m->fcls[i]->output; j++){
-            for(k = 0; k < m->fcls[i]->input; k++){
-                nesterov_momentum(&m->fcls[i]->weights[j*m->fcls[i]->input+k], lr, momentum, mini_batch_size, m->fcls[i]->d_weights[j*m->fcls[i]->input+k],&m->fcls[i]->d1_weights[j*m->fcls[i]->input+k]);
-            }
-            nesterov_momentum(&m->fcls[i]->biases[j], lr, momentum, mini_batch_size, m->fcls[i]->d_biases[j],&m->fcls[i]->d1_biases[j]);
-        }
+        update_fcl_nesterov(m->fcls[i],lr,momentum,mini_batch_size);
     }
 }
 
@@ -862,12 +979,9 @@ void update_fully_connected_layer_nesterov_bmodel(bmodel* m, float lr, float mom
  * 
  * */
 void update_batch_normalized_layer_nesterov_bmodel(bmodel* m, float lr, float momentum, int mini_batch_size){
-    int i,j,k;
+    int i;
     for(i = 0; i < m->n_bn; i++){
-        for(j = 0; j < m->bns[i]->vector_dim; j++){
-            nesterov_momentum(&m->bns[i]->gamma[j], lr, momentum, 1, m->bns[i]->d_gamma[j],&m->bns[i]->d1_gamma[j]);
-            nesterov_momentum(&m->bns[i]->beta[j], lr, momentum, 1, m->bns[i]->d_beta[j],&m->bns[i]->d1_beta[j]);
-        }
+        update_bn_nesterov(m->bns[i],lr,momentum);
     }
 }
 
@@ -884,14 +998,9 @@ void update_batch_normalized_layer_nesterov_bmodel(bmodel* m, float lr, float mo
  * 
  * */
 void update_fully_connected_layer_adam(model* m, float lr, int mini_batch_size, float b1, float b2){
-    int i,j,k;
+    int i;
     for(i = 0; i < m->n_fcl; i++){
-        for(j = 0; j < m->fcls[i]->output; j++){
-            for(k = 0; k < m->fcls[i]->input; k++){
-                adam_algorithm(&m->fcls[i]->weights[j*m->fcls[i]->input+k],&m->fcls[i]->d1_weights[j*m->fcls[i]->input+k], &m->fcls[i]->d2_weights[j*m->fcls[i]->input+k], m->fcls[i]->d_weights[j*m->fcls[i]->input+k], lr, BETA1_ADAM,BETA2_ADAM,b1,b2,EPSILON_ADAM,mini_batch_size);
-            }
-            adam_algorithm(&m->fcls[i]->biases[j],&m->fcls[i]->d1_biases[j], &m->fcls[i]->d2_biases[j], m->fcls[i]->d_biases[j],lr,BETA1_ADAM,BETA2_ADAM,b1,b2,EPSILON_ADAM,mini_batch_size);
-        }
+        update_fcl_adam(m->fcls[i],lr,mini_batch_size,b1,b2);
     }
 }
 
@@ -907,14 +1016,9 @@ void update_fully_connected_layer_adam(model* m, float lr, int mini_batch_size,
  * 
  * */
 void update_fully_connected_layer_adam_bmodel(bmodel* m, float lr, int mini_batch_size, float b1, float b2){
-    int i,j,k;
+    int i;
     for(i = 0; i < m->n_fcl; i++){
-        for(j = 0; j < m->fcls[i]->output; j++){
-            for(k = 0; k < m->fcls[i]->input; k++){
-                adam_algorithm(&m->fcls[i]->weights[j*m->fcls[i]->input+k],&m->fcls[i]->d1_weights[j*m->fcls[i]->input+k], &m->fcls[i]->d2_weights[j*m->fcls[i]->input+k], m->fcls[i]->d_weights[j*m->fcls[i]->input+k], lr, BETA1_ADAM,BETA2_ADAM,b1,b2,EPSILON_ADAM,mini_batch_size);
-            }
-            adam_algorithm(&m->fcls[i]->biases[j],&m->fcls[i]->d1_biases[j], &m->fcls[i]->d2_biases[j], m->fcls[i]->d_biases[j],lr,BETA1_ADAM,BETA2_ADAM,b1,b2,EPSILON_ADAM,mini_batch_size);
-        }
+        update_fcl_adam(m->fcls[i],lr,mini_batch_size,b1,b2);
     }
 }
 
@@ -930,12 +1034,9 @@ void update_fully_connected_layer_adam_bmodel(bmodel* m, float lr, int mini_batc
  * 
  * */
 void update_batch_normalized_layer_adam_bmodel(bmodel* m, float lr, int mini_batch_size, float b1, float b2){
-    int i,j,k;
+    int i;
     for(i = 0; i < m->n_bn; i++){
-        for(j = 0; j < m->bns[i]->vector_dim; j++){
-            adam_algorithm(&m->bns[i]->gamma[j],&m->bns[i]->d1_gamma[j], &m->bns[i]->d2_gamma[j], m->bns[i]->d_gamma[j], lr, BETA1_ADAM,BETA2_ADAM,b1,b2,EPSILON_ADAM,1);
-            adam_algorithm(&m->bns[i]->beta[j],&m->bns[i]->d1_beta[j], &m->bns[i]->d2_beta[j], m->bns[i]->d_beta[j], lr, BETA1_ADAM,BETA2_ADAM,b1,b2,EPSILON_ADAM,1);  
-        }
+        update_bn_adam(m->bns[i],lr,b1,b2);
     }
 }
 
@@ -1143,4 +1244,33 @@ void add_l2_fully_connected_layer_bmodel(bmodel* m,int total_number_weights,floa
     }
 }
 
-
+/* This function syncs the directory of file, so a rename in it is on the disk.
+ * The file systems that can't sync a directory (EINVAL) are accepted
+ *
+ * Input:
+ *             @ char* file:= the name of the file
+ *
+ * returns 0 or the errno of the error
+ * */
+int sync_directory(char* file){
+    int fd,error = 0;
+    char* slash = strrchr(file,'/');
+    char* directory = (char*)malloc(sizeof(char)*(strlen(file)+2));
+    if(slash == NULL)
+        strcpy(directory,".");
+    else if(slash == file)
+        strcpy(directory,"/");
+    else{
+        memcpy(directory,file,slash-file);
+        directory[slash-file] = '\0';
+    }
+    fd = open(directory,O_RDONLY | O_DIRECTORY);
+    free(directory);
+    if(fd < 0)
+        return errno;
+    if(fsync(fd) && errno != EINVAL)
+        error = errno;
+    if(close(fd) && !error)
+        error = errno;
+    return error;
+}